@@ -2,6 +2,7 @@
 ROOT_DIR := $(shell dirname $(realpath $(lastword $(MAKEFILE_LIST))))
 BUILD    ?= $(ROOT_DIR)/build
 OS ?= LINUX
+SPAWN ?= VFORK
 BUILD_BINDIR := $(BUILD)/bin
 BUILD_SBINDIR := $(BUILD)/sbin
 BUILD_LIBDIR := $(BUILD)/lib
@@ -49,6 +50,9 @@ BUILD_VDEVD_DIRS := $(BUILD_VDEVD) $(BUILD_VDEVD_HELPERS)
 INSTALL_VDEVD := $(DESTDIR)$(SBINDIR)
 INSTALL_VDEVD_HELPERS := $(DESTDIR)$(LIBDIR)/vdev
 
+# benchmarks (not installed)
+BUILD_BENCH := $(BUILD)/bench
+
 # vdevfs 
 BUILD_VDEVFS := $(BUILD_USRSBIN)
 BUILD_VDEVFS_DIRS := $(BUILD_VDEVFS)
@@ -72,7 +76,7 @@ INSTALL_HWDB := $(DESTDIR)$(LIBDIR)/vdev/hwdb
 CFLAGS     := -Wall -std=c99 -g -fPIC -fstack-protector -fstack-protector-all -pthread -Wno-unused-variable -Wno-unused-but-set-variable
 LDFLAGS    :=
 INC      := -I. -I$(ROOT_DIR) -I$(BUILD_INCLUDEDIR)
-DEFS     := -D_THREAD_SAFE -D__STDC_FORMAT_MACROS -D_VDEV_OS_$(OS) -D_XOPEN_SOURCE=700
+DEFS     := -D_THREAD_SAFE -D__STDC_FORMAT_MACROS -D_VDEV_OS_$(OS) -D_VDEV_SPAWN_$(SPAWN) -D_XOPEN_SOURCE=700
 LIBINC   := 
 CC       ?= cc
 
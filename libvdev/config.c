@@ -62,6 +62,16 @@ static int vdev_config_ini_parser( void* userdata, char const* section, char con
          return 1;
       }
       
+      if( strcmp( name, VDEV_CONFIG_ACTIONS_CACHE ) == 0 ) {
+         
+         if( conf->acts_cache_path == NULL ) {
+            // save this 
+            conf->acts_cache_path = vdev_strdup_or_null( value );
+         }
+         
+         return 1;
+      }
+      
       if( strcmp( name, VDEV_CONFIG_HELPERS ) == 0 ) {
          
          if( conf->helpers_dir == NULL ) {
@@ -188,6 +198,45 @@ static int vdev_config_ini_parser( void* userdata, char const* section, char con
          return 1;
       }
       
+      if( strcmp( name, VDEV_CONFIG_WORKERS ) == 0 ) {
+         
+         uint64_t num_workers = vdev_parse_uint64( value, &success );
+         if( !success || num_workers > INT_MAX ) {
+            
+            fprintf(stderr, "Invalid value '%s' for '%s'\n", value, name );
+            return 0;
+         }
+         
+         conf->num_workers = (int)num_workers;
+         return 1;
+      }
+      
+      if( strcmp( name, VDEV_CONFIG_STATS_INTERVAL ) == 0 ) {
+         
+         uint64_t stats_interval = vdev_parse_uint64( value, &success );
+         if( !success || stats_interval > INT_MAX / 1000 ) {
+            
+            fprintf(stderr, "Invalid value '%s' for '%s'\n", value, name );
+            return 0;
+         }
+         
+         conf->stats_interval = (int)stats_interval;
+         return 1;
+      }
+      
+      if( strcmp( name, VDEV_CONFIG_TRACE_BUFFER ) == 0 ) {
+         
+         uint64_t trace_buffer = vdev_parse_uint64( value, &success );
+         if( !success || trace_buffer > (1ULL << 24) ) {
+            
+            fprintf(stderr, "Invalid value '%s' for '%s'\n", value, name );
+            return 0;
+         }
+         
+         conf->trace_buffer = trace_buffer;
+         return 1;
+      }
+      
       return 1;
    }
    
@@ -284,6 +333,8 @@ static void vdev_config_make_instance_nonce( struct vdev_config* conf ) {
 int vdev_config_init( struct vdev_config* conf ) {
    
    memset( conf, 0, sizeof(struct vdev_config) );
+   
+   conf->stats_interval = VDEV_CONFIG_STATS_INTERVAL_DEFAULT;
    return 0;
 }
 
@@ -355,6 +406,12 @@ int vdev_config_free( struct vdev_config* conf ) {
       conf->acts_dir = NULL;
    }
    
+   if( conf->acts_cache_path != NULL ) {
+      
+      free( conf->acts_cache_path );
+      conf->acts_cache_path = NULL;
+   }
+   
    if( conf->os_config != NULL ) {
       
       vdev_params_free( conf->os_config );
@@ -397,10 +454,127 @@ int vdev_config_free( struct vdev_config* conf ) {
       conf->pidfile_path = NULL;
    }
    
+   if( conf->record_path != NULL ) {
+      
+      free( conf->record_path );
+      conf->record_path = NULL;
+   }
+   
    return 0;
 }
 
 
+// duplicate a string field of a config, if it is set
+// return 0 on success
+// return -ENOMEM on OOM
+static int vdev_config_dup_str( char** dest, char const* src ) {
+   
+   if( src == NULL ) {
+      
+      *dest = NULL;
+      return 0;
+   }
+   
+   *dest = vdev_strdup_or_null( src );
+   if( *dest == NULL ) {
+      return -ENOMEM;
+   }
+   
+   return 0;
+}
+
+
+// make a deep copy of a config into dest, which must not be initialized
+// return 0 on success
+// return -ENOMEM on OOM, in which case dest is left empty
+int vdev_config_dup( struct vdev_config* dest, struct vdev_config const* src ) {
+   
+   int rc = 0;
+   struct sglib_vdev_params_iterator itr;
+   struct vdev_param_t* dp = NULL;
+   
+   // scalar fields 
+   memcpy( dest, src, sizeof(struct vdev_config) );
+   
+   dest->config_path = NULL;
+   dest->preseed_path = NULL;
+   dest->acls_dir = NULL;
+   dest->acts_dir = NULL;
+   dest->acts_cache_path = NULL;
+   dest->helpers_dir = NULL;
+   dest->pidfile_path = NULL;
+   dest->logfile_path = NULL;
+   dest->mountpoint = NULL;
+   dest->record_path = NULL;
+   dest->os_config = NULL;
+   
+   // string fields 
+   if( rc == 0 ) {
+      rc = vdev_config_dup_str( &dest->config_path, src->config_path );
+   }
+   if( rc == 0 ) {
+      rc = vdev_config_dup_str( &dest->preseed_path, src->preseed_path );
+   }
+   if( rc == 0 ) {
+      rc = vdev_config_dup_str( &dest->acls_dir, src->acls_dir );
+   }
+   if( rc == 0 ) {
+      rc = vdev_config_dup_str( &dest->acts_dir, src->acts_dir );
+   }
+   if( rc == 0 ) {
+      rc = vdev_config_dup_str( &dest->acts_cache_path, src->acts_cache_path );
+   }
+   if( rc == 0 ) {
+      rc = vdev_config_dup_str( &dest->helpers_dir, src->helpers_dir );
+   }
+   if( rc == 0 ) {
+      rc = vdev_config_dup_str( &dest->pidfile_path, src->pidfile_path );
+   }
+   if( rc == 0 ) {
+      rc = vdev_config_dup_str( &dest->logfile_path, src->logfile_path );
+   }
+   if( rc == 0 ) {
+      rc = vdev_config_dup_str( &dest->mountpoint, src->mountpoint );
+   }
+   if( rc == 0 ) {
+      rc = vdev_config_dup_str( &dest->record_path, src->record_path );
+   }
+   
+   // OS-specific fields 
+   for( dp = sglib_vdev_params_it_init_inorder( &itr, src->os_config ); dp != NULL && rc == 0; dp = sglib_vdev_params_it_next( &itr ) ) {
+      
+      rc = vdev_params_add( &dest->os_config, dp->key, dp->value );
+   }
+   
+   if( rc != 0 ) {
+      
+      vdev_config_free( dest );
+      memset( dest, 0, sizeof(struct vdev_config) );
+   }
+   
+   return rc;
+}
+
+
+// look up an OS-specific option, from the [vdev-OS] section 
+// return its value, or NULL if not set
+char const* vdev_config_OS_option( struct vdev_config const* conf, char const* name ) {
+   
+   struct vdev_param_t lookup;
+   struct vdev_param_t* dp = NULL;
+   
+   memset( &lookup, 0, sizeof(struct vdev_param_t) );
+   lookup.key = (char*)name;
+   
+   dp = sglib_vdev_params_find_member( conf->os_config, &lookup );
+   if( dp == NULL ) {
+      return NULL;
+   }
+   
+   return dp->value;
+}
+
+
 // convert all paths in the config to absolute paths 
 // return 0 on success 
 // return -ENOMEM on OOM 
@@ -413,10 +587,12 @@ int vdev_config_fullpaths( struct vdev_config* conf ) {
       &conf->config_path,
       &conf->acls_dir,
       &conf->acts_dir,
+      &conf->acts_cache_path,
       &conf->helpers_dir,
       &conf->pidfile_path,
       &conf->logfile_path,
       &conf->preseed_path,
+      &conf->record_path,
       NULL
    };
    
@@ -487,6 +663,15 @@ Options include:\n\
                   \n\
    -p, --pidfile PATH\n\
                   Write the PID of the daemon to PATH.\n\
+                  \n\
+   -C, --compile-actions\n\
+                  Compile the actions into the config file's\n\
+                  actions_cache file, and exit.\n\
+                  \n\
+   -r, --record FILE\n\
+                  Append every uevent received from the kernel or\n\
+                  found in sysfs to FILE, for replaying later\n\
+                  (Linux only).\n\
 ", progname );
   
   return 0;
@@ -528,6 +713,8 @@ int vdev_config_load_from_args( struct vdev_config* config, int argc, char** arg
       {"once",            no_argument,         0, '1'},
       {"coldplug-only",   no_argument,         0, 'n'},
       {"foreground",      no_argument,         0, 'f'},
+      {"compile-actions", no_argument,         0, 'C'},
+      {"record",          required_argument,   0, 'r'},
       {0, 0, 0, 0}
    };
 
@@ -536,7 +723,7 @@ int vdev_config_load_from_args( struct vdev_config* config, int argc, char** arg
    int c = 0;
    int fuse_optind = 0;
    
-   char const* optstr = "c:v:l:o:f1np:ds";
+   char const* optstr = "c:v:l:o:f1np:dsCr:";
   
    if( fuse_argv != NULL ) { 
        fuse_argv[fuse_optind] = argv[0];
@@ -607,6 +794,22 @@ int vdev_config_load_from_args( struct vdev_config* config, int argc, char** arg
             break;
          }
          
+         case 'C': {
+            
+            config->compile_acts = true;
+            break;
+         }
+         
+         case 'r': {
+            
+            if( config->record_path != NULL ) {
+               free( config->record_path );
+            }
+            
+            config->record_path = vdev_strdup_or_null( optarg );
+            break;
+         }
+         
          case 's': {
             // FUSE Option 
             if( fuse_argv != NULL ) {
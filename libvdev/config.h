@@ -42,6 +42,12 @@
 #define VDEV_CONFIG_COLDPLUG_ONLY "coldplug_only"
 #define VDEV_CONFIG_FOREGROUND    "foreground"
 #define VDEV_CONFIG_PRESEED       "preseed"
+#define VDEV_CONFIG_WORKERS       "workers"
+#define VDEV_CONFIG_ACTIONS_CACHE "actions_cache"
+#define VDEV_CONFIG_STATS_INTERVAL "stats_interval"
+#define VDEV_CONFIG_TRACE_BUFFER  "trace_buffer"
+
+#define VDEV_CONFIG_STATS_INTERVAL_DEFAULT 10         // seconds
 
 #define VDEV_CONFIG_INSTANCE_NONCE_LEN 32
 #define VDEV_CONFIG_INSTANCE_NONCE_STRLEN (2*VDEV_CONFIG_INSTANCE_NONCE_LEN + 1)
@@ -66,6 +72,12 @@ struct vdev_config {
    // actions directory 
    char* acts_dir;
    
+   // compiled actions cache, made by --compile-actions (NULL if not used)
+   char* acts_cache_path;
+   
+   // compile the actions into acts_cache_path and exit?
+   bool compile_acts;
+   
    // helpers directory 
    char* helpers_dir;
    
@@ -104,6 +116,18 @@ struct vdev_config {
    
    // bitfield of OS-specific quirks 
    uint64_t OS_quirks;
+   
+   // number of threads to process device requests (0 means one per CPU)
+   int num_workers;
+   
+   // seconds between refreshing the action statistics files (0 means only on SIGUSR1)
+   int stats_interval;
+   
+   // number of most recent event-processing spans to keep for tracing (0 means don't trace)
+   uint64_t trace_buffer;
+   
+   // file to record received uevents to, from --record (NULL if not recording)
+   char* record_path;
 };
 
 C_LINKAGE_BEGIN
@@ -112,6 +136,8 @@ int vdev_config_init( struct vdev_config* conf );
 int vdev_config_load( char const* path, struct vdev_config* conf );
 int vdev_config_load_file( FILE* file, struct vdev_config* conf );
 int vdev_config_free( struct vdev_config* conf );
+int vdev_config_dup( struct vdev_config* dest, struct vdev_config const* src );
+char const* vdev_config_OS_option( struct vdev_config const* conf, char const* name );
 
 int vdev_config_usage( char const* progname );
 int vdev_config_load_from_args( struct vdev_config* config, int argc, char** argv, int* fuse_argc, char** fuse_argv );
@@ -0,0 +1,439 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "daemonlet.h"
+
+// parse a daemonlet protocol name 
+// return 0 on success, and set *protocol 
+// return -EINVAL if the name is not recognized
+int vdev_daemonlet_protocol_parse( char const* str, vdev_daemonlet_protocol_t* protocol ) {
+   
+   if( strcasecmp( str, VDEV_DAEMONLET_PROTOCOL_TEXT_STR ) == 0 ) {
+      
+      *protocol = VDEV_DAEMONLET_PROTOCOL_TEXT;
+      return 0;
+   }
+   
+   if( strcasecmp( str, VDEV_DAEMONLET_PROTOCOL_BINARY_STR ) == 0 ) {
+      
+      *protocol = VDEV_DAEMONLET_PROTOCOL_BINARY;
+      return 0;
+   }
+   
+   return -EINVAL;
+}
+
+
+// send a request to a text-protocol daemonlet: one KEY=VALUE line per variable, then "done"
+// return 0 on success
+// return -errno on I/O error (such as -EPIPE)
+int vdev_daemonlet_text_send( int fd, char** env, size_t num_env ) {
+   
+   ssize_t rc = 0;
+   char env_buf[ PATH_MAX+1 ];
+   
+   memset( env_buf, 0, PATH_MAX+1 );
+   
+   // feed environment variables
+   for( unsigned int i = 0; i < num_env; i++ ) {
+      
+      snprintf( env_buf, PATH_MAX, "%s\n", env[i] );
+      
+      rc = vdev_write_uninterrupted( fd, env_buf, strlen(env_buf) );
+      if( rc < 0 ) {
+         
+         return (int)rc;
+      }
+   }
+   
+   // feed end-of-environment flag
+   rc = vdev_write_uninterrupted( fd, "done\n", strlen("done\n") );
+   if( rc < 0 ) {
+      
+      return (int)rc;
+   }
+   
+   return 0;
+}
+
+
+// read a string-ified int64_t from a text-protocol daemonlet, followed by a newline.
+// this is used to get a daemonlet return code 
+// return 0 on success, and set *status
+// return -errno on I/O error (such as -EPIPE)
+// return -EAGAIN if we got EOF
+int vdev_daemonlet_text_recv_status( int fd, int64_t* status ) {
+  
+   int64_t value = 0;
+  
+   int cnt = 0; 
+   int c = 0;
+   int rc = 0;
+   int s = 1;
+   
+   while( 1 ) {
+      
+      // next character 
+      rc = vdev_read_uninterrupted( fd, (char*)&c, 1 );
+      if( rc < 0 ) {
+         
+         return rc;
+      }
+      if( rc == 0 ) {
+         
+         return -EAGAIN;
+      }
+      
+      if( c == '\n' ) {
+         break;
+      }
+      
+      if( cnt == 0 && c == '-' ) {
+         s = -1;
+      }
+      else if( c < '0' || c > '9' ) {
+         
+         // invalid 
+         rc = -EINVAL;
+         break;
+      }
+      
+      value *= 10;
+      value += (c - '0');
+
+      cnt++;
+   }
+   
+   *status = value * s;
+   return 0;
+}
+
+
+// parse a text-protocol daemonlet's status line out of a buffer of replies 
+// return the number of bytes consumed on success, and set *status 
+// return 0 if buf does not hold a whole line yet
+// return -EINVAL if the line is not an integer
+int vdev_daemonlet_text_parse_status( char const* buf, size_t len, int64_t* status ) {
+   
+   int64_t value = 0;
+   int s = 1;
+   size_t i = 0;
+   char const* eol = (char const*)memchr( buf, '\n', len );
+   
+   if( eol == NULL ) {
+      return 0;
+   }
+   
+   if( buf[0] == '-' ) {
+      
+      s = -1;
+      i = 1;
+   }
+   
+   if( buf + i == eol ) {
+      
+      // no digits
+      return -EINVAL;
+   }
+   
+   for( ; buf + i < eol; i++ ) {
+      
+      if( buf[i] < '0' || buf[i] > '9' ) {
+         return -EINVAL;
+      }
+      
+      value *= 10;
+      value += (buf[i] - '0');
+   }
+   
+   *status = value * s;
+   return (int)(eol - buf) + 1;
+}
+
+
+// send a request to a binary-protocol daemonlet: a header and the NUL-terminated variables, in one writev(2)
+// return 0 on success
+// return -ENOMEM on OOM 
+// return -E2BIG if the request is too big to frame
+// return -errno on I/O error (such as -EPIPE)
+int vdev_daemonlet_binary_send( int fd, uint32_t seq, char** env, size_t num_env ) {
+   
+   ssize_t rc = 0;
+   size_t len = 0;
+   struct iovec* iov = NULL;
+   struct vdev_daemonlet_header header;
+   
+   iov = VDEV_CALLOC( struct iovec, num_env + 1 );
+   if( iov == NULL ) {
+      return -ENOMEM;
+   }
+   
+   for( unsigned int i = 0; i < num_env; i++ ) {
+      
+      iov[i+1].iov_base = env[i];
+      iov[i+1].iov_len = strlen( env[i] ) + 1;
+      
+      len += iov[i+1].iov_len;
+   }
+   
+   if( len > VDEV_DAEMONLET_MAX_REQUEST ) {
+      
+      free( iov );
+      return -E2BIG;
+   }
+   
+   memset( &header, 0, sizeof(header) );
+   
+   header.magic = VDEV_DAEMONLET_REQUEST_MAGIC;
+   header.seq = seq;
+   header.num_env = num_env;
+   header.len = len;
+   
+   iov[0].iov_base = &header;
+   iov[0].iov_len = sizeof(header);
+   
+   rc = vdev_writev_uninterrupted( fd, iov, num_env + 1 );
+   
+   free( iov );
+   
+   if( rc < 0 ) {
+      return (int)rc;
+   }
+   
+   if( (size_t)rc != sizeof(header) + len ) {
+      
+      // daemonlet stopped reading
+      return -EPIPE;
+   }
+   
+   return 0;
+}
+
+
+// read a binary daemonlet's reply 
+// return 0 on success, and set *seq and *status 
+// return -errno on I/O error (such as -EPIPE)
+// return -EAGAIN if we got EOF 
+// return -EINVAL if the reply is malformed
+int vdev_daemonlet_binary_recv_status( int fd, uint32_t* seq, int64_t* status ) {
+   
+   ssize_t rc = 0;
+   struct vdev_daemonlet_reply reply;
+   
+   memset( &reply, 0, sizeof(reply) );
+   
+   rc = vdev_read_uninterrupted( fd, (char*)&reply, sizeof(reply) );
+   if( rc < 0 ) {
+      return (int)rc;
+   }
+   
+   if( (size_t)rc != sizeof(reply) ) {
+      return -EAGAIN;
+   }
+   
+   if( reply.magic != VDEV_DAEMONLET_REPLY_MAGIC ) {
+      return -EINVAL;
+   }
+   
+   *seq = reply.seq;
+   *status = reply.status;
+   return 0;
+}
+
+
+// parse a binary daemonlet's reply out of a buffer of replies 
+// return the number of bytes consumed on success, and set *seq and *status 
+// return 0 if buf does not hold a whole reply yet
+// return -EINVAL if the reply is malformed
+int vdev_daemonlet_binary_parse_reply( char const* buf, size_t len, uint32_t* seq, int64_t* status ) {
+   
+   struct vdev_daemonlet_reply reply;
+   
+   if( len < sizeof(reply) ) {
+      return 0;
+   }
+   
+   memcpy( &reply, buf, sizeof(reply) );
+   
+   if( reply.magic != VDEV_DAEMONLET_REPLY_MAGIC ) {
+      return -EINVAL;
+   }
+   
+   *seq = reply.seq;
+   *status = reply.status;
+   return (int)sizeof(reply);
+}
+
+
+// tell vdevd that this daemonlet is ready for requests 
+// return 0 on success
+// return -errno on I/O error
+int vdev_daemonlet_ready( int fd ) {
+   
+   ssize_t rc = vdev_write_uninterrupted( fd, "\n", 1 );
+   if( rc < 0 ) {
+      return (int)rc;
+   }
+   
+   return 0;
+}
+
+
+// set up a binary request buffer 
+// always succeeds
+int vdev_daemonlet_request_init( struct vdev_daemonlet_request* req ) {
+   
+   memset( req, 0, sizeof(struct vdev_daemonlet_request) );
+   return 0;
+}
+
+
+// free a binary request buffer 
+// always succeeds 
+int vdev_daemonlet_request_free( struct vdev_daemonlet_request* req ) {
+   
+   if( req->buf != NULL ) {
+      free( req->buf );
+   }
+   
+   if( req->env != NULL ) {
+      free( req->env );
+   }
+   
+   memset( req, 0, sizeof(struct vdev_daemonlet_request) );
+   return 0;
+}
+
+
+// receive the next binary request from vdevd.  req's buffers are reused across calls.
+// on success, req->env is a NULL-terminated list of req->num_env KEY=VALUE strings
+// return 0 on success
+// return -EPIPE if vdevd closed the pipe 
+// return -EINVAL if the request is malformed 
+// return -ENOMEM on OOM
+// return -errno on I/O error
+int vdev_daemonlet_binary_recv( int fd, struct vdev_daemonlet_request* req ) {
+   
+   ssize_t rc = 0;
+   size_t off = 0;
+   struct vdev_daemonlet_header header;
+   
+   memset( &header, 0, sizeof(header) );
+   
+   rc = vdev_read_uninterrupted( fd, (char*)&header, sizeof(header) );
+   if( rc < 0 ) {
+      return (int)rc;
+   }
+   
+   if( (size_t)rc != sizeof(header) ) {
+      return -EPIPE;
+   }
+   
+   if( header.magic != VDEV_DAEMONLET_REQUEST_MAGIC || header.len > VDEV_DAEMONLET_MAX_REQUEST || header.num_env > header.len ) {
+      return -EINVAL;
+   }
+   
+   if( req->max_buf < (size_t)header.len + 1 ) {
+      
+      char* buf = (char*)realloc( req->buf, header.len + 1 );
+      if( buf == NULL ) {
+         return -ENOMEM;
+      }
+      
+      req->buf = buf;
+      req->max_buf = header.len + 1;
+   }
+   
+   if( req->max_env < (size_t)header.num_env + 1 ) {
+      
+      char** env = (char**)realloc( req->env, sizeof(char*) * (header.num_env + 1) );
+      if( env == NULL ) {
+         return -ENOMEM;
+      }
+      
+      req->env = env;
+      req->max_env = header.num_env + 1;
+   }
+   
+   rc = vdev_read_uninterrupted( fd, req->buf, header.len );
+   if( rc < 0 ) {
+      return (int)rc;
+   }
+   
+   if( (size_t)rc != header.len ) {
+      return -EPIPE;
+   }
+   
+   req->buf[ header.len ] = '\0';
+   req->seq = header.seq;
+   req->num_env = 0;
+   
+   // split up the variables 
+   while( off < header.len ) {
+      
+      size_t len = strlen( req->buf + off );
+      
+      if( off + len >= header.len || req->num_env >= header.num_env ) {
+         
+         // not NUL-terminated, or too many strings
+         return -EINVAL;
+      }
+      
+      req->env[ req->num_env ] = req->buf + off;
+      req->num_env++;
+      
+      off += len + 1;
+   }
+   
+   if( req->num_env != header.num_env ) {
+      return -EINVAL;
+   }
+   
+   req->env[ req->num_env ] = NULL;
+   return 0;
+}
+
+
+// send a binary reply to vdevd, for the request with the given sequence number
+// return 0 on success 
+// return -errno on I/O error
+int vdev_daemonlet_binary_reply( int fd, uint32_t seq, int status ) {
+   
+   ssize_t rc = 0;
+   struct vdev_daemonlet_reply reply;
+   
+   memset( &reply, 0, sizeof(reply) );
+   
+   reply.magic = VDEV_DAEMONLET_REPLY_MAGIC;
+   reply.seq = seq;
+   reply.status = status;
+   
+   rc = vdev_write_uninterrupted( fd, (char const*)&reply, sizeof(reply) );
+   if( rc < 0 ) {
+      return (int)rc;
+   }
+   
+   if( (size_t)rc != sizeof(reply) ) {
+      return -EPIPE;
+   }
+   
+   return 0;
+}
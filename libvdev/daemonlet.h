@@ -0,0 +1,115 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// daemonlet wire protocols.
+//
+// text protocol (the default, spoken by the shell daemonlet runner):
+//    vdevd writes one "KEY=VALUE\n" line per environment variable, followed by "done\n".
+//    the daemonlet replies with its exit status as an ASCII integer and a newline.
+//
+// binary protocol:
+//    vdevd writes a struct vdev_daemonlet_header, followed by header.len bytes of 
+//    header.num_env NUL-terminated "KEY=VALUE" strings, all in one writev(2).
+//    the daemonlet replies with a struct vdev_daemonlet_reply, echoing the request's sequence number.
+//    vdevd may have several requests outstanding with an asynchronous daemonlet; the sequence
+//    number says which one a reply is for.
+//    integers are in host byte order, since both ends are on the same host.
+//
+// in both protocols, the daemonlet writes one byte to stdout once it is ready for requests.
+
+#ifndef _VDEV_DAEMONLET_H_
+#define _VDEV_DAEMONLET_H_
+
+#include "util.h"
+
+#define VDEV_DAEMONLET_PROTOCOL_TEXT_STR        "text"
+#define VDEV_DAEMONLET_PROTOCOL_BINARY_STR      "binary"
+
+// environment variable set for daemonlets, naming the protocol they should speak
+#define VDEV_DAEMONLET_PROTOCOL_ENV             "VDEV_DAEMONLET_PROTOCOL"
+
+typedef enum {
+   VDEV_DAEMONLET_PROTOCOL_TEXT = 0,
+   VDEV_DAEMONLET_PROTOCOL_BINARY
+} vdev_daemonlet_protocol_t;
+
+// frame magic numbers
+#define VDEV_DAEMONLET_REQUEST_MAGIC    0x76647271      // "vdrq"
+#define VDEV_DAEMONLET_REPLY_MAGIC      0x76647270      // "vdrp"
+
+// largest binary request a daemonlet will accept
+#define VDEV_DAEMONLET_MAX_REQUEST      (1024 * 1024)
+
+// binary request header
+struct vdev_daemonlet_header {
+   
+   uint32_t magic;
+   uint32_t seq;
+   uint32_t num_env;
+   uint32_t len;
+};
+
+// binary reply
+struct vdev_daemonlet_reply {
+   
+   uint32_t magic;
+   uint32_t seq;
+   int32_t status;
+};
+
+// a binary request, as received by a daemonlet 
+struct vdev_daemonlet_request {
+   
+   // sequence number to reply with
+   uint32_t seq;
+   
+   // packed environment strings
+   char* buf;
+   size_t max_buf;
+   
+   // pointers into buf 
+   char** env;
+   size_t num_env;
+   size_t max_env;
+};
+
+C_LINKAGE_BEGIN
+
+int vdev_daemonlet_protocol_parse( char const* str, vdev_daemonlet_protocol_t* protocol );
+
+// vdevd side
+int vdev_daemonlet_text_send( int fd, char** env, size_t num_env );
+int vdev_daemonlet_text_recv_status( int fd, int64_t* status );
+int vdev_daemonlet_text_parse_status( char const* buf, size_t len, int64_t* status );
+int vdev_daemonlet_binary_send( int fd, uint32_t seq, char** env, size_t num_env );
+int vdev_daemonlet_binary_recv_status( int fd, uint32_t* seq, int64_t* status );
+int vdev_daemonlet_binary_parse_reply( char const* buf, size_t len, uint32_t* seq, int64_t* status );
+
+// daemonlet side
+int vdev_daemonlet_ready( int fd );
+int vdev_daemonlet_request_init( struct vdev_daemonlet_request* req );
+int vdev_daemonlet_request_free( struct vdev_daemonlet_request* req );
+int vdev_daemonlet_binary_recv( int fd, struct vdev_daemonlet_request* req );
+int vdev_daemonlet_binary_reply( int fd, uint32_t seq, int status );
+
+C_LINKAGE_END
+
+#endif
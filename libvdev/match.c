@@ -156,3 +156,1169 @@ int vdev_match_first_regex( char const* path, regex_t* regexes, size_t num_regex
    
    return num_regexes;
 }
+
+
+// characters with special meaning in a POSIX extended regex 
+#define VDEV_MATCH_SPECIAL_CHARS ".[]()*+?{}|^$\\"
+
+// is this character special in a POSIX extended regex?
+static bool vdev_match_is_special( char c ) {
+   return c != '\0' && strchr( VDEV_MATCH_SPECIAL_CHARS, c ) != NULL;
+}
+
+
+// classify a pattern as an exact, prefix, or suffix literal, or as a full regex.
+// on success, *literal is the unescaped literal (malloc'ed) for non-regex patterns.
+// return 0 on success, and set *type, *literal, and *literal_len
+// return -ENOMEM on OOM
+static int vdev_match_classify( char const* str, vdev_match_t* type, char** literal, size_t* literal_len ) {
+   
+   char const* p = str;
+   char const* rest = NULL;
+   bool anchored = false;
+   bool leading_any = false;
+   char* lit = NULL;
+   size_t len = 0;
+   
+   *type = VDEV_MATCH_REGEX;
+   *literal = NULL;
+   *literal_len = 0;
+   
+   if( *p == '^' ) {
+      anchored = true;
+      p++;
+   }
+   
+   if( strncmp( p, ".*", 2 ) == 0 ) {
+      leading_any = true;
+      p += 2;
+   }
+   
+   lit = VDEV_CALLOC( char, strlen(p) + 1 );
+   if( lit == NULL ) {
+      return -ENOMEM;
+   }
+   
+   // longest run of (possibly escaped) literal characters 
+   while( *p != '\0' ) {
+      
+      if( *p == '\\' && vdev_match_is_special( *(p+1) ) ) {
+         
+         lit[len] = *(p+1);
+         len++;
+         p += 2;
+      }
+      else if( !vdev_match_is_special( *p ) ) {
+         
+         lit[len] = *p;
+         len++;
+         p++;
+      }
+      else {
+         break;
+      }
+   }
+   
+   rest = p;
+   
+   if( anchored && !leading_any ) {
+      
+      if( strcmp( rest, "$" ) == 0 ) {
+         *type = VDEV_MATCH_EXACT;
+      }
+      else if( strcmp( rest, "" ) == 0 || strcmp( rest, ".*" ) == 0 || strcmp( rest, ".*$" ) == 0 ) {
+         *type = VDEV_MATCH_PREFIX;
+      }
+   }
+   else if( strcmp( rest, "$" ) == 0 ) {
+      
+      *type = VDEV_MATCH_SUFFIX;
+   }
+   
+   if( *type == VDEV_MATCH_REGEX ) {
+      
+      free( lit );
+      return 0;
+   }
+   
+   *literal = lit;
+   *literal_len = len;
+   return 0;
+}
+
+
+// compile a path pattern, and classify it so cheap patterns don't need regexec(3)
+// return 0 on success
+// return -EINVAL if the pattern is not a valid extended regex
+// return -ENOMEM on OOM
+int vdev_match_pattern_init( struct vdev_match_pattern* pattern, char const* str ) {
+   
+   int rc = 0;
+   
+   memset( pattern, 0, sizeof(struct vdev_match_pattern) );
+   
+   rc = vdev_match_regex_init( &pattern->regex, str );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   pattern->has_regex = true;
+   
+   rc = vdev_match_classify( str, &pattern->type, &pattern->literal, &pattern->literal_len );
+   if( rc != 0 ) {
+      
+      regfree( &pattern->regex );
+      memset( pattern, 0, sizeof(struct vdev_match_pattern) );
+      return rc;
+   }
+   
+   return 0;
+}
+
+
+// set up an exact, prefix, or suffix pattern from an already-classified literal, without compiling its regex.
+// the literal must have come from a pattern that vdev_match_pattern_init() accepted.
+// return 0 on success
+// return -EINVAL if type is not a literal type, or the literal spans lines (these need the regex)
+// return -ENOMEM on OOM
+int vdev_match_pattern_init_literal( struct vdev_match_pattern* pattern, vdev_match_t type, char const* literal, size_t literal_len ) {
+   
+   memset( pattern, 0, sizeof(struct vdev_match_pattern) );
+   
+   if( type != VDEV_MATCH_EXACT && type != VDEV_MATCH_PREFIX && type != VDEV_MATCH_SUFFIX ) {
+      return -EINVAL;
+   }
+   
+   if( memchr( literal, '\n', literal_len ) != NULL ) {
+      return -EINVAL;
+   }
+   
+   pattern->literal = VDEV_CALLOC( char, literal_len + 1 );
+   if( pattern->literal == NULL ) {
+      return -ENOMEM;
+   }
+   
+   memcpy( pattern->literal, literal, literal_len );
+   pattern->literal_len = literal_len;
+   pattern->type = type;
+   
+   return 0;
+}
+
+
+// free a compiled path pattern 
+// always succeeds
+int vdev_match_pattern_free( struct vdev_match_pattern* pattern ) {
+   
+   if( pattern->type == 0 ) {
+      // not initialized
+      return 0;
+   }
+   
+   if( pattern->literal != NULL ) {
+      
+      free( pattern->literal );
+      pattern->literal = NULL;
+   }
+   
+   if( pattern->has_regex ) {
+      regfree( &pattern->regex );
+   }
+   
+   memset( pattern, 0, sizeof(struct vdev_match_pattern) );
+   return 0;
+}
+
+
+// does a string of the given length match a literal pattern?
+static bool vdev_match_literal( char const* str, size_t len, struct vdev_match_pattern* pattern ) {
+   
+   switch( pattern->type ) {
+      
+      case VDEV_MATCH_EXACT: {
+         
+         return len == pattern->literal_len && memcmp( str, pattern->literal, len ) == 0;
+      }
+      
+      case VDEV_MATCH_PREFIX: {
+         
+         return len >= pattern->literal_len && memcmp( str, pattern->literal, pattern->literal_len ) == 0;
+      }
+      
+      case VDEV_MATCH_SUFFIX: {
+         
+         return len >= pattern->literal_len && memcmp( str + len - pattern->literal_len, pattern->literal, pattern->literal_len ) == 0;
+      }
+      
+      default: {
+         
+         return false;
+      }
+   }
+}
+
+
+// does a literal pattern match any line of a path?  This is what regexec(3) 
+// does with REG_NEWLINE, since the literal itself never spans lines.
+static bool vdev_match_literal_lines( char const* path, struct vdev_match_pattern* pattern ) {
+   
+   char const* line = path;
+   char const* end = NULL;
+   
+   while( true ) {
+      
+      end = strchr( line, '\n' );
+      if( end == NULL ) {
+         
+         return vdev_match_literal( line, strlen( line ), pattern );
+      }
+      
+      if( vdev_match_literal( line, end - line, pattern ) ) {
+         return true;
+      }
+      
+      line = end + 1;
+   }
+}
+
+
+// does a path match a compiled path pattern?
+// return 1 if so, 0 if not, negative on error
+int vdev_match_pattern( char const* path, struct vdev_match_pattern* pattern ) {
+   
+   if( pattern->type == VDEV_MATCH_REGEX ) {
+      return vdev_match_regex( path, &pattern->regex );
+   }
+   
+   if( strchr( path, '\n' ) != NULL ) {
+      
+      // with REG_NEWLINE, ^ and $ also match around newlines, so let regexec handle those
+      if( pattern->has_regex ) {
+         return vdev_match_regex( path, &pattern->regex );
+      }
+      
+      return vdev_match_literal_lines( path, pattern );
+   }
+   
+   return vdev_match_literal( path, strlen( path ), pattern );
+}
+
+
+// NFA fragment under construction: a start state, and an epsilon end state whose out is not yet set
+struct vdev_match_nfa_frag {
+   
+   int start;
+   int end;
+};
+
+// NFA parser state 
+struct vdev_match_nfa_parser {
+   
+   struct vdev_match_set* set;
+   char const* str;
+   size_t pos;
+};
+
+
+static int vdev_match_nfa_parse_regex( struct vdev_match_nfa_parser* p, struct vdev_match_nfa_frag* frag );
+
+
+// add a state to the NFA 
+// return the index of the state on success
+// return -ENOMEM on OOM
+static int vdev_match_nfa_state_new( struct vdev_match_set* set, int op ) {
+   
+   struct vdev_match_nfa_state* state = NULL;
+   
+   if( set->num_states == set->max_states ) {
+      
+      size_t max_states = set->max_states > 0 ? 2 * set->max_states : 64;
+      struct vdev_match_nfa_state* states = (struct vdev_match_nfa_state*)realloc( set->states, sizeof(struct vdev_match_nfa_state) * max_states );
+      
+      if( states == NULL ) {
+         return -ENOMEM;
+      }
+      
+      set->states = states;
+      set->max_states = max_states;
+   }
+   
+   state = &set->states[ set->num_states ];
+   memset( state, 0, sizeof(struct vdev_match_nfa_state) );
+   
+   state->op = op;
+   state->out = -1;
+   state->out1 = -1;
+   state->pattern = -1;
+   
+   set->num_states++;
+   return (int)(set->num_states - 1);
+}
+
+
+// make a fragment out of a single state that goes to an epsilon end state
+// return 0 on success, and set *frag
+// return -ENOMEM on OOM
+static int vdev_match_nfa_frag_single( struct vdev_match_set* set, int op, struct vdev_match_nfa_frag* frag ) {
+   
+   int start = vdev_match_nfa_state_new( set, op );
+   int end = 0;
+   
+   if( start < 0 ) {
+      return start;
+   }
+   
+   end = vdev_match_nfa_state_new( set, VDEV_MATCH_NFA_EPSILON );
+   if( end < 0 ) {
+      return end;
+   }
+   
+   set->states[start].out = end;
+   
+   frag->start = start;
+   frag->end = end;
+   return 0;
+}
+
+
+// set a bit in a character class
+static void vdev_match_nfa_class_set( uint32_t* cls, unsigned char c ) {
+   cls[ c / 32 ] |= ((uint32_t)1 << (c % 32));
+}
+
+// test a bit in a character class
+static bool vdev_match_nfa_class_has( uint32_t const* cls, unsigned char c ) {
+   return (cls[ c / 32 ] & ((uint32_t)1 << (c % 32))) != 0;
+}
+
+
+// add a named character class (i.e. [:alpha:]) to a character class
+// return 0 on success
+// return -EINVAL if the name is not recognized
+static int vdev_match_nfa_class_named( uint32_t* cls, char const* name, size_t name_len ) {
+   
+   static char const* names[] = {
+      "alpha", "digit", "alnum", "upper", "lower", "space", "blank", "punct", "print", "graph", "cntrl", "xdigit", NULL
+   };
+   
+   static int (*predicates[])(int) = {
+      isalpha, isdigit, isalnum, isupper, islower, isspace, isblank, ispunct, isprint, isgraph, iscntrl, isxdigit, NULL
+   };
+   
+   for( int i = 0; names[i] != NULL; i++ ) {
+      
+      if( strlen(names[i]) != name_len || strncmp( names[i], name, name_len ) != 0 ) {
+         continue;
+      }
+      
+      for( int c = 1; c < 256; c++ ) {
+         
+         if( (*predicates[i])( c ) ) {
+            vdev_match_nfa_class_set( cls, (unsigned char)c );
+         }
+      }
+      
+      return 0;
+   }
+   
+   return -EINVAL;
+}
+
+
+// parse a bracket expression into a character class state.  p->pos is just past the '['
+// return 0 on success, and set *frag
+// return -EINVAL if the expression is malformed or unsupported (collating elements, equivalence classes)
+// return -ENOMEM on OOM
+static int vdev_match_nfa_parse_bracket( struct vdev_match_nfa_parser* p, struct vdev_match_nfa_frag* frag ) {
+   
+   int rc = 0;
+   uint32_t cls[8];
+   bool negate = false;
+   bool first = true;
+   char const* str = p->str;
+   
+   memset( cls, 0, sizeof(cls) );
+   
+   if( str[p->pos] == '^' ) {
+      
+      negate = true;
+      p->pos++;
+   }
+   
+   while( 1 ) {
+      
+      unsigned char lo = (unsigned char)str[p->pos];
+      unsigned char hi = 0;
+      
+      if( lo == '\0' ) {
+         return -EINVAL;
+      }
+      
+      if( lo == ']' && !first ) {
+         
+         p->pos++;
+         break;
+      }
+      
+      first = false;
+      
+      if( lo == '[' && (str[p->pos+1] == '.' || str[p->pos+1] == '=') ) {
+         
+         // collating elements and equivalence classes 
+         return -EINVAL;
+      }
+      
+      if( lo == '[' && str[p->pos+1] == ':' ) {
+         
+         char const* name = str + p->pos + 2;
+         char const* name_end = strstr( name, ":]" );
+         
+         if( name_end == NULL ) {
+            return -EINVAL;
+         }
+         
+         rc = vdev_match_nfa_class_named( cls, name, name_end - name );
+         if( rc != 0 ) {
+            return rc;
+         }
+         
+         p->pos = (name_end + 2) - str;
+         continue;
+      }
+      
+      p->pos++;
+      
+      if( str[p->pos] == '-' && str[p->pos+1] != ']' && str[p->pos+1] != '\0' ) {
+         
+         hi = (unsigned char)str[p->pos+1];
+         if( hi == '[' || hi < lo ) {
+            return -EINVAL;
+         }
+         
+         p->pos += 2;
+      }
+      else {
+         
+         hi = lo;
+      }
+      
+      for( int c = lo; c <= hi; c++ ) {
+         vdev_match_nfa_class_set( cls, (unsigned char)c );
+      }
+   }
+   
+   if( negate ) {
+      
+      for( int i = 0; i < 8; i++ ) {
+         cls[i] = ~cls[i];
+      }
+      
+      // REG_NEWLINE: a non-matching list never matches a newline 
+      cls[ '\n' / 32 ] &= ~((uint32_t)1 << ('\n' % 32));
+   }
+   
+   rc = vdev_match_nfa_frag_single( p->set, VDEV_MATCH_NFA_CLASS, frag );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   memcpy( p->set->states[ frag->start ].cls, cls, sizeof(cls) );
+   return 0;
+}
+
+
+// parse an atom: a group, bracket expression, anchor, wildcard, or (possibly escaped) character
+// return 0 on success, and set *frag
+// return -EINVAL if malformed or unsupported 
+// return -ENOMEM on OOM
+static int vdev_match_nfa_parse_atom( struct vdev_match_nfa_parser* p, struct vdev_match_nfa_frag* frag ) {
+   
+   int rc = 0;
+   char c = p->str[p->pos];
+   
+   switch( c ) {
+      
+      case '(': {
+         
+         p->pos++;
+         
+         if( p->str[p->pos] == ')' ) {
+            
+            // empty group 
+            return -EINVAL;
+         }
+         
+         rc = vdev_match_nfa_parse_regex( p, frag );
+         if( rc != 0 ) {
+            return rc;
+         }
+         
+         if( p->str[p->pos] != ')' ) {
+            return -EINVAL;
+         }
+         
+         p->pos++;
+         return 0;
+      }
+      
+      case '[': {
+         
+         p->pos++;
+         return vdev_match_nfa_parse_bracket( p, frag );
+      }
+      
+      case '.': {
+         
+         p->pos++;
+         return vdev_match_nfa_frag_single( p->set, VDEV_MATCH_NFA_ANY, frag );
+      }
+      
+      case '^': {
+         
+         p->pos++;
+         return vdev_match_nfa_frag_single( p->set, VDEV_MATCH_NFA_BOL, frag );
+      }
+      
+      case '$': {
+         
+         p->pos++;
+         return vdev_match_nfa_frag_single( p->set, VDEV_MATCH_NFA_EOL, frag );
+      }
+      
+      case '\\': {
+         
+         // only escaped special characters; everything else is a back-reference or GNU extension
+         c = p->str[p->pos+1];
+         if( !vdev_match_is_special( c ) ) {
+            return -EINVAL;
+         }
+         
+         p->pos += 2;
+         break;
+      }
+      
+      case '*':
+      case '+':
+      case '?':
+      case '{':
+      case '}': {
+         
+         // quantifier with nothing to quantify, or an interval
+         return -EINVAL;
+      }
+      
+      default: {
+         
+         p->pos++;
+         break;
+      }
+   }
+   
+   rc = vdev_match_nfa_frag_single( p->set, VDEV_MATCH_NFA_CHAR, frag );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   p->set->states[ frag->start ].c = (unsigned char)c;
+   return 0;
+}
+
+
+// parse an atom and its quantifiers
+// return 0 on success, and set *frag
+// return -EINVAL if malformed or unsupported 
+// return -ENOMEM on OOM
+static int vdev_match_nfa_parse_piece( struct vdev_match_nfa_parser* p, struct vdev_match_nfa_frag* frag ) {
+   
+   int rc = 0;
+   int split = 0;
+   int end = 0;
+   char c = 0;
+   
+   rc = vdev_match_nfa_parse_atom( p, frag );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   while( 1 ) {
+      
+      c = p->str[p->pos];
+      
+      if( c == '{' ) {
+         
+         // intervals are left to regexec 
+         return -EINVAL;
+      }
+      
+      if( c != '*' && c != '+' && c != '?' ) {
+         break;
+      }
+      
+      p->pos++;
+      
+      split = vdev_match_nfa_state_new( p->set, VDEV_MATCH_NFA_SPLIT );
+      if( split < 0 ) {
+         return split;
+      }
+      
+      end = vdev_match_nfa_state_new( p->set, VDEV_MATCH_NFA_EPSILON );
+      if( end < 0 ) {
+         return end;
+      }
+      
+      p->set->states[split].out = frag->start;
+      p->set->states[split].out1 = end;
+      
+      if( c == '*' ) {
+         
+         // zero or more: loop back to the split 
+         p->set->states[ frag->end ].out = split;
+         frag->start = split;
+      }
+      else if( c == '+' ) {
+         
+         // one or more: run once, then loop back to the split
+         p->set->states[ frag->end ].out = split;
+      }
+      else {
+         
+         // zero or one 
+         p->set->states[ frag->end ].out = end;
+         frag->start = split;
+      }
+      
+      frag->end = end;
+   }
+   
+   return 0;
+}
+
+
+// parse a sequence of pieces 
+// return 0 on success, and set *frag
+// return -EINVAL if malformed or unsupported (i.e. empty)
+// return -ENOMEM on OOM
+static int vdev_match_nfa_parse_branch( struct vdev_match_nfa_parser* p, struct vdev_match_nfa_frag* frag ) {
+   
+   int rc = 0;
+   bool first = true;
+   struct vdev_match_nfa_frag next;
+   
+   while( p->str[p->pos] != '\0' && p->str[p->pos] != '|' && p->str[p->pos] != ')' ) {
+      
+      rc = vdev_match_nfa_parse_piece( p, first ? frag : &next );
+      if( rc != 0 ) {
+         return rc;
+      }
+      
+      if( !first ) {
+         
+         // concatenate 
+         p->set->states[ frag->end ].out = next.start;
+         frag->end = next.end;
+      }
+      
+      first = false;
+   }
+   
+   if( first ) {
+      
+      // empty branch
+      return -EINVAL;
+   }
+   
+   return 0;
+}
+
+
+// parse alternated branches
+// return 0 on success, and set *frag
+// return -EINVAL if malformed or unsupported 
+// return -ENOMEM on OOM
+static int vdev_match_nfa_parse_regex( struct vdev_match_nfa_parser* p, struct vdev_match_nfa_frag* frag ) {
+   
+   int rc = 0;
+   int split = 0;
+   int end = 0;
+   struct vdev_match_nfa_frag next;
+   
+   rc = vdev_match_nfa_parse_branch( p, frag );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   while( p->str[p->pos] == '|' ) {
+      
+      p->pos++;
+      
+      rc = vdev_match_nfa_parse_branch( p, &next );
+      if( rc != 0 ) {
+         return rc;
+      }
+      
+      split = vdev_match_nfa_state_new( p->set, VDEV_MATCH_NFA_SPLIT );
+      if( split < 0 ) {
+         return split;
+      }
+      
+      end = vdev_match_nfa_state_new( p->set, VDEV_MATCH_NFA_EPSILON );
+      if( end < 0 ) {
+         return end;
+      }
+      
+      p->set->states[split].out = frag->start;
+      p->set->states[split].out1 = next.start;
+      p->set->states[ frag->end ].out = end;
+      p->set->states[ next.end ].out = end;
+      
+      frag->start = split;
+      frag->end = end;
+   }
+   
+   return 0;
+}
+
+
+// compile a pattern into the set's NFA
+// return the start state on success
+// return -EINVAL if the NFA can't represent it, in which case the set is unchanged
+// return -ENOMEM on OOM
+static int vdev_match_nfa_compile( struct vdev_match_set* set, char const* str, int pattern_idx ) {
+   
+   int rc = 0;
+   int match = 0;
+   size_t old_num_states = set->num_states;
+   struct vdev_match_nfa_parser parser;
+   struct vdev_match_nfa_frag frag;
+   
+   memset( &parser, 0, sizeof(parser) );
+   
+   parser.set = set;
+   parser.str = str;
+   parser.pos = 0;
+   
+   rc = vdev_match_nfa_parse_regex( &parser, &frag );
+   if( rc == 0 && str[parser.pos] != '\0' ) {
+      
+      // unbalanced ')'
+      rc = -EINVAL;
+   }
+   
+   if( rc == 0 ) {
+      
+      match = vdev_match_nfa_state_new( set, VDEV_MATCH_NFA_MATCH );
+      if( match < 0 ) {
+         rc = match;
+      }
+   }
+   
+   if( rc != 0 ) {
+      
+      // roll back 
+      set->num_states = old_num_states;
+      return rc;
+   }
+   
+   set->states[match].pattern = pattern_idx;
+   set->states[ frag.end ].out = match;
+   
+   return frag.start;
+}
+
+
+// set up a pattern set 
+// always succeeds
+int vdev_match_set_init( struct vdev_match_set* set ) {
+   
+   memset( set, 0, sizeof(struct vdev_match_set) );
+   return 0;
+}
+
+
+// make room for another pattern in a pattern set 
+// return 0 on success 
+// return -ENOMEM on OOM
+static int vdev_match_set_grow( struct vdev_match_set* set ) {
+   
+   if( set->num_patterns == set->max_patterns ) {
+      
+      size_t max_patterns = set->max_patterns > 0 ? 2 * set->max_patterns : 16;
+      struct vdev_match_pattern* patterns = (struct vdev_match_pattern*)realloc( set->patterns, sizeof(struct vdev_match_pattern) * max_patterns );
+      int* starts = NULL;
+      int* nfa_patterns = NULL;
+      
+      if( patterns == NULL ) {
+         return -ENOMEM;
+      }
+      
+      set->patterns = patterns;
+      
+      starts = (int*)realloc( set->starts, sizeof(int) * max_patterns );
+      if( starts == NULL ) {
+         return -ENOMEM;
+      }
+      
+      set->starts = starts;
+      
+      nfa_patterns = (int*)realloc( set->nfa_patterns, sizeof(int) * max_patterns );
+      if( nfa_patterns == NULL ) {
+         return -ENOMEM;
+      }
+      
+      set->nfa_patterns = nfa_patterns;
+      set->max_patterns = max_patterns;
+   }
+   
+   return 0;
+}
+
+
+// add a pattern to a pattern set 
+// return the index of the pattern on success 
+// return -EINVAL if the pattern is not a valid extended regex 
+// return -ENOMEM on OOM
+int vdev_match_set_add( struct vdev_match_set* set, char const* str ) {
+   
+   int rc = 0;
+   int idx = (int)set->num_patterns;
+   struct vdev_match_pattern* pattern = NULL;
+   
+   rc = vdev_match_set_grow( set );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   pattern = &set->patterns[idx];
+   
+   rc = vdev_match_pattern_init( pattern, str );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   set->starts[idx] = -1;
+   
+   if( pattern->type == VDEV_MATCH_REGEX ) {
+      
+      rc = vdev_match_nfa_compile( set, str, idx );
+      if( rc == -ENOMEM ) {
+         
+         vdev_match_pattern_free( pattern );
+         return rc;
+      }
+      else if( rc >= 0 ) {
+         
+         set->starts[idx] = rc;
+         set->nfa_patterns[ set->num_nfa_patterns ] = idx;
+         set->num_nfa_patterns++;
+      }
+      else {
+         
+         vdev_debug("Pattern '%s' will be matched with regexec\n", str );
+      }
+   }
+   
+   set->num_patterns++;
+   return idx;
+}
+
+
+// add a pattern to a pattern set, given an already-compiled copy of it.
+// exact, prefix, and suffix patterns reuse its classification, so their regex is not compiled again.
+// return the index of the pattern on success 
+// return -EINVAL if the pattern is not a valid extended regex 
+// return -ENOMEM on OOM
+int vdev_match_set_add_pattern( struct vdev_match_set* set, char const* str, struct vdev_match_pattern const* compiled ) {
+   
+   int rc = 0;
+   int idx = (int)set->num_patterns;
+   
+   if( compiled->type == VDEV_MATCH_REGEX ) {
+      return vdev_match_set_add( set, str );
+   }
+   
+   rc = vdev_match_set_grow( set );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   rc = vdev_match_pattern_init_literal( &set->patterns[idx], compiled->type, compiled->literal, compiled->literal_len );
+   if( rc == -EINVAL ) {
+      
+      // needs the regex after all
+      return vdev_match_set_add( set, str );
+   }
+   else if( rc != 0 ) {
+      return rc;
+   }
+   
+   set->starts[idx] = -1;
+   set->num_patterns++;
+   return idx;
+}
+
+
+// free a pattern set 
+// always succeeds 
+int vdev_match_set_free( struct vdev_match_set* set ) {
+   
+   for( unsigned int i = 0; i < set->num_patterns; i++ ) {
+      
+      vdev_match_pattern_free( &set->patterns[i] );
+   }
+   
+   if( set->patterns != NULL ) {
+      free( set->patterns );
+   }
+   
+   if( set->states != NULL ) {
+      free( set->states );
+   }
+   
+   if( set->starts != NULL ) {
+      free( set->starts );
+   }
+   
+   if( set->nfa_patterns != NULL ) {
+      free( set->nfa_patterns );
+   }
+   
+   memset( set, 0, sizeof(struct vdev_match_set) );
+   return 0;
+}
+
+
+// NFA simulation state 
+struct vdev_match_nfa_run {
+   
+   struct vdev_match_set* set;
+   char const* path;
+   
+   // per-state generation marks, so each state is added to a list at most once per step
+   unsigned int* marks;
+   unsigned int gen;
+   
+   bool* matched;
+};
+
+
+// follow epsilon transitions from a state, adding consuming states to list, and recording matches.
+// pos is the offset into the path where the state is being entered.
+static void vdev_match_nfa_add( struct vdev_match_nfa_run* run, int* list, size_t* len, int s, size_t pos ) {
+   
+   struct vdev_match_nfa_state* state = NULL;
+   
+   while( s >= 0 ) {
+      
+      if( run->marks[s] == run->gen ) {
+         return;
+      }
+      
+      run->marks[s] = run->gen;
+      state = &run->set->states[s];
+      
+      switch( state->op ) {
+         
+         case VDEV_MATCH_NFA_EPSILON: {
+            
+            s = state->out;
+            break;
+         }
+         
+         case VDEV_MATCH_NFA_SPLIT: {
+            
+            vdev_match_nfa_add( run, list, len, state->out, pos );
+            s = state->out1;
+            break;
+         }
+         
+         case VDEV_MATCH_NFA_BOL: {
+            
+            if( pos != 0 && run->path[pos-1] != '\n' ) {
+               return;
+            }
+            
+            s = state->out;
+            break;
+         }
+         
+         case VDEV_MATCH_NFA_EOL: {
+            
+            if( run->path[pos] != '\0' && run->path[pos] != '\n' ) {
+               return;
+            }
+            
+            s = state->out;
+            break;
+         }
+         
+         case VDEV_MATCH_NFA_MATCH: {
+            
+            run->matched[ state->pattern ] = true;
+            return;
+         }
+         
+         default: {
+            
+            // consumes a character 
+            list[*len] = s;
+            (*len)++;
+            return;
+         }
+      }
+   }
+}
+
+
+// run the set's NFA over a path, setting matched[i] for each NFA pattern i that matches anywhere in it
+// return 0 on success
+// return -ENOMEM on OOM
+static int vdev_match_nfa_run( struct vdev_match_set* set, char const* path, bool* matched ) {
+   
+   struct vdev_match_nfa_run run;
+   int* clist = NULL;
+   int* nlist = NULL;
+   int* tmp = NULL;
+   size_t clen = 0;
+   size_t nlen = 0;
+   size_t path_len = strlen( path );
+   size_t num_matched = 0;
+   
+   memset( &run, 0, sizeof(run) );
+   
+   run.set = set;
+   run.path = path;
+   run.matched = matched;
+   run.marks = VDEV_CALLOC( unsigned int, set->num_states );
+   clist = VDEV_CALLOC( int, set->num_states );
+   nlist = VDEV_CALLOC( int, set->num_states );
+   
+   if( run.marks == NULL || clist == NULL || nlist == NULL ) {
+      
+      free( run.marks );
+      free( clist );
+      free( nlist );
+      return -ENOMEM;
+   }
+   
+   run.gen = 1;
+   
+   for( size_t pos = 0; pos <= path_len; pos++ ) {
+      
+      // a match can start anywhere.  clist was built under the current generation, so no state is added twice
+      num_matched = 0;
+      
+      for( size_t i = 0; i < set->num_nfa_patterns; i++ ) {
+         
+         int idx = set->nfa_patterns[i];
+         
+         if( !matched[idx] ) {
+            vdev_match_nfa_add( &run, clist, &clen, set->starts[idx], pos );
+         }
+      }
+      
+      for( size_t i = 0; i < set->num_nfa_patterns; i++ ) {
+         
+         if( matched[ set->nfa_patterns[i] ] ) {
+            num_matched++;
+         }
+      }
+      
+      if( num_matched == set->num_nfa_patterns || pos == path_len ) {
+         
+         // done 
+         break;
+      }
+      
+      // step 
+      unsigned char c = (unsigned char)path[pos];
+      
+      run.gen++;
+      nlen = 0;
+      
+      for( size_t i = 0; i < clen; i++ ) {
+         
+         struct vdev_match_nfa_state* state = &set->states[ clist[i] ];
+         bool advance = false;
+         
+         switch( state->op ) {
+            
+            case VDEV_MATCH_NFA_CHAR: {
+               
+               advance = (state->c == c);
+               break;
+            }
+            
+            case VDEV_MATCH_NFA_ANY: {
+               
+               advance = (c != '\n');
+               break;
+            }
+            
+            case VDEV_MATCH_NFA_CLASS: {
+               
+               advance = vdev_match_nfa_class_has( state->cls, c );
+               break;
+            }
+            
+            default: {
+               break;
+            }
+         }
+         
+         if( advance ) {
+            vdev_match_nfa_add( &run, nlist, &nlen, state->out, pos + 1 );
+         }
+      }
+      
+      tmp = clist;
+      clist = nlist;
+      nlist = tmp;
+      clen = nlen;
+   }
+   
+   free( run.marks );
+   free( clist );
+   free( nlist );
+   
+   return 0;
+}
+
+
+// match a path against every pattern in a set, in one pass for the regexes the NFA represents.
+// matched must have room for set->num_patterns entries.
+// return 0 on success, and set matched[i] for each pattern i
+// return -ENOMEM on OOM 
+// return negative on regexec error
+int vdev_match_set( struct vdev_match_set* set, char const* path, bool* matched ) {
+   
+   int rc = 0;
+   bool has_newline = (strchr( path, '\n' ) != NULL);
+   
+   for( unsigned int i = 0; i < set->num_patterns; i++ ) {
+      
+      matched[i] = false;
+      
+      if( set->starts[i] >= 0 && !has_newline ) {
+         
+         // handled by the NFA
+         continue;
+      }
+      
+      rc = vdev_match_pattern( path, &set->patterns[i] );
+      if( rc < 0 ) {
+         return rc;
+      }
+      
+      matched[i] = (rc > 0);
+   }
+   
+   if( set->num_nfa_patterns > 0 && !has_newline ) {
+      
+      rc = vdev_match_nfa_run( set, path, matched );
+      if( rc != 0 ) {
+         return rc;
+      }
+   }
+   
+   return 0;
+}
@@ -26,6 +26,79 @@
 
 #include <regex.h>
 
+// how a pattern gets matched, decided when it is compiled 
+typedef enum {
+   VDEV_MATCH_EXACT = 1,        // ^literal$
+   VDEV_MATCH_PREFIX,           // ^literal, ^literal.*, ^literal.*$
+   VDEV_MATCH_SUFFIX,           // literal$, .*literal$, ^.*literal$
+   VDEV_MATCH_REGEX             // anything else
+} vdev_match_t;
+
+// a compiled path pattern 
+struct vdev_match_pattern {
+   
+   vdev_match_t type;
+   
+   // literal to compare against, for exact, prefix, and suffix patterns
+   char* literal;
+   size_t literal_len;
+   
+   // the full regex.  Compiled whenever the pattern is parsed, so invalid patterns are rejected 
+   // the same way regardless of type, and so paths with newlines (where ^ and $ also match 
+   // around the newline) get the exact regcomp semantics.
+   regex_t regex;
+   
+   // false for literal patterns set up from an already-validated classification;
+   // these match paths with newlines one line at a time instead.
+   bool has_regex;
+};
+
+// NFA state opcodes 
+#define VDEV_MATCH_NFA_CHAR     1       // consume c
+#define VDEV_MATCH_NFA_ANY      2       // consume anything but a newline
+#define VDEV_MATCH_NFA_CLASS    3       // consume a character in cls
+#define VDEV_MATCH_NFA_SPLIT    4       // go to out and out1
+#define VDEV_MATCH_NFA_EPSILON  5       // go to out 
+#define VDEV_MATCH_NFA_BOL      6       // go to out if at the beginning of a line
+#define VDEV_MATCH_NFA_EOL      7       // go to out if at the end of a line
+#define VDEV_MATCH_NFA_MATCH    8       // pattern matched
+
+// NFA state 
+struct vdev_match_nfa_state {
+   
+   int op;
+   unsigned char c;
+   uint32_t cls[8];
+   
+   int out;
+   int out1;
+   
+   // which pattern matched, for VDEV_MATCH_NFA_MATCH
+   int pattern;
+};
+
+// a set of patterns, matched against a path all at once.
+// regex patterns get combined into a single NFA, so a path is scanned once for all of them.
+// regex features the NFA does not implement (intervals, back-references, GNU extensions)
+// fall back to regexec(3) for that pattern.
+struct vdev_match_set {
+   
+   struct vdev_match_pattern* patterns;
+   size_t num_patterns;
+   size_t max_patterns;
+   
+   // combined NFA 
+   struct vdev_match_nfa_state* states;
+   size_t num_states;
+   size_t max_states;
+   
+   // start state of each pattern in the NFA (-1 if not in the NFA)
+   int* starts;
+   
+   // indexes of patterns in the NFA
+   int* nfa_patterns;
+   size_t num_nfa_patterns;
+};
 
 C_LINKAGE_BEGIN
 
@@ -34,6 +107,17 @@ int vdev_match_regex_append( char*** strings, regex_t** regexes, size_t* len, ch
 int vdev_match_regexes_free( char** regex_strs, regex_t* regexes, size_t len );
 int vdev_match_regex( char const* path, regex_t* regex );
 int vdev_match_first_regex( char const* path, regex_t* regexes, size_t num_regexes );
+
+int vdev_match_pattern_init( struct vdev_match_pattern* pattern, char const* str );
+int vdev_match_pattern_init_literal( struct vdev_match_pattern* pattern, vdev_match_t type, char const* literal, size_t literal_len );
+int vdev_match_pattern_free( struct vdev_match_pattern* pattern );
+int vdev_match_pattern( char const* path, struct vdev_match_pattern* pattern );
+
+int vdev_match_set_init( struct vdev_match_set* set );
+int vdev_match_set_add( struct vdev_match_set* set, char const* str );
+int vdev_match_set_add_pattern( struct vdev_match_set* set, char const* str, struct vdev_match_pattern const* compiled );
+int vdev_match_set_free( struct vdev_match_set* set );
+int vdev_match_set( struct vdev_match_set* set, char const* path, bool* matched );
    
 C_LINKAGE_END
 
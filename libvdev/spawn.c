@@ -0,0 +1,411 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "spawn.h"
+
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#if defined(_VDEV_SPAWN_VFORK) && defined(_VDEV_OS_LINUX)
+#include <sched.h>
+#include <sys/mman.h>
+
+// stack for a vfork'ed child (it only has to get as far as execve(2))
+#define VDEV_SPAWN_STACK_SIZE   (64 * 1024)
+#endif
+
+// what the child needs to exec, all set up by the parent beforehand
+struct vdev_spawn_args {
+   
+   char const* path;
+   char* const* argv;
+   char* const* env;
+   int stdio_fds[3];
+   int flags;
+   
+   // highest fd to close if close_range(2) is not available 
+   long max_fd;
+   
+   // signal mask to exec with 
+   sigset_t sigmask;
+   
+   // fork backend: write end of the pipe to send errno over if exec fails 
+   int err_fd;
+   
+   // vfork backend: stack for the detached grandchild, and errno if exec failed
+   char* stack;
+   volatile int err;
+};
+
+// environment for children started without one
+static char* const vdev_spawn_noenv[] = { NULL };
+
+
+// close all fds at or above lowfd 
+// NOTE: runs in the child; must be async-safe
+static void vdev_spawn_close_from( int lowfd, long max_fd ) {
+   
+#ifdef SYS_close_range
+   if( syscall( SYS_close_range, lowfd, ~0U, 0 ) == 0 ) {
+      return;
+   }
+#endif
+   
+   // no close_range(2); do it the slow way 
+   for( long i = lowfd; i < max_fd; i++ ) {
+      close( i );
+   }
+}
+
+
+// set up the child's fds and signals, and exec.
+// NOTE: runs in the child; must be async-safe.  In the vfork backend, the child shares vdevd's memory,
+// so it must not write to anything but its stack and args->err.
+// only returns on failure, with errno set
+static void vdev_spawn_exec( struct vdev_spawn_args* args ) {
+   
+   int rc = 0;
+   int fds[3];
+   struct sigaction sa;
+   struct sigaction old_sa;
+   
+   // vdevd's signal handlers must not run in the child.
+   // exec(2) would reset them anyway, but signals get unblocked before then.
+   memset( &sa, 0, sizeof(sa) );
+   sa.sa_handler = SIG_DFL;
+   
+   for( int sig = 1; sig < NSIG; sig++ ) {
+      
+      rc = sigaction( sig, NULL, &old_sa );
+      if( rc == 0 && old_sa.sa_handler != SIG_DFL && old_sa.sa_handler != SIG_IGN ) {
+         sigaction( sig, &sa, NULL );
+      }
+   }
+   
+   // keep the error pipe out of the way of stdio 
+   if( args->err_fd >= 0 && args->err_fd <= STDERR_FILENO ) {
+      
+      args->err_fd = fcntl( args->err_fd, F_DUPFD_CLOEXEC, STDERR_FILENO + 1 );
+      if( args->err_fd < 0 ) {
+         return;
+      }
+   }
+   
+   // copy the stdio fds out of the way first, in case they overlap 0-2
+   for( int i = 0; i < 3; i++ ) {
+      
+      fds[i] = -1;
+      
+      if( args->stdio_fds[i] >= 0 ) {
+         
+         fds[i] = fcntl( args->stdio_fds[i], F_DUPFD, STDERR_FILENO + 1 );
+         if( fds[i] < 0 ) {
+            return;
+         }
+      }
+   }
+   
+   for( int i = 0; i < 3; i++ ) {
+      
+      if( fds[i] >= 0 ) {
+         
+         rc = dup2( fds[i], i );
+         if( rc < 0 ) {
+            return;
+         }
+      }
+      else {
+         
+         close( i );
+      }
+   }
+   
+   // close everything else, except the error pipe 
+   if( args->err_fd >= 0 ) {
+      
+      if( args->err_fd != STDERR_FILENO + 1 ) {
+         
+         rc = dup3( args->err_fd, STDERR_FILENO + 1, O_CLOEXEC );
+         if( rc < 0 ) {
+            return;
+         }
+         
+         args->err_fd = STDERR_FILENO + 1;
+      }
+      
+      vdev_spawn_close_from( STDERR_FILENO + 2, args->max_fd );
+   }
+   else {
+      
+      vdev_spawn_close_from( STDERR_FILENO + 1, args->max_fd );
+   }
+   
+   sigprocmask( SIG_SETMASK, &args->sigmask, NULL );
+   
+   execve( args->path, args->argv, args->env );
+}
+
+
+#if defined(_VDEV_SPAWN_VFORK) && defined(_VDEV_OS_LINUX)
+
+// vfork'ed child that execs 
+static int vdev_spawn_vfork_exec( void* cls ) {
+   
+   struct vdev_spawn_args* args = (struct vdev_spawn_args*)cls;
+   
+   vdev_spawn_exec( args );
+   
+   args->err = errno;
+   _exit(127);
+   return 127;
+}
+
+
+// vfork'ed child: exec, or detach and vfork a grandchild to exec
+static int vdev_spawn_vfork_child( void* cls ) {
+   
+   struct vdev_spawn_args* args = (struct vdev_spawn_args*)cls;
+   pid_t pid = 0;
+   
+   if( !(args->flags & VDEV_SPAWN_DETACH) ) {
+      return vdev_spawn_vfork_exec( cls );
+   }
+   
+   if( setsid() < 0 ) {
+      
+      args->err = errno;
+      _exit(127);
+   }
+   
+   // the grandchild gets reparented to init once we exit
+   pid = clone( vdev_spawn_vfork_exec, args->stack + VDEV_SPAWN_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, args );
+   if( pid < 0 ) {
+      
+      args->err = errno;
+   }
+   
+   _exit(0);
+   return 0;
+}
+
+
+// spawn with clone(CLONE_VM|CLONE_VFORK):  the child runs on our memory (and we are suspended) until it execs.
+// return 0 on success, and set *ret_pid (to 0 if detached)
+// return -errno on failure to start or exec the child
+static int vdev_spawn_vfork( struct vdev_spawn_args* args, pid_t* ret_pid ) {
+   
+   int rc = 0;
+   pid_t pid = 0;
+   char* stack = NULL;
+   size_t stack_len = VDEV_SPAWN_STACK_SIZE;
+   sigset_t all_signals;
+   
+   if( args->flags & VDEV_SPAWN_DETACH ) {
+      
+      // room for the grandchild's stack 
+      stack_len += VDEV_SPAWN_STACK_SIZE;
+   }
+   
+   stack = (char*)mmap( NULL, stack_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0 );
+   if( stack == MAP_FAILED ) {
+      
+      rc = -errno;
+      vdev_error("mmap rc = %d\n", rc );
+      return rc;
+   }
+   
+   args->stack = stack + VDEV_SPAWN_STACK_SIZE;
+   args->err = 0;
+   
+   // no signal handlers may run in the child until it has reset them
+   sigfillset( &all_signals );
+   pthread_sigmask( SIG_SETMASK, &all_signals, &args->sigmask );
+   
+   pid = clone( vdev_spawn_vfork_child, stack + VDEV_SPAWN_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, args );
+   if( pid < 0 ) {
+      rc = -errno;
+   }
+   
+   pthread_sigmask( SIG_SETMASK, &args->sigmask, NULL );
+   munmap( stack, stack_len );
+   
+   if( rc != 0 ) {
+      
+      vdev_error("clone rc = %d\n", rc );
+      return rc;
+   }
+   
+   if( (args->flags & VDEV_SPAWN_DETACH) || args->err != 0 ) {
+      
+      // reap the intermediate process, or the child that failed to exec 
+      while( waitpid( pid, NULL, 0 ) < 0 && errno == EINTR );
+      pid = 0;
+   }
+   
+   if( args->err != 0 ) {
+      return -args->err;
+   }
+   
+   *ret_pid = pid;
+   return 0;
+}
+
+#else
+
+// spawn with fork(2).  A failure to exec is sent back over a close-on-exec pipe.
+// return 0 on success, and set *ret_pid (to 0 if detached)
+// return -errno on failure to start or exec the child
+static int vdev_spawn_fork( struct vdev_spawn_args* args, pid_t* ret_pid ) {
+   
+   int rc = 0;
+   int err = 0;
+   pid_t pid = 0;
+   int err_pipe[2];
+   ssize_t nr = 0;
+   sigset_t all_signals;
+   
+   rc = pipe2( err_pipe, O_CLOEXEC );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+      vdev_error("pipe2 rc = %d\n", rc );
+      return rc;
+   }
+   
+   sigfillset( &all_signals );
+   pthread_sigmask( SIG_SETMASK, &all_signals, &args->sigmask );
+   
+   pid = fork();
+   
+   if( pid == 0 ) {
+      
+      // child 
+      close( err_pipe[0] );
+      args->err_fd = err_pipe[1];
+      
+      if( args->flags & VDEV_SPAWN_DETACH ) {
+         
+         if( setsid() < 0 ) {
+            
+            err = errno;
+            vdev_write_uninterrupted( args->err_fd, (char*)&err, sizeof(int) );
+            _exit(127);
+         }
+         
+         // the grandchild gets reparented to init once we exit
+         pid = fork();
+         if( pid < 0 ) {
+            
+            err = errno;
+            vdev_write_uninterrupted( args->err_fd, (char*)&err, sizeof(int) );
+            _exit(127);
+         }
+         else if( pid > 0 ) {
+            
+            _exit(0);
+         }
+      }
+      
+      vdev_spawn_exec( args );
+      
+      err = errno;
+      vdev_write_uninterrupted( args->err_fd, (char*)&err, sizeof(int) );
+      _exit(127);
+   }
+   
+   if( pid < 0 ) {
+      rc = -errno;
+   }
+   
+   pthread_sigmask( SIG_SETMASK, &args->sigmask, NULL );
+   close( err_pipe[1] );
+   
+   if( rc != 0 ) {
+      
+      vdev_error("fork rc = %d\n", rc );
+      close( err_pipe[0] );
+      return rc;
+   }
+   
+   // EOF once the child has exec'ed
+   nr = vdev_read_uninterrupted( err_pipe[0], (char*)&err, sizeof(int) );
+   close( err_pipe[0] );
+   
+   if( nr != sizeof(int) ) {
+      err = 0;
+   }
+   
+   if( (args->flags & VDEV_SPAWN_DETACH) || err != 0 ) {
+      
+      // reap the intermediate process, or the child that failed to exec 
+      while( waitpid( pid, NULL, 0 ) < 0 && errno == EINTR );
+      pid = 0;
+   }
+   
+   if( err != 0 ) {
+      return -err;
+   }
+   
+   *ret_pid = pid;
+   return 0;
+}
+
+#endif
+
+
+// start a subprocess running path with the given arguments and environment (or an empty one if env is NULL).
+// stdio_fds are the fds to give it as stdin, stdout, and stderr (-1 to leave one closed).  It inherits no others.
+// flags is a bitwise OR of VDEV_SPAWN_*.
+// return 0 on success, and set *ret_pid to the child (or 0 if it was detached)
+// return -errno on failure to start the child, or if it failed to exec
+int vdev_spawn( char const* path, char* const argv[], char* const env[], int const stdio_fds[3], int flags, pid_t* ret_pid ) {
+   
+   struct vdev_spawn_args args;
+   
+   memset( &args, 0, sizeof(args) );
+   
+   args.path = path;
+   args.argv = argv;
+   args.env = (env != NULL ? env : vdev_spawn_noenv);
+   args.flags = flags;
+   args.err_fd = -1;
+   
+   for( int i = 0; i < 3; i++ ) {
+      args.stdio_fds[i] = stdio_fds[i];
+   }
+   
+   args.max_fd = sysconf( _SC_OPEN_MAX );
+   if( args.max_fd <= 0 ) {
+      
+      // should be big enough...
+      args.max_fd = 1024;
+   }
+   
+#if defined(_VDEV_SPAWN_VFORK) && defined(_VDEV_OS_LINUX)
+   return vdev_spawn_vfork( &args, ret_pid );
+#else
+   return vdev_spawn_fork( &args, ret_pid );
+#endif
+}
@@ -0,0 +1,63 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// subprocess launcher.
+//
+// vdevd starts helpers, daemonlets, and shell commands constantly, so
+// starting a process has to stay cheap even when vdevd is large and its
+// fd limit is high.  Two backends, chosen at build time with SPAWN=:
+//
+// VFORK (the default on Linux):
+//    clone(2) with CLONE_VM|CLONE_VFORK, so the child borrows vdevd's
+//    address space until it execs instead of copying its page tables.
+//    fds are closed with one close_range(2) call.
+//
+// FORK (the fallback, and the only backend elsewhere):
+//    fork(2), then exec.  fds are still closed with close_range(2)
+//    when the kernel has it.
+//
+// Either way, the child gets only the stdio fds it was given, its
+// signal handlers reset to the default, and vdevd's signal mask.  A
+// failure to exec is reported back to the caller, not as an exit status.
+
+#ifndef _VDEV_SPAWN_H_
+#define _VDEV_SPAWN_H_
+
+#include "util.h"
+
+// start the child in a new session, and reparent it to init.
+// there is no child for the caller to reap.
+#define VDEV_SPAWN_DETACH       0x1
+
+// name of the compiled-in backend, for logging
+#if defined(_VDEV_SPAWN_VFORK) && defined(_VDEV_OS_LINUX)
+#define VDEV_SPAWN_BACKEND      "vfork"
+#else
+#define VDEV_SPAWN_BACKEND      "fork"
+#endif
+
+C_LINKAGE_BEGIN
+
+int vdev_spawn( char const* path, char* const argv[], char* const env[], int const stdio_fds[3], int flags, pid_t* ret_pid );
+
+C_LINKAGE_END
+
+#endif
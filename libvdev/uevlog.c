@@ -0,0 +1,367 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "uevlog.h"
+
+// writer thread: write out buffered records every VDEV_UEVLOG_FLUSH_MILLIS, or sooner if the buffer is half full
+static void* vdev_uevlog_main( void* arg ) {
+   
+   struct vdev_uevlog* uevlog = (struct vdev_uevlog*)arg;
+   struct timespec deadline;
+   char* tmp = NULL;
+   size_t len = 0;
+   ssize_t nw = 0;
+   bool stop = false;
+   
+   while( !stop ) {
+      
+      pthread_mutex_lock( &uevlog->lock );
+      
+      clock_gettime( CLOCK_REALTIME, &deadline );
+      
+      deadline.tv_sec += VDEV_UEVLOG_FLUSH_MILLIS / 1000;
+      deadline.tv_nsec += (VDEV_UEVLOG_FLUSH_MILLIS % 1000) * 1000000L;
+      
+      if( deadline.tv_nsec >= 1000000000L ) {
+         
+         deadline.tv_sec++;
+         deadline.tv_nsec -= 1000000000L;
+      }
+      
+      while( uevlog->buf_len < VDEV_UEVLOG_BUF_LEN / 2 && !uevlog->stop ) {
+         
+         if( pthread_cond_timedwait( &uevlog->cond, &uevlog->lock, &deadline ) == ETIMEDOUT ) {
+            break;
+         }
+      }
+      
+      stop = uevlog->stop;
+      
+      // take the buffered records, so appending can continue while we write them 
+      tmp = uevlog->write_buf;
+      uevlog->write_buf = uevlog->buf;
+      uevlog->buf = tmp;
+      
+      len = uevlog->buf_len;
+      uevlog->buf_len = 0;
+      
+      pthread_mutex_unlock( &uevlog->lock );
+      
+      if( len == 0 ) {
+         continue;
+      }
+      
+      nw = vdev_write_uninterrupted( uevlog->fd, uevlog->write_buf, len );
+      if( nw < 0 ) {
+         
+         vdev_error("write(%d) rc = %zd\n", uevlog->fd, nw );
+      }
+   }
+   
+   return NULL;
+}
+
+
+// open a uevent log for appending, and start writing records to it.
+// a new or empty file gets the log's magic number; an existing log must have it.
+// return 0 on success
+// return -ENOMEM on OOM
+// return -EINVAL if path exists but is not a uevent log
+// return -errno on failure to open or write the file, or start the writer thread
+int vdev_uevlog_open( struct vdev_uevlog* uevlog, char const* path ) {
+   
+   int rc = 0;
+   struct stat sb;
+   char magic[ VDEV_UEVLOG_MAGIC_LEN ];
+   ssize_t nr = 0;
+   
+   memset( uevlog, 0, sizeof(struct vdev_uevlog) );
+   
+   uevlog->fd = open( path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600 );
+   if( uevlog->fd < 0 ) {
+      
+      rc = -errno;
+      vdev_error("open('%s') rc = %d\n", path, rc );
+      return rc;
+   }
+   
+   rc = fstat( uevlog->fd, &sb );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+      vdev_error("fstat('%s') rc = %d\n", path, rc );
+      
+      close( uevlog->fd );
+      return rc;
+   }
+   
+   if( sb.st_size == 0 ) {
+      
+      // new log 
+      nr = vdev_write_uninterrupted( uevlog->fd, VDEV_UEVLOG_MAGIC, VDEV_UEVLOG_MAGIC_LEN );
+      if( nr < 0 ) {
+         
+         vdev_error("write('%s') rc = %zd\n", path, nr );
+         
+         close( uevlog->fd );
+         return (int)nr;
+      }
+   }
+   else {
+      
+      // appending to an existing log.  Make sure it is one.
+      int fd = open( path, O_RDONLY | O_CLOEXEC );
+      if( fd < 0 ) {
+         
+         rc = -errno;
+         vdev_error("open('%s') rc = %d\n", path, rc );
+         
+         close( uevlog->fd );
+         return rc;
+      }
+      
+      nr = vdev_read_uninterrupted( fd, magic, VDEV_UEVLOG_MAGIC_LEN );
+      close( fd );
+      
+      if( nr != VDEV_UEVLOG_MAGIC_LEN || memcmp( magic, VDEV_UEVLOG_MAGIC, VDEV_UEVLOG_MAGIC_LEN ) != 0 ) {
+         
+         vdev_error("'%s' is not a uevent log\n", path );
+         
+         close( uevlog->fd );
+         return -EINVAL;
+      }
+   }
+   
+   uevlog->buf = VDEV_CALLOC( char, VDEV_UEVLOG_BUF_LEN );
+   uevlog->write_buf = VDEV_CALLOC( char, VDEV_UEVLOG_BUF_LEN );
+   
+   if( uevlog->buf == NULL || uevlog->write_buf == NULL ) {
+      
+      free( uevlog->buf );
+      free( uevlog->write_buf );
+      close( uevlog->fd );
+      
+      return -ENOMEM;
+   }
+   
+   pthread_mutex_init( &uevlog->lock, NULL );
+   pthread_cond_init( &uevlog->cond, NULL );
+   
+   rc = pthread_create( &uevlog->thread, NULL, vdev_uevlog_main, uevlog );
+   if( rc != 0 ) {
+      
+      vdev_error("pthread_create rc = %d\n", rc );
+      
+      pthread_mutex_destroy( &uevlog->lock );
+      pthread_cond_destroy( &uevlog->cond );
+      
+      free( uevlog->buf );
+      free( uevlog->write_buf );
+      close( uevlog->fd );
+      
+      return -rc;
+   }
+   
+   uevlog->running = true;
+   
+   return 0;
+}
+
+
+// buffer a uevent to be written to the log.  Never blocks on I/O.
+// ts is when it was received, or NULL for now 
+// return 0 on success
+// return -EINVAL if the uevent is too big to log
+// return -ENOBUFS if the buffer is full, in which case the uevent is dropped
+int vdev_uevlog_append( struct vdev_uevlog* uevlog, int source, struct timespec const* ts, char const* uevent, size_t len ) {
+   
+   struct vdev_uevlog_record rec;
+   struct timespec now;
+   
+   if( len > VDEV_UEVLOG_MAX_UEVENT ) {
+      return -EINVAL;
+   }
+   
+   if( ts == NULL ) {
+      
+      clock_gettime( CLOCK_MONOTONIC, &now );
+      ts = &now;
+   }
+   
+   memset( &rec, 0, sizeof(struct vdev_uevlog_record) );
+   
+   rec.timestamp_nanos = (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
+   rec.len = (uint32_t)len;
+   rec.source = (uint16_t)source;
+   
+   pthread_mutex_lock( &uevlog->lock );
+   
+   if( uevlog->buf_len + sizeof(struct vdev_uevlog_record) + len > VDEV_UEVLOG_BUF_LEN ) {
+      
+      // the writer can't keep up 
+      uevlog->num_dropped++;
+      
+      pthread_mutex_unlock( &uevlog->lock );
+      return -ENOBUFS;
+   }
+   
+   memcpy( uevlog->buf + uevlog->buf_len, &rec, sizeof(struct vdev_uevlog_record) );
+   memcpy( uevlog->buf + uevlog->buf_len + sizeof(struct vdev_uevlog_record), uevent, len );
+   
+   uevlog->buf_len += sizeof(struct vdev_uevlog_record) + len;
+   
+   if( uevlog->buf_len >= VDEV_UEVLOG_BUF_LEN / 2 ) {
+      
+      // time to write 
+      pthread_cond_signal( &uevlog->cond );
+   }
+   
+   pthread_mutex_unlock( &uevlog->lock );
+   
+   return 0;
+}
+
+
+// write out any buffered records, stop the writer thread, and close the log 
+// return 0 on success
+// return -errno on failure to join the writer thread or close the file
+int vdev_uevlog_close( struct vdev_uevlog* uevlog ) {
+   
+   int rc = 0;
+   
+   if( !uevlog->running ) {
+      return 0;
+   }
+   
+   pthread_mutex_lock( &uevlog->lock );
+   
+   uevlog->stop = true;
+   pthread_cond_signal( &uevlog->cond );
+   
+   pthread_mutex_unlock( &uevlog->lock );
+   
+   rc = pthread_join( uevlog->thread, NULL );
+   if( rc != 0 ) {
+      
+      vdev_error("pthread_join rc = %d\n", rc );
+      return -rc;
+   }
+   
+   uevlog->running = false;
+   
+   if( uevlog->num_dropped > 0 ) {
+      
+      vdev_warn("Dropped %" PRIu64 " uevents from the log\n", uevlog->num_dropped );
+   }
+   
+   rc = close( uevlog->fd );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+      vdev_error("close(%d) rc = %d\n", uevlog->fd, rc );
+   }
+   
+   pthread_mutex_destroy( &uevlog->lock );
+   pthread_cond_destroy( &uevlog->cond );
+   
+   free( uevlog->buf );
+   free( uevlog->write_buf );
+   
+   uevlog->buf = NULL;
+   uevlog->write_buf = NULL;
+   uevlog->fd = -1;
+   
+   return rc;
+}
+
+
+// check that a file is a uevent log, and skip past its magic number 
+// return 0 on success
+// return -EINVAL if it isn't a uevent log
+int vdev_uevlog_read_magic( FILE* f ) {
+   
+   char magic[ VDEV_UEVLOG_MAGIC_LEN ];
+   
+   if( fread( magic, 1, VDEV_UEVLOG_MAGIC_LEN, f ) != VDEV_UEVLOG_MAGIC_LEN || memcmp( magic, VDEV_UEVLOG_MAGIC, VDEV_UEVLOG_MAGIC_LEN ) != 0 ) {
+      return -EINVAL;
+   }
+   
+   return 0;
+}
+
+
+// read the next record from a uevent log.
+// *uevent is a buffer of *uevent_cap bytes (or NULL), which will be grown as needed to hold the uevent
+// return 0 on success
+// return 1 at the end of the log
+// return -EINVAL if the log is corrupt or truncated
+// return -ENOMEM on OOM
+int vdev_uevlog_read( FILE* f, struct vdev_uevlog_record* rec, char** uevent, size_t* uevent_cap ) {
+   
+   size_t nr = 0;
+   
+   nr = fread( rec, 1, sizeof(struct vdev_uevlog_record), f );
+   if( nr == 0 && feof( f ) ) {
+      return 1;
+   }
+   
+   if( nr != sizeof(struct vdev_uevlog_record) || rec->len > VDEV_UEVLOG_MAX_UEVENT ) {
+      return -EINVAL;
+   }
+   
+   if( *uevent == NULL || *uevent_cap < rec->len + 1 ) {
+      
+      char* tmp = (char*)realloc( *uevent, rec->len + 1 );
+      if( tmp == NULL ) {
+         return -ENOMEM;
+      }
+      
+      *uevent = tmp;
+      *uevent_cap = rec->len + 1;
+   }
+   
+   if( fread( *uevent, 1, rec->len, f ) != rec->len ) {
+      return -EINVAL;
+   }
+   
+   // always terminated 
+   (*uevent)[ rec->len ] = '\0';
+   
+   return 0;
+}
+
+
+// name a record's source 
+// return "unknown" if it's not a known source 
+char const* vdev_uevlog_source_str( int source ) {
+   
+   switch( source ) {
+      
+      case VDEV_UEVLOG_SOURCE_NETLINK:
+         return VDEV_UEVLOG_SOURCE_NETLINK_STR;
+         
+      case VDEV_UEVLOG_SOURCE_COLDPLUG:
+         return VDEV_UEVLOG_SOURCE_COLDPLUG_STR;
+      
+      default:
+         return "unknown";
+   }
+}
@@ -0,0 +1,98 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// recorded uevent log, written by `vdevd --record` and read by uevlog-dump.
+//
+// the log is VDEV_UEVLOG_MAGIC, followed by one record per uevent:  a struct vdev_uevlog_record,
+// followed by record.len bytes of the uevent as vdevd received it (NUL-separated strings; netlink
+// uevents start with the kernel's "ACTION@DEVPATH" header).
+// integers are in host byte order, since logs are meant to be replayed on the host that recorded them.
+// recording more than once to the same file appends to it.
+
+#ifndef _VDEV_UEVLOG_H_
+#define _VDEV_UEVLOG_H_
+
+#include "util.h"
+
+#include <inttypes.h>
+
+#define VDEV_UEVLOG_MAGIC               "vdevuev1"
+#define VDEV_UEVLOG_MAGIC_LEN           8
+
+// where a recorded uevent came from 
+#define VDEV_UEVLOG_SOURCE_NETLINK      1               // received from the kernel 
+#define VDEV_UEVLOG_SOURCE_COLDPLUG     2               // synthesized from sysfs at startup
+
+#define VDEV_UEVLOG_SOURCE_NETLINK_STR  "netlink"
+#define VDEV_UEVLOG_SOURCE_COLDPLUG_STR "coldplug"
+
+// largest uevent a log can hold 
+#define VDEV_UEVLOG_MAX_UEVENT          (64 * 1024)
+
+// bytes of records to buffer in memory.  Records that don't fit are dropped, rather than block the caller.
+#define VDEV_UEVLOG_BUF_LEN             (1024 * 1024)
+
+// most milliseconds a record stays buffered before it is written 
+#define VDEV_UEVLOG_FLUSH_MILLIS        1000
+
+// record header 
+struct vdev_uevlog_record {
+   
+   uint64_t timestamp_nanos;            // when vdevd got it (CLOCK_MONOTONIC, like `udevadm monitor`)
+   uint32_t len;                        // length of the uevent that follows 
+   uint16_t source;                     // VDEV_UEVLOG_SOURCE_*
+   uint16_t reserved;
+};
+
+// log writer.  Callers copy records into a buffer; a background thread writes it out.
+struct vdev_uevlog {
+   
+   int fd;
+   
+   // records waiting to be written, and the buffer the writer thread is writing from 
+   char* buf;
+   size_t buf_len;
+   char* write_buf;
+   
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   
+   pthread_t thread;
+   bool running;
+   bool stop;
+   
+   // records dropped because the buffer was full (covered by lock)
+   uint64_t num_dropped;
+};
+
+C_LINKAGE_BEGIN
+
+int vdev_uevlog_open( struct vdev_uevlog* uevlog, char const* path );
+int vdev_uevlog_append( struct vdev_uevlog* uevlog, int source, struct timespec const* ts, char const* uevent, size_t len );
+int vdev_uevlog_close( struct vdev_uevlog* uevlog );
+
+int vdev_uevlog_read_magic( FILE* f );
+int vdev_uevlog_read( FILE* f, struct vdev_uevlog_record* rec, char** uevent, size_t* uevent_cap );
+char const* vdev_uevlog_source_str( int source );
+
+C_LINKAGE_END
+
+#endif
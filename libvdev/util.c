@@ -20,6 +20,7 @@
 */
  
 #include "util.h"
+#include "spawn.h"
 
 int _VDEV_DEBUG_MESSAGES = 0;
 int _VDEV_INFO_MESSAGES = 0;
@@ -376,18 +377,20 @@ char* vdev_basename( char const* path, char* dest ) {
 // stderr will NOT be captured.
 // return 0 on success
 // return 1 on output truncate 
-// return negative on error
+// return negative on error, including failure to exec cmd
 // set the subprocess exit status in *exit_status
 int vdev_subprocess( char const* cmd, char* const env[], char** output, size_t max_output, int stderr_fd, int* exit_status, bool use_shell ) {
    
    int p[2];
    int rc = 0;
    pid_t pid = 0;
-   int max_fd = 0;
    ssize_t nr = 0;
    size_t num_read = 0;
    int status = 0;
    bool alloced = false;
+   int stdio_fds[3] = { -1, -1, -1 };
+   char* shell_argv[] = { "sh", "-c", (char*)cmd, NULL };
+   char* cmd_argv[] = { (char*)cmd, NULL };
    
    if( cmd == NULL ) {
       return -EINVAL;
@@ -402,79 +405,18 @@ int vdev_subprocess( char const* cmd, char* const env[], char** output, size_t m
       return rc;
    }
    
-   max_fd = sysconf(_SC_OPEN_MAX);
-   
-   // fork the child 
-   pid = fork();
+   // start the child, with stdout sent to p[1], and optionally stderr to stderr_fd 
+   stdio_fds[1] = p[1];
+   stdio_fds[2] = stderr_fd;
    
-   if( pid == 0 ) {
-      
-      // send stdout to p[1]
-      close( p[0] );
-      rc = dup2( p[1], STDOUT_FILENO );
-      
-      if( rc < 0 ) {
-         
-         rc = errno;
-         close( p[1] );
-         exit(rc);
-      }
-
-      // optionally redirect stderr (or just close it)
-      if( stderr_fd >= 0 ) {
-         rc = dup2( stderr_fd, STDERR_FILENO );
-         if( rc < 0 ) {
-
-            rc = errno;
-            close( p[1] );
-            exit(rc);
-         }
-      }
-      
-      // close everything else but stdout and optionally stderr.
-      for( int i = 0; i < max_fd; i++ ) {
-         
-         if( i != STDOUT_FILENO && i != stderr_fd ) {
-            close( i );
-         }
-      }
-      
-      // run the command 
-      if( use_shell ) {
-          
-         if( env != NULL ) {
-            rc = execle( "/bin/sh", "sh", "-c", cmd, (char*)0, env );
-         }
-         else {
-            
-            char** noenv = { NULL };
-            rc = execle( "/bin/sh", "sh", "-c", cmd, (char*)0, noenv );
-         }
-      }
-      else {
-         
-         if( env != NULL ) {
-            rc = execle( cmd, cmd, (char*)0, env );
-         }
-         else {
-            
-            char** noenv = { NULL };
-            rc = execle( cmd, cmd, (char*)0, noenv );
-         }
-      }
-      
-      if( rc != 0 ) {
-         
-         rc = errno;
-         exit(rc);
-      }
-      else {
-         
-         // make gcc happy 
-         exit(0);
-      }
+   if( use_shell ) {
+      rc = vdev_spawn( "/bin/sh", shell_argv, env, stdio_fds, 0, &pid );
    }
-   else if( pid > 0 ) {
+   else {
+      rc = vdev_spawn( cmd, cmd_argv, env, stdio_fds, 0, &pid );
+   }
+   
+   if( rc == 0 ) {
       
       // parent 
       close(p[1]);
@@ -553,8 +495,10 @@ int vdev_subprocess( char const* cmd, char* const env[], char** output, size_t m
    }
    else {
       
-      rc = -errno;
-      vdev_error("fork() rc = %d\n", rc );
+      vdev_error("vdev_spawn('%s') rc = %d\n", cmd, rc );
+      
+      close( p[0] );
+      close( p[1] );
       return rc;
    }
 }
@@ -593,6 +537,55 @@ ssize_t vdev_write_uninterrupted( int fd, char const* buf, size_t len ) {
 }
 
 
+// writev, but mask EINTR, and keep going after short writes.
+// iov is consumed as the data gets written.
+// return number of bytes written on success 
+// return -errno on I/O error
+ssize_t vdev_writev_uninterrupted( int fd, struct iovec* iov, int iovcnt ) {
+   
+   ssize_t num_written = 0;
+   
+   if( iov == NULL ) {
+      return -EINVAL;
+   }
+   
+   while( iovcnt > 0 ) {
+      
+      ssize_t nw = writev( fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX );
+      if( nw < 0 ) {
+         
+         int errsv = -errno;
+         if( errsv == -EINTR ) {
+            continue;
+         }
+         
+         return errsv;
+      }
+      if( nw == 0 ) {
+         break;
+      }
+      
+      num_written += nw;
+      
+      // skip what got written
+      while( iovcnt > 0 && (size_t)nw >= iov->iov_len ) {
+         
+         nw -= iov->iov_len;
+         iov++;
+         iovcnt--;
+      }
+      
+      if( iovcnt > 0 && nw > 0 ) {
+         
+         iov->iov_base = (char*)iov->iov_base + nw;
+         iov->iov_len -= nw;
+      }
+   }
+   
+   return num_written;
+}
+
+
 // read, but mask EINTR
 // return number of bytes read on success 
 // return -errno on I/O error
@@ -978,8 +971,17 @@ int vdev_mkdirs( char const* dirp, int start, mode_t mode ) {
             if( rc != 0 ) {
                
                rc = -errno;
-               free(currdir);
-               return rc;
+               
+               // someone else (i.e. another device worker) may have just made it
+               if( rc == -EEXIST && stat( currdir, &statbuf ) == 0 && S_ISDIR( statbuf.st_mode ) ) {
+                  
+                  rc = 0;
+               }
+               else {
+                  
+                  free(currdir);
+                  return rc;
+               }
             }
          }
       }
@@ -1034,6 +1036,116 @@ int vdev_rmdirs( char const* dirp ) {
 }
 
 
+// make a string of directories relative to an open directory, given the relative path dirp.
+// optimistic:  makes dirp first, and only walks back to make its parents if it has to,
+// so this is one syscall if only the last directory is missing or none are.
+// return 0 if the directory exists at the end of the call.
+// return -EINVAL if dirp is NULL 
+// return -ENAMETOOLONG if dirp is longer than PATH_MAX
+// return negative if the directory could not be created.
+int vdev_mkdirs_at( int dirfd, char const* dirp, mode_t mode ) {
+   
+   int rc = 0;
+   char parent[ PATH_MAX+1 ];
+   char* slash = NULL;
+   
+   if( dirp == NULL ) {
+      return -EINVAL;
+   }
+   
+   if( strlen(dirp) > PATH_MAX ) {
+      return -ENAMETOOLONG;
+   }
+   
+   rc = mkdirat( dirfd, dirp, mode );
+   if( rc == 0 || errno == EEXIST ) {
+      
+      // NOTE: if something other than a directory is here, creating things in it will fail with -ENOTDIR
+      return 0;
+   }
+   
+   if( errno != ENOENT ) {
+      return -errno;
+   }
+   
+   // make the parent, and try again 
+   strcpy( parent, dirp );
+   
+   slash = strrchr( parent, '/' );
+   while( slash != NULL && slash > parent && *(slash - 1) == '/' ) {
+      slash--;
+   }
+   
+   if( slash == NULL || slash == parent ) {
+      
+      // no parent to make; dirfd itself is gone
+      return -ENOENT;
+   }
+   
+   *slash = '\0';
+   
+   rc = vdev_mkdirs_at( dirfd, parent, mode );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   rc = mkdirat( dirfd, dirp, mode );
+   if( rc != 0 && errno != EEXIST ) {
+      return -errno;
+   }
+   
+   return 0;
+}
+
+
+// try to remove a path of directories relative to an open directory, stopping at the first one that isn't empty.
+// dirfd itself is never removed.
+// return 0 on success
+// return -EINVAL if dirp is NULL 
+// return -ENAMETOOLONG if dirp is longer than PATH_MAX
+// return negative on error (e.g. -ENOTEMPTY)
+int vdev_rmdirs_at( int dirfd, char const* dirp ) {
+   
+   int rc = 0;
+   char dirname[ PATH_MAX+1 ];
+   char* slash = NULL;
+   
+   if( dirp == NULL ) {
+      return -EINVAL;
+   }
+   
+   if( strlen(dirp) > PATH_MAX ) {
+      return -ENAMETOOLONG;
+   }
+   
+   strcpy( dirname, dirp );
+   
+   while( strlen(dirname) > 0 ) {
+      
+      rc = unlinkat( dirfd, dirname, AT_REMOVEDIR );
+      if( rc != 0 ) {
+         
+         rc = -errno;
+         break;
+      }
+      
+      // next parent up 
+      slash = strrchr( dirname, '/' );
+      if( slash == NULL ) {
+         break;
+      }
+      
+      while( slash > dirname && *(slash - 1) == '/' ) {
+         slash--;
+      }
+      
+      *slash = '\0';
+   }
+   
+   return rc;
+}
+
+
 // parse an unsigned 64-bit number 
 // uint64_str must contain *only* the text of the number 
 // return the number, and set *success to true if we succeeded
@@ -52,6 +52,7 @@
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <semaphore.h>
 #include <signal.h>
 #include <regex.h>
@@ -195,6 +196,7 @@ uint64_t vdev_parse_uint64( char const* uint64_str, bool* success );
 // I/O functions 
 ssize_t vdev_read_uninterrupted( int fd, char* buf, size_t len );
 ssize_t vdev_write_uninterrupted( int fd, char const* buf, size_t len );
+ssize_t vdev_writev_uninterrupted( int fd, struct iovec* iov, int iovcnt );
 int vdev_read_file( char const* path, char* buf, size_t len );
 int vdev_write_file( char const* path, char const* buf, size_t len, int flags, mode_t mode );
 
@@ -203,6 +205,8 @@ int vdev_load_all( char const* dir_path, vdev_dirent_loader_t loader, void* cls
 int vdev_load_all_at( int dirfd, vdev_dirent_loader_at_t loader_at, void* cls );
 int vdev_mkdirs( char const* dirp, int start, mode_t mode );
 int vdev_rmdirs( char const* dirp );
+int vdev_mkdirs_at( int dirfd, char const* dirp, mode_t mode );
+int vdev_rmdirs_at( int dirfd, char const* dirp );
 
 // misc 
 char* vdev_fullpath( char const* root, char const* path, char* dest );
@@ -0,0 +1,788 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "actcache.h"
+
+// FNV-1a parameters 
+#define VDEV_ACTCACHE_FNV_OFFSET        0xcbf29ce484222325ULL
+#define VDEV_ACTCACHE_FNV_PRIME         0x100000001b3ULL
+
+// an interned string, while compiling 
+struct vdev_actcache_str {
+   
+   char* str;
+   uint32_t offset;
+   
+   struct vdev_actcache_str* left;
+   struct vdev_actcache_str* right;
+   char color;
+};
+
+typedef struct vdev_actcache_str vdev_actcache_str;
+
+#define VDEV_ACTCACHE_STR_CMP( s1, s2 ) (strcmp( (s1)->str, (s2)->str ))
+
+SGLIB_DEFINE_RBTREE_PROTOTYPES( vdev_actcache_str, left, right, color, VDEV_ACTCACHE_STR_CMP );
+SGLIB_DEFINE_RBTREE_FUNCTIONS( vdev_actcache_str, left, right, color, VDEV_ACTCACHE_STR_CMP );
+
+// cache under construction 
+struct vdev_actcache_builder {
+   
+   struct vdev_actcache_action* acts;
+   uint32_t num_acts;
+   
+   struct vdev_actcache_param* params;
+   uint32_t num_params;
+   uint32_t max_params;
+   
+   // string table, and the strings in it 
+   char* strings;
+   uint32_t strings_len;
+   uint32_t max_strings_len;
+   
+   vdev_actcache_str* interned;
+};
+
+
+// hash a buffer 
+static uint64_t vdev_actcache_checksum( char const* buf, size_t len ) {
+   
+   uint64_t hash = VDEV_ACTCACHE_FNV_OFFSET;
+   
+   for( size_t i = 0; i < len; i++ ) {
+      
+      hash ^= (unsigned char)buf[i];
+      hash *= VDEV_ACTCACHE_FNV_PRIME;
+   }
+   
+   return hash;
+}
+
+
+// free up a builder 
+// always succeeds
+static int vdev_actcache_builder_free( struct vdev_actcache_builder* builder ) {
+   
+   struct sglib_vdev_actcache_str_iterator itr;
+   struct vdev_actcache_str* istr = NULL;
+   
+   for( istr = sglib_vdev_actcache_str_it_init( &itr, builder->interned ); istr != NULL; istr = sglib_vdev_actcache_str_it_next( &itr ) ) {
+      
+      free( istr->str );
+      free( istr );
+   }
+   
+   if( builder->acts != NULL ) {
+      free( builder->acts );
+   }
+   
+   if( builder->params != NULL ) {
+      free( builder->params );
+   }
+   
+   if( builder->strings != NULL ) {
+      free( builder->strings );
+   }
+   
+   memset( builder, 0, sizeof(struct vdev_actcache_builder) );
+   return 0;
+}
+
+
+// intern a string into the string table 
+// return 0 on success, and set *ret_offset (VDEV_ACTCACHE_NONE if str is NULL)
+// return -ENOMEM on OOM
+// return -EOVERFLOW if the string table would exceed 4GB
+static int vdev_actcache_intern( struct vdev_actcache_builder* builder, char const* str, uint32_t* ret_offset ) {
+   
+   struct vdev_actcache_str lookup;
+   struct vdev_actcache_str* istr = NULL;
+   size_t len = 0;
+   
+   if( str == NULL ) {
+      
+      *ret_offset = VDEV_ACTCACHE_NONE;
+      return 0;
+   }
+   
+   memset( &lookup, 0, sizeof(lookup) );
+   lookup.str = (char*)str;
+   
+   istr = sglib_vdev_actcache_str_find_member( builder->interned, &lookup );
+   if( istr != NULL ) {
+      
+      *ret_offset = istr->offset;
+      return 0;
+   }
+   
+   len = strlen( str ) + 1;
+   if( (uint64_t)builder->strings_len + len >= VDEV_ACTCACHE_NONE ) {
+      return -EOVERFLOW;
+   }
+   
+   if( builder->strings_len + len > builder->max_strings_len ) {
+      
+      uint32_t max_strings_len = builder->max_strings_len > 0 ? builder->max_strings_len : 4096;
+      char* strings = NULL;
+      
+      while( builder->strings_len + len > max_strings_len ) {
+         max_strings_len *= 2;
+      }
+      
+      strings = (char*)realloc( builder->strings, max_strings_len );
+      if( strings == NULL ) {
+         return -ENOMEM;
+      }
+      
+      builder->strings = strings;
+      builder->max_strings_len = max_strings_len;
+   }
+   
+   istr = VDEV_CALLOC( struct vdev_actcache_str, 1 );
+   if( istr == NULL ) {
+      return -ENOMEM;
+   }
+   
+   // the table moves as it grows, so keep our own copy to compare against 
+   istr->str = vdev_strdup_or_null( str );
+   if( istr->str == NULL ) {
+      
+      free( istr );
+      return -ENOMEM;
+   }
+   
+   memcpy( builder->strings + builder->strings_len, str, len );
+   
+   istr->offset = builder->strings_len;
+   builder->strings_len += len;
+   
+   sglib_vdev_actcache_str_add( &builder->interned, istr );
+   
+   *ret_offset = istr->offset;
+   return 0;
+}
+
+
+// add a set of params to the cache 
+// return 0 on success, and set *ret_start and *ret_num 
+// return -ENOMEM on OOM
+static int vdev_actcache_add_params( struct vdev_actcache_builder* builder, vdev_params* params, uint32_t* ret_start, uint32_t* ret_num ) {
+   
+   int rc = 0;
+   struct sglib_vdev_params_iterator itr;
+   struct vdev_param_t* dp = NULL;
+   
+   *ret_start = builder->num_params;
+   *ret_num = 0;
+   
+   for( dp = sglib_vdev_params_it_init_inorder( &itr, params ); dp != NULL; dp = sglib_vdev_params_it_next( &itr ) ) {
+      
+      struct vdev_actcache_param* param = NULL;
+      
+      if( builder->num_params == builder->max_params ) {
+         
+         uint32_t max_params = builder->max_params > 0 ? 2 * builder->max_params : 64;
+         struct vdev_actcache_param* new_params = (struct vdev_actcache_param*)realloc( builder->params, sizeof(struct vdev_actcache_param) * max_params );
+         
+         if( new_params == NULL ) {
+            return -ENOMEM;
+         }
+         
+         builder->params = new_params;
+         builder->max_params = max_params;
+      }
+      
+      param = &builder->params[ builder->num_params ];
+      memset( param, 0, sizeof(struct vdev_actcache_param) );
+      
+      rc = vdev_actcache_intern( builder, dp->key, &param->key );
+      if( rc == 0 ) {
+         rc = vdev_actcache_intern( builder, dp->value, &param->value );
+      }
+      
+      if( rc != 0 ) {
+         return rc;
+      }
+      
+      builder->num_params++;
+      (*ret_num)++;
+   }
+   
+   return 0;
+}
+
+
+// add an action to the cache 
+// return 0 on success 
+// return -ENOMEM on OOM
+static int vdev_actcache_add_action( struct vdev_actcache_builder* builder, struct vdev_action* act ) {
+   
+   int rc = 0;
+   struct vdev_actcache_action* rec = &builder->acts[ builder->num_acts ];
+   
+   memset( rec, 0, sizeof(struct vdev_actcache_action) );
+   
+   char const* strs[] = {
+      act->name,
+      act->path,
+      act->type,
+      act->rename_command,
+      act->command,
+      act->helper,
+      act->path != NULL ? act->path_pattern.literal : NULL
+   };
+   
+   uint32_t* offsets[] = {
+      &rec->name,
+      &rec->path,
+      &rec->type,
+      &rec->rename_command,
+      &rec->command,
+      &rec->helper,
+      &rec->path_literal
+   };
+   
+   for( unsigned int i = 0; i < sizeof(strs) / sizeof(strs[0]); i++ ) {
+      
+      rc = vdev_actcache_intern( builder, strs[i], offsets[i] );
+      if( rc != 0 ) {
+         return rc;
+      }
+   }
+   
+   rec->path_match_type = act->path != NULL ? (uint32_t)act->path_pattern.type : 0;
+   
+   rec->trigger = act->trigger;
+   rec->if_exists = act->if_exists;
+   rec->priority = act->priority;
+   rec->daemonlet_protocol = act->daemonlet_protocol;
+   rec->num_daemonlets = act->num_daemonlets;
+   
+   rec->has_type = act->has_type;
+   rec->use_shell = act->use_shell;
+   rec->async = act->async;
+   rec->is_daemonlet = act->is_daemonlet;
+   
+   rec->debounce_millis = act->debounce_millis;
+   
+   rc = vdev_actcache_add_params( builder, act->dev_params, &rec->dev_params, &rec->num_dev_params );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   rc = vdev_actcache_add_params( builder, act->helper_vars, &rec->helper_vars, &rec->num_helper_vars );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   rec->file_dev = act->file_dev;
+   rec->file_ino = act->file_ino;
+   rec->file_size = act->file_size;
+   rec->file_mtime_sec = act->file_mtime.tv_sec;
+   rec->file_mtime_nsec = act->file_mtime.tv_nsec;
+   rec->file_ctime_sec = act->file_ctime.tv_sec;
+   rec->file_ctime_nsec = act->file_ctime.tv_nsec;
+   
+   builder->num_acts++;
+   return 0;
+}
+
+
+// write out a cache of a set of actions, atomically replacing the old one.
+// dir_sb is the status of the actions directory from before the actions were loaded.
+// return 0 on success 
+// return -ENOMEM on OOM 
+// return -errno on failure to write
+static int vdev_actcache_write( struct vdev_config* config, struct stat const* dir_sb, struct vdev_action** acts, size_t num_acts ) {
+   
+   int rc = 0;
+   struct vdev_actcache_builder builder;
+   struct vdev_actcache_header header;
+   char* buf = NULL;
+   char* tmp_path = NULL;
+   size_t acts_len = 0;
+   size_t params_len = 0;
+   size_t len = 0;
+   
+   memset( &builder, 0, sizeof(builder) );
+   memset( &header, 0, sizeof(header) );
+   
+   if( num_acts >= VDEV_ACTCACHE_NONE ) {
+      return -EOVERFLOW;
+   }
+   
+   builder.acts = VDEV_CALLOC( struct vdev_actcache_action, num_acts + 1 );
+   if( builder.acts == NULL ) {
+      return -ENOMEM;
+   }
+   
+   rc = vdev_actcache_intern( &builder, config->acts_dir, &header.acts_dir );
+   if( rc == 0 ) {
+      rc = vdev_actcache_intern( &builder, config->helpers_dir, &header.helpers_dir );
+   }
+   
+   for( size_t i = 0; i < num_acts && rc == 0; i++ ) {
+      
+      rc = vdev_actcache_add_action( &builder, acts[i] );
+   }
+   
+   if( rc != 0 ) {
+      
+      vdev_actcache_builder_free( &builder );
+      return rc;
+   }
+   
+   // lay it out 
+   acts_len = sizeof(struct vdev_actcache_action) * builder.num_acts;
+   params_len = sizeof(struct vdev_actcache_param) * builder.num_params;
+   len = sizeof(struct vdev_actcache_header) + acts_len + params_len + builder.strings_len;
+   
+   buf = VDEV_CALLOC( char, len );
+   if( buf == NULL ) {
+      
+      vdev_actcache_builder_free( &builder );
+      return -ENOMEM;
+   }
+   
+   memcpy( buf + sizeof(struct vdev_actcache_header), builder.acts, acts_len );
+   memcpy( buf + sizeof(struct vdev_actcache_header) + acts_len, builder.params, params_len );
+   memcpy( buf + sizeof(struct vdev_actcache_header) + acts_len + params_len, builder.strings, builder.strings_len );
+   
+   memcpy( header.magic, VDEV_ACTCACHE_MAGIC, sizeof(header.magic) );
+   header.version = VDEV_ACTCACHE_VERSION;
+   header.header_size = sizeof(struct vdev_actcache_header);
+   header.action_size = sizeof(struct vdev_actcache_action);
+   header.param_size = sizeof(struct vdev_actcache_param);
+   header.num_acts = builder.num_acts;
+   header.num_params = builder.num_params;
+   header.strings_len = builder.strings_len;
+   header.file_size = len;
+   header.dir_mtime_sec = dir_sb->st_mtim.tv_sec;
+   header.dir_mtime_nsec = dir_sb->st_mtim.tv_nsec;
+   header.checksum = vdev_actcache_checksum( buf + sizeof(struct vdev_actcache_header), len - sizeof(struct vdev_actcache_header) );
+   
+   memcpy( buf, &header, sizeof(struct vdev_actcache_header) );
+   
+   vdev_actcache_builder_free( &builder );
+   
+   // write to a temporary file, and move it into place 
+   tmp_path = VDEV_CALLOC( char, strlen( config->acts_cache_path ) + 5 );
+   if( tmp_path == NULL ) {
+      
+      free( buf );
+      return -ENOMEM;
+   }
+   
+   sprintf( tmp_path, "%s.tmp", config->acts_cache_path );
+   
+   rc = vdev_write_file( tmp_path, buf, len, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+   free( buf );
+   
+   if( rc < 0 ) {
+      
+      vdev_error("vdev_write_file('%s') rc = %d\n", tmp_path, rc );
+      
+      unlink( tmp_path );
+      free( tmp_path );
+      return rc;
+   }
+   
+   rc = rename( tmp_path, config->acts_cache_path );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+      vdev_error("rename('%s', '%s') rc = %d\n", tmp_path, config->acts_cache_path, rc );
+      
+      unlink( tmp_path );
+   }
+   
+   free( tmp_path );
+   return rc;
+}
+
+
+// parse all actions in the actions directory, and write them to the action cache.
+// return 0 on success, and set *ret_acts and *ret_num_acts to the actions
+// return -EINVAL if there is no action cache configured, or an action file failed to load due to a sanity test failure 
+// return -ENOMEM on OOM 
+// return -errno on failure to read the actions or write the cache
+int vdev_actcache_compile( struct vdev_config* config, struct vdev_action*** ret_acts, size_t* ret_num_acts ) {
+   
+   int rc = 0;
+   struct stat dir_sb;
+   
+   if( config->acts_cache_path == NULL ) {
+      
+      vdev_error("No '%s' given in the config file\n", VDEV_CONFIG_ACTIONS_CACHE );
+      return -EINVAL;
+   }
+   
+   // before loading, so an action file added while we load makes the cache stale 
+   rc = stat( config->acts_dir, &dir_sb );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+      vdev_error("stat('%s') rc = %d\n", config->acts_dir, rc );
+      return rc;
+   }
+   
+   rc = vdev_action_load_all( config, ret_acts, ret_num_acts );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_action_load_all('%s') rc = %d\n", config->acts_dir, rc );
+      return rc;
+   }
+   
+   rc = vdev_actcache_write( config, &dir_sb, *ret_acts, *ret_num_acts );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_actcache_write('%s') rc = %d\n", config->acts_cache_path, rc );
+      
+      vdev_action_free_all( *ret_acts, *ret_num_acts );
+      *ret_acts = NULL;
+      *ret_num_acts = 0;
+      return rc;
+   }
+   
+   vdev_info("Compiled %zu actions into '%s'\n", *ret_num_acts, config->acts_cache_path );
+   return 0;
+}
+
+
+// look up a string in a mapped cache's string table 
+// return the string (NULL for VDEV_ACTCACHE_NONE)
+static char const* vdev_actcache_string( char const* strings, uint32_t offset ) {
+   
+   if( offset == VDEV_ACTCACHE_NONE ) {
+      return NULL;
+   }
+   
+   return strings + offset;
+}
+
+
+// check that a mapped cache is well-formed, and was compiled from the actions directory as it is now.
+// return 0 if so 
+// return -EINVAL if it is corrupt, or from a different build of vdevd
+// return -ESTALE if it does not match the config or the actions directory anymore
+static int vdev_actcache_validate( struct vdev_config* config, char const* buf, size_t len ) {
+   
+   int rc = 0;
+   struct stat sb;
+   struct vdev_actcache_header const* header = (struct vdev_actcache_header const*)buf;
+   struct vdev_actcache_action const* recs = NULL;
+   struct vdev_actcache_param const* params = NULL;
+   char const* strings = NULL;
+   uint64_t expected_len = 0;
+   
+   if( len < sizeof(struct vdev_actcache_header) ) {
+      return -EINVAL;
+   }
+   
+   if( memcmp( header->magic, VDEV_ACTCACHE_MAGIC, sizeof(header->magic) ) != 0 || header->version != VDEV_ACTCACHE_VERSION ) {
+      return -EINVAL;
+   }
+   
+   if( header->header_size != sizeof(struct vdev_actcache_header) || header->action_size != sizeof(struct vdev_actcache_action) || header->param_size != sizeof(struct vdev_actcache_param) ) {
+      return -EINVAL;
+   }
+   
+   expected_len = (uint64_t)sizeof(struct vdev_actcache_header) + (uint64_t)header->num_acts * sizeof(struct vdev_actcache_action) + (uint64_t)header->num_params * sizeof(struct vdev_actcache_param) + header->strings_len;
+   if( header->file_size != len || expected_len != len ) {
+      return -EINVAL;
+   }
+   
+   if( header->checksum != vdev_actcache_checksum( buf + sizeof(struct vdev_actcache_header), len - sizeof(struct vdev_actcache_header) ) ) {
+      return -EINVAL;
+   }
+   
+   recs = (struct vdev_actcache_action const*)(buf + sizeof(struct vdev_actcache_header));
+   params = (struct vdev_actcache_param const*)(recs + header->num_acts);
+   strings = (char const*)(params + header->num_params);
+   
+   // every string offset must land in the table, and the table must be terminated 
+   if( header->strings_len == 0 || strings[ header->strings_len - 1 ] != '\0' ) {
+      return -EINVAL;
+   }
+   
+   for( uint32_t i = 0; i < header->num_params; i++ ) {
+      
+      if( params[i].key >= header->strings_len || params[i].value >= header->strings_len ) {
+         return -EINVAL;
+      }
+   }
+   
+   for( uint32_t i = 0; i < header->num_acts; i++ ) {
+      
+      uint32_t const offsets[] = { recs[i].path, recs[i].type, recs[i].rename_command, recs[i].command, recs[i].helper, recs[i].path_literal };
+      
+      if( recs[i].name >= header->strings_len ) {
+         return -EINVAL;
+      }
+      
+      for( unsigned int j = 0; j < sizeof(offsets) / sizeof(offsets[0]); j++ ) {
+         
+         if( offsets[j] != VDEV_ACTCACHE_NONE && offsets[j] >= header->strings_len ) {
+            return -EINVAL;
+         }
+      }
+      
+      if( (uint64_t)recs[i].dev_params + recs[i].num_dev_params > header->num_params || (uint64_t)recs[i].helper_vars + recs[i].num_helper_vars > header->num_params ) {
+         return -EINVAL;
+      }
+      
+      if( recs[i].num_daemonlets <= 0 || recs[i].num_daemonlets > VDEV_ACTION_DAEMONLET_MAX_INSTANCES ) {
+         return -EINVAL;
+      }
+   }
+   
+   // compiled against this config?
+   if( header->acts_dir >= header->strings_len || header->helpers_dir >= header->strings_len ) {
+      return -EINVAL;
+   }
+   
+   if( strcmp( strings + header->acts_dir, config->acts_dir ) != 0 || strcmp( strings + header->helpers_dir, config->helpers_dir ) != 0 ) {
+      return -ESTALE;
+   }
+   
+   // no action files added, removed, or renamed since?
+   rc = stat( config->acts_dir, &sb );
+   if( rc != 0 ) {
+      return -errno;
+   }
+   
+   if( sb.st_mtim.tv_sec != header->dir_mtime_sec || sb.st_mtim.tv_nsec != header->dir_mtime_nsec ) {
+      return -ESTALE;
+   }
+   
+   // no action files changed since?
+   for( uint32_t i = 0; i < header->num_acts; i++ ) {
+      
+      rc = stat( strings + recs[i].name, &sb );
+      if( rc != 0 ) {
+         return -ESTALE;
+      }
+      
+      if( (uint64_t)sb.st_dev != recs[i].file_dev || (uint64_t)sb.st_ino != recs[i].file_ino || (int64_t)sb.st_size != recs[i].file_size ||
+          sb.st_mtim.tv_sec != recs[i].file_mtime_sec || sb.st_mtim.tv_nsec != recs[i].file_mtime_nsec ||
+          sb.st_ctim.tv_sec != recs[i].file_ctime_sec || sb.st_ctim.tv_nsec != recs[i].file_ctime_nsec ) {
+         
+         return -ESTALE;
+      }
+   }
+   
+   return 0;
+}
+
+
+// make an action from a validated cache record 
+// return 0 on success, and set *ret_act 
+// return -ENOMEM on OOM 
+// return -EINVAL if the path pattern is invalid
+static int vdev_actcache_action_new( struct vdev_actcache_action const* rec, struct vdev_actcache_param const* params, char const* strings, struct vdev_action** ret_act ) {
+   
+   int rc = 0;
+   struct vdev_action* act = NULL;
+   struct stat sb;
+   char const* path = vdev_actcache_string( strings, rec->path );
+   char const* literal = vdev_actcache_string( strings, rec->path_literal );
+   
+   act = VDEV_CALLOC( struct vdev_action, 1 );
+   if( act == NULL ) {
+      return -ENOMEM;
+   }
+   
+   // the path's pattern is set up below 
+   rc = vdev_action_init( act, (vdev_device_request_t)rec->trigger, NULL, (char*)vdev_actcache_string( strings, rec->command ), (char*)vdev_actcache_string( strings, rec->helper ), rec->async );
+   if( rc != 0 ) {
+      
+      free( act );
+      return rc;
+   }
+   
+   act->name = vdev_strdup_or_null( vdev_actcache_string( strings, rec->name ) );
+   act->path = vdev_strdup_or_null( path );
+   act->type = vdev_strdup_or_null( vdev_actcache_string( strings, rec->type ) );
+   act->rename_command = vdev_strdup_or_null( vdev_actcache_string( strings, rec->rename_command ) );
+   
+   if( act->name == NULL || (path != NULL && act->path == NULL) || (rec->type != VDEV_ACTCACHE_NONE && act->type == NULL) || (rec->rename_command != VDEV_ACTCACHE_NONE && act->rename_command == NULL) ||
+       (rec->command != VDEV_ACTCACHE_NONE && act->command == NULL) || (rec->helper != VDEV_ACTCACHE_NONE && act->helper == NULL) ) {
+      
+      rc = -ENOMEM;
+   }
+   
+   if( rc == 0 && path != NULL ) {
+      
+      // literal patterns were validated when they were compiled
+      rc = -EINVAL;
+      if( literal != NULL ) {
+         rc = vdev_match_pattern_init_literal( &act->path_pattern, (vdev_match_t)rec->path_match_type, literal, strlen( literal ) );
+      }
+      
+      if( rc == -EINVAL ) {
+         rc = vdev_match_pattern_init( &act->path_pattern, path );
+      }
+   }
+   
+   act->has_type = rec->has_type;
+   act->use_shell = rec->use_shell;
+   act->if_exists = rec->if_exists;
+   act->priority = rec->priority;
+   act->daemonlet_protocol = (vdev_daemonlet_protocol_t)rec->daemonlet_protocol;
+   act->num_daemonlets = rec->num_daemonlets;
+   act->is_daemonlet = rec->is_daemonlet;
+   act->debounce_millis = rec->debounce_millis;
+   
+   for( uint32_t i = 0; i < rec->num_dev_params && rc == 0; i++ ) {
+      
+      struct vdev_actcache_param const* param = &params[ rec->dev_params + i ];
+      rc = vdev_action_add_param( act, strings + param->key, strings + param->value );
+   }
+   
+   for( uint32_t i = 0; i < rec->num_helper_vars && rc == 0; i++ ) {
+      
+      struct vdev_actcache_param const* param = &params[ rec->helper_vars + i ];
+      rc = vdev_action_add_var( act, strings + param->key, strings + param->value );
+   }
+   
+   if( rc == 0 ) {
+      
+      memset( &sb, 0, sizeof(sb) );
+      
+      sb.st_dev = (dev_t)rec->file_dev;
+      sb.st_ino = (ino_t)rec->file_ino;
+      sb.st_size = (off_t)rec->file_size;
+      sb.st_mtim.tv_sec = rec->file_mtime_sec;
+      sb.st_mtim.tv_nsec = rec->file_mtime_nsec;
+      sb.st_ctim.tv_sec = rec->file_ctime_sec;
+      sb.st_ctim.tv_nsec = rec->file_ctime_nsec;
+      
+      rc = vdev_action_setup( act, &sb );
+   }
+   
+   if( rc != 0 ) {
+      
+      vdev_action_free( act );
+      free( act );
+      return rc;
+   }
+   
+   *ret_act = act;
+   return 0;
+}
+
+
+// load actions from the action cache, if it is up to date.
+// return 0 on success, and set *ret_acts and *ret_num_acts
+// return -ENOENT if there is no cache 
+// return -ESTALE if the cache is out of date; parse the actions instead
+// return -EINVAL if the cache is corrupt, or was written by a different build of vdevd
+// return -ENOMEM on OOM 
+// return -errno on failure to read the cache
+int vdev_actcache_load( struct vdev_config* config, struct vdev_action*** ret_acts, size_t* ret_num_acts ) {
+   
+   int rc = 0;
+   int fd = -1;
+   struct stat sb;
+   char* buf = NULL;
+   size_t len = 0;
+   struct vdev_actcache_header const* header = NULL;
+   struct vdev_actcache_action const* recs = NULL;
+   struct vdev_actcache_param const* params = NULL;
+   char const* strings = NULL;
+   struct vdev_action** acts = NULL;
+   uint32_t num_acts = 0;
+   
+   if( config->acts_cache_path == NULL ) {
+      return -ENOENT;
+   }
+   
+   fd = open( config->acts_cache_path, O_RDONLY | O_CLOEXEC );
+   if( fd < 0 ) {
+      return -errno;
+   }
+   
+   rc = fstat( fd, &sb );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+      close( fd );
+      return rc;
+   }
+   
+   len = sb.st_size;
+   if( len < sizeof(struct vdev_actcache_header) ) {
+      
+      close( fd );
+      return -EINVAL;
+   }
+   
+   buf = (char*)mmap( NULL, len, PROT_READ, MAP_PRIVATE, fd, 0 );
+   close( fd );
+   
+   if( buf == MAP_FAILED ) {
+      return -errno;
+   }
+   
+   rc = vdev_actcache_validate( config, buf, len );
+   if( rc != 0 ) {
+      
+      munmap( buf, len );
+      return rc;
+   }
+   
+   header = (struct vdev_actcache_header const*)buf;
+   recs = (struct vdev_actcache_action const*)(buf + sizeof(struct vdev_actcache_header));
+   params = (struct vdev_actcache_param const*)(recs + header->num_acts);
+   strings = (char const*)(params + header->num_params);
+   
+   if( header->num_acts > 0 ) {
+      
+      acts = VDEV_CALLOC( struct vdev_action*, header->num_acts );
+      if( acts == NULL ) {
+         
+         munmap( buf, len );
+         return -ENOMEM;
+      }
+   }
+   
+   for( num_acts = 0; num_acts < header->num_acts; num_acts++ ) {
+      
+      rc = vdev_actcache_action_new( &recs[num_acts], params, strings, &acts[num_acts] );
+      if( rc != 0 ) {
+         
+         vdev_error("vdev_actcache_action_new('%s') rc = %d\n", strings + recs[num_acts].name, rc );
+         break;
+      }
+   }
+   
+   munmap( buf, len );
+   
+   if( rc != 0 ) {
+      
+      vdev_action_free_all( acts, num_acts );
+      return rc;
+   }
+   
+   *ret_acts = acts;
+   *ret_num_acts = num_acts;
+   return 0;
+}
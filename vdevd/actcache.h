@@ -0,0 +1,131 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _VDEV_ACTCACHE_H_
+#define _VDEV_ACTCACHE_H_
+
+#include "libvdev/util.h"
+#include "libvdev/config.h"
+
+#include "action.h"
+
+// compiled action cache: the parsed actions of an actions directory, in one file that vdevd
+// mmap(2)s at startup instead of running the ini parser over every action file.
+//
+// layout: header, action records, param records, then the string table.
+// strings are interned, and referred to by their offset in the string table.
+// the cache is only valid for the build of vdevd that wrote it, on the machine that wrote it.
+
+#define VDEV_ACTCACHE_MAGIC     "vdevACT"
+#define VDEV_ACTCACHE_VERSION   1
+
+// string offset of a NULL string 
+#define VDEV_ACTCACHE_NONE      UINT32_MAX
+
+struct vdev_actcache_header {
+   
+   char magic[8];
+   uint32_t version;
+   
+   // record sizes, so a cache from a build with a different layout is rejected
+   uint32_t header_size;
+   uint32_t action_size;
+   uint32_t param_size;
+   
+   uint32_t num_acts;
+   uint32_t num_params;
+   uint32_t strings_len;
+   uint32_t padding;
+   
+   uint64_t file_size;
+   
+   // FNV-1a hash of everything after the header
+   uint64_t checksum;
+   
+   // what the actions were compiled against (string offsets)
+   uint32_t acts_dir;
+   uint32_t helpers_dir;
+   
+   // modification time of the actions directory, which changes when action files are added, removed, or renamed
+   int64_t dir_mtime_sec;
+   int64_t dir_mtime_nsec;
+};
+
+// an OS_ or VAR_ field of an action 
+struct vdev_actcache_param {
+   
+   uint32_t key;
+   uint32_t value;
+};
+
+// a parsed action 
+struct vdev_actcache_action {
+   
+   // strings
+   uint32_t name;
+   uint32_t path;
+   uint32_t type;
+   uint32_t rename_command;
+   uint32_t command;
+   uint32_t helper;
+   
+   // how the path gets matched (vdev_match_t), and its literal for exact, prefix, and suffix patterns,
+   // so these don't need regcomp(3) at startup
+   uint32_t path_match_type;
+   uint32_t path_literal;
+   
+   int32_t trigger;
+   int32_t if_exists;
+   int32_t priority;
+   int32_t daemonlet_protocol;
+   int32_t num_daemonlets;
+   
+   uint8_t has_type;
+   uint8_t use_shell;
+   uint8_t async;
+   uint8_t is_daemonlet;
+   
+   // ranges of param records 
+   uint32_t dev_params;
+   uint32_t num_dev_params;
+   uint32_t helper_vars;
+   uint32_t num_helper_vars;
+   
+   uint64_t debounce_millis;
+   
+   // which version of which file the action was compiled from
+   uint64_t file_dev;
+   uint64_t file_ino;
+   int64_t file_size;
+   int64_t file_mtime_sec;
+   int64_t file_mtime_nsec;
+   int64_t file_ctime_sec;
+   int64_t file_ctime_nsec;
+};
+
+C_LINKAGE_BEGIN
+
+int vdev_actcache_compile( struct vdev_config* config, struct vdev_action*** ret_acts, size_t* ret_num_acts );
+int vdev_actcache_load( struct vdev_config* config, struct vdev_action*** ret_acts, size_t* ret_num_acts );
+
+C_LINKAGE_END
+
+#endif
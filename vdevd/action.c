@@ -28,18 +28,29 @@
 
 #include "libvdev/ini.h"
 
+typedef struct vdev_action* vdev_action_ref;
+
 // to be passed into the action loader loop
 struct vdev_action_loader_cls {
 
-   struct sglib_vdev_action_vector* acts;
+   struct sglib_vdev_action_ref_vector* acts;
    struct vdev_config* config;
+   
+   // actions from the previous load, to be reused if their files have not changed (NULL if none)
+   struct vdev_action** old_acts;
+   size_t num_old_acts;
+   
+   // how many actions were reused 
+   size_t num_reused;
 };
 
 // prototypes
-SGLIB_DEFINE_VECTOR_PROTOTYPES( vdev_action );
-SGLIB_DEFINE_VECTOR_FUNCTIONS( vdev_action );
+SGLIB_DEFINE_VECTOR_PROTOTYPES( vdev_action_ref );
+SGLIB_DEFINE_VECTOR_FUNCTIONS( vdev_action_ref );
+SGLIB_DEFINE_RBTREE_FUNCTIONS( vdev_action_bucket, left, right, color, VDEV_ACTION_BUCKET_CMP );
 
-static int vdev_action_daemonlet_stop( struct vdev_action* act );
+static int vdev_action_daemonlet_stop( struct vdev_action* act, struct vdev_daemonlet* dlet );
+static int vdev_action_daemonlet_stop_pool( struct vdev_action* act );
 
 // initialize an action 
 // return 0 on success 
@@ -56,17 +67,19 @@ int vdev_action_init( struct vdev_action* act, vdev_device_request_t trigger, ch
    act->async = async;
    
    act->is_daemonlet = false;
-   act->daemonlet_stdin = -1;
-   act->daemonlet_stdout = -1;
-   act->daemonlet_pid = -1;
+   act->daemonlet_protocol = VDEV_DAEMONLET_PROTOCOL_TEXT;
+   act->num_daemonlets = 1;
+   act->daemonlets = NULL;
+   
+   act->priority = VDEV_ACTION_PRIORITY_UNSET;
    
    if( act->path != NULL ) {
       
-      rc = vdev_match_regex_init( &act->path_regex, path );
+      rc = vdev_match_pattern_init( &act->path_pattern, path );
       
       if( rc != 0 ) {
          
-         vdev_error("vdev_match_regex_init('%s') rc = %d\n", path, rc );
+         vdev_error("vdev_match_pattern_init('%s') rc = %d\n", path, rc );
          vdev_action_free( act );
          return rc;
       }
@@ -138,8 +151,7 @@ int vdev_action_free( struct vdev_action* act ) {
       free( act->path );
       act->path = NULL;
       
-      
-      regfree( &act->path_regex );
+      vdev_match_pattern_free( &act->path_pattern );
    }
    
    if( act->type != NULL ) {
@@ -188,6 +200,7 @@ static int vdev_action_ini_parser( void* userdata, char const* section, char con
          if( act->path != NULL ) {
             
             free( act->path );
+            vdev_match_pattern_free( &act->path_pattern );
          }
          
          act->path = vdev_strdup_or_null( value );
@@ -197,11 +210,11 @@ static int vdev_action_ini_parser( void* userdata, char const* section, char con
             return 0;
          } 
          else {
-            rc = vdev_match_regex_init( &act->path_regex, act->path );
+            rc = vdev_match_pattern_init( &act->path_pattern, act->path );
             
             if( rc != 0 ) {
                
-               vdev_error("vdev_match_regex_init('%s') rc = %d\n", act->path, rc );
+               vdev_error("vdev_match_pattern_init('%s') rc = %d\n", act->path, rc );
                return 0;
             }
          }
@@ -323,6 +336,76 @@ static int vdev_action_ini_parser( void* userdata, char const* section, char con
          return 1;
       }
       
+      if( strcmp(name, VDEV_ACTION_DAEMONLET_INSTANCES) == 0 ) {
+         
+         // how many daemonlet processes to run 
+         bool success = false;
+         uint64_t num_daemonlets = vdev_parse_uint64( value, &success );
+         
+         if( !success || num_daemonlets == 0 || num_daemonlets > VDEV_ACTION_DAEMONLET_MAX_INSTANCES ) {
+            
+            fprintf(stderr, "Invalid '%s' value '%s'\n", name, value );
+            return 0;
+         }
+         
+         act->num_daemonlets = (int)num_daemonlets;
+         return 1;
+      }
+      
+      if( strcmp(name, VDEV_ACTION_DEBOUNCE) == 0 ) {
+         
+         // how long to let change events settle, in milliseconds
+         bool success = false;
+         uint64_t debounce_millis = vdev_parse_uint64( value, &success );
+         
+         if( !success ) {
+            
+            fprintf(stderr, "Invalid '%s' value '%s'\n", name, value );
+            return 0;
+         }
+         
+         act->debounce_millis = debounce_millis;
+         return 1;
+      }
+      
+      if( strcmp(name, VDEV_ACTION_PRIORITY) == 0 ) {
+         
+         // which workqueue lane to process matching requests in 
+         if( strcasecmp( value, VDEV_ACTION_PRIORITY_HIGH ) == 0 ) {
+            
+            act->priority = VDEV_WQ_LANE_HIGH;
+            return 1;
+         }
+         
+         if( strcasecmp( value, VDEV_ACTION_PRIORITY_NORMAL ) == 0 ) {
+            
+            act->priority = VDEV_WQ_LANE_NORMAL;
+            return 1;
+         }
+         
+         if( strcasecmp( value, VDEV_ACTION_PRIORITY_LOW ) == 0 ) {
+            
+            act->priority = VDEV_WQ_LANE_LOW;
+            return 1;
+         }
+         
+         fprintf(stderr, "Invalid '%s' value '%s'\n", name, value );
+         return 0;
+      }
+      
+      if( strcmp(name, VDEV_ACTION_DAEMONLET_PROTOCOL) == 0 ) {
+         
+         // how to talk to the daemonlet 
+         rc = vdev_daemonlet_protocol_parse( value, &act->daemonlet_protocol );
+         if( rc != 0 ) {
+            
+            fprintf(stderr, "Invalid '%s' value '%s'\n", name, value );
+            return 0;
+         }
+         
+         return 1;
+      }
+      
       if( strncmp(name, VDEV_ACTION_NAME_OS_PREFIX, strlen(VDEV_ACTION_NAME_OS_PREFIX)) == 0 ) {
          
          // OS-specific param 
@@ -365,7 +448,8 @@ int vdev_action_sanity_check( struct vdev_action* act ) {
    
    int rc = 0;
    
-   if( act->command == NULL && act->rename_command == NULL && act->helper == NULL ) {
+   // an action that only sets how matching requests are scheduled need not run anything
+   if( act->command == NULL && act->rename_command == NULL && act->helper == NULL && act->priority == VDEV_ACTION_PRIORITY_UNSET && act->debounce_millis == 0 ) {
       
       fprintf(stderr, "Action is missing 'command=', 'rename_command=', and 'helper='\n");
       rc = -EINVAL;
@@ -493,23 +577,150 @@ int vdev_action_load( struct vdev_config* config, char const* path, struct vdev_
 }
 
 
-// free a C-style list of actions (including the list itself)
+// release a reference to an action.  Once no action list refers to it, stop its daemonlets and free it.
 // always succeeds
-int vdev_action_free_all( struct vdev_action* act_list, size_t num_acts ) {
+static int vdev_action_unref( struct vdev_action* act ) {
    
-   int rc = 0;
+   if( __sync_sub_and_fetch( &act->refcount, 1 ) > 0 ) {
+      
+      // still in use by another list
+      return 0;
+   }
+   
+   vdev_action_daemonlet_stop_pool( act );
+   vdev_action_free( act );
+   
+   if( act->daemonlets != NULL ) {
+      
+      free( act->daemonlets );
+      act->daemonlets = NULL;
+   }
+   
+   pthread_cond_destroy( &act->daemonlet_idle );
+   pthread_mutex_destroy( &act->lock );
+   
+   free( act );
+   return 0;
+}
+
+
+// release a C-style list of actions (including the list itself).
+// actions that no other list refers to get their daemonlets stopped, and are freed.
+// always succeeds
+int vdev_action_free_all( struct vdev_action** act_list, size_t num_acts ) {
    
    for( unsigned int i = 0; i < num_acts; i++ ) {
       
-      rc = vdev_action_free( &act_list[i] );
-      if( rc != 0 ) {
-         return rc;
-      }
+      vdev_action_unref( act_list[i] );
    }
    
    free( act_list );
    
-   return rc;
+   return 0;
+}
+
+
+// set up a loaded action to run: give it a daemonlet pool (if needed), and remember which file it came from.
+// the caller holds the only reference to it afterwards.
+// return 0 on success
+// return -ENOMEM on OOM, in which case the action is left as it was
+int vdev_action_setup( struct vdev_action* act, struct stat const* sb ) {
+   
+   // set up a daemonlet pool 
+   if( act->is_daemonlet ) {
+      
+      act->daemonlets = VDEV_CALLOC( struct vdev_daemonlet, act->num_daemonlets );
+      if( act->daemonlets == NULL ) {
+         
+         return -ENOMEM;
+      }
+      
+      for( int j = 0; j < act->num_daemonlets; j++ ) {
+         
+         act->daemonlets[j].act = act;
+         act->daemonlets[j].pid = -1;
+         act->daemonlets[j].stdin_fd = -1;
+         act->daemonlets[j].stdout_fd = -1;
+      }
+   }
+   
+   pthread_mutex_init( &act->lock, NULL );
+   pthread_cond_init( &act->daemonlet_idle, NULL );
+   
+   // remember which version of the file this is 
+   act->file_dev = sb->st_dev;
+   act->file_ino = sb->st_ino;
+   act->file_size = sb->st_size;
+   act->file_mtime = sb->st_mtim;
+   act->file_ctime = sb->st_ctim;
+   
+   act->refcount = 1;
+   
+   return 0;
+}
+
+
+// load a new action from a file, and set it up to run.
+// the caller holds the only reference to it.
+// return 0 on success, and set *ret_act
+// return -ENOMEM on OOM
+// return -errno on failure to open or read the file
+// return -EINVAL if the file could not be parsed
+static int vdev_action_new( struct vdev_config* config, char const* path, struct stat* sb, struct vdev_action** ret_act ) {
+   
+   int rc = 0;
+   struct vdev_action* act = NULL;
+   
+   act = VDEV_CALLOC( struct vdev_action, 1 );
+   if( act == NULL ) {
+      return -ENOMEM;
+   }
+   
+   rc = vdev_action_load( config, path, act );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_action_load(%s) rc = %d\n", path, rc );
+      free( act );
+      return rc;
+   }
+   
+   rc = vdev_action_setup( act, sb );
+   if( rc != 0 ) {
+      
+      vdev_action_free( act );
+      free( act );
+      return rc;
+   }
+   
+   *ret_act = act;
+   return 0;
+}
+
+
+// find an action from the previous load whose file has not changed since
+// return the action if found
+// return NULL if not 
+static struct vdev_action* vdev_action_find_unchanged( struct vdev_action_loader_cls* loader_cls, char const* path, struct stat* sb ) {
+   
+   for( size_t i = 0; i < loader_cls->num_old_acts; i++ ) {
+      
+      struct vdev_action* act = loader_cls->old_acts[i];
+      
+      if( strcmp( act->name, path ) != 0 ) {
+         continue;
+      }
+      
+      if( act->file_dev == sb->st_dev && act->file_ino == sb->st_ino && act->file_size == sb->st_size &&
+          act->file_mtime.tv_sec == sb->st_mtim.tv_sec && act->file_mtime.tv_nsec == sb->st_mtim.tv_nsec &&
+          act->file_ctime.tv_sec == sb->st_ctim.tv_sec && act->file_ctime.tv_nsec == sb->st_ctim.tv_nsec ) {
+         
+         return act;
+      }
+      
+      return NULL;
+   }
+   
+   return NULL;
 }
 
 
@@ -521,11 +732,11 @@ int vdev_action_free_all( struct vdev_action* act_list, size_t num_acts ) {
 int vdev_action_loader( char const* path, void* cls ) {
    
    int rc = 0;
-   struct vdev_action act;
+   struct vdev_action* act = NULL;
    struct stat sb;
    struct vdev_action_loader_cls* loader_cls = (struct vdev_action_loader_cls*)cls;
    
-   struct sglib_vdev_action_vector* acts = loader_cls->acts;
+   struct sglib_vdev_action_ref_vector* acts = loader_cls->acts;
    struct vdev_config* config = loader_cls->config;
    
    // skip if not a regular file 
@@ -542,93 +753,118 @@ int vdev_action_loader( char const* path, void* cls ) {
       return 0;
    }
    
-   vdev_debug("Load Action %s\n", path );
-   
-   memset( &act, 0, sizeof(struct vdev_action) );
-   
-   rc = vdev_action_load( config, path, &act );
-   if( rc != 0 ) {
+   // unchanged since we last loaded it?
+   act = vdev_action_find_unchanged( loader_cls, path, &sb );
+   if( act != NULL ) {
       
-      vdev_error("vdev_acl_load(%s) rc = %d\n", path, rc );
-      return rc;
+      // keep its compiled matchers, daemonlets, and statistics 
+      __sync_fetch_and_add( &act->refcount, 1 );
+      loader_cls->num_reused++;
+   }
+   else {
+      
+      vdev_debug("Load Action %s\n", path );
+      
+      rc = vdev_action_new( config, path, &sb, &act );
+      if( rc != 0 ) {
+         
+         vdev_error("vdev_action_new(%s) rc = %d\n", path, rc );
+         return rc;
+      }
    }
    
    // save this action 
-   rc = sglib_vdev_action_vector_push_back( acts, act );
+   rc = sglib_vdev_action_ref_vector_push_back( acts, act );
    if( rc != 0 ) {
       
       // OOM
-      vdev_action_free( &act );
+      vdev_action_unref( act );
       return rc;
    }
    
    return 0;
 }
 
-// free a vector of actions 
+
+// release a vector of actions 
 // always succeeds
-static int vdev_action_vector_free( struct sglib_vdev_action_vector* acts ) {
+static int vdev_action_vector_free( struct sglib_vdev_action_ref_vector* acts ) {
    
-   for( unsigned long i = 0; i < sglib_vdev_action_vector_size( acts ); i++ ) {
+   for( unsigned long i = 0; i < sglib_vdev_action_ref_vector_size( acts ); i++ ) {
       
-      struct vdev_action* act = sglib_vdev_action_vector_at_ref( acts, i );
-      
-      vdev_action_free( act );
+      vdev_action_unref( sglib_vdev_action_ref_vector_at( acts, i ) );
    }
    
-   sglib_vdev_action_vector_clear( acts );
+   sglib_vdev_action_ref_vector_clear( acts );
    return 0;
 }
 
 
-// load all actions in a directory
-// return 0 on success
+// load all actions in a directory, reusing the given actions from a previous load if their files have not changed.
+// old_acts is not modified; reused actions get an extra reference.
+// return 0 on success, and set *ret_acts, *ret_num_acts, and *ret_num_reused (if not NULL)
 // return -ENOMEM if OOM 
 // return -EINVAL if at least one action file failed to load due to a sanity test failure 
 // return -errno if at least one action file failed to load due to an I/O error
-int vdev_action_load_all( struct vdev_config* config, struct vdev_action** ret_acts, size_t* ret_num_acts ) {
+int vdev_action_reload_all( struct vdev_config* config, struct vdev_action** old_acts, size_t num_old_acts, struct vdev_action*** ret_acts, size_t* ret_num_acts, size_t* ret_num_reused ) {
    
    int rc = 0;
    struct vdev_action_loader_cls loader_cls;
-   struct sglib_vdev_action_vector acts;
+   struct sglib_vdev_action_ref_vector acts;
+   unsigned long len_acts = 0;
    
-   sglib_vdev_action_vector_init( &acts );
+   sglib_vdev_action_ref_vector_init( &acts );
+   
+   memset( &loader_cls, 0, sizeof(struct vdev_action_loader_cls) );
    
    loader_cls.acts = &acts;
    loader_cls.config = config;
+   loader_cls.old_acts = old_acts;
+   loader_cls.num_old_acts = num_old_acts;
    
    rc = vdev_load_all( config->acts_dir, vdev_action_loader, &loader_cls );
    
    if( rc != 0 ) {
       
       vdev_action_vector_free( &acts );
-      sglib_vdev_action_vector_free( &acts );
+      sglib_vdev_action_ref_vector_free( &acts );
       
       return rc;
    }
+   
+   if( sglib_vdev_action_ref_vector_size( &acts ) == 0 ) {
+      
+      // nothing 
+      sglib_vdev_action_ref_vector_free( &acts );
+      
+      *ret_acts = NULL;
+      *ret_num_acts = 0;
+   }
    else {
-         
-      if( sglib_vdev_action_vector_size( &acts ) == 0 ) {
-         
-         // nothing 
-         *ret_acts = NULL;
-         *ret_num_acts = 0;
-      }
-      else {
       
-         // extract values
-         unsigned long len_acts = 0;
-         
-         sglib_vdev_action_vector_yoink( &acts, ret_acts, &len_acts );
-         
-         *ret_num_acts = len_acts;
-      }
+      // extract values
+      sglib_vdev_action_ref_vector_yoink( &acts, ret_acts, &len_acts );
+      *ret_num_acts = len_acts;
+   }
+   
+   if( ret_num_reused != NULL ) {
+      *ret_num_reused = loader_cls.num_reused;
    }
    
    return 0;
 }
 
 
+// load all actions in a directory
+// return 0 on success
+// return -ENOMEM if OOM 
+// return -EINVAL if at least one action file failed to load due to a sanity test failure 
+// return -errno if at least one action file failed to load due to an I/O error
+int vdev_action_load_all( struct vdev_config* config, struct vdev_action*** ret_acts, size_t* ret_num_acts ) {
+   
+   return vdev_action_reload_all( config, NULL, 0, ret_acts, ret_num_acts, NULL );
+}
+
 // carry out a command, synchronously, using an environment given by vreq.
 // stdout will be captured to *output
 // return the exit status on success (non-negative)
@@ -663,7 +899,7 @@ int vdev_action_run_sync( struct vdev_device_request* vreq, char const* command,
       vdev_debug("command output: '%s'\n", *output );
    }
    
-   VDEV_FREE_LIST( req_env );
+   free( req_env );
    
    if( rc != 0 ) {
       
@@ -682,16 +918,19 @@ int vdev_action_run_sync( struct vdev_device_request* vreq, char const* command,
 
 
 // carry out an action, asynchronously.
-// fork, setsid, fork, and exec, so the helper gets reparented to init.
-// return 0 if we were able to fork 
-// return -errno on failure to fork
+// the helper is detached (new session, reparented to init), so we never wait for it.
+// return 0 if we were able to start it 
+// return -errno on failure to start it
 // TODO: configurable interpreter (defaults to /bin/dash)
 int vdev_action_run_async( struct vdev_device_request* req, char const* command, vdev_params* helper_vars, bool use_shell ) {
    
    int rc = 0;
    pid_t pid = 0;
-   pid_t sid = 0;
-   int max_fd = 0;
+   
+   // only stderr, which should be directed to our log
+   int stdio_fds[3] = { -1, -1, STDERR_FILENO };
+   char* shell_argv[] = { "dash", "-c", (char*)command, NULL };
+   char* cmd_argv[] = { (char*)command, NULL };
    
    // generate the environment 
    char** env = NULL;
@@ -700,7 +939,6 @@ int vdev_action_run_async( struct vdev_device_request* req, char const* command,
    rc = vdev_device_request_to_env( req, helper_vars, &env, &num_env, 0 );
    if( rc != 0 ) {
       
-      // NOTE: must be async-safe!
       vdev_error("vdev_device_request_to_env rc = %d\n", rc);
       return rc;
    }
@@ -711,123 +949,316 @@ int vdev_action_run_async( struct vdev_device_request* req, char const* command,
       vdev_debug("command async env: '%s'\n", env[i] );
    }
    
-   pid = fork();
+   if( use_shell ) {
+      rc = vdev_spawn( "/bin/dash", shell_argv, env, stdio_fds, VDEV_SPAWN_DETACH, &pid );
+   }
+   else {
+      rc = vdev_spawn( command, cmd_argv, env, stdio_fds, VDEV_SPAWN_DETACH, &pid );
+   }
+   
+   free( env );
    
-   if( pid == 0 ) {
+   if( rc != 0 ) {
       
-      // child
-      // detach from parent 
-      sid = setsid();
-      if( sid < 0 ) {
-         
-         rc = -errno;
+      vdev_error("vdev_spawn('%s') rc = %d\n", command, rc );
+   }
+   
+   return rc;
+}
+
+
+// fail all of an asynchronous daemonlet instance's outstanding requests, i.e. because it died
+// NOTE: call while act->lock is held
+static void vdev_action_daemonlet_fail_inflight( struct vdev_action* act, struct vdev_daemonlet* dlet ) {
+   
+   if( dlet->num_inflight == 0 ) {
+      return;
+   }
+   
+   vdev_error("Daemonlet '%s' (PID=%d) lost %d outstanding request(s)\n", act->name, dlet->pid, dlet->num_inflight );
+   
+   dlet->num_requests += dlet->num_inflight;
+   dlet->num_failures += dlet->num_inflight;
+   dlet->num_inflight = 0;
+   
+   pthread_cond_broadcast( &act->daemonlet_idle );
+}
+
+
+// remove an outstanding request from an asynchronous daemonlet instance
+// return the index it was at, or -1 if it was not outstanding
+// NOTE: call while act->lock is held
+static int vdev_action_daemonlet_inflight_remove( struct vdev_daemonlet* dlet, uint32_t seq, struct vdev_daemonlet_inflight* ret_inflight ) {
+   
+   for( int i = 0; i < dlet->num_inflight; i++ ) {
+      
+      if( dlet->inflight[i].seq != seq ) {
+         continue;
+      }
+      
+      if( ret_inflight != NULL ) {
+         *ret_inflight = dlet->inflight[i];
+      }
+      
+      memmove( &dlet->inflight[i], &dlet->inflight[i+1], sizeof(struct vdev_daemonlet_inflight) * (dlet->num_inflight - i - 1) );
+      dlet->num_inflight--;
+      return i;
+   }
+   
+   return -1;
+}
+
+
+// record an asynchronous daemonlet's reply to a request 
+// text-protocol daemonlets reply in order, so their replies are for the oldest outstanding request.
+// NOTE: call while act->lock is held
+static void vdev_action_daemonlet_complete_one( struct vdev_action* act, struct vdev_daemonlet* dlet, uint32_t seq, int64_t status ) {
+   
+   struct vdev_daemonlet_inflight inflight;
+   struct timespec end;
+   uint64_t millis = 0;
+   uint64_t nanos = 0;
+   int rc = 0;
+   
+   if( act->daemonlet_protocol != VDEV_DAEMONLET_PROTOCOL_BINARY ) {
+      
+      if( dlet->num_inflight == 0 ) {
          
-         // NOTE: must be async-safe!
-         vdev_error_async_safe("setsid failed\n" );
-         exit(1);
+         vdev_warn("Daemonlet '%s' (PID=%d) sent an unsolicited reply\n", act->name, dlet->pid );
+         return;
       }
       
-      pid = fork();
+      seq = dlet->inflight[0].seq;
+   }
+   
+   rc = vdev_action_daemonlet_inflight_remove( dlet, seq, &inflight );
+   if( rc < 0 ) {
+      
+      vdev_warn("Daemonlet '%s' (PID=%d) replied to unknown request %u\n", act->name, dlet->pid, seq );
+      return;
+   }
+   
+   clock_gettime( CLOCK_MONOTONIC, &end );
+   millis = (1000L * end.tv_sec + (end.tv_nsec / 1000000L)) - (1000L * inflight.start.tv_sec + (inflight.start.tv_nsec / 1000000L));
+   nanos = vdev_stats_nanos( &inflight.start, &end );
+   
+   dlet->num_requests++;
+   dlet->cumulative_time_millis += millis;
+   
+   vdev_histogram_add( &act->latency[ VDEV_STATS_DAEMONLET ][ status == 0 ? VDEV_STATS_SUCCESS : VDEV_STATS_FAILURE ], nanos );
+   vdev_trace_record( inflight.trace, inflight.trace_id, VDEV_TRACE_REPLY, act->name, &inflight.start, &end );
+   
+   if( status == 0 ) {
+      
+      vdev_debug("Benchmark: action %s succeeded in %lu millis (async)\n", act->name, (unsigned long)millis );
+   }
+   else {
+      
+      dlet->num_failures++;
+      vdev_error("Daemonlet '%s' (PID=%d) request %u exit status %d\n", act->name, dlet->pid, seq, (int)status );
+   }
+   
+   pthread_cond_broadcast( &act->daemonlet_idle );
+}
+
+
+// completion thread callback: collect an asynchronous daemonlet instance's replies
+// return 0 to keep collecting 
+// return negative if the daemonlet closed stdout or sent garbage, in which case its outstanding requests have failed
+static int vdev_action_daemonlet_complete( int fd, void* cls ) {
+   
+   struct vdev_daemonlet* dlet = (struct vdev_daemonlet*)cls;
+   struct vdev_action* act = dlet->act;
+   ssize_t nr = 0;
+   int rc = 0;
+   int consumed = 0;
+   uint32_t seq = 0;
+   int64_t status = 0;
+   
+   while( 1 ) {
       
-      if( pid == 0 ) {
+      nr = read( fd, dlet->reply_buf + dlet->reply_len, VDEV_ACTION_DAEMONLET_REPLY_BUF_LEN - dlet->reply_len );
+      if( nr < 0 ) {
          
-         // fully detached
-         max_fd = sysconf(_SC_OPEN_MAX);
-         if( max_fd < 0 ) {
-            
-            // should be big enough...
-            max_fd = 1024;
+         rc = -errno;
+         if( rc == -EINTR ) {
+            continue;
          }
          
-         // close everything except stderr, which should be directed to our log
-         for( int i = 0; i < max_fd; i++ ) {
-            if( i != STDERR_FILENO ) {
-               close( i );
-            }
+         if( rc == -EAGAIN || rc == -EWOULDBLOCK ) {
+            
+            // drained 
+            rc = 0;
          }
          
-         clearenv();
+         break;
+      }
+      
+      if( nr == 0 ) {
+         
+         // daemonlet closed stdout 
+         rc = -EPIPE;
+         break;
+      }
+      
+      dlet->reply_len += nr;
+      
+      if( !dlet->ready ) {
+         
+         // skip the readiness hint
+         dlet->ready = true;
+         dlet->reply_len--;
+         memmove( dlet->reply_buf, dlet->reply_buf + 1, dlet->reply_len );
+      }
+      
+      pthread_mutex_lock( &act->lock );
+      
+      // consume all whole replies 
+      while( dlet->reply_len > 0 ) {
          
-         // run the command 
-         if( use_shell ) {
-            execle( "/bin/dash", "dash", "-c", command, (char*)0, env );
+         if( act->daemonlet_protocol == VDEV_DAEMONLET_PROTOCOL_BINARY ) {
+            consumed = vdev_daemonlet_binary_parse_reply( dlet->reply_buf, dlet->reply_len, &seq, &status );
          }
          else {
-            execle( command, command, (char*)0, env );
+            consumed = vdev_daemonlet_text_parse_status( dlet->reply_buf, dlet->reply_len, &status );
          }
          
-         // keep gcc happy 
-         exit(0);
-      }
-      else if( pid > 0 ) {
+         if( consumed <= 0 ) {
+            break;
+         }
          
-         exit(0);
+         vdev_action_daemonlet_complete_one( act, dlet, seq, status );
+         
+         dlet->reply_len -= consumed;
+         memmove( dlet->reply_buf, dlet->reply_buf + consumed, dlet->reply_len );
       }
-      else {
+      
+      pthread_mutex_unlock( &act->lock );
+      
+      if( consumed < 0 || dlet->reply_len == VDEV_ACTION_DAEMONLET_REPLY_BUF_LEN ) {
          
-         rc = -errno;
-         vdev_error_async_safe("fork() failed\n");
-         exit(-rc);
+         // garbage 
+         rc = -EBADMSG;
+         break;
       }
    }
-   else if( pid > 0 ) {
+   
+   if( rc < 0 ) {
       
-      rc = 0;
+      pthread_mutex_lock( &act->lock );
       
-      VDEV_FREE_LIST( env );
+      if( rc == -EPIPE && dlet->num_inflight == 0 ) {
+         vdev_debug("Daemonlet '%s' (PID=%d) closed stdout\n", act->name, dlet->pid );
+      }
+      else {
+         vdev_error("Daemonlet '%s' (PID=%d) reply stream ended, rc = %d\n", act->name, dlet->pid, rc );
+      }
       
-      // parent; succeeded
-      // wait for intermediate process
-      pid_t child_pid = waitpid( pid, &rc, 0 );
-      if( child_pid < 0 ) {
-         
-         rc = -errno;
-         vdev_error("waitpid(%d) rc = %d\n", pid, rc );
-         return rc;
-      }
-      else if( WIFEXITED( rc ) && WEXITSTATUS( rc ) != 0 ) {
-         
-         rc = -WEXITSTATUS( rc );
-         vdev_error("fork() rc = %d\n", rc );
-      }
+      vdev_action_daemonlet_fail_inflight( act, dlet );
       
-      return rc;
+      pthread_mutex_unlock( &act->lock );
    }
-   else {
+   
+   return rc;
+}
+
+
+// clean up a daemonlet instance's process state
+// always succeeds 
+// NOTE: do not call while act->lock is held
+static int vdev_action_daemonlet_clean( struct vdev_daemonlet* dlet ) {
+   
+   // stop collecting its replies before closing its stdout
+   if( dlet->completion != NULL ) {
       
-      // error 
-      rc = -errno;
+      vdev_completion_remove( dlet->completion, dlet->completion_id );
+      dlet->completion = NULL;
+   }
+   
+   // anything still outstanding is lost 
+   if( dlet->act != NULL ) {
       
-      VDEV_FREE_LIST( env );
+      pthread_mutex_lock( &dlet->act->lock );
       
-      vdev_error("fork() rc = %d\n", rc);
+      vdev_action_daemonlet_fail_inflight( dlet->act, dlet );
       
-      return rc;
+      pthread_mutex_unlock( &dlet->act->lock );
+   }
+   
+   // dead 
+   dlet->pid = -1;
+   
+   if( dlet->stdin_fd >= 0 ) {
+      close( dlet->stdin_fd );
+      dlet->stdin_fd = -1;
    }
+   
+   if( dlet->stdout_fd >= 0 ) {
+      close( dlet->stdout_fd );
+      dlet->stdout_fd = -1;
+   }
+   
+   return 0;
 }
 
-
-// clean up a daemonlet's state in an action 
-// always succeeds 
-static int vdev_action_daemonlet_clean( struct vdev_action* act ) {
+// build a daemonlet's environment: vdevd's global settings, and the protocol to speak
+// return 0 on success, and set *ret_env to a NULL-terminated list (free with VDEV_FREE_LIST)
+// return -ENOMEM on OOM
+static int vdev_action_daemonlet_env( struct vdev_config* config, struct vdev_action* act, char const* global_metadata, char*** ret_env ) {
+   
+   char const* names[] = {
+      "VDEV_GLOBAL_METADATA",
+      "VDEV_MOUNTPOINT",
+      "VDEV_HELPERS",
+      "VDEV_LOGFILE",
+      "VDEV_CONFIG_FILE",
+      "VDEV_INSTANCE",
+      VDEV_DAEMONLET_PROTOCOL_ENV,
+      NULL
+   };
    
-   // dead 
-   act->daemonlet_pid = -1;
+   char const* values[] = {
+      global_metadata,
+      config->mountpoint,
+      config->helpers_dir,
+      config->logfile_path,
+      config->config_path,
+      config->instance_str,
+      (act->daemonlet_protocol == VDEV_DAEMONLET_PROTOCOL_BINARY ? VDEV_DAEMONLET_PROTOCOL_BINARY_STR : NULL),
+      NULL
+   };
    
-   if( act->daemonlet_stdin >= 0 ) {
-      close( act->daemonlet_stdin );
-      act->daemonlet_stdin = -1;
+   int num_env = 0;
+   char** env = VDEV_CALLOC( char*, (sizeof(names) / sizeof(names[0])) );
+   
+   if( env == NULL ) {
+      return -ENOMEM;
    }
    
-   if( act->daemonlet_stdout >= 0 ) {
-      close( act->daemonlet_stdout );
-      act->daemonlet_stdout = -1;
+   for( int i = 0; names[i] != NULL; i++ ) {
+      
+      if( values[i] == NULL ) {
+         continue;
+      }
+      
+      env[num_env] = VDEV_CALLOC( char, strlen(names[i]) + 1 + strlen(values[i]) + 1 );
+      if( env[num_env] == NULL ) {
+         
+         VDEV_FREE_LIST( env );
+         return -ENOMEM;
+      }
+      
+      sprintf( env[num_env], "%s=%s", names[i], values[i] );
+      num_env++;
    }
    
+   *ret_env = env;
    return 0;
 }
 
+
 // start up a daemonlet, using the daemonlet helper program at $VDEV_HELPERS/daemonlet.
+// binary-protocol daemonlets implement the protocol themselves, so their command is run directly with the shell.
 // stderr will be routed to /dev/null
 // return 0 on success, and fill in the relevant information to act.
 // return 0 if the daemonlet is already running
@@ -835,10 +1266,10 @@ static int vdev_action_daemonlet_clean( struct vdev_action* act ) {
 // return -EPERM if the daemonlet is not executable
 // return -errno from pipe(2) if we could not allocate a pipe
 // return -errno from open(2) if we could not open /dev/null
-// return -errno from fork(2) if we could not fork
+// return -errno from vdev_spawn() if we could not start it
 // return -ECHILD if the daemonlet died before it could signal readiness
 // NOTE: /dev/null *must* exist already--this should be taken care of by the pre-seed script.
-static int vdev_action_daemonlet_start( struct vdev_state* state, struct vdev_action* act ) {
+static int vdev_action_daemonlet_start( struct vdev_device_request* vreq, struct vdev_action* act, struct vdev_daemonlet* dlet ) {
    
    int rc = 0;
    pid_t pid = 0;
@@ -847,9 +1278,11 @@ static int vdev_action_daemonlet_start( struct vdev_state* state, struct vdev_ac
    char daemonlet_runner_path[ PATH_MAX+1 ];
    char vdevd_global_metadata[ PATH_MAX+1 ];
    char null_path[ PATH_MAX+1 ];
-   long max_open = sysconf( _SC_OPEN_MAX );
+   char** daemonlet_env = NULL;
+   int stdio_fds[3];
    struct stat sb;
-   struct vdev_config* config = state->config;
+   struct vdev_state* state = vreq->state;
+   struct vdev_config* config = vreq->snapshot->config;
 
    char* daemonlet_argv[] = {
       "vdevd-daemonlet",
@@ -857,11 +1290,14 @@ static int vdev_action_daemonlet_start( struct vdev_state* state, struct vdev_ac
       NULL
    };
    
-   if( max_open <= 0 ) {
-      max_open = 1024;  // a good guess
-   }
+   char* binary_daemonlet_argv[] = {
+      "/bin/sh",
+      "-c",
+      act->command,
+      NULL
+   };
    
-   if( act->daemonlet_pid > 0 ) {
+   if( dlet->pid > 0 ) {
       return 0;
    }
    
@@ -871,6 +1307,11 @@ static int vdev_action_daemonlet_start( struct vdev_state* state, struct vdev_ac
    snprintf( daemonlet_runner_path, PATH_MAX, "%s/daemonlet", config->helpers_dir );
    snprintf( vdevd_global_metadata, PATH_MAX, "%s/" VDEV_METADATA_PREFIX, config->mountpoint );
    
+   if( act->daemonlet_protocol == VDEV_DAEMONLET_PROTOCOL_BINARY ) {
+      
+      snprintf( daemonlet_runner_path, PATH_MAX, "%s", binary_daemonlet_argv[0] );
+   }
+   
    // the daemonlet runner must exist 
    rc = stat( daemonlet_runner_path, &sb );
    if( rc != 0 ) {
@@ -905,58 +1346,32 @@ static int vdev_action_daemonlet_start( struct vdev_state* state, struct vdev_ac
       return rc;
    }
   
-   pid = fork();
-   if( pid == 0 ) {
+   rc = vdev_action_daemonlet_env( config, act, vdevd_global_metadata, &daemonlet_env );
+   if( rc != 0 ) {
       
-      // child 
+      close( daemonlet_pipe_stdin[0] );
       close( daemonlet_pipe_stdin[1] );
       close( daemonlet_pipe_stdout[0] );
-      
-      // redirect 
-      rc = dup2( daemonlet_pipe_stdin[0], STDIN_FILENO );
-      if( rc < 0 ) {
-         
-         vdev_error_async_safe("dup2 stdin failed\n");
-         exit(1);
-      }
-      
-      rc = dup2( daemonlet_pipe_stdout[1], STDOUT_FILENO );
-      if( rc < 0 ) {
-         
-         vdev_error_async_safe("dup2 stdout to vdevd failed\n");
-         _exit(1);
-      }
-
-      rc = dup2( state->error_fd, STDERR_FILENO );
-      if( rc < 0 ) {
-
-         vdev_error_async_safe("dup2 stderr to null failed\n");
-         _exit(1);
-      }
-      
-      // close everything else
-      // the daemonlet should capture stderr itself
-      for( int i = 3; i < max_open; i++ ) {
-         
-         close( i );
-      }
+      close( daemonlet_pipe_stdout[1] );
+      return rc;
+   }
    
-      // set basic environment variables 
-      clearenv();
-      setenv( "VDEV_GLOBAL_METADATA", vdevd_global_metadata, 1 );
-      setenv( "VDEV_MOUNTPOINT", config->mountpoint, 1 );
-      setenv( "VDEV_HELPERS", config->helpers_dir, 1 );
-      setenv( "VDEV_LOGFILE", config->logfile_path, 1 );
-      setenv( "VDEV_CONFIG_FILE", config->config_path, 1 );
-      setenv( "VDEV_INSTANCE", config->instance_str, 1 );
-      
-      // start the daemonlet 
-      execv( daemonlet_runner_path, daemonlet_argv );
-      
-      // keep gcc happy
-      _exit(0);
+   // start the daemonlet on the pipes.
+   // the daemonlet should capture stderr itself
+   stdio_fds[0] = daemonlet_pipe_stdin[0];
+   stdio_fds[1] = daemonlet_pipe_stdout[1];
+   stdio_fds[2] = state->error_fd;
+   
+   if( act->daemonlet_protocol == VDEV_DAEMONLET_PROTOCOL_BINARY ) {
+      rc = vdev_spawn( daemonlet_runner_path, binary_daemonlet_argv, daemonlet_env, stdio_fds, 0, &pid );
+   }
+   else {
+      rc = vdev_spawn( daemonlet_runner_path, daemonlet_argv, daemonlet_env, stdio_fds, 0, &pid );
    }
-   else if( pid > 0 ) {
+   
+   VDEV_FREE_LIST( daemonlet_env );
+   
+   if( rc == 0 ) {
       
       // parent vdevd 
       close( daemonlet_pipe_stdin[0] );
@@ -996,18 +1411,41 @@ static int vdev_action_daemonlet_start( struct vdev_state* state, struct vdev_ac
       
       // record runtime state 
       act->is_daemonlet = true;
-      act->daemonlet_pid = pid;
-      act->daemonlet_stdin = daemonlet_pipe_stdin[1];
-      act->daemonlet_stdout = daemonlet_pipe_stdout[0];
+      dlet->pid = pid;
+      dlet->stdin_fd = daemonlet_pipe_stdin[1];
+      dlet->stdout_fd = daemonlet_pipe_stdout[0];
+      dlet->num_starts++;
+      
+      if( act->async ) {
+         
+         // collect replies in the completion thread, so requests can be pipelined
+         dlet->ready = false;
+         dlet->reply_len = 0;
+         
+         rc = fcntl( dlet->stdout_fd, F_SETFL, fcntl( dlet->stdout_fd, F_GETFL, 0 ) | O_NONBLOCK );
+         if( rc == 0 ) {
+            rc = vdev_completion_add( &state->daemonlet_completion, dlet->stdout_fd, vdev_action_daemonlet_complete, dlet, &dlet->completion_id );
+         }
+         else {
+            rc = -errno;
+         }
+         
+         if( rc != 0 ) {
+            
+            vdev_error("Failed to collect replies from daemonlet '%s' (PID=%d), rc = %d\n", act->name, pid, rc );
+            vdev_action_daemonlet_stop( act, dlet );
+            return rc;
+         }
+         
+         dlet->completion = &state->daemonlet_completion;
+      }
       
       // daemonlet started!
       return 0;
    }
    else {
       
-      // fork() error 
-      rc = -errno;
-      vdev_error("fork() rc = %d\n", rc );
+      vdev_error("vdev_spawn('%s') rc = %d\n", daemonlet_runner_path, rc );
       
       close( daemonlet_pipe_stdin[0] );
       close( daemonlet_pipe_stdin[1] );
@@ -1023,7 +1461,7 @@ static int vdev_action_daemonlet_start( struct vdev_state* state, struct vdev_ac
 // first, ask it by writing "exit" to its stdin pipe.
 // wait 30 seconds before SIGTERM'ing the daemonlet.
 // return 0 on success, even if the daemonlet is already dead
-static int vdev_action_daemonlet_stop( struct vdev_action* act ) {
+static int vdev_action_daemonlet_stop( struct vdev_action* act, struct vdev_daemonlet* dlet ) {
    
    int rc = 0;
    pid_t child_pid = 0;
@@ -1035,32 +1473,51 @@ static int vdev_action_daemonlet_stop( struct vdev_action* act ) {
    timeout.tv_sec = 30;
    timeout.tv_nsec = 0;
    
-   if( act->daemonlet_pid <= 0 || act->daemonlet_stdin < 0 || act->daemonlet_stdout < 0 ) {
+   if( dlet->pid <= 0 || dlet->stdin_fd < 0 || dlet->stdout_fd < 0 ) {
       // not running
       return 0;
    }
    
    // confirm that it is still running by trying to join with it 
-   child_pid = waitpid( act->daemonlet_pid, &rc, WNOHANG );
-   if( child_pid == act->daemonlet_pid || child_pid < 0 ) {
+   child_pid = waitpid( dlet->pid, &rc, WNOHANG );
+   if( child_pid == dlet->pid || child_pid < 0 ) {
       
       // joined, or not running
-      vdev_debug("Daemonlet %d (%s) dead\n", act->daemonlet_pid, act->name );
-      vdev_action_daemonlet_clean( act );
+      vdev_debug("Daemonlet %d (%s) dead\n", dlet->pid, act->name );
+      vdev_action_daemonlet_clean( dlet );
       return 0;
    }
    
+   if( act->async ) {
+      
+      // give it a chance to reply to its outstanding requests
+      clock_gettime( CLOCK_REALTIME, &stop_deadline );
+      stop_deadline.tv_sec += VDEV_ACTION_DAEMONLET_DRAIN_TIMEOUT;
+      
+      pthread_mutex_lock( &act->lock );
+      
+      while( dlet->num_inflight > 0 ) {
+         
+         rc = pthread_cond_timedwait( &act->daemonlet_idle, &act->lock, &stop_deadline );
+         if( rc == ETIMEDOUT ) {
+            break;
+         }
+      }
+      
+      pthread_mutex_unlock( &act->lock );
+   }
+   
    // ask it to die: close stdin 
-   rc = close( act->daemonlet_stdin );
+   rc = close( dlet->stdin_fd );
    
    if( rc < 0 ) {
       
-      vdev_error("close(%d PID=%d name=%s) rc = %d\n", act->daemonlet_stdin, act->daemonlet_pid, act->name, rc );
-      act->daemonlet_stdin = -1;
+      vdev_error("close(%d PID=%d name=%s) rc = %d\n", dlet->stdin_fd, dlet->pid, act->name, rc );
+      dlet->stdin_fd = -1;
       
       // no choice but to kill this one 
-      kill( act->daemonlet_pid, SIGTERM );
-      vdev_action_daemonlet_clean( act );
+      kill( dlet->pid, SIGTERM );
+      vdev_action_daemonlet_clean( dlet );
       
       // join with it...
       rc = 0;
@@ -1068,21 +1525,21 @@ static int vdev_action_daemonlet_stop( struct vdev_action* act ) {
    else {
       
       // tell daemonlet to die 
-      rc = kill( act->daemonlet_pid, SIGINT );
+      rc = kill( dlet->pid, SIGINT );
       if( rc < 0 ) {
          
-         vdev_error("kill(PID=%d name=%s) rc = %d\n", act->daemonlet_pid, act->name, rc );
+         vdev_error("kill(PID=%d name=%s) rc = %d\n", dlet->pid, act->name, rc );
       }
       
       // will wait for the child to die
-      act->daemonlet_stdin = -1;
+      dlet->stdin_fd = -1;
    }
    
    // join with it.
    while( 1 ) {
          
       // attempt to join 
-      child_pid = waitpid( act->daemonlet_pid, &rc, 0 );
+      child_pid = waitpid( dlet->pid, &rc, 0 );
       
       if( child_pid < 0 ) {
          
@@ -1091,14 +1548,14 @@ static int vdev_action_daemonlet_stop( struct vdev_action* act ) {
             
             // already dead 
             rc = 0;
-            vdev_debug("Daemonlet %d (%s) dead\n", act->daemonlet_pid, act->name );
-            vdev_action_daemonlet_clean( act );
+            vdev_debug("Daemonlet %d (%s) dead\n", dlet->pid, act->name );
+            vdev_action_daemonlet_clean( dlet );
             break;
          }
          else if( rc == -EINTR ) {
             
             // unhandled signal *or* SIGCHLD 
-            child_pid = waitpid( act->daemonlet_pid, &rc, WNOHANG );
+            child_pid = waitpid( dlet->pid, &rc, WNOHANG );
             if( child_pid > 0 ) {
                
                // child died 
@@ -1119,87 +1576,50 @@ static int vdev_action_daemonlet_stop( struct vdev_action* act ) {
    }
 
    // clean this child out (even if we had an error with waitpid)
-   vdev_debug("Daemonlet %d (%s) dead\n", act->daemonlet_pid, act->name );
-   vdev_action_daemonlet_clean( act );
+   vdev_debug("Daemonlet %d (%s) dead\n", dlet->pid, act->name );
+   vdev_action_daemonlet_clean( dlet );
    
    return rc;
 }
 
 
-// stop all daemonlets 
-// always succeeds; mask all stop errors (i.e. only call this on shutdown)
-int vdev_action_daemonlet_stop_all( struct vdev_action* actions, size_t num_actions ) {
+// stop all of an action's daemonlets 
+// always succeeds; mask all stop errors
+static int vdev_action_daemonlet_stop_pool( struct vdev_action* act ) {
    
    int rc = 0;
    
-   for( unsigned int i = 0; i < num_actions; i++ ) {
+   if( !act->is_daemonlet || act->daemonlets == NULL ) {
+      return 0;
+   }
+   
+   for( int j = 0; j < act->num_daemonlets; j++ ) {
       
-      if( !actions[i].is_daemonlet ) {
-         continue;
-      }
+      struct vdev_daemonlet* dlet = &act->daemonlets[j];
       
-      rc = vdev_action_daemonlet_stop( &actions[i] );
+      rc = vdev_action_daemonlet_stop( act, dlet );
       if( rc < 0 ) {
          
-         vdev_error("vdev_action_daemonlet_stop('%s' PID=%d) rc = %d\n", actions[i].name, actions[i].daemonlet_pid, rc );
+         vdev_error("vdev_action_daemonlet_stop('%s' PID=%d) rc = %d\n", act->name, dlet->pid, rc );
       }
    }
    
    return 0;
 }
 
-// read a string-ified int64_t from a file descriptor, followed by a newline.
-// this is used to get a daemonlet return code 
-// return 0 on success, and set *ret 
-// return -errno on I/O error (such as -EPIPE)
-// return -EAGAIN if we got EOF
-static int vdev_action_daemonlet_read_int64( int fd, int64_t* ret ) {
-  
-   int64_t value = 0;
-  
-   int cnt = 0; 
-   int c = 0;
-   int rc = 0;
-   int s = 1;
+
+// stop all daemonlets 
+// always succeeds; mask all stop errors (i.e. only call this on shutdown)
+int vdev_action_daemonlet_stop_all( struct vdev_action** actions, size_t num_actions ) {
    
-   while( 1 ) {
-      
-      // next character 
-      rc = vdev_read_uninterrupted( fd, (char*)&c, 1 );
-      if( rc < 0 ) {
-         
-         return rc;
-      }
-      if( rc == 0 ) {
-         
-         return -EAGAIN;
-      }
-      
-      if( c == '\n' ) {
-         break;
-      }
-      
-      if( cnt == 0 && c == '-' ) {
-         s = -1;
-      }
-      else if( c < '0' || c > '9' ) {
-         
-         // invalid 
-         rc = -EINVAL;
-         break;
-      }
+   for( unsigned int i = 0; i < num_actions; i++ ) {
       
-      value *= 10;
-      value += (c - '0');
-
-      cnt++;
+      vdev_action_daemonlet_stop_pool( actions[i] );
    }
    
-   *ret = value * s;
    return 0;
 }
 
-
 // issue a command to a daemonlet, and get back its return code.
 // the daemonlet should already be running (or thought to be running) before calling this method.
 // if this method fails, the caller should consider restarting the daemonlet.
@@ -1207,14 +1627,13 @@ static int vdev_action_daemonlet_read_int64( int fd, int64_t* ret ) {
 // return -ENOMEM on OOM
 // return -EAGAIN if the daemonlet needs to be restarted and the request retried.
 // return -EPERM on permanent daemonlet failure
-static int vdev_action_daemonlet_send_command( struct vdev_device_request* vreq, struct vdev_action* act, int64_t* daemonlet_rc ) {
+static int vdev_action_daemonlet_send_command( struct vdev_device_request* vreq, struct vdev_action* act, struct vdev_daemonlet* dlet, int64_t* daemonlet_rc ) {
     
    int rc = 0;
    char** req_env = NULL;
    size_t num_env = 0;
-   char env_buf[ PATH_MAX+1 ];
-
-   memset( env_buf, 0, PATH_MAX+1 );
+   uint32_t seq = 0;
+   uint32_t reply_seq = 0;
 
    // generate the environment...
    rc = vdev_device_request_to_env( vreq, act->helper_vars, &req_env, &num_env, 1 );
@@ -1231,31 +1650,58 @@ static int vdev_action_daemonlet_send_command( struct vdev_device_request* vreq,
       vdev_debug("daemonlet env: '%s'\n", req_env[i] );
    } 
    
-   // feed environment variables
-   for( unsigned int i = 0; i < num_env; i++ ) {
+   if( act->async ) {
+      
+      // the reply can arrive as soon as the request is sent, so track it first.
+      // the caller made sure there is room.
+      pthread_mutex_lock( &act->lock );
+      
+      seq = dlet->next_seq;
+      dlet->next_seq++;
       
-      snprintf( env_buf, PATH_MAX, "%s\n", req_env[i] );
+      dlet->inflight[ dlet->num_inflight ].seq = seq;
+      clock_gettime( CLOCK_MONOTONIC, &dlet->inflight[ dlet->num_inflight ].start );
+      dlet->inflight[ dlet->num_inflight ].trace = &vreq->state->trace;
+      dlet->inflight[ dlet->num_inflight ].trace_id = vreq->trace_id;
+      dlet->num_inflight++;
       
-      rc = vdev_write_uninterrupted( act->daemonlet_stdin, env_buf, strlen(env_buf) );
+      pthread_mutex_unlock( &act->lock );
+   }
+   else {
+      
+      seq = dlet->next_seq;
+      dlet->next_seq++;
+   }
+   
+   // feed the request 
+   if( act->daemonlet_protocol == VDEV_DAEMONLET_PROTOCOL_BINARY ) {
+      
+      rc = vdev_daemonlet_binary_send( dlet->stdin_fd, seq, req_env, num_env );
       if( rc < 0 ) {
          
-         // failed to write! 
-         vdev_error("vdev_write_uninterrupted(%d) to daemonlet '%s' rc = %d\n", act->daemonlet_stdin, act->name, rc );
-         break;
+         vdev_error("vdev_daemonlet_binary_send(%d) to daemonlet '%s' rc = %d\n", dlet->stdin_fd, act->name, rc );
       }
    }
-   
-   if( rc > 0 ) {
+   else {
       
-      // feed end-of-environment flag
-      rc = vdev_write_uninterrupted( act->daemonlet_stdin, "done\n", strlen("done\n") );
+      rc = vdev_daemonlet_text_send( dlet->stdin_fd, req_env, num_env );
       if( rc < 0 ) {
          
-         vdev_error("vdev_write_uninterrupted(%d) to daemonlet '%s' rc = %d\n", act->daemonlet_stdin, act->name, rc );
+         vdev_error("vdev_daemonlet_text_send(%d) to daemonlet '%s' rc = %d\n", dlet->stdin_fd, act->name, rc );
       }
    }
    
-   VDEV_FREE_LIST( req_env );
+   free( req_env );
+   
+   if( rc < 0 && act->async ) {
+      
+      // never sent 
+      pthread_mutex_lock( &act->lock );
+      
+      vdev_action_daemonlet_inflight_remove( dlet, seq, NULL );
+      
+      pthread_mutex_unlock( &act->lock );
+   }
    
    if( rc < 0 ) {
 
@@ -1268,17 +1714,32 @@ static int vdev_action_daemonlet_send_command( struct vdev_device_request* vreq,
       }
    }
    
-   // if we're running asynchronously, then we don't care about getting back the reply (stdout is routed to /dev/null anyway)
+   // if we're running asynchronously, the completion thread collects the reply
    if( act->async ) {
       *daemonlet_rc = 0;
       return 0;
    }
    
    // wait for a status code reply 
-   rc = vdev_action_daemonlet_read_int64( act->daemonlet_stdout, daemonlet_rc );
+   if( act->daemonlet_protocol == VDEV_DAEMONLET_PROTOCOL_BINARY ) {
+      
+      rc = vdev_daemonlet_binary_recv_status( dlet->stdout_fd, &reply_seq, daemonlet_rc );
+      
+      if( rc == 0 && reply_seq != seq ) {
+         
+         // out of sync 
+         vdev_error("Daemonlet '%s' (PID=%d) replied to request %u, expected %u\n", act->name, dlet->pid, reply_seq, seq );
+         return -EAGAIN;
+      }
+   }
+   else {
+      
+      rc = vdev_daemonlet_text_recv_status( dlet->stdout_fd, daemonlet_rc );
+   }
+   
    if( rc < 0 ) {
       
-      vdev_error("vdev_action_daemonlet_read_int64('%s') rc = %d\n", act->name, rc );
+      vdev_error("vdev_daemonlet_recv_status('%s') rc = %d\n", act->name, rc );
 
       // -EPIPE means the daemonlet is dead, and the caller should restart it 
       if( rc == -EPIPE ) {
@@ -1293,7 +1754,7 @@ static int vdev_action_daemonlet_send_command( struct vdev_device_request* vreq,
       
       // invalid daemonlet return code 
       // caller should consider restarting the daemonlet and trying again
-      vdev_error("vdev_daemonlet_read_int64('%s', PID=%d) exit status %d\n", act->name, act->daemonlet_pid, (int)*daemonlet_rc );
+      vdev_error("vdev_daemonlet_recv_status('%s', PID=%d) exit status %d\n", act->name, dlet->pid, (int)*daemonlet_rc );
       return -EAGAIN;
    }
    
@@ -1301,30 +1762,24 @@ static int vdev_action_daemonlet_send_command( struct vdev_device_request* vreq,
 }
 
 
-// carry out a command by sending it to a running daemonlet.
+// carry out a command by sending it to a daemonlet instance.
 // restart the daemonlet if we need to (e.g. if it hasn't been started, or it died since the last device request).
 // return the daemonlet's exit status on success (will be positive if the daemonlet failed in error).
 // return -ENOMEM on OOM
 // return -EPERM if the daemonlet could not be started, or was not responding and we could not restart it.  A subsequent call probably won't succeed.
-// return -EAGAIN if the daemonlet was not responding, but we were able to stop it.  A subsequent call might succeed in starting it up and feeding it the request.
-// return -EINVAL if the action is not a daemonlet.
 // return a positive exit code if the daemonlet failed to process the device request
 // NOTE: if this method fails to communicate with the daemonlet, it will try to "reset" the daemonlet by stopping it, and allowing a subsequent call to start it.
-// NOTE: not reload-safe; call while the reload lock is held
-int vdev_action_run_daemonlet( struct vdev_device_request* vreq, struct vdev_action* act ) {
+// NOTE: the caller must own dlet (i.e. have marked it busy)
+static int vdev_action_daemonlet_run_instance( struct vdev_device_request* vreq, struct vdev_action* act, struct vdev_daemonlet* dlet ) {
    
    int rc = 0;
    int64_t daemonlet_rc = 0;
    int num_attempts = 0;
 
-   if( !act->is_daemonlet ) {
-      return -EINVAL;
-   }
-   
    // do we need to start it?
-   if( act->daemonlet_pid <= 0 ) {
+   if( dlet->pid <= 0 ) {
       
-      rc = vdev_action_daemonlet_start( vreq->state, act );
+      rc = vdev_action_daemonlet_start( vreq, act, dlet );
       if( rc < 0 ) {
          
          vdev_error("vdev_action_daemonlet_start('%s') rc = %d\n", act->name, rc );
@@ -1335,7 +1790,7 @@ int vdev_action_run_daemonlet( struct vdev_device_request* vreq, struct vdev_act
    // try twice, in case we need to stop and start it.
    while( num_attempts < 2 ) {
 
-      rc = vdev_action_daemonlet_send_command( vreq, act, &daemonlet_rc );
+      rc = vdev_action_daemonlet_send_command( vreq, act, dlet, &daemonlet_rc );
       if( rc != 0 ) {
          
          vdev_error("vdev_action_daemonlet_send_command('%s') rc = %d\n", act->name, rc );
@@ -1343,16 +1798,16 @@ int vdev_action_run_daemonlet( struct vdev_device_request* vreq, struct vdev_act
          if( rc == -EAGAIN ) {
 
             // try restarting and re-dispatching the command 
-            rc = vdev_action_daemonlet_stop( act );
+            rc = vdev_action_daemonlet_stop( act, dlet );
             if( rc < 0 ) {
 
-               vdev_error("vdev_action_daemonlet_stop('%s', PID=%d) rc = %d\n", act->name, act->daemonlet_pid, rc );
+               vdev_error("vdev_action_daemonlet_stop('%s', PID=%d) rc = %d\n", act->name, dlet->pid, rc );
                rc = -EPERM;
                break;
             }
             else {
 
-               rc = vdev_action_daemonlet_start( vreq->state, act );
+               rc = vdev_action_daemonlet_start( vreq, act, dlet );
                if( rc < 0 ) {
 
                    vdev_error("vdev_action_daemonlet_start('%s') rc = %d\n", act->name, rc );
@@ -1393,32 +1848,135 @@ int vdev_action_run_daemonlet( struct vdev_device_request* vreq, struct vdev_act
 }
 
 
-// match device request against action
-// return 1 if match
-// return 0 if not match 
-int vdev_action_match( struct vdev_device_request* vreq, struct vdev_action* act ) {
+// cancellation cleanup handler for a thread waiting on an action's daemonlet_idle condition:
+// the thread re-acquires act->lock when it is cancelled in the wait, so give it back
+static void vdev_action_unlock_cleanup( void* cls ) {
    
-   int rc = 0;
+   pthread_mutex_t* lock = (pthread_mutex_t*)cls;
+   pthread_mutex_unlock( lock );
+}
+
+
+// get an idle daemonlet instance for an action, waiting for one if they are all busy.
+// asynchronous daemonlets are idle while being written to, and have room for another outstanding request.
+// instances with the fewest outstanding requests are preferred, and then running instances over ones that would have to be started.
+// return the instance, marked busy
+// NOTE: call while act->lock is held
+static struct vdev_daemonlet* vdev_action_daemonlet_acquire( struct vdev_action* act ) {
    
-   // action match?
-   if( act->trigger != vreq->type && act->trigger != VDEV_DEVICE_ANY ) {
-      return 0;
-   }
+   struct vdev_daemonlet* idle = NULL;
    
-   // path match?
-   if( act->path != NULL ) {
+   while( 1 ) {
       
-      rc = vdev_match_regex( vreq->path, &act->path_regex );
-      if( rc == 0 ) {
+      for( int i = 0; i < act->num_daemonlets; i++ ) {
          
-         // no match 
-         return 0;
+         struct vdev_daemonlet* dlet = &act->daemonlets[i];
+         
+         if( dlet->busy || dlet->num_inflight >= VDEV_ACTION_DAEMONLET_MAX_INFLIGHT ) {
+            continue;
+         }
+         
+         if( idle == NULL || dlet->num_inflight < idle->num_inflight || (dlet->num_inflight == idle->num_inflight && dlet->pid > 0 && idle->pid <= 0) ) {
+            idle = dlet;
+         }
       }
-      if( rc < 0 ) {
+      
+      if( idle != NULL ) {
          
-         // some error
-         return rc;
+         idle->busy = true;
+         return idle;
+      }
+      
+      // don't leave the lock held if we get cancelled while waiting 
+      pthread_cleanup_push( vdev_action_unlock_cleanup, &act->lock );
+      
+      pthread_cond_wait( &act->daemonlet_idle, &act->lock );
+      
+      pthread_cleanup_pop( 0 );
+   }
+}
+
+
+// carry out a command by sending it to one of the action's daemonlet instances.
+// dispatches to an idle instance, waiting for one if they are all busy, and starts or restarts it if needed.
+// asynchronous daemonlets get the request pipelined behind their outstanding ones; the completion thread records the outcome.
+// return the daemonlet's exit status on success (will be positive if the daemonlet failed in error).
+// return -ENOMEM on OOM
+// return -EPERM if the daemonlet could not be started, or was not responding and we could not restart it.  A subsequent call probably won't succeed.
+// return -EINVAL if the action is not a daemonlet.
+// return a positive exit code if the daemonlet failed to process the device request
+// NOTE: act must belong to the request's pinned snapshot (vreq->snapshot), which keeps it alive across reloads
+int vdev_action_run_daemonlet( struct vdev_device_request* vreq, struct vdev_action* act ) {
+   
+   int rc = 0;
+   struct vdev_daemonlet* dlet = NULL;
+   struct timespec start, end;
+   
+   if( !act->is_daemonlet || act->daemonlets == NULL ) {
+      return -EINVAL;
+   }
+   
+   pthread_mutex_lock( &act->lock );
+   
+   dlet = vdev_action_daemonlet_acquire( act );
+   
+   pthread_mutex_unlock( &act->lock );
+   
+   clock_gettime( CLOCK_MONOTONIC, &start );
+   
+   rc = vdev_action_daemonlet_run_instance( vreq, act, dlet );
+   
+   clock_gettime( CLOCK_MONOTONIC, &end );
+   
+   // give it back, and record how it went (asynchronous requests that got sent are recorded on completion)
+   pthread_mutex_lock( &act->lock );
+   
+   if( !act->async ) {
+      
+      dlet->num_requests++;
+      dlet->cumulative_time_millis += (1000L * end.tv_sec + (end.tv_nsec / 1000000L)) - (1000L * start.tv_sec + (start.tv_nsec / 1000000L));
+   }
+   
+   if( rc != 0 ) {
+      
+      if( act->async ) {
+         dlet->num_requests++;
       }
+      
+      dlet->num_failures++;
+   }
+   
+   dlet->busy = false;
+   pthread_cond_signal( &act->daemonlet_idle );
+   
+   pthread_mutex_unlock( &act->lock );
+   
+   return rc;
+}
+
+
+// match device request against an action's path 
+// return 1 if match (or if the action has no path)
+// return 0 if not match 
+// return negative on error
+static int vdev_action_match_path( struct vdev_device_request* vreq, struct vdev_action* act ) {
+   
+   if( act->path == NULL ) {
+      return 1;
+   }
+   
+   return vdev_match_pattern( vreq->path, &act->path_pattern );
+}
+
+
+// match device request against an action's trigger, type, and OS parameters, but not its path
+// return 1 if match
+// return 0 if not match 
+static int vdev_action_match_fields( struct vdev_device_request* vreq, struct vdev_action* act ) {
+   
+   // action match?
+   if( act->trigger != vreq->type && act->trigger != VDEV_DEVICE_ANY ) {
+      return 0;
    }
    
    // type match?
@@ -1483,28 +2041,433 @@ int vdev_action_match( struct vdev_device_request* vreq, struct vdev_action* act
 }
 
 
-// find the next action in a list of actions to run, given the path 
-// return the index into acts of the next match, if found 
-// return num_acts if not found 
-// return negative on error
-int vdev_action_find_next( struct vdev_device_request* vreq, struct vdev_action* acts, size_t num_acts ) {
+
+// make a dispatch index key.  NULL fields become empty, and match anything.
+// return the key on success
+// return NULL on OOM
+static char* vdev_action_index_key( vdev_device_request_t trigger, char const* type, char const* subsystem, char const* devtype ) {
    
-   int rc = 0;
-   int i = 0;
+   char* key = NULL;
+   size_t len = 0;
    
-   for( i = 0; (unsigned)i < num_acts; i++ ) {
-      
-      rc = vdev_action_match( vreq, &acts[i] );
+   if( type == NULL ) {
+      type = "";
+   }
+   if( subsystem == NULL ) {
+      subsystem = "";
+   }
+   if( devtype == NULL ) {
+      devtype = "";
+   }
+   
+   // NOTE: OS parameter values cannot contain newlines
+   len = 10 + 1 + strlen(type) + 1 + strlen(subsystem) + 1 + strlen(devtype) + 1;
+   
+   key = VDEV_CALLOC( char, len );
+   if( key == NULL ) {
+      return NULL;
+   }
+   
+   snprintf( key, len, "%d\n%s\n%s\n%s", (int)trigger, type, subsystem, devtype );
+   return key;
+}
+
+
+// get the exact value of an OS parameter 
+// return the value if present and non-empty
+// return NULL otherwise
+static char const* vdev_action_index_param( vdev_params* params, char const* name ) {
+   
+   struct vdev_param_t lookup;
+   struct vdev_param_t* dp = NULL;
+   
+   memset( &lookup, 0, sizeof(struct vdev_param_t) );
+   lookup.key = (char*)name;
+   
+   dp = sglib_vdev_params_find_member( params, &lookup );
+   if( dp == NULL || dp->value == NULL || strlen(dp->value) == 0 ) {
+      return NULL;
+   }
+   
+   return dp->value;
+}
+
+
+// add an action to the index bucket with the given key 
+// return 0 on success
+// return -ENOMEM on OOM
+static int vdev_action_index_insert( struct vdev_action_index* index, vdev_device_request_t trigger, char const* type, char const* subsystem, char const* devtype, int act_idx ) {
+   
+   struct vdev_action_bucket lookup;
+   struct vdev_action_bucket* bucket = NULL;
+   char* key = NULL;
+   
+   key = vdev_action_index_key( trigger, type, subsystem, devtype );
+   if( key == NULL ) {
+      return -ENOMEM;
+   }
+   
+   memset( &lookup, 0, sizeof(struct vdev_action_bucket) );
+   lookup.key = key;
+   
+   bucket = sglib_vdev_action_bucket_find_member( index->buckets, &lookup );
+   if( bucket == NULL ) {
+      
+      bucket = VDEV_CALLOC( struct vdev_action_bucket, 1 );
+      if( bucket == NULL ) {
+         
+         free( key );
+         return -ENOMEM;
+      }
+      
+      bucket->key = key;
+      sglib_vdev_action_bucket_add( &index->buckets, bucket );
+   }
+   else {
+      
+      free( key );
+   }
+   
+   if( bucket->num_acts == bucket->max_acts ) {
+      
+      size_t max_acts = bucket->max_acts > 0 ? 2 * bucket->max_acts : 4;
+      int* acts = (int*)realloc( bucket->acts, sizeof(int) * max_acts );
+      
+      if( acts == NULL ) {
+         return -ENOMEM;
+      }
+      
+      bucket->acts = acts;
+      bucket->max_acts = max_acts;
+   }
+   
+   // actions are inserted in order, so this stays sorted
+   bucket->acts[ bucket->num_acts ] = act_idx;
+   bucket->num_acts++;
+   
+   return 0;
+}
+
+
+// build a dispatch index over a list of actions.
+// actions that can never match a device (i.e. with a type other than block or char) are left out.
+// return 0 on success, and set *ret_index
+// return -ENOMEM on OOM
+int vdev_action_index_build( struct vdev_action** acts, size_t num_acts, struct vdev_action_index** ret_index ) {
+   
+   int rc = 0;
+   struct vdev_action_index* index = NULL;
+   vdev_device_request_t triggers[] = {
+      VDEV_DEVICE_ADD,
+      VDEV_DEVICE_REMOVE,
+      VDEV_DEVICE_CHANGE
+   };
+   
+   index = VDEV_CALLOC( struct vdev_action_index, 1 );
+   if( index == NULL ) {
+      return -ENOMEM;
+   }
+   
+   index->num_acts = num_acts;
+   
+   vdev_match_set_init( &index->paths );
+   
+   if( num_acts > 0 ) {
+      
+      index->path_patterns = VDEV_CALLOC( int, num_acts );
+      if( index->path_patterns == NULL ) {
+         
+         free( index );
+         return -ENOMEM;
+      }
+   }
+   
+   for( unsigned int i = 0; i < num_acts; i++ ) {
+      
+      index->path_patterns[i] = -1;
+   }
+   
+   for( unsigned int i = 0; i < num_acts; i++ ) {
+      
+      char const* type = NULL;
+      char const* subsystem = vdev_action_index_param( acts[i]->dev_params, VDEV_ACTION_INDEX_PARAM_SUBSYSTEM );
+      char const* devtype = vdev_action_index_param( acts[i]->dev_params, VDEV_ACTION_INDEX_PARAM_DEVTYPE );
+      
+      if( acts[i]->has_type ) {
+         
+         if( acts[i]->type != NULL && strcasecmp( acts[i]->type, "block" ) == 0 ) {
+            type = "block";
+         }
+         else if( acts[i]->type != NULL && strcasecmp( acts[i]->type, "char" ) == 0 ) {
+            type = "char";
+         }
+         else {
+            
+            // will never match 
+            continue;
+         }
+      }
+      
+      if( acts[i]->path != NULL ) {
+         
+         // reuse the action's compiled pattern, so literal paths aren't compiled twice
+         rc = vdev_match_set_add_pattern( &index->paths, acts[i]->path, &acts[i]->path_pattern );
+         if( rc < 0 ) {
+            
+            vdev_error("vdev_match_set_add_pattern('%s') rc = %d\n", acts[i]->path, rc );
+            vdev_action_index_free( index );
+            return rc;
+         }
+         
+         index->path_patterns[i] = rc;
+         rc = 0;
+      }
+      
+      for( unsigned int j = 0; j < sizeof(triggers) / sizeof(triggers[0]); j++ ) {
+         
+         if( acts[i]->trigger != triggers[j] && acts[i]->trigger != VDEV_DEVICE_ANY ) {
+            continue;
+         }
+         
+         rc = vdev_action_index_insert( index, triggers[j], type, subsystem, devtype, i );
+         if( rc != 0 ) {
+            
+            vdev_action_index_free( index );
+            return rc;
+         }
+      }
+   }
+   
+   *ret_index = index;
+   return 0;
+}
+
+
+// free a dispatch index 
+// always succeeds
+int vdev_action_index_free( struct vdev_action_index* index ) {
+   
+   struct sglib_vdev_action_bucket_iterator itr;
+   struct vdev_action_bucket* bucket = NULL;
+   
+   if( index == NULL ) {
+      return 0;
+   }
+   
+   for( bucket = sglib_vdev_action_bucket_it_init( &itr, index->buckets ); bucket != NULL; bucket = sglib_vdev_action_bucket_it_next( &itr ) ) {
+      
+      free( bucket->key );
+      free( bucket->acts );
+      free( bucket );
+   }
+   
+   vdev_match_set_free( &index->paths );
+   
+   if( index->path_patterns != NULL ) {
+      free( index->path_patterns );
+   }
+   
+   free( index );
+   return 0;
+}
+
+
+// find the actions that might match a device request, in lexicographic order.
+// candidates' paths already match the device path; a candidate still needs to be checked with vdev_action_match_fields.
+// return 0 on success, and set *ret_candidates (which the caller must free) and *ret_num_candidates
+// return -EINVAL if index is NULL
+// return -ENOMEM on OOM
+int vdev_action_index_candidates( struct vdev_action_index* index, struct vdev_device_request* vreq, int** ret_candidates, size_t* ret_num_candidates ) {
+   
+   struct vdev_action_bucket* buckets[8];
+   size_t cursors[8];
+   int num_buckets = 0;
+   size_t num_candidates = 0;
+   int* candidates = NULL;
+   bool* path_matched = NULL;
+   size_t num_path_matched = 0;
+   int rc = 0;
+   
+   char const* types[2] = { NULL, NULL };
+   char const* subsystems[2] = { NULL, NULL };
+   char const* devtypes[2] = { NULL, NULL };
+   
+   struct vdev_action_bucket lookup;
+   
+   if( index == NULL ) {
+      return -EINVAL;
+   }
+   
+   // wildcard, and exact value (if the device has one)
+   if( S_ISBLK( vreq->mode ) ) {
+      types[1] = "block";
+   }
+   else if( S_ISCHR( vreq->mode ) ) {
+      types[1] = "char";
+   }
+   
+   subsystems[1] = vdev_action_index_param( vreq->params, VDEV_ACTION_INDEX_PARAM_SUBSYSTEM );
+   devtypes[1] = vdev_action_index_param( vreq->params, VDEV_ACTION_INDEX_PARAM_DEVTYPE );
+   
+   memset( &lookup, 0, sizeof(struct vdev_action_bucket) );
+   memset( cursors, 0, sizeof(cursors) );
+   
+   for( int t = 0; t < 2; t++ ) {
+      
+      if( t > 0 && types[t] == NULL ) {
+         continue;
+      }
+      
+      for( int s = 0; s < 2; s++ ) {
+         
+         if( s > 0 && subsystems[s] == NULL ) {
+            continue;
+         }
+         
+         for( int d = 0; d < 2; d++ ) {
+            
+            if( d > 0 && devtypes[d] == NULL ) {
+               continue;
+            }
+            
+            struct vdev_action_bucket* bucket = NULL;
+            
+            lookup.key = vdev_action_index_key( vreq->type, types[t], subsystems[s], devtypes[d] );
+            if( lookup.key == NULL ) {
+               return -ENOMEM;
+            }
+            
+            bucket = sglib_vdev_action_bucket_find_member( index->buckets, &lookup );
+            
+            free( lookup.key );
+            lookup.key = NULL;
+            
+            if( bucket != NULL ) {
+               
+               buckets[ num_buckets ] = bucket;
+               num_buckets++;
+               
+               num_candidates += bucket->num_acts;
+            }
+         }
+      }
+   }
+   
+   if( num_candidates > 0 ) {
+      
+      candidates = VDEV_CALLOC( int, num_candidates );
+      if( candidates == NULL ) {
+         return -ENOMEM;
+      }
+   }
+   
+   // merge the buckets, preserving order.  Each action is in exactly one bucket.
+   for( size_t i = 0; i < num_candidates; i++ ) {
+      
+      int next = -1;
+      
+      for( int j = 0; j < num_buckets; j++ ) {
+         
+         if( cursors[j] >= buckets[j]->num_acts ) {
+            continue;
+         }
+         
+         if( next < 0 || buckets[j]->acts[ cursors[j] ] < buckets[next]->acts[ cursors[next] ] ) {
+            next = j;
+         }
+      }
+      
+      candidates[i] = buckets[next]->acts[ cursors[next] ];
+      cursors[next]++;
+   }
+   
+   // match the device path against all action paths in one pass, and drop candidates whose paths don't match
+   if( num_candidates > 0 && index->paths.num_patterns > 0 ) {
       
-      if( rc > 0 ) {
-         return i;
+      path_matched = VDEV_CALLOC( bool, index->paths.num_patterns );
+      if( path_matched == NULL ) {
+         
+         free( candidates );
+         return -ENOMEM;
       }
-      else if( rc < 0 ) {
+      
+      rc = vdev_match_set( &index->paths, vreq->path, path_matched );
+      if( rc != 0 ) {
+         
+         vdev_error("vdev_match_set('%s') rc = %d\n", vreq->path, rc );
+         free( path_matched );
+         free( candidates );
          return rc;
       }
+      
+      for( size_t i = 0; i < num_candidates; i++ ) {
+         
+         int pattern = index->path_patterns[ candidates[i] ];
+         
+         if( pattern >= 0 && !path_matched[ pattern ] ) {
+            continue;
+         }
+         
+         candidates[ num_path_matched ] = candidates[i];
+         num_path_matched++;
+      }
+      
+      num_candidates = num_path_matched;
+      free( path_matched );
    }
    
-   return num_acts;
+   *ret_candidates = candidates;
+   *ret_num_candidates = num_candidates;
+   
+   return 0;
+}
+
+
+// get the candidate actions for a device request, using the index if we have one.
+// candidates' paths match the device path; they still need to be checked with vdev_action_match_fields.
+// return 0 on success, and set *ret_candidates and *ret_num_candidates
+// return -ENOMEM on OOM
+// return negative on path match error
+static int vdev_action_find_candidates( struct vdev_device_request* vreq, struct vdev_action** acts, size_t num_acts, struct vdev_action_index* index, int** ret_candidates, size_t* ret_num_candidates ) {
+   
+   int rc = 0;
+   int* candidates = NULL;
+   size_t num_candidates = 0;
+   
+   if( index != NULL ) {
+      return vdev_action_index_candidates( index, vreq, ret_candidates, ret_num_candidates );
+   }
+   
+   // consider them all 
+   if( num_acts > 0 ) {
+      
+      candidates = VDEV_CALLOC( int, num_acts );
+      if( candidates == NULL ) {
+         return -ENOMEM;
+      }
+      
+      for( unsigned int i = 0; i < num_acts; i++ ) {
+         
+         rc = vdev_action_match_path( vreq, acts[i] );
+         if( rc < 0 ) {
+            
+            vdev_error("vdev_action_match_path(%s, action = %s) rc = %d\n", vreq->path, acts[i]->name, rc );
+            free( candidates );
+            return rc;
+         }
+         
+         if( rc == 0 ) {
+            continue;
+         }
+         
+         candidates[ num_candidates ] = i;
+         num_candidates++;
+      }
+   }
+   
+   *ret_candidates = candidates;
+   *ret_num_candidates = num_candidates;
+   return 0;
 }
 
 
@@ -1513,72 +2476,75 @@ int vdev_action_find_next( struct vdev_device_request* vreq, struct vdev_action*
 // return 0 on success
 // return -EINVAL if *path is not NULL, or if we failed to match the vreq against our actions due to a regex error 
 // return -ENODATA if *path has zero-length
-int vdev_action_create_path( struct vdev_device_request* vreq, struct vdev_action* acts, size_t num_acts, char** path ) {
+int vdev_action_create_path( struct vdev_device_request* vreq, struct vdev_action** acts, size_t num_acts, struct vdev_action_index* index, char** path ) {
    
    int rc = 0;
-   int act_offset = 0;
    int i = 0;
    char* new_path = NULL;
+   int* candidates = NULL;
+   size_t num_candidates = 0;
    
    if( *path != NULL ) {
       return -EINVAL;
    }
    
-   while( act_offset < (signed)num_acts ) {
+   // which actions might match?
+   rc = vdev_action_find_candidates( vreq, acts, num_acts, index, &candidates, &num_candidates );
+   if( rc != 0 ) {
       
-      rc = 0;
+      vdev_error("vdev_action_find_candidates(%s) rc = %d\n", vreq->path, rc );
+      return rc;
+   }
+   
+   for( unsigned int c = 0; c < num_candidates; c++ ) {
+      
+      i = candidates[c];
       
       // skip this action if there is no rename command 
-      if( acts[act_offset].rename_command == NULL ) {
-         act_offset++;
+      if( acts[i]->rename_command == NULL ) {
          continue;
       }
       
-      // find the next action that matches this path
-      rc = vdev_action_find_next( vreq, acts + act_offset, num_acts - act_offset );
-      
-      if( rc == (signed)(num_acts - act_offset) ) {
+      // does this action match this path?
+      rc = vdev_action_match_fields( vreq, acts[i] );
+      if( rc < 0 ) {
          
-         // not found 
-         rc = 0;
+         // error
+         vdev_error("vdev_action_match_fields(%s, action = %s) rc = %d\n", vreq->path, acts[i]->name, rc );
          break;
       }
-      else if( rc < 0 ) {
+      else if( rc == 0 ) {
          
-         // error
-         vdev_error("vdev_action_find_next(%s, offset = %d) rc = %d\n", vreq->path, act_offset, rc );
+         // no match 
+         continue;
+      }
+      
+      rc = 0;
+      
+      // generate the new name
+      rc = vdev_action_run_sync( vreq, acts[i]->rename_command, acts[i]->helper_vars, true, &new_path, PATH_MAX + 1 );
+      if( rc < 0 ) {
+         
+         vdev_error("vdev_action_run_sync('%s') rc = %d\n", acts[i]->rename_command, rc );
          break;
       }
       else {
          
-         // matched! advance offset to next action
-         i = act_offset + rc;
-         act_offset += rc + 1;
          rc = 0;
          
-         if( acts[i].rename_command == NULL ) {
-            continue;
+         if( *path != NULL ) {
+            free( *path );
          }
          
-         // generate the new name
-         rc = vdev_action_run_sync( vreq, acts[i].rename_command, acts[i].helper_vars, true, &new_path, PATH_MAX + 1 );
-         if( rc < 0 ) {
-            
-            vdev_error("vdev_action_run_sync('%s') rc = %d\n", acts[i].rename_command, rc );
-            break;
-         }
-         else {
-            
-            if( *path != NULL ) {
-               free( *path );
-            }
-            
-            *path = new_path;
-            new_path = NULL;
-         }
+         *path = new_path;
+         new_path = NULL;
       }
    }
    
+   if( candidates != NULL ) {
+      free( candidates );
+   }
+   
    if( *path != NULL && strlen(*path) == 0 ) {
       
       // if this is "UNKNOWN", then just reset to "UNKNOWN"
@@ -1602,57 +2568,116 @@ int vdev_action_create_path( struct vdev_device_request* vreq, struct vdev_actio
 }
 
 
+// find out how to schedule a device request, given the actions it matches.
+// its priority is the highest priority any of them sets.  If it is a change request, it is held back
+// for the longest debounce window any of them sets, so a burst of changes to the device can be merged into it.
+// return 0 on success, and set *ret_priority (VDEV_ACTION_PRIORITY_UNSET if none is set) and *ret_debounce_millis (0 if no window applies)
+// return -ENOMEM on OOM
+// return negative on path match error
+int vdev_action_get_scheduling( struct vdev_device_request* vreq, struct vdev_action** acts, size_t num_acts, struct vdev_action_index* index, int* ret_priority, uint64_t* ret_debounce_millis ) {
+   
+   int rc = 0;
+   int i = 0;
+   int* candidates = NULL;
+   size_t num_candidates = 0;
+   int priority = VDEV_ACTION_PRIORITY_UNSET;
+   uint64_t debounce_millis = 0;
+   
+   *ret_priority = VDEV_ACTION_PRIORITY_UNSET;
+   *ret_debounce_millis = 0;
+   
+   // which actions might match?
+   rc = vdev_action_find_candidates( vreq, acts, num_acts, index, &candidates, &num_candidates );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_action_find_candidates(%s) rc = %d\n", vreq->path, rc );
+      return rc;
+   }
+   
+   for( unsigned int c = 0; c < num_candidates; c++ ) {
+      
+      i = candidates[c];
+      
+      if( acts[i]->priority == VDEV_ACTION_PRIORITY_UNSET && acts[i]->debounce_millis == 0 ) {
+         continue;
+      }
+      
+      if( vdev_action_match_fields( vreq, acts[i] ) <= 0 ) {
+         continue;
+      }
+      
+      if( acts[i]->priority != VDEV_ACTION_PRIORITY_UNSET && (priority == VDEV_ACTION_PRIORITY_UNSET || acts[i]->priority < priority) ) {
+         priority = acts[i]->priority;
+      }
+      
+      if( vreq->type == VDEV_DEVICE_CHANGE && acts[i]->debounce_millis > debounce_millis ) {
+         debounce_millis = acts[i]->debounce_millis;
+      }
+   }
+   
+   if( candidates != NULL ) {
+      free( candidates );
+   }
+   
+   *ret_priority = priority;
+   *ret_debounce_millis = debounce_millis;
+   return 0;
+}
+
+
 // run all actions for a device, sequentially, in lexographic order.
 // commands are executed optimistically--even if one fails, the other subsequent ones will be attempted, unless
 // the device already exists and we encounter if_exists=error in one of the matching actions.
 // if the device already exists (given by the exists flag), then only run commands with if_exists set to "run"
 // return 0 on success
 // return negative on failure
-int vdev_action_run_commands( struct vdev_device_request* vreq, struct vdev_action* acts, size_t num_acts, bool exists ) {
+int vdev_action_run_commands( struct vdev_device_request* vreq, struct vdev_action** acts, size_t num_acts, struct vdev_action_index* index, bool exists ) {
    
    int rc = 0;
-   int act_offset = 0;
    int i = 0;
    char const* method = NULL;
    struct timespec start;
    struct timespec end;
+   int* candidates = NULL;
+   size_t num_candidates = 0;
+   
+   // which actions might match?
+   rc = vdev_action_find_candidates( vreq, acts, num_acts, index, &candidates, &num_candidates );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_action_find_candidates(%s) rc = %d\n", vreq->path, rc );
+      return rc;
+   }
    
-   while( act_offset < (signed)num_acts && rc == 0 ) {
+   for( unsigned int c = 0; c < num_candidates && rc == 0; c++ ) {
+      
+      i = candidates[c];
       
       // skip this action if there is no command 
-      if( acts[act_offset].command == NULL ) {
-         act_offset++;
+      if( acts[i]->command == NULL ) {
          continue;
       }
       
-      // find the next action that matches this path 
-      rc = vdev_action_find_next( vreq, acts + act_offset, num_acts - act_offset );
-      
-      if( rc == (signed)(num_acts - act_offset) ) {
+      // does this action match this path?
+      rc = vdev_action_match_fields( vreq, acts[i] );
+      if( rc < 0 ) {
          
-         // not found 
-         rc = 0;
+         vdev_error("vdev_action_match_fields(%s, action = %s) rc = %d\n", vreq->path, acts[i]->name, rc );
          break;
       }
-      else if( rc < 0 ) {
+      else if( rc == 0 ) {
          
-         vdev_error("vdev_action_find_next(%s, offset = %d) rc = %d\n", vreq->path, act_offset, rc );
-         break;
+         // no match 
+         continue;
       }
       else {
          
-         // matched! advance offset to next action
-         i = act_offset + rc;
-         act_offset += rc + 1;
+         // matched!
          rc = 0;
          
-         if( acts[i].command == NULL ) {
-            continue;
-         }
-         
-         if( vreq->type == VDEV_DEVICE_ADD && exists && acts[i].if_exists != VDEV_IF_EXISTS_RUN ) {
+         if( vreq->type == VDEV_DEVICE_ADD && exists && acts[i]->if_exists != VDEV_IF_EXISTS_RUN ) {
             
-            if( acts[i].if_exists == VDEV_IF_EXISTS_ERROR ) {
+            if( acts[i]->if_exists == VDEV_IF_EXISTS_ERROR ) {
                
                vdev_error("Will stop processing %s, since it already exists\n", vreq->path );
                rc = 1;
@@ -1669,24 +2694,24 @@ int vdev_action_run_commands( struct vdev_device_request* vreq, struct vdev_acti
          clock_gettime( CLOCK_MONOTONIC, &start );
          
          // what kind of action to take?
-         if( !acts[i].is_daemonlet ) {
+         if( !acts[i]->is_daemonlet ) {
          
-            if( acts[i].async ) {
+            if( acts[i]->async ) {
                
                // fork a subprocess and handle asynchronously
                method = "vdev_action_run_async";
-               rc = vdev_action_run_async( vreq, acts[i].command, acts[i].helper_vars, acts[i].use_shell );
+               rc = vdev_action_run_async( vreq, acts[i]->command, acts[i]->helper_vars, acts[i]->use_shell );
             }
             else {
                
                // run as a subprocess, wait, and join with it
                method = "vdev_action_run_sync";
-               rc = vdev_action_run_sync( vreq, acts[i].command, acts[i].helper_vars, acts[i].use_shell, NULL, 0 );
+               rc = vdev_action_run_sync( vreq, acts[i]->command, acts[i]->helper_vars, acts[i]->use_shell, NULL, 0 );
             }
          }
          else {
             
-            if( acts[i].async ) {
+            if( acts[i]->async ) {
                
                // run as a daemonlet, feed it the request, but don't wait for a reply
                method = "vdev_action_run_daemonlet_async";
@@ -1697,17 +2722,31 @@ int vdev_action_run_commands( struct vdev_device_request* vreq, struct vdev_acti
                method = "vdev_action_run_daemonlet";
             }
             
-            rc = vdev_action_run_daemonlet( vreq, &acts[i] );
+            rc = vdev_action_run_daemonlet( vreq, acts[i] );
          }
          
          clock_gettime( CLOCK_MONOTONIC, &end );
          
+         vdev_device_request_trace( vreq, VDEV_TRACE_ACTION, acts[i]->name, &start, &end );
+         
+         // record the latency, unless the completion thread will (i.e. for a dispatched asynchronous daemonlet request)
+         if( rc != 0 || !acts[i]->is_daemonlet || !acts[i]->async ) {
+            
+            int kind = acts[i]->is_daemonlet ? VDEV_STATS_DAEMONLET : (acts[i]->async ? VDEV_STATS_ASYNC : VDEV_STATS_SYNC);
+            
+            pthread_mutex_lock( &acts[i]->lock );
+            
+            vdev_histogram_add( &acts[i]->latency[ kind ][ rc == 0 ? VDEV_STATS_SUCCESS : VDEV_STATS_FAILURE ], vdev_stats_nanos( &start, &end ) );
+            
+            pthread_mutex_unlock( &acts[i]->lock );
+         }
+         
          if( rc != 0 ) {
             
-            vdev_error("%s('%s') rc = %d\n", method, acts[i].command, rc );
+            vdev_error("%s('%s') rc = %d\n", method, acts[i]->command, rc );
             
             if( rc < 0 ) {
-               return rc;
+               break;
             }
             else {
                
@@ -1715,26 +2754,31 @@ int vdev_action_run_commands( struct vdev_device_request* vreq, struct vdev_acti
                uint64_t start_millis = 1000L * start.tv_sec + (start.tv_nsec / 1000000L);
                uint64_t end_millis = 1000L * end.tv_sec + (end.tv_nsec / 1000000L);
                
-               vdev_debug("Benchmark: action %s failed (exit %d) in %lu millis\n", acts[i].name, rc, (unsigned long)(end_millis - start_millis) );
+               vdev_debug("Benchmark: action %s failed (exit %d) in %lu millis\n", acts[i]->name, rc, (unsigned long)(end_millis - start_millis) );
                rc = 0;
             }
          }
-         else {
+         else if( acts[i]->is_daemonlet && acts[i]->async ) {
             
-            // success! update benchmark 
-            acts[i].num_successful_calls++;
+            // the completion thread will record how it went 
+            vdev_debug("Benchmark: action %s dispatched\n", acts[i]->name );
+         }
+         else {
             
+            // success! 
             uint64_t start_millis = 1000L * start.tv_sec + (start.tv_nsec / 1000000L);
             uint64_t end_millis = 1000L * end.tv_sec + (end.tv_nsec / 1000000L);
             
-            acts[i].cumulative_time_millis += (end_millis - start_millis);
-            
             // log timings directly, for finer granularity...
-            vdev_debug("Benchmark: action %s succeeded in %lu millis\n", acts[i].name, (unsigned long)(end_millis - start_millis) );
+            vdev_debug("Benchmark: action %s succeeded in %lu millis\n", acts[i]->name, (unsigned long)(end_millis - start_millis) );
          }
       }
    }
    
+   if( candidates != NULL ) {
+      free( candidates );
+   }
+   
    if( rc > 0 ) {
       
       // not an error, but a cause to abort
@@ -1750,15 +2794,37 @@ int vdev_action_run_commands( struct vdev_device_request* vreq, struct vdev_acti
 int vdev_action_log_benchmarks( struct vdev_action* action ) {
    
    int rc = 0;
+   struct vdev_histogram success;
+   
+   memset( &success, 0, sizeof(struct vdev_histogram) );
+   
+   pthread_mutex_lock( &action->lock );
    
-   if( action->num_successful_calls > 0 ) {
-      vdev_debug("Action '%s' (daemon=%d, async=%d): %lu successful calls; %lu millis total; %lf avg.\n",
-                 action->name, action->is_daemonlet, action->async, action->num_successful_calls, action->cumulative_time_millis, (double)(action->cumulative_time_millis) / (double)(action->num_successful_calls));
+   for( int i = 0; i < VDEV_STATS_NUM_KINDS; i++ ) {
+      vdev_histogram_merge( &success, &action->latency[i][ VDEV_STATS_SUCCESS ] );
+   }
+   
+   pthread_mutex_unlock( &action->lock );
+   
+   if( success.count > 0 ) {
+      vdev_debug("Action '%s' (daemon=%d, async=%d): %" PRIu64 " successful calls; %lf millis total; %lf avg.; %lf millis p99\n",
+                 action->name, action->is_daemonlet, action->async, success.count, (double)success.sum_nanos / 1e6, (double)success.sum_nanos / 1e6 / (double)success.count, (double)vdev_histogram_quantile( &success, 0.99 ) / 1e6 );
    }
    else {
       vdev_debug("Action '%s' (daemon=%d, async=%d): 0 successful calls\n", action->name, action->is_daemonlet, action->async );
    }
    
+   if( action->daemonlets != NULL ) {
+      
+      for( int i = 0; i < action->num_daemonlets; i++ ) {
+         
+         struct vdev_daemonlet* dlet = &action->daemonlets[i];
+         
+         vdev_debug("Action '%s' daemonlet %d: %lu starts; %lu requests; %lu failures; %lu millis total\n",
+                    action->name, i, (unsigned long)dlet->num_starts, (unsigned long)dlet->num_requests, (unsigned long)dlet->num_failures, (unsigned long)dlet->cumulative_time_millis );
+      }
+   }
+   
    return 0;
 }
 
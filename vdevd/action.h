@@ -25,6 +25,13 @@
 #include "libvdev/util.h"
 #include "libvdev/param.h"
 #include "libvdev/config.h"
+#include "libvdev/match.h"
+#include "libvdev/daemonlet.h"
+#include "libvdev/spawn.h"
+
+#include "completion.h"
+#include "stats.h"
+#include "trace.h"
 
 #include "device.h"
 
@@ -53,6 +60,42 @@
 #define VDEV_ACTION_IF_EXISTS_RUN       "run"
 
 #define VDEV_ACTION_DAEMONLET           "daemonlet"
+#define VDEV_ACTION_DAEMONLET_PROTOCOL  "daemonlet_protocol"
+#define VDEV_ACTION_DAEMONLET_INSTANCES "daemonlet_instances"
+#define VDEV_ACTION_DEBOUNCE           "debounce"
+#define VDEV_ACTION_PRIORITY           "priority"
+
+#define VDEV_ACTION_PRIORITY_HIGH       "high"
+#define VDEV_ACTION_PRIORITY_NORMAL     "normal"
+#define VDEV_ACTION_PRIORITY_LOW        "low"
+
+// the action does not set a priority
+#define VDEV_ACTION_PRIORITY_UNSET      -1
+
+// most daemonlet instances an action can have 
+#define VDEV_ACTION_DAEMONLET_MAX_INSTANCES     256
+
+// most requests an asynchronous daemonlet instance can have outstanding
+#define VDEV_ACTION_DAEMONLET_MAX_INFLIGHT      64
+
+// space for replies that have been read from an asynchronous daemonlet, but not yet parsed
+#define VDEV_ACTION_DAEMONLET_REPLY_BUF_LEN     256
+
+// seconds to wait for an asynchronous daemonlet's outstanding replies when stopping it
+#define VDEV_ACTION_DAEMONLET_DRAIN_TIMEOUT     5
+
+struct vdev_action;
+
+// a request sent to an asynchronous daemonlet, awaiting its reply 
+struct vdev_daemonlet_inflight {
+   
+   uint32_t seq;
+   struct timespec start;
+   
+   // where to trace the reply, and as which event 
+   struct vdev_trace* trace;
+   uint64_t trace_id;
+};
 
 enum vdev_action_if_exists {
    VDEV_IF_EXISTS_ERROR = 1,
@@ -60,6 +103,38 @@ enum vdev_action_if_exists {
    VDEV_IF_EXISTS_RUN
 };
 
+// a daemonlet process, one of an action's pool of instances
+struct vdev_daemonlet {
+   
+   pid_t pid;
+   int stdin_fd;
+   int stdout_fd;
+   
+   // is a device worker using it?
+   bool busy;
+   
+   // next request sequence number 
+   uint32_t next_seq;
+   
+   // asynchronous daemonlets only: outstanding requests, oldest first (covered by the action's lock)
+   struct vdev_daemonlet_inflight inflight[ VDEV_ACTION_DAEMONLET_MAX_INFLIGHT ];
+   int num_inflight;
+   
+   // asynchronous daemonlets only: replies are collected by the completion thread, which needs these
+   struct vdev_action* act;
+   struct vdev_completion* completion;
+   uint64_t completion_id;
+   bool ready;
+   char reply_buf[ VDEV_ACTION_DAEMONLET_REPLY_BUF_LEN ];
+   size_t reply_len;
+   
+   // instance runtime statistics
+   uint64_t num_starts;
+   uint64_t num_requests;
+   uint64_t num_failures;
+   uint64_t cumulative_time_millis;
+};
+
 // vdev action to take on an event 
 struct vdev_action {
    
@@ -71,7 +146,7 @@ struct vdev_action {
    
    // device path to match on 
    char* path;
-   regex_t path_regex;
+   struct vdev_match_pattern path_pattern;
    
    // device type to match on (block, char)
    bool has_type;
@@ -102,34 +177,108 @@ struct vdev_action {
    // how to handle the case where the device already exists 
    int if_exists;
    
+   // how long to wait for a burst of change events on a device to subside before running this action, in milliseconds (0 to not wait)
+   uint64_t debounce_millis;
+   
+   // workqueue lane for the requests this action matches, or VDEV_ACTION_PRIORITY_UNSET
+   int priority;
+   
    // is the action's command implemented as a daemonlet?  If so, hold onto its runtime state 
    bool is_daemonlet;
-   int daemonlet_stdin;
-   int daemonlet_stdout;
-   pid_t daemonlet_pid;
+   vdev_daemonlet_protocol_t daemonlet_protocol;
    
-   // action runtime statistics 
-   uint64_t num_successful_calls;
-   uint64_t cumulative_time_millis;
+   // pool of daemonlet instances, so device workers can use the daemonlet concurrently
+   int num_daemonlets;
+   struct vdev_daemonlet* daemonlets;
+   
+   // signaled when a daemonlet instance becomes idle
+   pthread_cond_t daemonlet_idle;
+   
+   // action runtime statistics: latency of running the command, by how it ran (VDEV_STATS_SYNC, etc.) and how it went
+   struct vdev_histogram latency[ VDEV_STATS_NUM_KINDS ][ VDEV_STATS_NUM_OUTCOMES ];
+   
+   // lock governing access to the daemonlet pool and the statistics, since device workers share actions
+   pthread_mutex_t lock;
+   
+   // which version of which file the action was loaded from, so a reload can tell whether it changed
+   dev_t file_dev;
+   ino_t file_ino;
+   off_t file_size;
+   struct timespec file_mtime;
+   struct timespec file_ctime;
+   
+   // number of action lists that include this action (updated atomically).
+   // a reload shares unchanged actions, with their daemonlets and statistics, between the old and new lists.
+   volatile int refcount;
 };
 
 typedef struct vdev_action vdev_action;
 
+// OS parameters the action dispatch index is keyed on
+#define VDEV_ACTION_INDEX_PARAM_SUBSYSTEM       "SUBSYSTEM"
+#define VDEV_ACTION_INDEX_PARAM_DEVTYPE         "DEVTYPE"
+
+// action dispatch index bucket: all actions with the same index key.
+// the key is made of the trigger, the device type, and the exact OS_SUBSYSTEM and OS_DEVTYPE values to match,
+// where an empty field matches anything.
+struct vdev_action_bucket {
+   
+   char* key;
+   
+   // indexes into the action list, in ascending (i.e. lexicographic) order
+   int* acts;
+   size_t num_acts;
+   size_t max_acts;
+   
+   struct vdev_action_bucket* left;
+   struct vdev_action_bucket* right;
+   char color;
+};
+
+typedef struct vdev_action_bucket vdev_action_bucket;
+
+#define VDEV_ACTION_BUCKET_CMP( b1, b2 ) (strcmp( (b1)->key, (b2)->key ))
+
+// action dispatch index, so a device request only gets matched against actions that can match it 
+struct vdev_action_index {
+   
+   struct vdev_action_bucket* buckets;
+   
+   // number of actions indexed
+   size_t num_acts;
+   
+   // all action paths, so a device path gets matched against every action at once
+   struct vdev_match_set paths;
+   
+   // index into paths for each action, or -1 if the action has no path
+   int* path_patterns;
+};
+
 C_LINKAGE_BEGIN
 
+SGLIB_DEFINE_RBTREE_PROTOTYPES( vdev_action_bucket, left, right, color, VDEV_ACTION_BUCKET_CMP );
+
 int vdev_action_init( struct vdev_action* act, vdev_device_request_t trigger, char* path, char* command, char* helper, bool async );
 int vdev_action_add_param( struct vdev_action* act, char const* name, char const* value );
+int vdev_action_add_var( struct vdev_action* act, char const* name, char const* value );
+int vdev_action_setup( struct vdev_action* act, struct stat const* sb );
 int vdev_action_free( struct vdev_action* act );
-int vdev_action_free_all( struct vdev_action* act_list, size_t num_acts );
+int vdev_action_free_all( struct vdev_action** act_list, size_t num_acts );
 
 int vdev_action_load( struct vdev_config* config, char const* path, struct vdev_action* act );
 
-int vdev_action_load_all( struct vdev_config* config, struct vdev_action** acts, size_t* num_acts );
+int vdev_action_load_all( struct vdev_config* config, struct vdev_action*** acts, size_t* num_acts );
+int vdev_action_reload_all( struct vdev_config* config, struct vdev_action** old_acts, size_t num_old_acts, struct vdev_action*** acts, size_t* num_acts, size_t* num_reused );
+
+int vdev_action_index_build( struct vdev_action** acts, size_t num_acts, struct vdev_action_index** index );
+int vdev_action_index_free( struct vdev_action_index* index );
+int vdev_action_index_candidates( struct vdev_action_index* index, struct vdev_device_request* vreq, int** candidates, size_t* num_candidates );
 
-int vdev_action_create_path( struct vdev_device_request* vreq, struct vdev_action* acts, size_t num_acts, char** path );
-int vdev_action_run_commands( struct vdev_device_request* vreq, struct vdev_action* acts, size_t num_acts, bool exists );
+int vdev_action_create_path( struct vdev_device_request* vreq, struct vdev_action** acts, size_t num_acts, struct vdev_action_index* index, char** path );
+int vdev_action_run_commands( struct vdev_device_request* vreq, struct vdev_action** acts, size_t num_acts, struct vdev_action_index* index, bool exists );
+int vdev_action_get_scheduling( struct vdev_device_request* vreq, struct vdev_action** acts, size_t num_acts, struct vdev_action_index* index, int* ret_priority, uint64_t* ret_debounce_millis );
 
-int vdev_action_daemonlet_stop_all( struct vdev_action* actions, size_t num_actions );
+int vdev_action_daemonlet_stop_all( struct vdev_action** actions, size_t num_actions );
 
 int vdev_action_log_benchmarks( struct vdev_action* action );
 
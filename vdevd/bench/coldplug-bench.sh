@@ -0,0 +1,93 @@
+#!/bin/sh -e
+
+# coldplug a fake sysfs tree with vdevd, and print how long it took.
+#
+# usage: coldplug-bench.sh VDEVD FAKE_SYSFS
+#
+# FAKE_SYSFS generates the tree: DISKS disks with PARTS partitions each, NICS network cards with
+# VFS virtual functions each, and TTYS serial ports.  vdevd is pointed at it with sysfs_mountpoint=,
+# so it does not create device files and does not need to run as root.
+#
+# environment:
+#   DISKS     number of disks (default 1000)
+#   PARTS     partitions per disk (default 2)
+#   NICS      number of network cards (default 2)
+#   VFS       virtual functions per network card (default 64)
+#   TTYS      number of serial ports (default 32)
+#   ACTIONS   actions directory to benchmark (default: trivial bench actions)
+#   SCRATCH   where to put the tree, mountpoint, config and logs (default: a temporary directory)
+
+VDEVD=$1
+FAKE_SYSFS=$2
+
+DISKS=${DISKS:-1000}
+PARTS=${PARTS:-2}
+NICS=${NICS:-2}
+VFS=${VFS:-64}
+TTYS=${TTYS:-32}
+
+if [ -z "$VDEVD" ] || [ -z "$FAKE_SYSFS" ]; then 
+   echo "Usage: $0 VDEVD FAKE_SYSFS" >&2
+   exit 1
+fi
+
+if [ -z "$SCRATCH" ]; then 
+   SCRATCH=$(mktemp -d "${TMPDIR:-/tmp}/vdevd-coldplug.XXXXXX")
+   trap 'rm -rf "$SCRATCH"' EXIT
+fi
+
+# the preseed script normally makes the metadata directory
+mkdir -p "$SCRATCH/dev/metadata" "$SCRATCH/helpers"
+
+NUM_DEVICES=$("$FAKE_SYSFS" -d "$DISKS" -p "$PARTS" -n "$NICS" -v "$VFS" -t "$TTYS" "$SCRATCH/sys")
+
+# trivial actions, so the benchmark measures vdevd rather than its helpers
+if [ -z "$ACTIONS" ]; then 
+   ACTIONS="$SCRATCH/actions"
+   mkdir -p "$ACTIONS"
+   
+   cat > "$ACTIONS/tty.act" <<EOA
+[vdev-action]
+event=add
+path=^ttyS
+command=true
+EOA
+
+   cat > "$ACTIONS/block.act" <<EOA
+[vdev-action]
+event=add
+type=block
+command=true
+EOA
+
+   cat > "$ACTIONS/net.act" <<EOA
+[vdev-action]
+event=add
+OS_SUBSYSTEM=net
+command=true
+async=true
+EOA
+fi
+
+cat > "$SCRATCH/vdevd.conf" <<EOC
+[vdev-config]
+actions=$ACTIONS
+helpers=$SCRATCH/helpers
+pidfile=$SCRATCH/vdevd.pid
+logfile=$SCRATCH/vdevd.log
+loglevel=error
+default_permissions=0600
+
+[vdev-OS]
+sysfs_mountpoint=$SCRATCH/sys
+EOC
+
+START=$(date +%s%N)
+"$VDEVD" -c "$SCRATCH/vdevd.conf" -f -1 "$SCRATCH/dev"
+END=$(date +%s%N)
+
+awk -v devices="$NUM_DEVICES" -v nanos="$((END - START))" 'BEGIN {
+   printf "devices: %d (%d disks, %d partitions each; %d nics, %d vfs each; %d ttys)\n", devices, '"$DISKS"', '"$PARTS"', '"$NICS"', '"$VFS"', '"$TTYS"'
+   printf "elapsed: %.6f s\n", nanos / 1e9
+   printf "throughput: %.1f devices/s\n", devices / (nanos / 1e9)
+}'
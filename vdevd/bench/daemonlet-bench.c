@@ -0,0 +1,372 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// daemonlet protocol throughput benchmark.
+// forks a daemonlet that speaks the text or binary protocol, and times round-trips of a 
+// typical device request through it, using the same send/receive code as vdevd.
+
+#include "libvdev/util.h"
+#include "libvdev/daemonlet.h"
+
+#include <time.h>
+
+#define DAEMONLET_BENCH_DEFAULT_REQUESTS        100000
+#define DAEMONLET_BENCH_DEFAULT_VARS            20
+
+// running daemonlet 
+struct daemonlet_bench_child {
+   
+   pid_t pid;
+   int req_fd;
+   int reply_fd;
+};
+
+
+// text-protocol daemonlet main loop: read lines until "done", and reply with "0"
+// return 0 when vdevd closes the pipe 
+static int daemonlet_bench_serve_text( int in_fd, int out_fd ) {
+   
+   FILE* in = fdopen( in_fd, "r" );
+   char* line = NULL;
+   size_t line_len = 0;
+   ssize_t nr = 0;
+   
+   if( in == NULL ) {
+      return -errno;
+   }
+   
+   vdev_daemonlet_ready( out_fd );
+   
+   while( 1 ) {
+      
+      nr = getline( &line, &line_len, in );
+      if( nr <= 0 ) {
+         break;
+      }
+      
+      if( strcmp( line, "done\n" ) != 0 ) {
+         continue;
+      }
+      
+      vdev_write_uninterrupted( out_fd, "0\n", 2 );
+   }
+   
+   free( line );
+   fclose( in );
+   return 0;
+}
+
+
+// binary-protocol daemonlet main loop: read a frame, and reply with 0
+// return 0 when vdevd closes the pipe 
+static int daemonlet_bench_serve_binary( int in_fd, int out_fd ) {
+   
+   int rc = 0;
+   struct vdev_daemonlet_request req;
+   
+   vdev_daemonlet_request_init( &req );
+   vdev_daemonlet_ready( out_fd );
+   
+   while( 1 ) {
+      
+      rc = vdev_daemonlet_binary_recv( in_fd, &req );
+      if( rc != 0 ) {
+         break;
+      }
+      
+      rc = vdev_daemonlet_binary_reply( out_fd, req.seq, 0 );
+      if( rc != 0 ) {
+         break;
+      }
+   }
+   
+   vdev_daemonlet_request_free( &req );
+   return rc == -EPIPE ? 0 : rc;
+}
+
+
+// fork a daemonlet that speaks the given protocol, and wait for it to become ready
+// return 0 on success, and fill in *child
+// return -errno on error
+static int daemonlet_bench_start( vdev_daemonlet_protocol_t protocol, struct daemonlet_bench_child* child ) {
+   
+   int rc = 0;
+   int req_pipe[2];
+   int reply_pipe[2];
+   char ready = 0;
+   
+   if( pipe( req_pipe ) != 0 ) {
+      return -errno;
+   }
+   
+   if( pipe( reply_pipe ) != 0 ) {
+      
+      rc = -errno;
+      close( req_pipe[0] );
+      close( req_pipe[1] );
+      return rc;
+   }
+   
+   child->pid = fork();
+   if( child->pid == 0 ) {
+      
+      close( req_pipe[1] );
+      close( reply_pipe[0] );
+      
+      if( protocol == VDEV_DAEMONLET_PROTOCOL_BINARY ) {
+         rc = daemonlet_bench_serve_binary( req_pipe[0], reply_pipe[1] );
+      }
+      else {
+         rc = daemonlet_bench_serve_text( req_pipe[0], reply_pipe[1] );
+      }
+      
+      _exit( rc == 0 ? 0 : 1 );
+   }
+   else if( child->pid < 0 ) {
+      
+      rc = -errno;
+      close( req_pipe[0] );
+      close( req_pipe[1] );
+      close( reply_pipe[0] );
+      close( reply_pipe[1] );
+      return rc;
+   }
+   
+   close( req_pipe[0] );
+   close( reply_pipe[1] );
+   
+   child->req_fd = req_pipe[1];
+   child->reply_fd = reply_pipe[0];
+   
+   rc = vdev_read_uninterrupted( child->reply_fd, &ready, 1 );
+   if( rc != 1 ) {
+      return -ECHILD;
+   }
+   
+   return 0;
+}
+
+
+// stop a daemonlet by closing its input, and join it 
+static void daemonlet_bench_stop( struct daemonlet_bench_child* child ) {
+   
+   close( child->req_fd );
+   close( child->reply_fd );
+   waitpid( child->pid, NULL, 0 );
+}
+
+
+// make a request environment that looks like what vdevd sends for a block device 
+// return 0 on success, and set *ret_env (a NULL-terminated list)
+// return -ENOMEM on OOM
+static int daemonlet_bench_make_env( int num_vars, char*** ret_env ) {
+   
+   char** env = VDEV_CALLOC( char*, num_vars + 1 );
+   char buf[ 4096 ];
+   
+   static char const* templates[] = {
+      "VDEV_ACTION=add",
+      "VDEV_MOUNTPOINT=/dev",
+      "VDEV_PATH=sda1",
+      "VDEV_METADATA=/dev/metadata/dev/sda1",
+      "VDEV_GLOBAL_METADATA=/dev/metadata",
+      "VDEV_CONFIG_FILE=/etc/vdev/vdevd.conf",
+      "VDEV_MAJOR=8",
+      "VDEV_MINOR=1",
+      "VDEV_MODE=block",
+      "VDEV_HELPERS=/lib/vdev",
+      "VDEV_LOGFILE=/var/log/vdevd.log",
+      "VDEV_INSTANCE=2d7e2ab3b4ef1c8e",
+      "VDEV_OS_DEVPATH=/devices/pci0000:00/0000:00:1f.2/ata1/host0/target0:0:0/0:0:0:0/block/sda/sda1",
+      "VDEV_OS_SUBSYSTEM=block",
+      "VDEV_OS_DEVTYPE=partition",
+      "VDEV_OS_SEQNUM=1234",
+      "VDEV_OS_PARTN=1",
+      "VDEV_OS_DEVNAME=sda1",
+      "VDEV_OS_SYSFS_MOUNTPOINT=/sys",
+      "VDEV_OS_MODALIAS=",
+      NULL
+   };
+   
+   if( env == NULL ) {
+      return -ENOMEM;
+   }
+   
+   for( int i = 0; i < num_vars; i++ ) {
+      
+      if( i < (int)(sizeof(templates) / sizeof(templates[0])) - 1 ) {
+         snprintf( buf, sizeof(buf), "%s", templates[i] );
+      }
+      else {
+         snprintf( buf, sizeof(buf), "VDEV_OS_EXTRA_%d=%d", i, i );
+      }
+      
+      env[i] = vdev_strdup_or_null( buf );
+      if( env[i] == NULL ) {
+         
+         VDEV_FREE_LIST( env );
+         return -ENOMEM;
+      }
+   }
+   
+   *ret_env = env;
+   return 0;
+}
+
+
+// time num_requests round-trips through a daemonlet 
+// return 0 on success, and set *elapsed (in seconds)
+// return negative on error
+static int daemonlet_bench_run( vdev_daemonlet_protocol_t protocol, char** env, size_t num_env, int num_requests, double* elapsed ) {
+   
+   int rc = 0;
+   int64_t status = 0;
+   uint32_t seq = 0;
+   struct daemonlet_bench_child child;
+   struct timespec start, end;
+   
+   rc = daemonlet_bench_start( protocol, &child );
+   if( rc != 0 ) {
+      
+      fprintf(stderr, "daemonlet_bench_start rc = %d\n", rc );
+      return rc;
+   }
+   
+   clock_gettime( CLOCK_MONOTONIC, &start );
+   
+   for( int i = 0; i < num_requests; i++ ) {
+      
+      if( protocol == VDEV_DAEMONLET_PROTOCOL_BINARY ) {
+         
+         rc = vdev_daemonlet_binary_send( child.req_fd, (uint32_t)i, env, num_env );
+         if( rc == 0 ) {
+            rc = vdev_daemonlet_binary_recv_status( child.reply_fd, &seq, &status );
+         }
+         
+         if( rc == 0 && seq != (uint32_t)i ) {
+            rc = -EBADMSG;
+         }
+      }
+      else {
+         
+         rc = vdev_daemonlet_text_send( child.req_fd, env, num_env );
+         if( rc == 0 ) {
+            rc = vdev_daemonlet_text_recv_status( child.reply_fd, &status );
+         }
+      }
+      
+      if( rc != 0 || status != 0 ) {
+         
+         fprintf(stderr, "request %d: rc = %d, status = %d\n", i, rc, (int)status );
+         rc = (rc != 0 ? rc : -EIO);
+         break;
+      }
+   }
+   
+   clock_gettime( CLOCK_MONOTONIC, &end );
+   
+   daemonlet_bench_stop( &child );
+   
+   *elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   return rc;
+}
+
+
+static void usage( char const* progname ) {
+   
+   fprintf(stderr, "Usage: %s [-n NUM_REQUESTS] [-v NUM_VARIABLES]\n", progname );
+   exit(1);
+}
+
+
+int main( int argc, char** argv ) {
+   
+   int rc = 0;
+   int c = 0;
+   int num_requests = DAEMONLET_BENCH_DEFAULT_REQUESTS;
+   int num_vars = DAEMONLET_BENCH_DEFAULT_VARS;
+   char** env = NULL;
+   double elapsed[2];
+   
+   vdev_daemonlet_protocol_t protocols[2] = {
+      VDEV_DAEMONLET_PROTOCOL_TEXT,
+      VDEV_DAEMONLET_PROTOCOL_BINARY
+   };
+   
+   char const* names[2] = {
+      VDEV_DAEMONLET_PROTOCOL_TEXT_STR,
+      VDEV_DAEMONLET_PROTOCOL_BINARY_STR
+   };
+   
+   while( (c = getopt( argc, argv, "n:v:" )) != -1 ) {
+      
+      switch( c ) {
+         
+         case 'n': {
+            
+            num_requests = atoi( optarg );
+            break;
+         }
+         
+         case 'v': {
+            
+            num_vars = atoi( optarg );
+            break;
+         }
+         
+         default: {
+            
+            usage( argv[0] );
+         }
+      }
+   }
+   
+   if( num_requests <= 0 || num_vars < 0 ) {
+      usage( argv[0] );
+   }
+   
+   rc = daemonlet_bench_make_env( num_vars, &env );
+   if( rc != 0 ) {
+      
+      fprintf(stderr, "daemonlet_bench_make_env rc = %d\n", rc );
+      exit(1);
+   }
+   
+   printf("%d requests, %d variables each\n", num_requests, num_vars );
+   
+   for( int i = 0; i < 2; i++ ) {
+      
+      rc = daemonlet_bench_run( protocols[i], env, num_vars, num_requests, &elapsed[i] );
+      if( rc != 0 ) {
+         
+         fprintf(stderr, "%s protocol failed: rc = %d\n", names[i], rc );
+         VDEV_FREE_LIST( env );
+         exit(1);
+      }
+      
+      printf("%-8s %10.3f s %12.0f req/s %10.2f us/req\n", names[i], elapsed[i], num_requests / elapsed[i], 1e6 * elapsed[i] / num_requests );
+   }
+   
+   printf("speedup  %10.2fx\n", elapsed[0] / elapsed[1] );
+   
+   VDEV_FREE_LIST( env );
+   return 0;
+}
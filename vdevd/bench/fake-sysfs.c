@@ -0,0 +1,631 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// generate a fake sysfs tree, for benchmarking coldplug on machines without the hardware.
+// builds $DIR/devices with the uevent, dev, and subsystem files vdevd reads, a few of the
+// attributes helpers read, and the class/, bus/, block/, and dev/ symlinks pointing into it:
+// a JBOD of disks behind SCSI hosts, NICs with SR-IOV virtual functions, and serial ports.
+// device numbers are unique, but are not the ones the kernel would assign.
+// point vdevd at it with sysfs_mountpoint= in the [vdev-OS] section of its config file.
+
+#include "libvdev/util.h"
+
+#include <stdarg.h>
+
+// disks per SCSI host 
+#define FAKE_SYSFS_DISKS_PER_HOST       256
+
+// first device/function number of a NIC's virtual functions, relative to its own
+#define FAKE_SYSFS_VF_OFFSET            16
+
+#define FAKE_SYSFS_DISK_MAJOR           8
+#define FAKE_SYSFS_DISK_MINORS          16
+#define FAKE_SYSFS_TTY_MAJOR            4
+#define FAKE_SYSFS_TTY_MINOR_BASE       64
+
+// tree being generated 
+struct fake_sysfs {
+   
+   char const* root;
+   
+   // devices with non-empty uevent files, i.e. the ones vdevd will register
+   unsigned long num_devices;
+   
+   // next free PCI bus and interface index
+   int next_bus;
+   int next_ifindex;
+};
+
+
+// format a path into a PATH_MAX+1 buffer, truncating it if need be
+static void fake_sysfs_path( char* path, char const* fmt, ... ) {
+   
+   va_list args;
+   
+   va_start( args, fmt );
+   vsnprintf( path, PATH_MAX+1, fmt, args );
+   va_end( args );
+}
+
+
+// make a directory in the tree, if it doesn't exist already 
+// return 0 on success
+// return -errno on failure
+static int fake_sysfs_mkdir( struct fake_sysfs* fs, char const* path ) {
+   
+   char full_path[ PATH_MAX+1 ];
+   
+   fake_sysfs_path( full_path, "%s/%s", fs->root, path );
+   
+   if( mkdir( full_path, 0755 ) != 0 && errno != EEXIST ) {
+      
+      fprintf(stderr, "mkdir('%s'): %s\n", full_path, strerror(errno) );
+      return -errno;
+   }
+   
+   return 0;
+}
+
+
+// write a file in a directory in the tree 
+// return 0 on success
+// return -errno on failure
+static int fake_sysfs_write( struct fake_sysfs* fs, char const* dir, char const* name, char const* fmt, ... ) {
+   
+   int rc = 0;
+   char full_path[ PATH_MAX+1 ];
+   char buf[ 4096 ];
+   va_list args;
+   
+   va_start( args, fmt );
+   vsnprintf( buf, sizeof(buf), fmt, args );
+   va_end( args );
+   
+   fake_sysfs_path( full_path, "%s/%s/%s", fs->root, dir, name );
+   
+   rc = vdev_write_file( full_path, buf, strlen(buf), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+   if( rc < 0 ) {
+      
+      fprintf(stderr, "write('%s'): %s\n", full_path, strerror(-rc) );
+      return rc;
+   }
+   
+   return 0;
+}
+
+
+// symlink path to target, both relative to the root of the tree, as sysfs does: with a relative target 
+// return 0 on success
+// return -errno on failure
+static int fake_sysfs_link( struct fake_sysfs* fs, char const* path, char const* target ) {
+   
+   char full_path[ PATH_MAX+1 ];
+   char rel_target[ PATH_MAX+1 ];
+   size_t len = 0;
+   
+   // one ../ per directory the link is in
+   for( char const* p = strchr( path, '/' ); p != NULL && len + 3 < PATH_MAX; p = strchr( p + 1, '/' ) ) {
+      
+      memcpy( rel_target + len, "../", 3 );
+      len += 3;
+   }
+   
+   snprintf( rel_target + len, PATH_MAX - len, "%s", target );
+   fake_sysfs_path( full_path, "%s/%s", fs->root, path );
+   
+   if( symlink( rel_target, full_path ) != 0 && errno != EEXIST ) {
+      
+      fprintf(stderr, "symlink('%s'): %s\n", full_path, strerror(errno) );
+      return -errno;
+   }
+   
+   return 0;
+}
+
+
+// make a device directory, with its uevent file and subsystem link, and link to it from its class or bus.
+// subsystem is "class/NAME" or "bus/NAME".
+// if major is non-negative, also give it a dev file, and link to it from dev/block or dev/char.
+// return 0 on success
+// return -errno on failure
+static int fake_sysfs_device( struct fake_sysfs* fs, char const* devpath, char const* subsystem, int major, int minor, char const* uevent_fmt, ... ) {
+   
+   int rc = 0;
+   char path[ PATH_MAX+1 ];
+   char uevent[ 4096 ];
+   char const* name = strrchr( devpath, '/' ) + 1;
+   va_list args;
+   
+   va_start( args, uevent_fmt );
+   vsnprintf( uevent, sizeof(uevent), uevent_fmt, args );
+   va_end( args );
+   
+   rc = fake_sysfs_mkdir( fs, devpath );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   if( major >= 0 ) {
+      
+      // real uevent files lead with the device numbers
+      rc = fake_sysfs_write( fs, devpath, "uevent", "MAJOR=%d\nMINOR=%d\n%s", major, minor, uevent );
+   }
+   else {
+      
+      rc = fake_sysfs_write( fs, devpath, "uevent", "%s", uevent );
+   }
+   
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   fake_sysfs_path( path, "%s/subsystem", devpath );
+   
+   rc = fake_sysfs_link( fs, path, subsystem );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   if( strncmp( subsystem, "bus/", 4 ) == 0 ) {
+      fake_sysfs_path( path, "%s/devices/%s", subsystem, name );
+   }
+   else {
+      fake_sysfs_path( path, "%s/%s", subsystem, name );
+   }
+   
+   rc = fake_sysfs_link( fs, path, devpath );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   if( major >= 0 ) {
+      
+      rc = fake_sysfs_write( fs, devpath, "dev", "%d:%d\n", major, minor );
+      if( rc != 0 ) {
+         return rc;
+      }
+      
+      fake_sysfs_path( path, "dev/%s/%d:%d", (strcmp( subsystem, "class/block" ) == 0 ? "block" : "char"), major, minor );
+      
+      rc = fake_sysfs_link( fs, path, devpath );
+      if( rc != 0 ) {
+         return rc;
+      }
+   }
+   
+   if( uevent[0] != '\0' || major >= 0 ) {
+      fs->num_devices++;
+   }
+   
+   return 0;
+}
+
+
+// name the i'th SCSI disk like the kernel does: sda ... sdz, sdaa ... sdzz, sdaaa ...
+static void fake_sysfs_disk_name( unsigned long i, char* name ) {
+   
+   char suffix[ 16 ];
+   int len = 0;
+   
+   do {
+      
+      suffix[ len++ ] = 'a' + (i % 26);
+      i = i / 26;
+   } while( i-- > 0 );
+   
+   strcpy( name, "sd" );
+   
+   for( int j = 0; j < len; j++ ) {
+      
+      name[ 2 + j ] = suffix[ len - 1 - j ];
+   }
+   
+   name[ 2 + len ] = '\0';
+}
+
+
+// make a PCI function under a host bridge or root port 
+// return 0 on success
+// return -errno on failure
+static int fake_sysfs_pci( struct fake_sysfs* fs, char const* devpath, char const* slot, char const* driver, char const* pci_class, char const* vendor, char const* device ) {
+   
+   return fake_sysfs_device( fs, devpath, "bus/pci", -1, -1, 
+                             "DRIVER=%s\nPCI_CLASS=%s\nPCI_ID=%s:%s\nPCI_SUBSYS_ID=%s:0000\nPCI_SLOT_NAME=%s\nMODALIAS=pci:v0000%sd0000%ssv0000%ssd00000000bc%.2ssc%.2si%.2s\n",
+                             driver, pci_class, vendor, device, vendor, slot, vendor, device, vendor, pci_class, pci_class + 2, pci_class + 4 );
+}
+
+
+// make a JBOD: a storage controller, with num_disks disks spread across SCSI hosts, each with num_parts partitions 
+// return 0 on success
+// return -errno on failure
+static int fake_sysfs_disks( struct fake_sysfs* fs, unsigned long num_disks, int num_parts ) {
+   
+   int rc = 0;
+   char const* hba = "devices/pci0000:00/0000:00:01.0";
+   char lun[ PATH_MAX+1 ];
+   char path[ PATH_MAX+1 ];
+   char disk[ PATH_MAX+1 ];
+   char part[ PATH_MAX+1 ];
+   char name[ 32 ];
+   
+   rc = fake_sysfs_pci( fs, hba, "0000:00:01.0", "mpt3sas", "010700", "1000", "0097" );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   for( unsigned long i = 0; i < num_disks; i++ ) {
+      
+      unsigned long host = i / FAKE_SYSFS_DISKS_PER_HOST;
+      unsigned long target = i % FAKE_SYSFS_DISKS_PER_HOST;
+      int minor = (int)(i * FAKE_SYSFS_DISK_MINORS);
+      
+      if( target == 0 ) {
+         
+         fake_sysfs_path( path, "%s/host%lu", hba, host );
+         
+         rc = fake_sysfs_device( fs, path, "bus/scsi", -1, -1, "DEVTYPE=scsi_host\n" );
+         if( rc != 0 ) {
+            return rc;
+         }
+      }
+      
+      fake_sysfs_path( path, "%s/host%lu/target%lu:0:%lu", hba, host, host, target );
+      
+      rc = fake_sysfs_device( fs, path, "bus/scsi", -1, -1, "DEVTYPE=scsi_target\n" );
+      if( rc != 0 ) {
+         return rc;
+      }
+      
+      fake_sysfs_path( lun, "%s/%lu:0:%lu:0", path, host, target );
+      
+      rc = fake_sysfs_device( fs, lun, "bus/scsi", -1, -1, "DEVTYPE=scsi_device\nDRIVER=sd\nMODALIAS=scsi:t-0x00\n" );
+      if( rc == 0 ) {
+         rc = fake_sysfs_write( fs, lun, "vendor", "ATA     \n" );
+      }
+      if( rc == 0 ) {
+         rc = fake_sysfs_write( fs, lun, "model", "FAKE DISK %lu\n", i );
+      }
+      if( rc == 0 ) {
+         rc = fake_sysfs_write( fs, lun, "type", "0\n" );
+      }
+      if( rc != 0 ) {
+         return rc;
+      }
+      
+      fake_sysfs_disk_name( i, name );
+      
+      fake_sysfs_path( path, "%s/block", lun );
+      
+      rc = fake_sysfs_mkdir( fs, path );
+      if( rc != 0 ) {
+         return rc;
+      }
+      
+      fake_sysfs_path( disk, "%s/block/%s", lun, name );
+      
+      rc = fake_sysfs_device( fs, disk, "class/block", FAKE_SYSFS_DISK_MAJOR, minor, "DEVNAME=%s\nDEVTYPE=disk\n", name );
+      if( rc == 0 ) {
+         rc = fake_sysfs_write( fs, disk, "size", "7814037168\n" );
+      }
+      if( rc == 0 ) {
+         rc = fake_sysfs_write( fs, disk, "ro", "0\n" );
+      }
+      if( rc == 0 ) {
+         rc = fake_sysfs_write( fs, disk, "removable", "0\n" );
+      }
+      if( rc != 0 ) {
+         return rc;
+      }
+      
+      // the request queue's attributes are in a subdirectory without a uevent, like on a real disk
+      fake_sysfs_path( path, "%s/queue", disk );
+      
+      rc = fake_sysfs_mkdir( fs, path );
+      if( rc == 0 ) {
+         rc = fake_sysfs_write( fs, path, "rotational", "1\n" );
+      }
+      if( rc == 0 ) {
+         rc = fake_sysfs_write( fs, path, "logical_block_size", "512\n" );
+      }
+      if( rc != 0 ) {
+         return rc;
+      }
+      
+      fake_sysfs_path( path, "block/%s", name );
+      
+      rc = fake_sysfs_link( fs, path, disk );
+      if( rc != 0 ) {
+         return rc;
+      }
+      
+      for( int p = 1; p <= num_parts; p++ ) {
+         
+         fake_sysfs_path( part, "%s/%s%d", disk, name, p );
+         
+         rc = fake_sysfs_device( fs, part, "class/block", FAKE_SYSFS_DISK_MAJOR, minor + p, "DEVNAME=%s%d\nDEVTYPE=partition\nPARTN=%d\n", name, p, p );
+         if( rc == 0 ) {
+            rc = fake_sysfs_write( fs, part, "partition", "%d\n", p );
+         }
+         if( rc == 0 ) {
+            rc = fake_sysfs_write( fs, part, "start", "%d\n", 2048 * p );
+         }
+         if( rc != 0 ) {
+            return rc;
+         }
+      }
+   }
+   
+   return 0;
+}
+
+
+// make a network interface for a PCI function 
+// return 0 on success
+// return -errno on failure
+static int fake_sysfs_netdev( struct fake_sysfs* fs, char const* pci_path, int nic, int vf ) {
+   
+   int rc = 0;
+   char path[ PATH_MAX+1 ];
+   char name[ 32 ];
+   int ifindex = fs->next_ifindex++;
+   
+   if( vf < 0 ) {
+      snprintf( name, sizeof(name), "eth%d", nic );
+   }
+   else {
+      snprintf( name, sizeof(name), "eth%dv%d", nic, vf );
+   }
+   
+   fake_sysfs_path( path, "%s/net", pci_path );
+   
+   rc = fake_sysfs_mkdir( fs, path );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   fake_sysfs_path( path, "%s/net/%s", pci_path, name );
+   
+   rc = fake_sysfs_device( fs, path, "class/net", -1, -1, "INTERFACE=%s\nIFINDEX=%d\n", name, ifindex );
+   if( rc == 0 ) {
+      rc = fake_sysfs_write( fs, path, "address", "02:00:00:%02x:%02x:%02x\n", nic & 0xff, ((vf + 1) >> 8) & 0xff, (vf + 1) & 0xff );
+   }
+   if( rc == 0 ) {
+      rc = fake_sysfs_write( fs, path, "mtu", "1500\n" );
+   }
+   if( rc == 0 ) {
+      rc = fake_sysfs_write( fs, path, "operstate", "down\n" );
+   }
+   
+   return rc;
+}
+
+
+// make NICs, each with num_vfs SR-IOV virtual functions on the buses after its own 
+// return 0 on success
+// return -errno on failure
+static int fake_sysfs_nics( struct fake_sysfs* fs, int num_nics, int num_vfs ) {
+   
+   int rc = 0;
+   char const* port = "devices/pci0000:00/0000:00:03.0";
+   char pf[ PATH_MAX+1 ];
+   char vf[ PATH_MAX+1 ];
+   char path[ PATH_MAX+1 ];
+   char slot[ 32 ];
+   
+   rc = fake_sysfs_pci( fs, port, "0000:00:03.0", "pcieport", "060400", "8086", "2f08" );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   for( int n = 0; n < num_nics; n++ ) {
+      
+      int bus = fs->next_bus;
+      
+      snprintf( slot, sizeof(slot), "0000:%02x:00.0", bus );
+      fake_sysfs_path( pf, "%s/%s", port, slot );
+      
+      rc = fake_sysfs_pci( fs, pf, slot, "ixgbe", "020000", "8086", "10fb" );
+      if( rc == 0 ) {
+         rc = fake_sysfs_netdev( fs, pf, n, -1 );
+      }
+      if( rc == 0 ) {
+         rc = fake_sysfs_write( fs, pf, "sriov_numvfs", "%d\n", num_vfs );
+      }
+      if( rc != 0 ) {
+         return rc;
+      }
+      
+      for( int v = 0; v < num_vfs; v++ ) {
+         
+         int devfn = FAKE_SYSFS_VF_OFFSET + v;
+         
+         snprintf( slot, sizeof(slot), "0000:%02x:%02x.%d", bus + devfn / 256, (devfn % 256) / 8, devfn % 8 );
+         fake_sysfs_path( vf, "%s/%s", port, slot );
+         
+         rc = fake_sysfs_pci( fs, vf, slot, "ixgbevf", "020000", "8086", "10ed" );
+         if( rc == 0 ) {
+            rc = fake_sysfs_netdev( fs, vf, n, v );
+         }
+         if( rc != 0 ) {
+            return rc;
+         }
+         
+         // link the virtual function and its physical function to each other
+         fake_sysfs_path( path, "%s/physfn", vf );
+         
+         rc = fake_sysfs_link( fs, path, pf );
+         if( rc != 0 ) {
+            return rc;
+         }
+         
+         fake_sysfs_path( path, "%s/virtfn%d", pf, v );
+         
+         rc = fake_sysfs_link( fs, path, vf );
+         if( rc != 0 ) {
+            return rc;
+         }
+      }
+      
+      fs->next_bus = bus + 1 + (FAKE_SYSFS_VF_OFFSET + num_vfs - 1) / 256;
+   }
+   
+   return 0;
+}
+
+
+// make serial ports 
+// return 0 on success
+// return -errno on failure
+static int fake_sysfs_ttys( struct fake_sysfs* fs, int num_ttys ) {
+   
+   int rc = 0;
+   char const* platform = "devices/platform/serial8250";
+   char path[ PATH_MAX+1 ];
+   
+   rc = fake_sysfs_device( fs, platform, "bus/platform", -1, -1, "DRIVER=serial8250\nMODALIAS=platform:serial8250\n" );
+   if( rc == 0 ) {
+      
+      fake_sysfs_path( path, "%s/tty", platform );
+      rc = fake_sysfs_mkdir( fs, path );
+   }
+   
+   for( int i = 0; rc == 0 && i < num_ttys; i++ ) {
+      
+      fake_sysfs_path( path, "%s/tty/ttyS%d", platform, i );
+      
+      rc = fake_sysfs_device( fs, path, "class/tty", FAKE_SYSFS_TTY_MAJOR, FAKE_SYSFS_TTY_MINOR_BASE + i, "DEVNAME=ttyS%d\n", i );
+   }
+   
+   return rc;
+}
+
+
+static void usage( char const* progname ) {
+   
+   fprintf(stderr, "Usage: %s [-d DISKS] [-p PARTITIONS_PER_DISK] [-n NICS] [-v VFS_PER_NIC] [-t TTYS] DIR\n", progname );
+   exit(1);
+}
+
+
+int main( int argc, char** argv ) {
+   
+   int rc = 0;
+   int c = 0;
+   struct fake_sysfs fs;
+   struct stat sb;
+   unsigned long num_disks = 0;
+   int num_parts = 0;
+   int num_nics = 0;
+   int num_vfs = 0;
+   int num_ttys = 0;
+   char path[ PATH_MAX+1 ];
+   
+   // the directories everything else hangs off of 
+   char const* dirs[] = {
+      "", "devices", "devices/pci0000:00", "devices/platform", "devices/virtual",
+      "block", "bus", "bus/pci", "bus/pci/devices", "bus/scsi", "bus/scsi/devices", "bus/platform", "bus/platform/devices",
+      "class", "class/block", "class/net", "class/tty", "dev", "dev/block", "dev/char", NULL
+   };
+   
+   memset( &fs, 0, sizeof(struct fake_sysfs) );
+   
+   fs.next_bus = 1;
+   fs.next_ifindex = 2;         // 1 is lo
+   
+   while( (c = getopt( argc, argv, "d:p:n:v:t:" )) != -1 ) {
+      
+      switch( c ) {
+         
+         case 'd': {
+            
+            num_disks = strtoul( optarg, NULL, 10 );
+            break;
+         }
+         
+         case 'p': {
+            
+            num_parts = atoi( optarg );
+            break;
+         }
+         
+         case 'n': {
+            
+            num_nics = atoi( optarg );
+            break;
+         }
+         
+         case 'v': {
+            
+            num_vfs = atoi( optarg );
+            break;
+         }
+         
+         case 't': {
+            
+            num_ttys = atoi( optarg );
+            break;
+         }
+         
+         default: {
+            
+            usage( argv[0] );
+         }
+      }
+   }
+   
+   if( optind != argc - 1 || num_parts < 0 || num_parts >= FAKE_SYSFS_DISK_MINORS || num_nics < 0 || num_vfs < 0 || num_ttys < 0 ) {
+      usage( argv[0] );
+   }
+   
+   fs.root = argv[optind];
+   
+   // don't add to an old tree 
+   fake_sysfs_path( path, "%s/devices", fs.root );
+   if( stat( path, &sb ) == 0 ) {
+      
+      fprintf(stderr, "'%s' already exists\n", path );
+      exit(1);
+   }
+   
+   for( int i = 0; rc == 0 && dirs[i] != NULL; i++ ) {
+      
+      rc = fake_sysfs_mkdir( &fs, dirs[i] );
+   }
+   
+   if( rc == 0 && num_disks > 0 ) {
+      rc = fake_sysfs_disks( &fs, num_disks, num_parts );
+   }
+   
+   if( rc == 0 && num_nics > 0 ) {
+      rc = fake_sysfs_nics( &fs, num_nics, num_vfs );
+   }
+   
+   if( rc == 0 && num_ttys > 0 ) {
+      rc = fake_sysfs_ttys( &fs, num_ttys );
+   }
+   
+   if( rc != 0 ) {
+      exit(1);
+   }
+   
+   printf("%lu\n", fs.num_devices );
+   return 0;
+}
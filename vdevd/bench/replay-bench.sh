@@ -0,0 +1,103 @@
+#!/bin/sh -e
+
+# replay a stream of uevents through vdevd-replay, and print how it kept up.
+#
+# usage: replay-bench.sh VDEVD_REPLAY [RECORDING]
+#
+# with no RECORDING, a synthetic one is generated: EVENTS/2 character and block devices
+# are plugged in, and then unplugged.  A recording can also be made with
+# `udevadm monitor --kernel --property > RECORDING`.
+#
+# environment:
+#   EVENTS    number of synthetic events (default 10000)
+#   RATE      max, recorded, or events per second (default max)
+#   ACTIONS   actions directory to benchmark (default: trivial bench actions)
+#   SCRATCH   where to put the mountpoint, config and logs (default: a temporary directory)
+
+VDEVD_REPLAY=$1
+RECORDING=$2
+
+EVENTS=${EVENTS:-10000}
+RATE=${RATE:-max}
+
+if [ -z "$VDEVD_REPLAY" ]; then 
+   echo "Usage: $0 VDEVD_REPLAY [RECORDING]" >&2
+   exit 1
+fi
+
+if [ -z "$SCRATCH" ]; then 
+   SCRATCH=$(mktemp -d "${TMPDIR:-/tmp}/vdevd-replay.XXXXXX")
+   trap 'rm -rf "$SCRATCH"' EXIT
+fi
+
+# the preseed script normally makes the metadata directory
+mkdir -p "$SCRATCH/dev/metadata" "$SCRATCH/helpers"
+
+# synthetic recording: plug in a batch of ttys and disks, and unplug them
+if [ -z "$RECORDING" ]; then 
+   RECORDING="$SCRATCH/uevents"
+   
+   awk -v events="$EVENTS" 'BEGIN {
+      devices = int((events + 1) / 2);
+      
+      for( i = 0; i < events; i++ ) {
+         dev = i % devices;
+         action = (i < devices ? "add" : "remove");
+         
+         if( dev % 2 == 0 ) {
+            printf "KERNEL[%.6f] %s /devices/virtual/tty/ttyB%d (tty)\n", 1000 + i / 1000.0, action, dev;
+            printf "ACTION=%s\nDEVPATH=/devices/virtual/tty/ttyB%d\nSUBSYSTEM=tty\nDEVNAME=ttyB%d\nMAJOR=250\nMINOR=%d\n", action, dev, dev, dev;
+         }
+         else {
+            printf "KERNEL[%.6f] %s /devices/virtual/block/ram%d (block)\n", 1000 + i / 1000.0, action, dev;
+            printf "ACTION=%s\nDEVPATH=/devices/virtual/block/ram%d\nSUBSYSTEM=block\nDEVNAME=ram%d\nDEVTYPE=disk\nMAJOR=1\nMINOR=%d\n", action, dev, dev, dev;
+         }
+         
+         printf "SEQNUM=%d\n\n", i + 1;
+      }
+   }' > "$RECORDING"
+fi
+
+# trivial actions, so the benchmark measures vdevd rather than its helpers
+if [ -z "$ACTIONS" ]; then 
+   ACTIONS="$SCRATCH/actions"
+   mkdir -p "$ACTIONS"
+   
+   cat > "$ACTIONS/tty.act" <<EOA
+[vdev-action]
+event=add
+path=^ttyB
+command=true
+EOA
+
+   cat > "$ACTIONS/block.act" <<EOA
+[vdev-action]
+event=any
+type=block
+command=true
+EOA
+
+   cat > "$ACTIONS/block-async.act" <<EOA
+[vdev-action]
+event=add
+type=block
+command=true
+async=true
+EOA
+fi
+
+cat > "$SCRATCH/vdevd.conf" <<EOC
+[vdev-config]
+actions=$ACTIONS
+helpers=$SCRATCH/helpers
+pidfile=$SCRATCH/vdevd.pid
+logfile=$SCRATCH/vdevd.log
+loglevel=error
+default_permissions=0600
+
+[vdev-OS]
+replay_events=$RECORDING
+replay_rate=$RATE
+EOC
+
+"$VDEVD_REPLAY" -c "$SCRATCH/vdevd.conf" -f -1 "$SCRATCH/dev"
@@ -0,0 +1,227 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// subprocess launch benchmark.
+// times vdev_spawn() (with whichever backend it was built with) against the old
+// fork-and-close-every-fd launcher, starting /bin/true and reaping it.
+// vdevd is made to look big first (resident memory and a high fd limit), since
+// that is what makes fork(2) and the close loop expensive.
+
+#include "libvdev/util.h"
+#include "libvdev/spawn.h"
+
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define SPAWN_BENCH_DEFAULT_SPAWNS      2000
+#define SPAWN_BENCH_DEFAULT_MEGABYTES   256
+#define SPAWN_BENCH_DEFAULT_FDS         64
+
+#define SPAWN_BENCH_PROGRAM             "/bin/true"
+
+
+// start a child the way vdev_subprocess() used to: fork, then close every possible fd
+// return 0 on success, and set *ret_pid 
+// return -errno on failure to fork
+static int spawn_bench_legacy( char* const argv[], pid_t* ret_pid ) {
+   
+   long max_fd = sysconf(_SC_OPEN_MAX);
+   char* noenv[] = { NULL };
+   pid_t pid = fork();
+   
+   if( pid == 0 ) {
+      
+      for( long i = 0; i < max_fd; i++ ) {
+         
+         if( i != STDERR_FILENO ) {
+            close( i );
+         }
+      }
+      
+      execve( argv[0], argv, noenv );
+      _exit(127);
+   }
+   else if( pid < 0 ) {
+      return -errno;
+   }
+   
+   *ret_pid = pid;
+   return 0;
+}
+
+
+// start and reap num_spawns children, with either launcher 
+// return 0 on success, and set *elapsed to the seconds it took 
+// return negative on failure to start or reap a child
+static int spawn_bench_run( bool legacy, int num_spawns, double* elapsed ) {
+   
+   int rc = 0;
+   int status = 0;
+   pid_t pid = 0;
+   struct timespec start, end;
+   char* argv[] = { SPAWN_BENCH_PROGRAM, NULL };
+   int stdio_fds[3] = { -1, -1, STDERR_FILENO };
+   
+   clock_gettime( CLOCK_MONOTONIC, &start );
+   
+   for( int i = 0; i < num_spawns; i++ ) {
+      
+      if( legacy ) {
+         rc = spawn_bench_legacy( argv, &pid );
+      }
+      else {
+         rc = vdev_spawn( argv[0], argv, NULL, stdio_fds, 0, &pid );
+      }
+      
+      if( rc != 0 ) {
+         
+         fprintf(stderr, "spawn %d: rc = %d\n", i, rc );
+         return rc;
+      }
+      
+      if( waitpid( pid, &status, 0 ) < 0 ) {
+         
+         rc = -errno;
+         fprintf(stderr, "waitpid(%d) rc = %d\n", pid, rc );
+         return rc;
+      }
+      
+      if( !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 ) {
+         
+         fprintf(stderr, "spawn %d: exit status %d\n", i, status );
+         return -EIO;
+      }
+   }
+   
+   clock_gettime( CLOCK_MONOTONIC, &end );
+   
+   *elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   return 0;
+}
+
+
+static void usage( char const* progname ) {
+   
+   fprintf(stderr, "Usage: %s [-n NUM_SPAWNS] [-m RESIDENT_MEGABYTES] [-f NUM_OPEN_FDS]\n", progname );
+   exit(1);
+}
+
+
+int main( int argc, char** argv ) {
+   
+   int rc = 0;
+   int c = 0;
+   int num_spawns = SPAWN_BENCH_DEFAULT_SPAWNS;
+   int num_megabytes = SPAWN_BENCH_DEFAULT_MEGABYTES;
+   int num_fds = SPAWN_BENCH_DEFAULT_FDS;
+   char* ballast = NULL;
+   struct rlimit nofile;
+   double elapsed[2];
+   
+   char const* names[2] = {
+      "legacy",
+      VDEV_SPAWN_BACKEND
+   };
+   
+   while( (c = getopt( argc, argv, "n:m:f:" )) != -1 ) {
+      
+      switch( c ) {
+         
+         case 'n': {
+            
+            num_spawns = atoi( optarg );
+            break;
+         }
+         
+         case 'm': {
+            
+            num_megabytes = atoi( optarg );
+            break;
+         }
+         
+         case 'f': {
+            
+            num_fds = atoi( optarg );
+            break;
+         }
+         
+         default: {
+            
+            usage( argv[0] );
+         }
+      }
+   }
+   
+   if( num_spawns <= 0 || num_megabytes < 0 || num_fds < 0 ) {
+      usage( argv[0] );
+   }
+   
+   // look like a big vdevd: touch every page of the ballast...
+   if( num_megabytes > 0 ) {
+      
+      ballast = VDEV_CALLOC( char, (size_t)num_megabytes * 1024 * 1024 );
+      if( ballast == NULL ) {
+         
+         fprintf(stderr, "out of memory\n");
+         exit(1);
+      }
+      
+      memset( ballast, 1, (size_t)num_megabytes * 1024 * 1024 );
+   }
+   
+   // ...raise the fd limit as far as it will go...
+   rc = getrlimit( RLIMIT_NOFILE, &nofile );
+   if( rc == 0 ) {
+      
+      nofile.rlim_cur = nofile.rlim_max;
+      setrlimit( RLIMIT_NOFILE, &nofile );
+   }
+   
+   // ...and hold some fds open that children must not inherit
+   for( int i = 0; i < num_fds; i++ ) {
+      
+      if( open( "/dev/null", O_RDONLY ) < 0 ) {
+         
+         fprintf(stderr, "open('/dev/null') rc = %d\n", -errno );
+         exit(1);
+      }
+   }
+   
+   printf("%d spawns of %s, %d MB resident, %d open fds, fd limit %ld\n", num_spawns, SPAWN_BENCH_PROGRAM, num_megabytes, num_fds, sysconf(_SC_OPEN_MAX) );
+   
+   for( int i = 0; i < 2; i++ ) {
+      
+      rc = spawn_bench_run( i == 0, num_spawns, &elapsed[i] );
+      if( rc != 0 ) {
+         
+         fprintf(stderr, "%s launcher failed: rc = %d\n", names[i], rc );
+         exit(1);
+      }
+      
+      printf("%-8s %10.3f s %12.0f spawns/s %10.2f us/spawn\n", names[i], elapsed[i], num_spawns / elapsed[i], 1e6 * elapsed[i] / num_spawns );
+   }
+   
+   printf("speedup  %10.2fx\n", elapsed[0] / elapsed[1] );
+   
+   free( ballast );
+   return 0;
+}
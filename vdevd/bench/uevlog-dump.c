@@ -0,0 +1,260 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// dump or filter a uevent log recorded with `vdevd --record`.
+// by default, prints the uevents in the format of `udevadm monitor --kernel --property`,
+// which vdevd-replay reads.  With -b, writes the matching records as another uevent log.
+
+#include "libvdev/util.h"
+#include "libvdev/uevlog.h"
+
+#include <fnmatch.h>
+
+// most -m filters 
+#define UEVLOG_DUMP_MAX_MATCHES         32
+
+// KEY=PATTERN filter 
+struct uevlog_dump_match {
+   
+   char* key;
+   char* pattern;
+};
+
+
+// find the value of a key in a recorded uevent 
+// return a pointer to it, or NULL if the uevent doesn't have it 
+static char const* uevlog_dump_get( char const* uevent, size_t len, char const* key ) {
+   
+   size_t key_len = strlen( key );
+   
+   for( size_t i = 0; i < len; i += strlen( uevent + i ) + 1 ) {
+      
+      if( strncmp( uevent + i, key, key_len ) == 0 && uevent[ i + key_len ] == '=' ) {
+         
+         return uevent + i + key_len + 1;
+      }
+   }
+   
+   return NULL;
+}
+
+
+// does a recorded uevent match all of the filters?
+static bool uevlog_dump_matches( char const* uevent, size_t len, struct uevlog_dump_match* matches, int num_matches ) {
+   
+   for( int i = 0; i < num_matches; i++ ) {
+      
+      char const* value = uevlog_dump_get( uevent, len, matches[i].key );
+      
+      if( value == NULL || fnmatch( matches[i].pattern, value, 0 ) != 0 ) {
+         return false;
+      }
+   }
+   
+   return true;
+}
+
+
+// print a recorded uevent like `udevadm monitor --kernel --property` would
+static void uevlog_dump_print( struct vdev_uevlog_record* rec, char const* uevent ) {
+   
+   char const* action = uevlog_dump_get( uevent, rec->len, "ACTION" );
+   char const* devpath = uevlog_dump_get( uevent, rec->len, "DEVPATH" );
+   char const* subsystem = uevlog_dump_get( uevent, rec->len, "SUBSYSTEM" );
+   
+   printf("KERNEL[%" PRIu64 ".%06" PRIu64 "] %-8s %s (%s)\n", (uint64_t)(rec->timestamp_nanos / 1000000000ULL), (uint64_t)((rec->timestamp_nanos % 1000000000ULL) / 1000),
+          action != NULL ? action : "", devpath != NULL ? devpath : "", subsystem != NULL ? subsystem : "" );
+   
+   for( size_t i = 0; i < rec->len; i += strlen( uevent + i ) + 1 ) {
+      
+      // skip the kernel's ACTION@DEVPATH header 
+      if( strchr( uevent + i, '=' ) != NULL ) {
+         printf("%s\n", uevent + i );
+      }
+   }
+   
+   printf("\n");
+}
+
+
+// copy a record to a uevent log on stdout 
+// return 0 on success
+// return -errno on failure to write
+static int uevlog_dump_write( struct vdev_uevlog_record* rec, char const* uevent ) {
+   
+   if( fwrite( rec, 1, sizeof(struct vdev_uevlog_record), stdout ) != sizeof(struct vdev_uevlog_record) || fwrite( uevent, 1, rec->len, stdout ) != rec->len ) {
+      return -errno;
+   }
+   
+   return 0;
+}
+
+
+static void usage( char const* progname ) {
+   
+   fprintf(stderr, "Usage: %s [-b] [-s netlink|coldplug] [-m KEY=PATTERN]... [-n MAX_UEVENTS] [LOG]\n", progname );
+   exit(1);
+}
+
+
+int main( int argc, char** argv ) {
+   
+   int rc = 0;
+   int c = 0;
+   bool binary = false;
+   int source = 0;
+   long max_uevents = -1;
+   long num_uevents = 0;
+   struct uevlog_dump_match matches[ UEVLOG_DUMP_MAX_MATCHES ];
+   int num_matches = 0;
+   char* eq = NULL;
+   FILE* f = stdin;
+   struct vdev_uevlog_record rec;
+   char* uevent = NULL;
+   size_t uevent_cap = 0;
+   
+   while( (c = getopt( argc, argv, "bs:m:n:" )) != -1 ) {
+      
+      switch( c ) {
+         
+         case 'b': {
+            
+            binary = true;
+            break;
+         }
+         
+         case 's': {
+            
+            if( strcmp( optarg, VDEV_UEVLOG_SOURCE_NETLINK_STR ) == 0 ) {
+               source = VDEV_UEVLOG_SOURCE_NETLINK;
+            }
+            else if( strcmp( optarg, VDEV_UEVLOG_SOURCE_COLDPLUG_STR ) == 0 ) {
+               source = VDEV_UEVLOG_SOURCE_COLDPLUG;
+            }
+            else {
+               usage( argv[0] );
+            }
+            break;
+         }
+         
+         case 'm': {
+            
+            eq = strchr( optarg, '=' );
+            if( eq == NULL || num_matches == UEVLOG_DUMP_MAX_MATCHES ) {
+               usage( argv[0] );
+            }
+            
+            *eq = '\0';
+            
+            matches[ num_matches ].key = optarg;
+            matches[ num_matches ].pattern = eq + 1;
+            num_matches++;
+            break;
+         }
+         
+         case 'n': {
+            
+            max_uevents = atol( optarg );
+            break;
+         }
+         
+         default: {
+            
+            usage( argv[0] );
+         }
+      }
+   }
+   
+   if( optind < argc - 1 ) {
+      usage( argv[0] );
+   }
+   
+   if( optind == argc - 1 && strcmp( argv[optind], "-" ) != 0 ) {
+      
+      f = fopen( argv[optind], "r" );
+      if( f == NULL ) {
+         
+         fprintf(stderr, "fopen('%s'): %s\n", argv[optind], strerror(errno) );
+         exit(1);
+      }
+   }
+   
+   rc = vdev_uevlog_read_magic( f );
+   if( rc != 0 ) {
+      
+      fprintf(stderr, "Not a uevent log\n");
+      exit(1);
+   }
+   
+   if( binary ) {
+      
+      fwrite( VDEV_UEVLOG_MAGIC, 1, VDEV_UEVLOG_MAGIC_LEN, stdout );
+   }
+   
+   while( max_uevents < 0 || num_uevents < max_uevents ) {
+      
+      rc = vdev_uevlog_read( f, &rec, &uevent, &uevent_cap );
+      if( rc != 0 ) {
+         break;
+      }
+      
+      if( source != 0 && rec.source != source ) {
+         continue;
+      }
+      
+      if( !uevlog_dump_matches( uevent, rec.len, matches, num_matches ) ) {
+         continue;
+      }
+      
+      if( binary ) {
+         
+         rc = uevlog_dump_write( &rec, uevent );
+         if( rc != 0 ) {
+            
+            fprintf(stderr, "write: %s\n", strerror(-rc) );
+            break;
+         }
+      }
+      else {
+         
+         uevlog_dump_print( &rec, uevent );
+      }
+      
+      num_uevents++;
+   }
+   
+   if( rc == -EINVAL ) {
+      
+      // i.e. vdevd was killed while writing 
+      fprintf(stderr, "%s", "Log is truncated\n");
+      rc = 0;
+   }
+   
+   free( uevent );
+   
+   if( f != stdin ) {
+      fclose( f );
+   }
+   
+   fflush( stdout );
+   
+   return (rc < 0 ? 1 : 0);
+}
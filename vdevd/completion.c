@@ -0,0 +1,296 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "completion.h"
+
+#include <sys/epoll.h>
+
+SGLIB_DEFINE_RBTREE_FUNCTIONS( vdev_completion_source, left, right, color, VDEV_COMPLETION_SOURCE_CMP );
+
+// most events to handle per epoll_wait(2)
+#define VDEV_COMPLETION_MAX_EVENTS      64
+
+// ID of the wakeup pipe's epoll registration (source IDs start at 1)
+#define VDEV_COMPLETION_WAKEUP_ID       0
+
+
+// set up a completion thread 
+// return 0 on success
+// return -errno on failure to create the epoll instance or wakeup pipe
+int vdev_completion_init( struct vdev_completion* comp ) {
+   
+   int rc = 0;
+   struct epoll_event ev;
+   
+   memset( comp, 0, sizeof(struct vdev_completion) );
+   
+   comp->epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+   if( comp->epoll_fd < 0 ) {
+      
+      rc = -errno;
+      vdev_error("epoll_create1 rc = %d\n", rc );
+      return rc;
+   }
+   
+   rc = pipe( comp->wakeup_pipe );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+      vdev_error("pipe rc = %d\n", rc );
+      
+      close( comp->epoll_fd );
+      return rc;
+   }
+   
+   memset( &ev, 0, sizeof(ev) );
+   ev.events = EPOLLIN;
+   ev.data.u64 = VDEV_COMPLETION_WAKEUP_ID;
+   
+   rc = epoll_ctl( comp->epoll_fd, EPOLL_CTL_ADD, comp->wakeup_pipe[0], &ev );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+      vdev_error("epoll_ctl rc = %d\n", rc );
+      
+      close( comp->wakeup_pipe[0] );
+      close( comp->wakeup_pipe[1] );
+      close( comp->epoll_fd );
+      return rc;
+   }
+   
+   pthread_mutex_init( &comp->lock, NULL );
+   comp->next_id = VDEV_COMPLETION_WAKEUP_ID + 1;
+   
+   return 0;
+}
+
+
+// completion thread main loop 
+static void* vdev_completion_main( void* arg ) {
+   
+   struct vdev_completion* comp = (struct vdev_completion*)arg;
+   struct epoll_event events[ VDEV_COMPLETION_MAX_EVENTS ];
+   int num_events = 0;
+   int rc = 0;
+   
+   while( comp->running ) {
+      
+      num_events = epoll_wait( comp->epoll_fd, events, VDEV_COMPLETION_MAX_EVENTS, -1 );
+      if( num_events < 0 ) {
+         
+         rc = -errno;
+         if( rc == -EINTR ) {
+            continue;
+         }
+         
+         vdev_error("epoll_wait rc = %d\n", rc );
+         break;
+      }
+      
+      for( int i = 0; i < num_events; i++ ) {
+         
+         struct vdev_completion_source lookup;
+         struct vdev_completion_source* source = NULL;
+         
+         if( events[i].data.u64 == VDEV_COMPLETION_WAKEUP_ID ) {
+            
+            // woken up to check comp->running
+            continue;
+         }
+         
+         memset( &lookup, 0, sizeof(lookup) );
+         lookup.id = events[i].data.u64;
+         
+         pthread_mutex_lock( &comp->lock );
+         
+         // the source may have been removed since epoll_wait returned
+         source = sglib_vdev_completion_source_find_member( comp->sources, &lookup );
+         if( source != NULL ) {
+            
+            rc = (*source->func)( source->fd, source->cls );
+            if( rc != 0 ) {
+               
+               // done with this source
+               epoll_ctl( comp->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL );
+               sglib_vdev_completion_source_delete( &comp->sources, source );
+               free( source );
+            }
+         }
+         
+         pthread_mutex_unlock( &comp->lock );
+      }
+   }
+   
+   return NULL;
+}
+
+
+// start the completion thread 
+// return 0 on success
+// return -errno on failure to create the thread
+int vdev_completion_start( struct vdev_completion* comp ) {
+   
+   int rc = 0;
+   
+   comp->running = true;
+   
+   rc = pthread_create( &comp->thread, NULL, vdev_completion_main, comp );
+   if( rc != 0 ) {
+      
+      comp->running = false;
+      vdev_error("pthread_create rc = %d\n", rc );
+      return -rc;
+   }
+   
+   return 0;
+}
+
+
+// stop the completion thread, and join with it 
+// return 0 on success 
+// return -EINVAL if not running
+int vdev_completion_stop( struct vdev_completion* comp ) {
+   
+   int rc = 0;
+   
+   if( !comp->running ) {
+      return -EINVAL;
+   }
+   
+   comp->running = false;
+   
+   rc = vdev_write_uninterrupted( comp->wakeup_pipe[1], "x", 1 );
+   if( rc < 0 ) {
+      
+      vdev_error("vdev_write_uninterrupted rc = %d\n", rc );
+   }
+   
+   pthread_join( comp->thread, NULL );
+   return 0;
+}
+
+
+// free a stopped completion thread's state.  Does not close the sources' file descriptors.
+// always succeeds
+int vdev_completion_free( struct vdev_completion* comp ) {
+   
+   struct sglib_vdev_completion_source_iterator itr;
+   struct vdev_completion_source* source = NULL;
+   
+   for( source = sglib_vdev_completion_source_it_init( &itr, comp->sources ); source != NULL; source = sglib_vdev_completion_source_it_next( &itr ) ) {
+      free( source );
+   }
+   
+   comp->sources = NULL;
+   
+   if( comp->epoll_fd >= 0 ) {
+      
+      close( comp->epoll_fd );
+      close( comp->wakeup_pipe[0] );
+      close( comp->wakeup_pipe[1] );
+      
+      comp->epoll_fd = -1;
+      
+      pthread_mutex_destroy( &comp->lock );
+   }
+   
+   return 0;
+}
+
+
+// start watching a file descriptor.  func will be called from the completion thread, with comp's lock held.
+// return 0 on success, and set *ret_id to the ID to remove it with
+// return -ENOMEM on OOM 
+// return -errno on failure to watch fd
+int vdev_completion_add( struct vdev_completion* comp, int fd, vdev_completion_func_t func, void* cls, uint64_t* ret_id ) {
+   
+   int rc = 0;
+   struct epoll_event ev;
+   struct vdev_completion_source* source = VDEV_CALLOC( struct vdev_completion_source, 1 );
+   
+   if( source == NULL ) {
+      return -ENOMEM;
+   }
+   
+   source->fd = fd;
+   source->func = func;
+   source->cls = cls;
+   
+   memset( &ev, 0, sizeof(ev) );
+   ev.events = EPOLLIN;
+   
+   pthread_mutex_lock( &comp->lock );
+   
+   source->id = comp->next_id;
+   comp->next_id++;
+   
+   ev.data.u64 = source->id;
+   
+   rc = epoll_ctl( comp->epoll_fd, EPOLL_CTL_ADD, fd, &ev );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+      pthread_mutex_unlock( &comp->lock );
+      
+      vdev_error("epoll_ctl(%d) rc = %d\n", fd, rc );
+      free( source );
+      return rc;
+   }
+   
+   sglib_vdev_completion_source_add( &comp->sources, source );
+   
+   pthread_mutex_unlock( &comp->lock );
+   
+   *ret_id = source->id;
+   return 0;
+}
+
+
+// stop watching a file descriptor.  Once this returns, its callback is not running, and won't be called again.
+// call this before closing the file descriptor.
+// return 0 on success
+// return -ENOENT if it is not being watched (i.e. its callback already asked to stop)
+// NOTE: do not call from a completion callback
+int vdev_completion_remove( struct vdev_completion* comp, uint64_t id ) {
+   
+   struct vdev_completion_source lookup;
+   struct vdev_completion_source* source = NULL;
+   
+   memset( &lookup, 0, sizeof(lookup) );
+   lookup.id = id;
+   
+   pthread_mutex_lock( &comp->lock );
+   
+   source = sglib_vdev_completion_source_find_member( comp->sources, &lookup );
+   if( source == NULL ) {
+      
+      pthread_mutex_unlock( &comp->lock );
+      return -ENOENT;
+   }
+   
+   epoll_ctl( comp->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL );
+   sglib_vdev_completion_source_delete( &comp->sources, source );
+   
+   pthread_mutex_unlock( &comp->lock );
+   
+   free( source );
+   return 0;
+}
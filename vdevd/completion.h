@@ -0,0 +1,84 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _VDEV_COMPLETION_H_
+#define _VDEV_COMPLETION_H_
+
+#include "libvdev/util.h"
+#include "libvdev/sglib.h"
+
+// completion callback: called by the completion thread whenever fd is readable (or hung up).
+// it should read everything it can without blocking.
+// return 0 to keep watching fd, or negative to stop watching it.
+typedef int (*vdev_completion_func_t)( int fd, void* cls );
+
+// something the completion thread is watching
+struct vdev_completion_source {
+   
+   // unique ID, so a stale event for a removed source is never delivered to a new one with the same fd
+   uint64_t id;
+   
+   int fd;
+   vdev_completion_func_t func;
+   void* cls;
+   
+   struct vdev_completion_source* left;
+   struct vdev_completion_source* right;
+   char color;
+};
+
+typedef struct vdev_completion_source vdev_completion_source;
+
+#define VDEV_COMPLETION_SOURCE_CMP( s1, s2 ) ((s1)->id < (s2)->id ? -1 : ((s1)->id > (s2)->id ? 1 : 0))
+
+// completion thread: watches file descriptors with epoll(7), and calls back when they become readable
+struct vdev_completion {
+   
+   int epoll_fd;
+   
+   // written to in order to wake up the thread when stopping
+   int wakeup_pipe[2];
+   
+   pthread_t thread;
+   volatile bool running;
+   
+   // lock governing access to sources.  Held while a callback runs.
+   pthread_mutex_t lock;
+   
+   struct vdev_completion_source* sources;
+   uint64_t next_id;
+};
+
+C_LINKAGE_BEGIN
+
+SGLIB_DEFINE_RBTREE_PROTOTYPES( vdev_completion_source, left, right, color, VDEV_COMPLETION_SOURCE_CMP );
+
+int vdev_completion_init( struct vdev_completion* comp );
+int vdev_completion_start( struct vdev_completion* comp );
+int vdev_completion_stop( struct vdev_completion* comp );
+int vdev_completion_free( struct vdev_completion* comp );
+
+int vdev_completion_add( struct vdev_completion* comp, int fd, vdev_completion_func_t func, void* cls, uint64_t* ret_id );
+int vdev_completion_remove( struct vdev_completion* comp, uint64_t id );
+
+C_LINKAGE_END
+
+#endif
@@ -45,9 +45,28 @@ int vdev_device_request_init( struct vdev_device_request* req, struct vdev_state
    return 0;
 }
 
+// forget a request's cached helper environment, i.e. because the request changed
+static void vdev_device_request_env_invalidate( struct vdev_device_request* req ) {
+   
+   if( req->env != NULL ) {
+      
+      free( req->env );
+      req->env = NULL;
+   }
+}
+
+
 // free a request 
 int vdev_device_request_free( struct vdev_device_request* req ) {
    
+   vdev_device_request_env_invalidate( req );
+   
+   if( req->snapshot != NULL ) {
+      
+      vdev_snapshot_release( req->state, req->snapshot );
+      req->snapshot = NULL;
+   }
+   
    if( req->params != NULL ) {
       
       vdev_params_free( req->params );
@@ -77,25 +96,10 @@ int vdev_device_request_free( struct vdev_device_request* req ) {
 // return -ENOMEM if OOM
 int vdev_device_request_add_param( struct vdev_device_request* req, char const* key, char const* value ) {
    
+   vdev_device_request_env_invalidate( req );
    return vdev_params_add( &req->params, key, value );
 }
 
-// create a KEY=VALUE string
-static int vdev_device_request_make_env_str( char const* key, char const* value, char** ret ) {
-   
-   char* e = VDEV_CALLOC( char, strlen(key) + 1 + strlen(value) + 1 );
-   
-   if( e == NULL ) {
-      return -ENOMEM;
-   }
-   
-   sprintf(e, "%s=%s", key, value );
-   *ret = e;
-   
-   return 0;
-}
-
-
 // action to const string 
 static char const* vdev_device_request_type_to_string( vdev_device_request_t req ) {
    
@@ -131,20 +135,71 @@ static char const* vdev_device_request_mode_to_string( mode_t mode ) {
    return none_str;
 }
 
-// convert a device request to a list of null-terminated KEY=VALUE environment variable strings 
-// put the resulting vector into **ret_env, and put the number of variables into *num_env 
-// if is_daemonlet is set, then set VDEV_DAEMONLET=1
-// return 0 on success 
-// return negative on error 
-// NOTE: not reload-safe; call while the reload lock is held
-int vdev_device_request_to_env( struct vdev_device_request* req, vdev_params* helper_vars, char*** ret_env, size_t* num_env, int is_daemonlet ) {
+// one helper environment variable, as PREFIX KEY=VALUE
+struct vdev_device_env_var {
+   char const* prefix;
+   char const* key;
+   char const* value;
+};
+
+
+// length of a PREFIX KEY=VALUE string, including the NUL
+static size_t vdev_device_env_var_len( char const* prefix, char const* key, char const* value ) {
+   
+   return strlen( prefix ) + strlen( key ) + 1 + strlen( value ) + 1;
+}
+
+
+// write a PREFIX KEY=VALUE string at *cursor, and advance *cursor past it 
+// return the string
+static char* vdev_device_env_var_put( char** cursor, char const* prefix, char const* key, char const* value ) {
+   
+   char* var = *cursor;
+   
+   *cursor += sprintf( var, "%s%s=%s", prefix, key, value ) + 1;
+   return var;
+}
+
+
+// get the log level helpers should use, based on ours 
+static char const* vdev_device_request_loglevel( void ) {
+   
+   if( vdev_get_debug_level() > 0 ) {
+      
+      if( vdev_get_debug_level() == 1 ) {
+         return "info";
+      }
+      else {
+         return "debug";
+      }
+   }
+   else if( vdev_get_error_level() > 0 ) {
+      
+      if( vdev_get_error_level() == 1 ) {
+         return "error";
+      }
+      else {
+         return "warning";
+      }
+   }
+   
+   return "warning";
+}
+
+
+// build the part of a request's helper environment that is the same for all of its actions,
+// as a single allocation.
+// vdev_path is the device's current path (renamed or not), or NULL if it has none.
+// return 0 on success, and set *ret_env
+// return -ENOMEM on OOM
+// NOTE: uses the request's pinned snapshot (req->snapshot), so a reload can happen meanwhile
+static int vdev_device_env_build( struct vdev_device_request* req, char const* vdev_path, struct vdev_device_env** ret_env ) {
    
    // type --> VDEV_ACTION
    // path --> VDEV_PATH (if non-null)
    // dev --> VDEV_MAJOR, VDEV_MINOR (if given)
    // mode --> VDEV_MODE (if given)
    // params --> VDEV_OS_* 
-   // helper vars --> VDEV_VAR_*
    // mountpoint --> VDEV_MOUNTPOINT
    // metadata --> VDEV_METADATA (if path is non-null)
    // global metadata --> VDEV_GLOBAL_METADATA
@@ -152,268 +207,194 @@ int vdev_device_request_to_env( struct vdev_device_request* req, vdev_params* he
    // logfile --> VDEV_LOGFILE
    // vdev instance nonce --> VDEV_INSTANCE
    // config file --> VDEV_CONFIG_FILE
-   // daemonlet --> VDEV_DAEMONLET (0 by default, 1 if is_daemonlet is non-zero)
+   // log level --> VDEV_LOGLEVEL
    
-   size_t num_vars = 15 + sglib_vdev_params_len( req->params ) + sglib_vdev_params_len( helper_vars );
-   int i = 0;
-   int rc = 0;
-   char dev_buf[51];
+   struct vdev_device_env_var vars[13];
+   int num_fixed = 0;
+   size_t num_vars = 0;
+   size_t len = 0;
    struct vdev_param_t* dp = NULL;
    struct sglib_vdev_params_iterator itr;
-   char* vdev_path = req->renamed_path;
+   char major_buf[51];
+   char minor_buf[51];
    char metadata_dir[ PATH_MAX + 1 ];
    char global_metadata_dir[ PATH_MAX + 1 ];
-   char const* is_daemonlet_str = NULL;
-   char const* loglevel = NULL;
-   
-   if( is_daemonlet != 0 ) {
-      is_daemonlet_str = "1";
-   }
-   else {
-      is_daemonlet_str = "0";
-   }
+   struct vdev_config* config = req->snapshot->config;
+   struct vdev_device_env* env = NULL;
+   char* cursor = NULL;
    
    memset( metadata_dir, 0, PATH_MAX+1 );
    memset( global_metadata_dir, 0, PATH_MAX+1 );
-   memset( dev_buf, 0, 51 );
    
-   if( vdev_path == NULL ) {
-      
-      vdev_path = req->path;
-   }
+   snprintf( global_metadata_dir, PATH_MAX, "%s/" VDEV_METADATA_PREFIX, req->state->mountpoint );
    
-   if( vdev_path != NULL ) {
-      snprintf( metadata_dir, PATH_MAX, "%s/" VDEV_METADATA_PREFIX "/dev/%s", req->state->mountpoint, vdev_path );
-   }
+#define VDEV_DEVICE_ENV_FIXED( k, v ) do { vars[num_fixed].prefix = ""; vars[num_fixed].key = (k); vars[num_fixed].value = (v); num_fixed++; } while(0)
    
-   char** env = VDEV_CALLOC( char*, num_vars + 1 );
+   VDEV_DEVICE_ENV_FIXED( "VDEV_MOUNTPOINT", req->state->mountpoint );
+   VDEV_DEVICE_ENV_FIXED( "VDEV_ACTION", vdev_device_request_type_to_string( req->type ) );
    
-   if( env == NULL ) {
-      return -ENOMEM;
+   if( vdev_path != NULL ) {
+      
+      snprintf( metadata_dir, PATH_MAX, "%s/" VDEV_METADATA_PREFIX "/dev/%s", req->state->mountpoint, vdev_path );
+      
+      VDEV_DEVICE_ENV_FIXED( "VDEV_PATH", vdev_path );
+      VDEV_DEVICE_ENV_FIXED( "VDEV_METADATA", metadata_dir );
    }
    
-   snprintf( global_metadata_dir, PATH_MAX, "%s/" VDEV_METADATA_PREFIX, req->state->mountpoint );
+   VDEV_DEVICE_ENV_FIXED( "VDEV_GLOBAL_METADATA", global_metadata_dir );
+   VDEV_DEVICE_ENV_FIXED( "VDEV_CONFIG_FILE", config->config_path );
    
-   rc = vdev_device_request_make_env_str( "VDEV_MOUNTPOINT", req->state->mountpoint, &env[i] );
-   if( rc != 0 ) {
+   if( req->dev != 0 ) {
       
-      VDEV_FREE_LIST( env );
-      return rc;
+      snprintf( major_buf, 50, "%u", major(req->dev) );
+      snprintf( minor_buf, 50, "%u", minor(req->dev) );
+      
+      VDEV_DEVICE_ENV_FIXED( "VDEV_MAJOR", major_buf );
+      VDEV_DEVICE_ENV_FIXED( "VDEV_MINOR", minor_buf );
    }
    
-   i++;
-   
-   rc = vdev_device_request_make_env_str( "VDEV_ACTION", vdev_device_request_type_to_string( req->type ), &env[i] );
-   if( rc != 0 ) {
+   if( (req->mode & (S_IFBLK | S_IFCHR)) != 0 ) {
       
-      VDEV_FREE_LIST( env );
-      return rc;
+      VDEV_DEVICE_ENV_FIXED( "VDEV_MODE", vdev_device_request_mode_to_string( req->mode ) );
    }
    
-   i++;
+   VDEV_DEVICE_ENV_FIXED( "VDEV_HELPERS", config->helpers_dir );
    
-   if( vdev_path != NULL ) {
-      
-      rc = vdev_device_request_make_env_str( "VDEV_PATH", vdev_path, &env[i] );
-      if( rc != 0 ) {
-         
-         VDEV_FREE_LIST( env );
-         return rc;
-      }
-      
-      i++;
-      
-      rc = vdev_device_request_make_env_str( "VDEV_METADATA", metadata_dir, &env[i] );
-      if( rc != 0 ) {
-         
-         VDEV_FREE_LIST( env );
-         return rc;
-      }
+   if( config->logfile_path != NULL && strcasecmp( config->logfile_path, "syslog" ) != 0 ) {
       
-      i++;
+      VDEV_DEVICE_ENV_FIXED( "VDEV_LOGFILE", config->logfile_path );
    }
    
-   rc = vdev_device_request_make_env_str( "VDEV_GLOBAL_METADATA", global_metadata_dir, &env[i] );
-   if( rc != 0 ) {
-      
-      VDEV_FREE_LIST( env );
-      return rc;
-   }
+   VDEV_DEVICE_ENV_FIXED( "VDEV_INSTANCE", config->instance_str );
+   VDEV_DEVICE_ENV_FIXED( "VDEV_LOGLEVEL", vdev_device_request_loglevel() );
    
-   i++;
+#undef VDEV_DEVICE_ENV_FIXED
    
-   rc = vdev_device_request_make_env_str( "VDEV_CONFIG_FILE", req->state->config->config_path, &env[i] );
-   if( rc != 0 ) {
-      
-      VDEV_FREE_LIST( env );
-      return rc;
+   // size everything up...
+   for( int i = 0; i < num_fixed; i++ ) {
+      len += vdev_device_env_var_len( vars[i].prefix, vars[i].key, vars[i].value );
    }
    
-   i++;
+   num_vars = num_fixed;
    
-   if( req->dev != 0 ) {
-         
-      snprintf(dev_buf, 50, "%u", major(req->dev) );
-      
-      rc = vdev_device_request_make_env_str( "VDEV_MAJOR", dev_buf, &env[i] );
-      if( rc != 0 ) {
-         
-         VDEV_FREE_LIST( env );
-         return rc;
-      }
-      
-      i++;
-      
-      snprintf(dev_buf, 50, "%u", minor(req->dev) );
-      
-      rc = vdev_device_request_make_env_str( "VDEV_MINOR", dev_buf, &env[i] );
-      if( rc != 0 ) {
-         
-         VDEV_FREE_LIST( env );
-         return rc;
-      }
+   for( dp = sglib_vdev_params_it_init_inorder( &itr, req->params ); dp != NULL; dp = sglib_vdev_params_it_next( &itr ) ) {
       
-      i++;
+      len += vdev_device_env_var_len( "VDEV_OS_", dp->key, dp->value );
+      num_vars++;
    }
    
-   if( (req->mode & (S_IFBLK | S_IFCHR)) != 0 ) {
-      
-      rc = vdev_device_request_make_env_str( "VDEV_MODE", vdev_device_request_mode_to_string( req->mode ), &env[i] );
-      if( rc != 0 ) {
-         
-         VDEV_FREE_LIST( env );
-         return rc;
-      }
-      
-      i++;
+   if( vdev_path != NULL ) {
+      len += strlen( vdev_path ) + 1;
    }
    
-   rc = vdev_device_request_make_env_str( "VDEV_HELPERS", req->state->config->helpers_dir, &env[i] );
-   if( rc != 0 ) {
-      
-      VDEV_FREE_LIST( env );
-      return rc;
+   // ...and lay it out in one allocation
+   env = (struct vdev_device_env*)VDEV_CALLOC( char, sizeof(struct vdev_device_env) + sizeof(char*) * num_vars + len );
+   if( env == NULL ) {
+      return -ENOMEM;
    }
    
-   i++;
+   env->vars = (char**)(env + 1);
+   cursor = (char*)(env->vars + num_vars);
    
-   if( req->state->config->logfile_path != NULL && strcasecmp( req->state->config->logfile_path, "syslog" ) != 0 ) {
-      
-      rc = vdev_device_request_make_env_str( "VDEV_LOGFILE", req->state->config->logfile_path, &env[i] );
-      if( rc != 0 ) {
-         
-         VDEV_FREE_LIST( env );
-         return rc;
-      }
+   for( int i = 0; i < num_fixed; i++ ) {
       
-      i++;
+      env->vars[ env->num_vars ] = vdev_device_env_var_put( &cursor, vars[i].prefix, vars[i].key, vars[i].value );
+      env->num_vars++;
    }
    
-   rc = vdev_device_request_make_env_str( "VDEV_INSTANCE", req->state->config->instance_str, &env[i] );
-   if( rc != 0 ) {
+   for( dp = sglib_vdev_params_it_init_inorder( &itr, req->params ); dp != NULL; dp = sglib_vdev_params_it_next( &itr ) ) {
       
-      VDEV_FREE_LIST( env );
-      return rc;
+      env->vars[ env->num_vars ] = vdev_device_env_var_put( &cursor, "VDEV_OS_", dp->key, dp->value );
+      env->num_vars++;
    }
    
-   i++;
-   
-   rc = vdev_device_request_make_env_str( "VDEV_DAEMONLET", is_daemonlet_str, &env[i] );
-   if( rc != 0 ) {
+   if( vdev_path != NULL ) {
       
-      VDEV_FREE_LIST( env );
-      return rc;
+      env->path = cursor;
+      strcpy( env->path, vdev_path );
    }
    
-   i++;
-   
-   if( vdev_get_debug_level() > 0 ) {
-     if( vdev_get_debug_level() == 1 ) {
-        loglevel = "info";
-     }
-     else {
-        loglevel = "debug";
-     }
-   }
-   else if( vdev_get_error_level() > 0 ) {
-      if( vdev_get_error_level() == 1 ) {
-         loglevel = "error";
-      }
-      else {
-         loglevel = "warning";
-      }
-   }
-
-   if( loglevel == NULL ) {
-      loglevel = "warning";
-   }
-
-   rc = vdev_device_request_make_env_str( "VDEV_LOGLEVEL", loglevel, &env[i] );
-   if( rc != 0 ) {
+   *ret_env = env;
+   return 0;
+}
 
-      VDEV_FREE_LIST( env );
-      return rc;
-   }
 
-   i++;
-        
-   // add all OS-specific parameters 
-   for( dp = sglib_vdev_params_it_init_inorder( &itr, req->params ); dp != NULL; dp = sglib_vdev_params_it_next( &itr ) ) {
-      
-      char const* param_key = dp->key;
-      char const* param_value = dp->value;
+// convert a device request to a list of null-terminated KEY=VALUE environment variable strings 
+// put the resulting vector into **ret_env, and put the number of variables into *num_env 
+// the variables common to all actions are built once and cached on the request; only the
+// action-specific ones (VDEV_VAR_* from helper_vars, and VDEV_DAEMONLET) are built on each call.
+// if is_daemonlet is set, then set VDEV_DAEMONLET=1
+// the vector is a single allocation: free it with free(), not VDEV_FREE_LIST.  It is only valid
+// as long as the request is not freed or changed.
+// return 0 on success 
+// return negative on error 
+// NOTE: uses the request's pinned snapshot (req->snapshot), so a reload can happen meanwhile
+int vdev_device_request_to_env( struct vdev_device_request* req, vdev_params* helper_vars, char*** ret_env, size_t* num_env, int is_daemonlet ) {
+   
+   // helper vars --> VDEV_VAR_*
+   // daemonlet --> VDEV_DAEMONLET (0 by default, 1 if is_daemonlet is non-zero)
+   
+   int rc = 0;
+   size_t num_vars = 1 + sglib_vdev_params_len( helper_vars );
+   size_t len = 0;
+   struct vdev_param_t* dp = NULL;
+   struct sglib_vdev_params_iterator itr;
+   char const* vdev_path = req->renamed_path;
+   char const* is_daemonlet_str = (is_daemonlet != 0 ? "1" : "0");
+   char** env = NULL;
+   char* cursor = NULL;
+   size_t i = 0;
+   
+   if( vdev_path == NULL ) {
       
-      // prepend with "VDEV_OS_"
-      char* varname = VDEV_CALLOC( char, strlen(param_key) + 1 + strlen("VDEV_OS_") );
+      vdev_path = req->path;
+   }
+   
+   // the device may have been renamed since the environment was cached 
+   if( req->env != NULL ) {
       
-      if( varname == NULL ) {
+      if( (req->env->path == NULL) != (vdev_path == NULL) || (vdev_path != NULL && strcmp( req->env->path, vdev_path ) != 0) ) {
          
-         VDEV_FREE_LIST( env );
-         return -ENOMEM;
+         vdev_device_request_env_invalidate( req );
       }
+   }
+   
+   if( req->env == NULL ) {
       
-      sprintf( varname, "VDEV_OS_%s", param_key );
-      
-      rc = vdev_device_request_make_env_str( varname, param_value, &env[i] );
-      
-      free( varname );
-      
+      rc = vdev_device_env_build( req, vdev_path, &req->env );
       if( rc != 0 ) {
          
-         VDEV_FREE_LIST( env );
          return rc;
       }
-      
-      i++;
    }
    
-   // add all helper-specific variables 
+   // size up the action-specific variables...
+   len += vdev_device_env_var_len( "", "VDEV_DAEMONLET", is_daemonlet_str );
+   
    for( dp = sglib_vdev_params_it_init_inorder( &itr, helper_vars ); dp != NULL; dp = sglib_vdev_params_it_next( &itr ) ) {
       
-      char const* param_key = dp->key;
-      char const* param_value = dp->value;
-      
-      // prepend with "VDEV_OS_"
-      char* varname = VDEV_CALLOC( char, strlen(param_key) + 1 + strlen("VDEV_VAR_") );
-      
-      if( varname == NULL ) {
-         
-         VDEV_FREE_LIST( env );
-         return -ENOMEM;
-      }
-      
-      sprintf( varname, "VDEV_VAR_%s", param_key );
-      
-      rc = vdev_device_request_make_env_str( varname, param_value, &env[i] );
-      
-      free( varname );
+      len += vdev_device_env_var_len( "VDEV_VAR_", dp->key, dp->value );
+   }
+   
+   // ...and put them after the common ones 
+   env = (char**)VDEV_CALLOC( char, sizeof(char*) * (req->env->num_vars + num_vars + 1) + len );
+   if( env == NULL ) {
+      return -ENOMEM;
+   }
+   
+   cursor = (char*)(env + req->env->num_vars + num_vars + 1);
+   
+   for( i = 0; i < req->env->num_vars; i++ ) {
       
-      if( rc != 0 ) {
-         
-         VDEV_FREE_LIST( env );
-         return rc;
-      }
+      env[i] = req->env->vars[i];
+   }
+   
+   env[i] = vdev_device_env_var_put( &cursor, "", "VDEV_DAEMONLET", is_daemonlet_str );
+   i++;
+   
+   for( dp = sglib_vdev_params_it_init_inorder( &itr, helper_vars ); dp != NULL; dp = sglib_vdev_params_it_next( &itr ) ) {
       
+      env[i] = vdev_device_env_var_put( &cursor, "VDEV_VAR_", dp->key, dp->value );
       i++;
    }
    
@@ -429,6 +410,8 @@ int vdev_device_request_to_env( struct vdev_device_request* req, vdev_params* he
 // return -ENOMEM on OOM
 int vdev_device_request_set_path( struct vdev_device_request* req, char const* path ) {
    
+   vdev_device_request_env_invalidate( req );
+   
    if( req->path != NULL ) {
       free( req->path );
    }
@@ -446,6 +429,8 @@ int vdev_device_request_set_path( struct vdev_device_request* req, char const* p
 // always succeeds
 int vdev_device_request_set_dev( struct vdev_device_request* req, dev_t dev ) {
    
+   vdev_device_request_env_invalidate( req );
+   
    req->dev = dev;
    return 0;
 }
@@ -458,6 +443,41 @@ int vdev_device_request_set_exists( struct vdev_device_request* req, bool exists
    req->exists = exists;
    return 0;
 }
+
+
+// mark this device request as synthesized from a scan of the system's devices 
+// always succeeds
+int vdev_device_request_set_coldplug( struct vdev_device_request* req, bool coldplug ) {
+   
+   req->coldplug = coldplug;
+   return 0;
+}
+
+
+// set the event's trace ID (i.e. its kernel SEQNUM)
+// always succeeds
+int vdev_device_request_set_trace_id( struct vdev_device_request* req, uint64_t trace_id ) {
+   
+   req->trace_id = trace_id;
+   return 0;
+}
+
+
+// record that this request spent [start, end] in a stage of processing.
+// name is the action name, for action stages.
+// always succeeds
+int vdev_device_request_trace( struct vdev_device_request* req, int stage, char const* name, struct timespec const* start, struct timespec const* end ) {
+   
+   if( req->state == NULL || !vdev_trace_enabled( &req->state->trace ) ) {
+      return 0;
+   }
+   
+   if( req->trace_id == 0 ) {
+      req->trace_id = vdev_trace_synthetic_id( &req->state->trace );
+   }
+   
+   return vdev_trace_record( &req->state->trace, req->trace_id, stage, name, start, end );
+}
    
 
 // device request sanity check 
@@ -484,6 +504,8 @@ int vdev_device_request_sanity_check( struct vdev_device_request* req ) {
 // set the request type 
 int vdev_device_request_set_type( struct vdev_device_request* req, vdev_device_request_t req_type ) {
    
+   vdev_device_request_env_invalidate( req );
+   
    req->type = req_type;
    return 0;
 }
@@ -492,101 +514,209 @@ int vdev_device_request_set_type( struct vdev_device_request* req, vdev_device_r
 // set the request device mode 
 int vdev_device_request_set_mode( struct vdev_device_request* req, mode_t mode ) {
    
-   req->mode = mode;
+   vdev_device_request_env_invalidate( req );
+   
+   req->mode = mode;
+   return 0;
+}
+
+
+// generate a path to a device's metadata directory, where helpers keep its links, properties, and tags
+// return the malloc'ed path on success
+// return NULL on error 
+char* vdev_device_metadata_fullpath( char const* mountpoint, char const* device_path ) {
+   
+   char* base_dir = NULL;
+   char* metadata_dir = VDEV_CALLOC( char, strlen( mountpoint ) + 1 + strlen(VDEV_METADATA_PREFIX) + 2 + strlen(device_path) + 1 );
+   if( metadata_dir == NULL ) {
+      
+      return NULL;
+   }
+   
+   sprintf( metadata_dir, VDEV_METADATA_PREFIX "/dev/%s", device_path );
+   
+   base_dir = vdev_fullpath( mountpoint, metadata_dir, NULL );
+   
+   free( metadata_dir );
+   
+   if( base_dir == NULL ) {
+      
+      return NULL;
+   }
+   
+   return base_dir;
+}
+
+
+// get a device path relative to the mountpoint (i.e. without leading slashes), for the *at() syscalls 
+static char const* vdev_device_relpath( char const* device_path ) {
+   
+   while( *device_path == '/' ) {
+      device_path++;
+   }
+   
+   return device_path;
+}
+
+
+// get the name of a device's record in $VDEV_MOUNTPOINT/$VDEV_METADATA_PREFIX/records.
+// the device path is serialized like the helpers' vdev_serialize_path does it:  '/' becomes "\x2f" (and '\' becomes "\x5c"),
+// ignoring leading and repeated slashes, so all records are in one directory.
+// name must be at least VDEV_METADATA_RECORD_NAME_MAX+1 bytes.
+// return 0 on success
+// return -ENAMETOOLONG if the name (or its temporary file's name) would be too long for a file name
+static int vdev_device_record_name( char const* device_path, char* name ) {
+   
+   size_t len = 0;
+   char const* relpath = vdev_device_relpath( device_path );
+   
+   for( char const* p = relpath; *p != '\0'; p++ ) {
+      
+      // leave room for an escape, and for the temporary file's suffix (see vdev_device_put_metadata)
+      if( len + 4 > VDEV_METADATA_RECORD_NAME_MAX ) {
+         
+         return -ENAMETOOLONG;
+      }
+      
+      if( *p == '/' ) {
+         
+         if( *(p - 1) == '/' ) {
+            
+            // repeated slash 
+            continue;
+         }
+         
+         memcpy( name + len, "\\x2f", 4 );
+         len += 4;
+      }
+      else if( *p == '\\' ) {
+         
+         memcpy( name + len, "\\x5c", 4 );
+         len += 4;
+      }
+      else {
+         
+         name[ len++ ] = *p;
+      }
+   }
+   
+   name[ len ] = '\0';
+   
+   // no trailing slash 
+   if( len >= 4 && strcmp( name + len - 4, "\\x2f" ) == 0 ) {
+      
+      name[ len - 4 ] = '\0';
+   }
+   
    return 0;
 }
 
 
-// generate a path to a device's metadata
-// return the malloc'ed path on success
-// return NULL on error 
-char* vdev_device_metadata_fullpath( char const* mountpoint, char const* device_path ) {
-   
-   char* base_dir = NULL;
-   char* metadata_dir = VDEV_CALLOC( char, strlen( mountpoint ) + 1 + strlen(VDEV_METADATA_PREFIX) + 2 + strlen(device_path) + 1 );
-   if( metadata_dir == NULL ) {
-      
-      return NULL;
-   }
-   
-   sprintf( metadata_dir, VDEV_METADATA_PREFIX "/dev/%s", device_path );
-   
-   base_dir = vdev_fullpath( mountpoint, metadata_dir, NULL );
-   
-   free( metadata_dir );
+// get the path to a device's metadata directory, relative to $VDEV_MOUNTPOINT/$VDEV_METADATA_PREFIX (i.e. for metadata_fd)
+// md_path must be at least PATH_MAX+1 bytes.
+// return 0 on success
+// return -ENAMETOOLONG if the path does not fit
+static int vdev_device_metadata_relpath( char const* device_path, char* md_path ) {
    
-   if( base_dir == NULL ) {
+   int len = snprintf( md_path, PATH_MAX + 1, "dev/%s", vdev_device_relpath( device_path ) );
+   if( len < 0 || len > PATH_MAX ) {
       
-      return NULL;
+      return -ENAMETOOLONG;
    }
    
-   return base_dir;
+   return 0;
 }
 
 
-// create or update an item of metadata to $VDEV_MOUNTPOINT/$VDEV_METADATA_PREFIX/dev/$VDEV_PATH/$PARAM_KEY
+// get a field from a device's record 
+// value gets at most value_len - 1 bytes, and is always null-terminated
 // return 0 on success
-// return negative on error 
-static int vdev_device_put_metadata_item( char* base_dir, char const* param_name, char const* param_value, int flags, mode_t mode ) {
+// return -ENOENT if the device has no record, or the record doesn't have the field
+// return -ENAMETOOLONG if the device path is too long to have a record
+// return -errno on failure to read
+int vdev_device_record_get( int records_fd, char const* device_path, char const* key, char* value, size_t value_len ) {
    
    int rc = 0;
-   char* param_value_with_newline = NULL;
-   char* key_value_path = NULL;
+   int fd = -1;
+   ssize_t nr = 0;
+   char buf[ VDEV_METADATA_RECORD_MAX + 1 ];
+   char name[ VDEV_METADATA_RECORD_NAME_MAX + 1 ];
+   char* line = NULL;
+   char* next = NULL;
+   size_t key_len = strlen( key );
+   
+   rc = vdev_device_record_name( device_path, name );
+   if( rc != 0 ) {
+      
+      return rc;
+   }
    
-   key_value_path = vdev_fullpath( base_dir, param_name, NULL );
+   memset( buf, 0, VDEV_METADATA_RECORD_MAX + 1 );
    
-   if( key_value_path == NULL ) {
+   // not vdev_read_file(), since a missing record isn't an error 
+   fd = openat( records_fd, name, O_RDONLY | O_CLOEXEC );
+   if( fd < 0 ) {
       
-      rc = -ENOMEM;
-      return rc;
+      return -errno;
    }
    
-   param_value_with_newline = VDEV_CALLOC( char, strlen(param_value) + 2 );
-   if( param_value_with_newline == NULL ) {
+   nr = vdev_read_uninterrupted( fd, buf, VDEV_METADATA_RECORD_MAX );
+   if( nr < 0 ) {
       
-      rc = -ENOMEM;
-      free( key_value_path );
-      return rc;
+      rc = (int)nr;
    }
    
-   strcpy( param_value_with_newline, param_value );
-   strcat( param_value_with_newline, "\n");
+   close( fd );
    
-   rc = vdev_write_file( key_value_path, param_value_with_newline, strlen(param_value_with_newline), flags, mode );
+   if( rc != 0 ) {
+      
+      return rc;
+   }
    
-   free( param_value_with_newline );
+   rc = -ENOENT;
    
-   if( rc < 0 ) {
+   for( line = buf; line != NULL && *line != '\0'; line = next ) {
       
-      vdev_error("vdev_write_file('%s', '%s') rc = %d\n", key_value_path, param_value, rc );
-   }
-   else {
+      next = strchr( line, '\n' );
+      if( next != NULL ) {
+         
+         *next = '\0';
+         next++;
+      }
       
-      rc = 0;
+      if( strncmp( line, key, key_len ) == 0 && line[ key_len ] == '=' ) {
+         
+         memset( value, 0, value_len );
+         strncpy( value, line + key_len + 1, value_len - 1 );
+         
+         rc = 0;
+         break;
+      }
    }
    
-   free( key_value_path );
-   
    return rc;
 }
 
 
 // record extra metadata (i.e. vdev parameters) for a device node
+// the record is one small file of KEY=VALUE lines, written to a temporary file and renamed into place,
+// so it is replaced atomically:  readers see either the old record or the new one.
 // overwrite existing metadata if it already exists for this device.
 // return 0 on success
-// return -ENOMEM on OOM 
 // return -EINVAL if there is no device path defined for this request
+// return -ENAMETOOLONG if the device path is too long to have a record
 // return negative on I/O error
-// NOTE: the device metadata directory ($VDEV_MOUNTPOINT/$VDEV_METADATA_PREFIX/dev) must exist
-// NOTE: not reload-safe; call while the reload lock is held
+// NOTE: the record directory must be open (i.e. vdev_main() is running)
 static int vdev_device_put_metadata( struct vdev_device_request* req ) {
 
    int rc = 0;
-   struct sglib_vdev_params_iterator itr;
-   struct vdev_param_t* dp;
-   
-   char* base_dir = NULL;
+   int fd = -1;
+   int records_fd = req->state->records_fd;
+   char name[ VDEV_METADATA_RECORD_NAME_MAX + 1 ];
+   char tmp_name[ NAME_MAX + 1 ];
    char* device_path = NULL;
+   char record[ VDEV_METADATA_RECORD_MAX + 1 ];
+   int record_len = 0;
    
    // only create device metadata if the device path is known.
    if( req->renamed_path != NULL ) {
@@ -608,41 +738,68 @@ static int vdev_device_put_metadata( struct vdev_device_request* req ) {
       return -EINVAL;
    }
    
-   // path to device metadata
-   base_dir = vdev_device_metadata_fullpath( req->state->mountpoint, req->renamed_path );
-   if( base_dir == NULL ) {
+   record_len = snprintf( record, VDEV_METADATA_RECORD_MAX + 1, VDEV_METADATA_PARAM_INSTANCE "=%s\n" VDEV_METADATA_PARAM_PATH "=%s\n", req->snapshot->config->instance_str, device_path );
+   
+   if( record_len <= VDEV_METADATA_RECORD_MAX && req->dev != 0 && req->mode != 0 ) {
       
-      return -ENOMEM;
+      record_len += snprintf( record + record_len, VDEV_METADATA_RECORD_MAX + 1 - record_len, VDEV_METADATA_PARAM_TYPE "=%s\n" VDEV_METADATA_PARAM_MAJOR "=%u\n" VDEV_METADATA_PARAM_MINOR "=%u\n", 
+                              (S_ISBLK( req->mode ) ? "block" : "char"), major( req->dev ), minor( req->dev ) );
    }
    
-   // all directories must exist 
-   rc = vdev_mkdirs( base_dir, strlen( req->state->mountpoint ), 0755 );
-   if( rc != 0 ) {
+   if( record_len > VDEV_METADATA_RECORD_MAX ) {
       
-      vdev_error("vdev_mkdirs('%s') rc = %d\n", base_dir, rc );
+      return -ENAMETOOLONG;
+   }
+   
+   rc = vdev_device_record_name( device_path, name );
+   if( rc != 0 ) {
       
-      free( base_dir );
-      base_dir = NULL;
+      vdev_error("No record for '%s': path is too long\n", device_path );
+      return rc;
+   }
+   
+   // write it next to the record, and swap it in.
+   // each worker thread writes one record at a time, so name the temporary file after it.
+   snprintf( tmp_name, NAME_MAX + 1, "%s.%lx", name, (unsigned long)pthread_self() );
+   
+   fd = openat( records_fd, tmp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+   if( fd < 0 ) {
       
+      rc = -errno;
+      vdev_error("openat('%s') rc = %d\n", tmp_name, rc );
       return rc;
    }
    
-   // save instance nonce
-   rc = vdev_device_put_metadata_item( base_dir, VDEV_METADATA_PARAM_INSTANCE, req->state->config->instance_str, O_CREAT | O_WRONLY | O_TRUNC, 0644 );
-   if( rc != 0 ) {
+   // readable by helpers, like the rest of the metadata (whatever the umask is)
+   rc = fchmod( fd, 0644 );
+   if( rc == 0 ) {
       
-      if( rc == -EEXIST ) {
-         
-         // try to update instead
-         rc = vdev_device_put_metadata_item( base_dir, VDEV_METADATA_PARAM_INSTANCE, req->state->config->instance_str, O_WRONLY | O_TRUNC, 0644 );
+      rc = vdev_write_uninterrupted( fd, record, record_len );
+      if( rc >= 0 ) {
+         rc = 0;
       }
+   }
+   else {
+      
+      rc = -errno;
+   }
+   
+   close( fd );
+   
+   if( rc == 0 ) {
       
+      rc = renameat( records_fd, tmp_name, records_fd, name );
       if( rc != 0 ) {
-         vdev_error("vdev_device_put_metadata_item('%s', '%s') rc = %d\n", VDEV_METADATA_PARAM_INSTANCE, req->state->config->instance_str, rc );
+         
+         rc = -errno;
       }
    }
    
-   free( base_dir );
+   if( rc != 0 ) {
+      
+      vdev_error("writing record '%s' rc = %d\n", name, rc );
+      unlinkat( records_fd, tmp_name, 0 );
+   }
    
    return rc;
 }
@@ -703,113 +860,225 @@ static int vdev_device_remove_metadata_file( char const* fp, void* cls ) {
    return rc;
 }
 
-// remove extra metadata (i.e. vdev and OS parameters) for a deivce node 
+// remove extra metadata (i.e. vdev and OS parameters) for a deivce node:
+// its record, and whatever its helpers left in its metadata directory.
+// the directory only exists if a helper wrote to it (or if an older vdevd made it), so this is usually two syscalls.
 // return 0 on success
 // return negative on error 
-// NOTE: not reload-safe; call while the reload lock is held
+// NOTE: the metadata and record directories must be open (i.e. vdev_main() is running)
 static int vdev_device_remove_metadata( struct vdev_device_request* req ) {
    
    int rc = 0;
-   
+   char name[ VDEV_METADATA_RECORD_NAME_MAX + 1 ];
+   char md_path[ PATH_MAX + 1 ];
    char* base_dir = NULL;
-   char metadata_dir[ PATH_MAX + 1 ];
    
-   // NOTE: req->path is guaranteed to be <= 256 characters
-   sprintf( metadata_dir, VDEV_METADATA_PREFIX "/dev/%s", req->path );
-   
-   base_dir = vdev_fullpath( req->state->mountpoint, metadata_dir, NULL );
-   if( base_dir == NULL ) {
+   rc = vdev_device_record_name( req->renamed_path, name );
+   if( rc == 0 ) {
       
-      return -ENOMEM;
+      rc = unlinkat( req->state->records_fd, name, 0 );
+      if( rc != 0 ) {
+         
+         rc = -errno;
+         if( rc != -ENOENT ) {
+            vdev_warn("unlinkat('%s') rc = %d\n", name, rc );
+         }
+      }
    }
    
-   // remove everything in this directory 
-   rc = vdev_load_all( base_dir, vdev_device_remove_metadata_file, NULL );
-   
+   rc = vdev_device_metadata_relpath( req->renamed_path, md_path );
    if( rc != 0 ) {
       
-      vdev_error("vdev_load_all('%s') rc = %d\n", base_dir, rc );
+      vdev_warn("No metadata directory for '%s': path is too long\n", req->renamed_path );
+      return rc;
    }
    
-   // remove the directory itself 
-   rc = rmdir( base_dir );
+   rc = unlinkat( req->state->metadata_fd, md_path, AT_REMOVEDIR );
    if( rc != 0 ) {
       
       rc = -errno;
-      vdev_warn("rmdir('%s') rc = %d\n", base_dir, rc );
    }
    
-   free( base_dir );
+   if( rc == -ENOTEMPTY || rc == -EEXIST ) {
+      
+      // helpers left files here.  Remove everything in this directory, and then the directory itself 
+      base_dir = vdev_device_metadata_fullpath( req->state->mountpoint, req->renamed_path );
+      if( base_dir == NULL ) {
+         
+         return -ENOMEM;
+      }
+      
+      rc = vdev_load_all( base_dir, vdev_device_remove_metadata_file, NULL );
+      if( rc != 0 ) {
+         
+         vdev_error("vdev_load_all('%s') rc = %d\n", base_dir, rc );
+      }
+      
+      free( base_dir );
+      
+      rc = unlinkat( req->state->metadata_fd, md_path, AT_REMOVEDIR );
+      if( rc != 0 ) {
+         
+         rc = -errno;
+      }
+   }
+   
+   if( rc == -ENOENT ) {
+      
+      // no helper left anything
+      rc = 0;
+   }
+   
+   if( rc != 0 ) {
+      
+      vdev_warn("rmdir('%s/" VDEV_METADATA_PREFIX "%s') rc = %d\n", req->state->mountpoint, md_path, rc );
+   }
+   
    return rc;
 }
 
 
 // do we have metadata logged for a device?
+// that is, does it have a record, or (if an older vdevd or a helper made it) a metadata directory?
 // return 0 on success
 // return negative on error 
-// NOTE: not reload-safe; call while the reload lock is held
+// NOTE: the metadata and record directories must be open (i.e. vdev_main() is running)
 static int vdev_device_has_metadata( struct vdev_device_request* req ) {
    
    int rc = 0;
    struct stat sb;
-   char* md_fp = vdev_device_metadata_fullpath( req->state->mountpoint, req->renamed_path );
-   if( md_fp == NULL ) {
+   char name[ VDEV_METADATA_RECORD_NAME_MAX + 1 ];
+   char md_path[ PATH_MAX + 1 ];
+   
+   rc = vdev_device_record_name( req->renamed_path, name );
+   if( rc == 0 ) {
       
-      rc = -ENOMEM;
-   }
-   else {
+      rc = fstatat( req->state->records_fd, name, &sb, 0 );
+      if( rc == 0 ) {
+         return 0;
+      }
       
-      rc = stat( md_fp, &sb );
-
-      if( rc != 0 ) {
-         rc = -errno;
+      rc = -errno;
+      if( rc != -ENOENT ) {
+         return rc;
       }
+   }
+   
+   rc = vdev_device_metadata_relpath( req->renamed_path, md_path );
+   if( rc != 0 ) {
+      
+      return rc;
+   }
+   
+   rc = fstatat( req->state->metadata_fd, md_path, &sb, 0 );
+   if( rc != 0 ) {
       
-      free( md_fp );
+      rc = -errno;
    }
    
    return rc;
 }
 
 
-// create all directories leading up to a device 
+// create all directories leading up to a device, relative to the mountpoint
 // return 0 on success
 // return negative on error 
-// NOTE: not reload-safe; call while the reload lock is held
-static int vdev_device_mkdirs( struct vdev_device_request* req, char** dev_fullpath ) {
+// NOTE: the mountpoint must be open (i.e. vdev_main() is running)
+static int vdev_device_mkdirs( struct vdev_device_request* req ) {
    
    int rc = 0;
-   char* fp = NULL;
-   char* fp_dir = NULL;
+   char fp_dir[ PATH_MAX + 1 ];
+   char const* relpath = vdev_device_relpath( req->renamed_path );
+   char const* slash = strrchr( relpath, '/' );
    
-   fp = vdev_fullpath( req->state->mountpoint, req->renamed_path, NULL );
-   if( fp == NULL ) {
+   if( slash == NULL ) {
       
-      rc = -ENOMEM;
-      return rc;
+      // in the mountpoint itself 
+      return 0;
    }
    
-   if( strchr(req->renamed_path, '/') != NULL ) {
-      
-      fp_dir = vdev_dirname( fp, NULL );
-      if( fp_dir == NULL ) {
-         
-         rc = -ENOMEM;
-         free( fp );
-         return rc;
-      }
+   if( (size_t)(slash - relpath) > PATH_MAX ) {
+      return -ENAMETOOLONG;
+   }
    
-      // make sure the directories leading to this path exist
-      rc = vdev_mkdirs( fp_dir, strlen(req->state->mountpoint), 0755 );
-      if( rc != 0 ) {
-      
-         vdev_error("vdev_mkdirs('%s') rc = %d\n", fp_dir, rc );
-      }
+   memcpy( fp_dir, relpath, slash - relpath );
+   fp_dir[ slash - relpath ] = '\0';
+   
+   // make sure the directories leading to this path exist
+   rc = vdev_mkdirs_at( req->state->mountpoint_fd, fp_dir, 0755 );
+   if( rc != 0 ) {
       
-      free( fp_dir );
+      vdev_error("vdev_mkdirs_at('%s/%s') rc = %d\n", req->state->mountpoint, fp_dir, rc );
+   }
+   
+   return rc;
+}
+
+
+// pin the current configuration and actions, so the request sees the same ones from start to finish even if they get reloaded
+// always succeeds
+static int vdev_device_request_pin( struct vdev_device_request* req ) {
+   
+   req->snapshot = vdev_snapshot_pin( req->state );
+   return 0;
+}
+
+
+// release the request's configuration and actions 
+// always succeeds
+static int vdev_device_request_unpin( struct vdev_device_request* req ) {
+   
+   vdev_snapshot_release( req->state, req->snapshot );
+   req->snapshot = NULL;
+   return 0;
+}
+
+
+// run the request's rename commands, if any, to find its device path 
+// return 0 on success, and set req->renamed_path (NULL if no action renames it)
+// return -errno on failure (see vdev_action_create_path)
+static int vdev_device_create_path( struct vdev_device_request* req ) {
+   
+   int rc = 0;
+   struct timespec start, end;
+   
+   clock_gettime( CLOCK_MONOTONIC, &start );
+   
+   rc = vdev_action_create_path( req, req->snapshot->acts, req->snapshot->num_acts, req->snapshot->acts_index, &req->renamed_path );
+   
+   clock_gettime( CLOCK_MONOTONIC, &end );
+   vdev_device_request_trace( req, VDEV_TRACE_CREATE_PATH, NULL, &start, &end );
+   
+   return rc;
+}
+
+
+// run a dequeued request's handler, recording how long it waited in the workqueue and tracing how long it took.
+// the handler frees the request.
+// return the handler's return code
+static int vdev_device_request_process( struct vdev_device_request* req, int (*handler)( struct vdev_device_request* ) ) {
+   
+   int rc = 0;
+   struct vdev_state* state = req->state;
+   uint64_t trace_id = 0;
+   struct timespec dequeued, done;
+   
+   clock_gettime( CLOCK_MONOTONIC, &dequeued );
+   vdev_device_request_trace( req, VDEV_TRACE_QUEUED, NULL, &req->enqueued, &dequeued );
+   
+   if( state != NULL ) {
+      vdev_stats_add_queue_delay( &state->stats, vdev_stats_nanos( &req->enqueued, &dequeued ) );
    }
    
-   *dev_fullpath = fp;
+   trace_id = req->trace_id;
+   
+   rc = (*handler)( req );
+   
+   if( state != NULL && vdev_trace_enabled( &state->trace ) ) {
+      
+      clock_gettime( CLOCK_MONOTONIC, &done );
+      vdev_trace_record( &state->trace, trace_id, VDEV_TRACE_REQUEST, NULL, &dequeued, &done );
+   }
    
    return rc;
 }
@@ -827,17 +1096,17 @@ int vdev_device_add( struct vdev_device_request* req ) {
    int do_mknod = 1;            // if 1, issue mknod.  Otherwise, check to see if the device exists by checking for metadata.
    int device_exists = 0;       // if 1, the device already exists.  only run commands with the if_exists directive set to "run"
    
-   // prevent reloads while processing   
-   vdev_reload_lock( req->state );
+   // use the same config and actions throughout, even if they get reloaded
+   vdev_device_request_pin( req );
 
    // do the rename, possibly generating it
-   rc = vdev_action_create_path( req, req->state->acts, req->state->num_acts, &req->renamed_path );
+   rc = vdev_device_create_path( req );
    if( rc != 0 ) {
       
       vdev_error("vdev_action_create_path('%s') rc = %d\n", req->path, rc);
       
       // done with this request
-      vdev_reload_unlock( req->state );
+      vdev_device_request_unpin( req );
       vdev_device_request_free( req );
       free( req );
    
@@ -851,7 +1120,7 @@ int vdev_device_add( struct vdev_device_request* req ) {
       if( req->renamed_path == NULL && req->path != NULL ) {
          
          // done with this request
-         vdev_reload_unlock( req->state );
+         vdev_device_request_unpin( req );
          vdev_device_request_free( req );
          free( req );
       
@@ -866,18 +1135,20 @@ int vdev_device_add( struct vdev_device_request* req ) {
       // device has a name (i.e. something for us to add)?
       if( strcmp( req->renamed_path, VDEV_DEVICE_PATH_UNKNOWN ) != 0 ) {
          
+         struct timespec start, end;
+         
+         clock_gettime( CLOCK_MONOTONIC, &start );
+         
          // device has major/minor/mode?
          if( req->dev != 0 && req->mode != 0 ) {
             
-            char* fp = NULL;       // full path to the device 
-            
-            rc = vdev_device_mkdirs( req, &fp );
+            rc = vdev_device_mkdirs( req );
             if( rc != 0 ) {
                
                vdev_error("vdev_device_mkdirs('%s/%s') rc = %d\n", req->state->mountpoint, req->renamed_path, rc );
                
                // done with this request 
-               vdev_reload_unlock( req->state );
+               vdev_device_request_unpin( req );
                vdev_device_request_free( req );
                free( req );
 
@@ -885,10 +1156,10 @@ int vdev_device_add( struct vdev_device_request* req ) {
             }
             
             // do we need to make the device?
-            if( vdev_config_has_OS_quirk( req->state->config->OS_quirks, VDEV_OS_QUIRK_DEVICE_EXISTS ) ) {
+            if( vdev_config_has_OS_quirk( req->snapshot->config->OS_quirks, VDEV_OS_QUIRK_DEVICE_EXISTS ) ) {
                
-               // nope, but did we process it already?
-               if( vdev_device_has_metadata( req ) ) {
+               // nope, but did we process it already?  (i.e. does it have metadata?)
+               if( vdev_device_has_metadata( req ) == 0 ) {
                   
                   // this device already exists, insofar as 
                   // we (or some other device manager)
@@ -902,7 +1173,7 @@ int vdev_device_add( struct vdev_device_request* req ) {
                if( !req->exists ) {
                
                   // file is not expected to exist
-                  rc = mknod( fp, req->mode | req->state->config->default_mode, req->dev );
+                  rc = mknodat( req->state->mountpoint_fd, vdev_device_relpath( req->renamed_path ), req->mode | req->snapshot->config->default_mode, req->dev );
                }
                else {
                   
@@ -922,8 +1193,6 @@ int vdev_device_add( struct vdev_device_request* req ) {
                   }
                }
             }
-            
-            free( fp );
          }
          
          // no major/minor/mode
@@ -949,6 +1218,9 @@ int vdev_device_add( struct vdev_device_request* req ) {
             }
          }
          
+         clock_gettime( CLOCK_MONOTONIC, &end );
+         vdev_device_request_trace( req, VDEV_TRACE_MKNOD, NULL, &start, &end );
+         
          if( rc != 0 ) {
             
             // some mknod or metadata I/O error occurred
@@ -958,8 +1230,13 @@ int vdev_device_add( struct vdev_device_request* req ) {
          else {
 
             // put/update metadata 
+            clock_gettime( CLOCK_MONOTONIC, &start );
+            
             rc = vdev_device_put_metadata( req );
             
+            clock_gettime( CLOCK_MONOTONIC, &end );
+            vdev_device_request_trace( req, VDEV_TRACE_METADATA, NULL, &start, &end );
+            
             if( rc != 0 ) {
                
                vdev_error("vdev_device_put_metadata('%s/%s') rc = %d\n", req->state->mountpoint, req->renamed_path, rc );
@@ -970,7 +1247,7 @@ int vdev_device_add( struct vdev_device_request* req ) {
       if( rc == 0 ) {
 
          // no problems yet.  call all ADD actions 
-         rc = vdev_action_run_commands( req, req->state->acts, req->state->num_acts, device_exists );
+         rc = vdev_action_run_commands( req, req->snapshot->acts, req->snapshot->num_acts, req->snapshot->acts_index, device_exists );
          if( rc != 0 ) {
             
             vdev_error("vdev_action_run_commands(ADD %s, dev=(%u, %u)) rc = %d\n", req->renamed_path, major(req->dev), minor(req->dev), rc );
@@ -979,7 +1256,7 @@ int vdev_device_add( struct vdev_device_request* req ) {
    }
    
    // done with this request
-   vdev_reload_unlock( req->state );
+   vdev_device_request_unpin( req );
    vdev_device_request_free( req );
    free( req );
                 
@@ -990,7 +1267,7 @@ int vdev_device_add( struct vdev_device_request* req ) {
 static int vdev_device_add_wq( struct vdev_wreq* wreq, void* cls ) {
    
    struct vdev_device_request* req = (struct vdev_device_request*)cls;
-   return vdev_device_add( req );
+   return vdev_device_request_process( req, vdev_device_add );
 }
 
 
@@ -1001,16 +1278,16 @@ int vdev_device_remove( struct vdev_device_request* req ) {
    
    int rc = 0;
    
-   vdev_reload_lock( req->state );
+   vdev_device_request_pin( req );
 
    // do the rename, possibly generating it
-   rc = vdev_action_create_path( req, req->state->acts, req->state->num_acts, &req->renamed_path );
+   rc = vdev_device_create_path( req );
    if( rc != 0 ) {
       
       vdev_error("vdev_action_create_path('%s') rc = %d\n", req->path, rc);
       
       // done with this request
-      vdev_reload_unlock( req->state );
+      vdev_device_request_unpin( req );
       vdev_device_request_free( req );
       free( req );
       
@@ -1023,7 +1300,7 @@ int vdev_device_remove( struct vdev_device_request* req ) {
       if( req->renamed_path == NULL && req->path == NULL ) {
          
          // done with this request
-         vdev_reload_unlock( req->state );
+         vdev_device_request_unpin( req );
          vdev_device_request_free( req );
          free( req );
       
@@ -1036,7 +1313,7 @@ int vdev_device_remove( struct vdev_device_request* req ) {
    if( req->renamed_path != NULL ) {
       
       // call all REMOVE actions
-      rc = vdev_action_run_commands( req, req->state->acts, req->state->num_acts, true );
+      rc = vdev_action_run_commands( req, req->snapshot->acts, req->snapshot->num_acts, req->snapshot->acts_index, true );
       if( rc != 0 ) {
          
          vdev_error("vdev_action_run_all(REMOVE %s) rc = %d\n", req->renamed_path, rc );
@@ -1045,39 +1322,59 @@ int vdev_device_remove( struct vdev_device_request* req ) {
       
       if( strcmp( req->renamed_path, VDEV_DEVICE_PATH_UNKNOWN ) != 0 ) {
          
+         struct timespec start, end;
+         
+         clock_gettime( CLOCK_MONOTONIC, &start );
+         
          // known path
          // only remove files from /dev if this is a device, and we created it
-         if( req->dev != 0 && req->mode != 0 && !vdev_config_has_OS_quirk( req->state->config->OS_quirks, VDEV_OS_QUIRK_DEVICE_EXISTS ) ) {
+         if( req->dev != 0 && req->mode != 0 && !vdev_config_has_OS_quirk( req->snapshot->config->OS_quirks, VDEV_OS_QUIRK_DEVICE_EXISTS ) ) {
                
             // remove the data itself, if there is data 
-            char* fp = vdev_fullpath( req->state->mountpoint, req->renamed_path, NULL );
+            char const* relpath = vdev_device_relpath( req->renamed_path );
+            char const* slash = NULL;
+            char dir[ PATH_MAX + 1 ];
             
-            rc = unlink( fp );
+            rc = unlinkat( req->state->mountpoint_fd, relpath, 0 );
             if( rc != 0 ) {
                
                rc = -errno;
                
                if( rc != -ENOENT ) {
-                  vdev_error("unlink(%s) rc = %d\n", fp, rc );
+                  vdev_error("unlink(%s/%s) rc = %d\n", req->state->mountpoint, relpath, rc );
                }
                
                rc = 0;
             }
-               
+            
             // try to clean up directories
-            rc = vdev_rmdirs( fp );
-            if( rc != 0 && rc != -ENOTEMPTY && rc != -ENOENT ) {
+            slash = strrchr( relpath, '/' );
+            if( slash != NULL && (size_t)(slash - relpath) <= PATH_MAX ) {
+               
+               memcpy( dir, relpath, slash - relpath );
+               dir[ slash - relpath ] = '\0';
+               
+               rc = vdev_rmdirs_at( req->state->mountpoint_fd, dir );
+               if( rc != 0 && rc != -ENOTEMPTY && rc != -ENOENT && rc != -EEXIST ) {
+                  
+                  vdev_error("vdev_rmdirs_at('%s/%s') rc = %d\n", req->state->mountpoint, dir, rc );
+               }
                
-               vdev_error("vdev_rmdirs('%s') rc = %d\n", fp, rc );
                rc = 0;
             }
-            
-            free( fp );
          }
+         
+         clock_gettime( CLOCK_MONOTONIC, &end );
+         vdev_device_request_trace( req, VDEV_TRACE_MKNOD, NULL, &start, &end );
       
          // remove metadata 
+         clock_gettime( CLOCK_MONOTONIC, &start );
+         
          rc = vdev_device_remove_metadata( req );
          
+         clock_gettime( CLOCK_MONOTONIC, &end );
+         vdev_device_request_trace( req, VDEV_TRACE_METADATA, NULL, &start, &end );
+         
          if( rc != 0 ) {
             
             vdev_warn("unable to clean up metadata for %s\n", req->renamed_path );
@@ -1086,7 +1383,7 @@ int vdev_device_remove( struct vdev_device_request* req ) {
       }
    }
    
-   vdev_reload_unlock( req->state );
+   vdev_device_request_unpin( req );
 
    // done with this request 
    vdev_device_request_free( req );
@@ -1100,7 +1397,7 @@ int vdev_device_remove( struct vdev_device_request* req ) {
 static int vdev_device_remove_wq( struct vdev_wreq* wreq, void* cls ) {
    
    struct vdev_device_request* req = (struct vdev_device_request*)cls;
-   return vdev_device_remove( req );
+   return vdev_device_request_process( req, vdev_device_remove );
 }
 
 
@@ -1115,16 +1412,16 @@ int vdev_device_change( struct vdev_device_request* req ) {
    
    int rc = 0;
    
-   vdev_reload_lock( req->state );
+   vdev_device_request_pin( req );
 
    // do the rename, possibly generating it
-   rc = vdev_action_create_path( req, req->state->acts, req->state->num_acts, &req->renamed_path );
+   rc = vdev_device_create_path( req );
    if( rc != 0 ) {
       
       vdev_error("vdev_action_create_path('%s') rc = %d\n", req->path, rc);
       
       // done with this request
-      vdev_reload_unlock( req->state );
+      vdev_device_request_unpin( req );
       vdev_device_request_free( req );
       free( req );
    
@@ -1138,7 +1435,7 @@ int vdev_device_change( struct vdev_device_request* req ) {
       if( req->renamed_path == NULL && req->path != NULL ) {
          
          // done with this request
-         vdev_reload_unlock( req->state );
+         vdev_device_request_unpin( req );
          vdev_device_request_free( req );
          free( req );
          return -ENOMEM;
@@ -1147,17 +1444,18 @@ int vdev_device_change( struct vdev_device_request* req ) {
    
    vdev_debug("CHANGE device: type '%s' at '%s' ('%s' %d:%d)\n", (S_ISBLK(req->mode) ? "block" : S_ISCHR(req->mode) ? "char" : "unknown"), req->renamed_path, req->path, major(req->dev), minor(req->dev) );
    
-   if( req->renamed_path != NULL && vdev_device_has_metadata( req ) ) {
+   // only for devices we've added (i.e. that have metadata)
+   if( req->renamed_path != NULL && vdev_device_has_metadata( req ) == 0 ) {
    
       // call all CHANGE actions 
-      rc = vdev_action_run_commands( req, req->state->acts, req->state->num_acts, 1 );
+      rc = vdev_action_run_commands( req, req->snapshot->acts, req->snapshot->num_acts, req->snapshot->acts_index, 1 );
       if( rc != 0 ) {
          
          vdev_error("vdev_action_run_commands(ADD %s, dev=(%u, %u)) rc = %d\n", req->renamed_path, major(req->dev), minor(req->dev), rc );
       }  
    }
    
-   vdev_reload_unlock( req->state );
+   vdev_device_request_unpin( req );
 
    // done with this request
    vdev_device_request_free( req );
@@ -1171,7 +1469,71 @@ int vdev_device_change( struct vdev_device_request* req ) {
 static int vdev_device_change_wq( struct vdev_wreq* wreq, void* cls ) {
    
    struct vdev_device_request* req = (struct vdev_device_request*)cls;
-   return vdev_device_change( req );
+   return vdev_device_request_process( req, vdev_device_change );
+}
+
+
+// get the key that orders a device request against other requests in the workqueue.
+// this is the OS's device path, if given (so a device's requests are ordered with its parents' requests),
+// or the device node path otherwise.
+// return NULL if the request has neither, in which case it gets ordered against every other request.
+static char const* vdev_device_request_order_key( struct vdev_device_request* req ) {
+   
+   struct vdev_param_t lookup;
+   struct vdev_param_t* devpath = NULL;
+   
+   memset( &lookup, 0, sizeof(struct vdev_param_t) );
+   lookup.key = (char*)VDEV_DEVICE_ORDER_PARAM;
+   
+   devpath = sglib_vdev_params_find_member( req->params, &lookup );
+   if( devpath != NULL && devpath->value != NULL && strlen(devpath->value) > 0 ) {
+      
+      return devpath->value;
+   }
+   
+   if( req->path != NULL && strcmp( req->path, VDEV_DEVICE_PATH_UNKNOWN ) != 0 ) {
+      
+      return req->path;
+   }
+   
+   return NULL;
+}
+
+
+// merge a device request into a pending request for the same device.
+// a change absorbs into a pending change (the newer request's parameters win), and
+// a remove cancels out a pending add of a device that did not already exist.
+// return the outcome of the merge, having freed the requests it drops
+// NOTE: called with the workqueue locked
+static vdev_wq_merge_t vdev_device_request_merge( struct vdev_wreq* pending, struct vdev_wreq* wreq ) {
+   
+   struct vdev_device_request* pending_req = (struct vdev_device_request*)pending->work_data;
+   struct vdev_device_request* req = (struct vdev_device_request*)wreq->work_data;
+   
+   if( pending_req->type == VDEV_DEVICE_CHANGE && req->type == VDEV_DEVICE_CHANGE ) {
+      
+      // only the latest change matters
+      pending->work_data = req;
+      
+      vdev_device_request_free( pending_req );
+      free( pending_req );
+      
+      return VDEV_WQ_MERGE_ABSORBED;
+   }
+   
+   if( pending_req->type == VDEV_DEVICE_ADD && req->type == VDEV_DEVICE_REMOVE && !pending_req->exists ) {
+      
+      // the device came and went before we got to it
+      vdev_device_request_free( pending_req );
+      free( pending_req );
+      
+      vdev_device_request_free( req );
+      free( req );
+      
+      return VDEV_WQ_MERGE_CANCELLED;
+   }
+   
+   return VDEV_WQ_MERGE_NONE;
 }
 
 
@@ -1184,9 +1546,14 @@ int vdev_device_request_enqueue( struct vdev_wq* wq, struct vdev_device_request*
    
    int rc = 0;
    struct vdev_wreq wreq;
+   int priority = VDEV_ACTION_PRIORITY_UNSET;
+   uint64_t debounce_millis = 0;
+   struct timespec start;
    
    memset( &wreq, 0, sizeof(struct vdev_wreq) );
    
+   clock_gettime( CLOCK_MONOTONIC, &start );
+   
    // sanity check 
    rc = vdev_device_request_sanity_check( req );
    if( rc != 0 ) {
@@ -1207,12 +1574,14 @@ int vdev_device_request_enqueue( struct vdev_wq* wq, struct vdev_device_request*
       case VDEV_DEVICE_REMOVE: {
          
          vdev_wreq_init( &wreq, vdev_device_remove_wq, req );
+         vdev_wreq_set_merge( &wreq, vdev_device_request_merge );
          break;
       }
       
       case VDEV_DEVICE_CHANGE: {
          
          vdev_wreq_init( &wreq, vdev_device_change_wq, req );
+         vdev_wreq_set_merge( &wreq, vdev_device_request_merge );
          break;
       }
       
@@ -1223,10 +1592,63 @@ int vdev_device_request_enqueue( struct vdev_wq* wq, struct vdev_device_request*
       }  
    }
    
+   // what do the actions say about scheduling this request?
+   vdev_device_request_pin( req );
+   
+   rc = vdev_action_get_scheduling( req, req->snapshot->acts, req->snapshot->num_acts, req->snapshot->acts_index, &priority, &debounce_millis );
+   
+   vdev_device_request_unpin( req );
+   
+   if( rc != 0 ) {
+      
+      // schedule it by type alone
+      vdev_warn("vdev_action_get_scheduling('%s') rc = %d\n", req->path, rc );
+      
+      priority = VDEV_ACTION_PRIORITY_UNSET;
+      debounce_millis = 0;
+      rc = 0;
+   }
+   
+   if( priority == VDEV_ACTION_PRIORITY_UNSET ) {
+      
+      if( req->coldplug ) {
+         
+         // catching up on existing devices can wait 
+         priority = VDEV_WQ_LANE_LOW;
+      }
+      else if( req->type == VDEV_DEVICE_REMOVE ) {
+         
+         // a device that went away should be cleaned up before we set up new ones
+         priority = VDEV_WQ_LANE_HIGH;
+      }
+      else {
+         
+         priority = VDEV_WQ_LANE_NORMAL;
+      }
+   }
+   
+   vdev_wreq_set_lane( &wreq, priority );
+   
+   // give a burst of changes a chance to be merged, if the actions ask for it.
+   // changes merged into this request do not push its deadline back.
+   vdev_wreq_set_delay( &wreq, debounce_millis );
+   
+   // keep requests for the same device (and its parents) in order
+   rc = vdev_wreq_set_key( &wreq, vdev_device_request_order_key( req ) );
+   if( rc != 0 ) {
+      
+      return rc;
+   }
+   
+   // a worker may process (and free) the request as soon as it is queued 
+   clock_gettime( CLOCK_MONOTONIC, &req->enqueued );
+   vdev_device_request_trace( req, VDEV_TRACE_ENQUEUE, NULL, &start, &req->enqueued );
+   
    rc = vdev_wq_add( wq, &wreq );
    if( rc != 0 ) {
       
       vdev_error("vdev_wq_add('%s') rc = %d\n", req->path, rc );
+      vdev_wreq_free( &wreq );
    }
    
    return rc;
@@ -32,7 +32,27 @@
 
 #define VDEV_DEVICE_PATH_UNKNOWN        "UNKNOWN"
 
+// OS parameter with the hierarchical device path, used to order requests for the same device
+#define VDEV_DEVICE_ORDER_PARAM         "DEVPATH"
+
+// per-device records, in $VDEV_MOUNTPOINT/$VDEV_METADATA_PREFIX
+#define VDEV_METADATA_RECORDS           "records"
+
+// longest record 
+#define VDEV_METADATA_RECORD_MAX        4096
+
+// longest suffix of a record's temporary file ("." and a thread ID in hex)
+#define VDEV_METADATA_RECORD_TMP_SUFFIX_MAX  (1 + 2 * sizeof(unsigned long))
+
+// longest record name, so its temporary file's name still fits in NAME_MAX
+#define VDEV_METADATA_RECORD_NAME_MAX   (NAME_MAX - VDEV_METADATA_RECORD_TMP_SUFFIX_MAX)
+
+// record fields
 #define VDEV_METADATA_PARAM_INSTANCE    "vdev_instance"
+#define VDEV_METADATA_PARAM_PATH        "vdev_path"
+#define VDEV_METADATA_PARAM_TYPE        "vdev_type"
+#define VDEV_METADATA_PARAM_MAJOR       "vdev_major"
+#define VDEV_METADATA_PARAM_MINOR       "vdev_minor"
 
 // device request type 
 typedef enum {
@@ -44,6 +64,18 @@ typedef enum {
 } vdev_device_request_t;
 
 struct vdev_state;
+struct vdev_snapshot;
+
+// helper environment variables common to all of a request's actions, built once per request.
+// this header, the vars array, and the KEY=VALUE strings are all one allocation.
+struct vdev_device_env {
+   
+   // device path it was built for (NULL if none), since renaming the device changes it
+   char* path;
+   
+   size_t num_vars;
+   char** vars;
+};
 
 // device request 
 struct vdev_device_request {
@@ -70,9 +102,25 @@ struct vdev_device_request {
    // reference to vdev state, so we can call other methods when working
    struct vdev_state* state;
    
+   // configuration and actions pinned while the request is being processed 
+   struct vdev_snapshot* snapshot;
+   
+   // cached helper environment (built on first use by vdev_device_request_to_env)
+   struct vdev_device_env* env;
+   
    // does this device file already exist?  for example, did the preseed script create it?  this applies to files like /dev/null, which *need* to exist.
    bool exists;
    
+   // was this request synthesized by scanning the system's devices, instead of reported as it happened?
+   // such requests are not urgent, so they get processed in the low-priority lane unless an action says otherwise.
+   bool coldplug;
+   
+   // ID of this event in the trace: the kernel's SEQNUM, or a synthetic one (0 until assigned)
+   uint64_t trace_id;
+   
+   // when this request was put into the workqueue (CLOCK_MONOTONIC), to trace how long it waited
+   struct timespec enqueued;
+   
    // reference to the next item, since this structure often gets used for linked lists 
    struct vdev_device_request* next;
 };
@@ -91,6 +139,11 @@ int vdev_device_request_set_mode( struct vdev_device_request* req, mode_t mode )
 int vdev_device_request_set_path( struct vdev_device_request* req, char const* path );
 int vdev_device_request_add_param( struct vdev_device_request* req, char const* key, char const* value );
 int vdev_device_request_set_exists( struct vdev_device_request* req, bool exists );
+int vdev_device_request_set_coldplug( struct vdev_device_request* req, bool coldplug );
+int vdev_device_request_set_trace_id( struct vdev_device_request* req, uint64_t trace_id );
+
+// tracing
+int vdev_device_request_trace( struct vdev_device_request* req, int stage, char const* name, struct timespec const* start, struct timespec const* end );
 
 // environment variables 
 int vdev_device_request_to_env( struct vdev_device_request* req, vdev_params* helper_vars, char*** env, size_t* num_env, int is_daemonlet );
@@ -103,6 +156,7 @@ int vdev_device_request_sanity_check( struct vdev_device_request* req );
 
 // device metadata 
 char* vdev_device_metadata_fullpath( char const* mountpoint, char const* device_path );
+int vdev_device_record_get( int records_fd, char const* device_path, char const* key, char* value, size_t value_len );
 
 // add/remove devices 
 int vdev_device_add( struct vdev_device_request* req );
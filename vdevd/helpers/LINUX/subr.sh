@@ -33,6 +33,7 @@ vdev_symlink() {
    if [ 0 -eq $_RC ]; then
 
       # save this
+      test -d "$_METADATA" || /bin/mkdir -p "$_METADATA"
       echo "$_LINK_TARGET" >> "$_METADATA/links"
    fi
 
@@ -50,6 +51,11 @@ vdev_rmlinks() {
    _METADATA="$1"
    _OLDIFS="$IFS"
 
+   # no links were made 
+   if ! [ -f "$_METADATA/links" ]; then 
+      return 0
+   fi
+
    while IFS= read -r _LINKNAME; do
 
       /bin/rm -f "$_LINKNAME"
@@ -409,6 +415,7 @@ vdev_add_property() {
       _METADATA="$VDEV_METADATA"
    fi
 
+   test -d "$_METADATA" || /bin/mkdir -p "$_METADATA"
    echo "$_PROP_KEY=$_PROP_VALUE" >> "$_METADATA/properties"
    
    return $_RC
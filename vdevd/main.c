@@ -24,10 +24,22 @@
 // global vdev state
 static struct vdev_state vdev;
 
-// reload handler 
+// reload handler:  the reload thread does the work 
 void vdev_reload_sighup( int ignored ) {
     
-   vdev_reload( &vdev );
+   vdev_reload_request( &vdev );
+}
+
+// statistics refresh handler 
+void vdev_stats_sigusr1( int ignored ) {
+   
+   vdev_stats_refresh( &vdev.stats );
+}
+
+// trace dump handler 
+void vdev_trace_sigusr2( int ignored ) {
+   
+   vdev_stats_dump_trace( &vdev.stats );
 }
 
 // run! 
@@ -56,6 +68,13 @@ int main( int argc, char** argv ) {
       exit(1);
    }
    
+   // only compiling the actions?  vdev_init() wrote the cache
+   if( vdev.snapshot->config->compile_acts ) {
+      
+      vdev_shutdown( &vdev, false );
+      exit(0);
+   }
+   
    // run the preseed command 
    rc = vdev_preseed_run( &vdev );
    if( rc != 0 ) {
@@ -67,10 +86,10 @@ int main( int argc, char** argv ) {
    }
    
    // if we're going to daemonize, then redirect logging to the logfile
-   if( !vdev.config->foreground ) {
+   if( !vdev.snapshot->config->foreground ) {
       
       // sanity check
-      if( vdev.config->logfile_path == NULL ) {
+      if( vdev.snapshot->config->logfile_path == NULL ) {
          
          fprintf(stderr, "No logfile specified\n");
          
@@ -79,7 +98,7 @@ int main( int argc, char** argv ) {
       }
       
       // do we need to connect to syslog?
-      if( strcmp( vdev.config->logfile_path, "syslog" ) == 0 ) {
+      if( strcmp( vdev.snapshot->config->logfile_path, "syslog" ) == 0 ) {
          
          vdev_debug("%s", "Switching to syslog for messages\n");
          vdev_enable_syslog();
@@ -88,17 +107,17 @@ int main( int argc, char** argv ) {
       else {
          
          // send to a specific logfile 
-         rc = vdev_log_redirect( vdev.config->logfile_path );
+         rc = vdev_log_redirect( vdev.snapshot->config->logfile_path );
          if( rc != 0 ) {
             
-            vdev_error("vdev_log_redirect('%s') rc = %d\n", vdev.config->logfile_path, rc );
+            vdev_error("vdev_log_redirect('%s') rc = %d\n", vdev.snapshot->config->logfile_path, rc );
             
             vdev_shutdown( &vdev, false );
             exit(2);
          }
       }
       
-      if( !vdev.config->coldplug_only ) {
+      if( !vdev.snapshot->config->coldplug_only ) {
          
          // will become a daemon after handling coldplug. 
          // set up a pipe between parent and child, so the child can 
@@ -131,12 +150,12 @@ int main( int argc, char** argv ) {
             coldplug_finished_fd = coldplug_quiesce_pipe[1];
             
             // write a pidfile 
-            if( vdev.config->pidfile_path != NULL ) {
+            if( vdev.snapshot->config->pidfile_path != NULL ) {
                   
-               rc = vdev_pidfile_write( vdev.config->pidfile_path );
+               rc = vdev_pidfile_write( vdev.snapshot->config->pidfile_path );
                if( rc != 0 ) {
                   
-                  vdev_error("vdev_pidfile_write('%s') rc = %d\n", vdev.config->pidfile_path, rc );
+                  vdev_error("vdev_pidfile_write('%s') rc = %d\n", vdev.snapshot->config->pidfile_path, rc );
                   
                   vdev_shutdown( &vdev, false );
                   exit(4);
@@ -157,7 +176,7 @@ int main( int argc, char** argv ) {
       }
    }
    
-   if( !is_parent || vdev.config->foreground || vdev.config->coldplug_only ) {
+   if( !is_parent || vdev.snapshot->config->foreground || vdev.snapshot->config->coldplug_only ) {
          
       // child, or foreground, or coldplug only.  start handling (coldplug) device events
       rc = vdev_start( &vdev );
@@ -169,7 +188,7 @@ int main( int argc, char** argv ) {
          vdev_shutdown( &vdev, false );
          
          // if child, and we're connected to the parent, then tell the parent to exit failure 
-         if( is_child && !vdev.config->foreground && !vdev.config->coldplug_only ) {
+         if( is_child && !vdev.snapshot->config->foreground && !vdev.snapshot->config->coldplug_only ) {
             
             write( coldplug_quiesce_pipe[1], &rc, sizeof(rc) );
             close( coldplug_quiesce_pipe[1] );
@@ -178,6 +197,10 @@ int main( int argc, char** argv ) {
          exit(5);
       }
       
+      // refresh the statistics files, or dump the event trace, on request
+      signal( SIGUSR1, vdev_stats_sigusr1 );
+      signal( SIGUSR2, vdev_trace_sigusr2 );
+      
       // main loop: get events from the OS and process them.
       // wake up the parent once we finish the coldplugged devices
       rc = vdev_main( &vdev, coldplug_finished_fd );
@@ -188,7 +211,7 @@ int main( int argc, char** argv ) {
       
       // if only doing coldplug, find and remove all stale coldplug devices.
       // use the metadata directory to figure this out
-      if( vdev.config->coldplug_only ) {
+      if( vdev.snapshot->config->coldplug_only ) {
          
          rc = vdev_remove_unplugged_devices( &vdev );
          if( rc != 0 ) {
@@ -202,14 +225,16 @@ int main( int argc, char** argv ) {
       
       // print benchmarks...
       vdev_debug("%s", "Action benchmarks:\n");
-      for( unsigned int i = 0; i < vdev.num_acts; i++ ) {
+      for( unsigned int i = 0; i < vdev.snapshot->num_acts; i++ ) {
             
-         vdev_action_log_benchmarks( &vdev.acts[i] );
+         vdev_action_log_benchmarks( vdev.snapshot->acts[i] );
       }
       
+      vdev_wq_log_stats( &vdev.device_wq );
+      
       // clean up
       // keep the pidfile unless we're doing coldplug only (in which case don't touch it)
-      vdev_shutdown( &vdev, !vdev.config->coldplug_only );
+      vdev_shutdown( &vdev, !vdev.snapshot->config->coldplug_only );
       
       return rc;
    }
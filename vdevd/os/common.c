@@ -152,10 +152,13 @@ int vdev_os_context_free( struct vdev_os_context* vos ) {
 }
 
 
-// backend signal to vdevd that it has processed all coldplugged devices 
+// backend signal to vdevd that it has handed off all coldplugged devices to the device workqueue
 int vdev_os_context_signal_coldplug_finished( struct vdev_os_context* vos ) {
    
    vos->coldplug_finished = true;
+   
+   // if the workqueue has already drained, no worker will notice
+   vdev_wq_check_idle( &vos->state->device_wq );
    return 0;
 }
 
@@ -164,3 +167,12 @@ bool vdev_os_context_is_coldplug_finished( struct vdev_os_context* vos ) {
    
    return vos->coldplug_finished;
 }
+
+// let the back-end stop delivering events that none of the given actions could handle.
+// call after (re)loading actions.
+// return 0 on success
+// return negative on error, in which case the back-end keeps its old filter
+int vdev_os_context_update_filter( struct vdev_os_context* vos, struct vdev_action** acts, size_t num_acts ) {
+   
+   return vdev_os_update_filter( acts, num_acts, vos->os_cls );
+}
@@ -39,6 +39,8 @@ struct vdev_os_context {
    struct vdev_state* state;
 };
 
+struct vdev_action;
+
 C_LINKAGE_BEGIN
 
 // context management
@@ -49,6 +51,9 @@ int vdev_os_context_free( struct vdev_os_context* vos );
 int vdev_os_context_signal_coldplug_finished( struct vdev_os_context* vos );
 bool vdev_os_context_is_coldplug_finished( struct vdev_os_context* vos );
 
+// tell the back-end which actions are loaded
+int vdev_os_context_update_filter( struct vdev_os_context* vos, struct vdev_action** acts, size_t num_acts );
+
 int vdev_os_main( struct vdev_os_context* vos );
 
 C_LINKAGE_END
@@ -19,10 +19,11 @@
    <http://www.isc.org/downloads/software-support-policy/isc-license/>.
 */
 
-#ifdef _VDEV_OS_LINUX
+#if defined(_VDEV_OS_LINUX) && !defined(_VDEV_OS_REPLAY)
 
 #include "linux.h"
 #include "workqueue.h"
+#include "action.h"
 #include "libvdev/sglib.h"
 
 // parse a uevent action 
@@ -200,6 +201,259 @@ static int vdev_linux_log_uevent( char const* uevent_buf, size_t uevent_buf_len,
 #define vdev_linux_debug_uevent( uevent_buf, uevent_buf_len ) vdev_linux_log_uevent( uevent_buf, uevent_buf_len, true )
 #define vdev_linux_error_uevent( uevent_buf, uevent_buf_len ) vdev_linux_log_uevent( uevent_buf, uevent_buf_len, false )
 
+// append a key/value pair to a uevent buffer
+// return 0 on success
+// return -ENOMEM on OOM
+static int vdev_linux_uevent_append( char** ret_uevent_buf, size_t* ret_uevent_buf_len, char const* key, char const* value ) {
+   
+   char* tmp = NULL;
+   char* uevent_buf = *ret_uevent_buf;
+   size_t uevent_buf_len = *ret_uevent_buf_len;
+   
+   // add it to the uevent buffer, so we can parse it like a normal uevent
+   tmp = (char*)realloc( uevent_buf, uevent_buf_len + 1 + strlen(key) + 1 + strlen(value) + 1 );
+   if( tmp == NULL ) {
+      
+      return -ENOMEM;
+   }
+   
+   uevent_buf = tmp;
+   
+   // add key
+   memcpy( uevent_buf + uevent_buf_len, key, strlen(key) );
+   uevent_buf_len += strlen(key);
+   
+   // add '='
+   *(uevent_buf + uevent_buf_len) = '=';
+   uevent_buf_len ++;
+   
+   // add value
+   memcpy( uevent_buf + uevent_buf_len, value, strlen(value) );
+   uevent_buf_len += strlen(value);
+   
+   // NULL-terminate 
+   *(uevent_buf + uevent_buf_len) = '\0';
+   uevent_buf_len ++;
+   
+   *ret_uevent_buf = uevent_buf;
+   *ret_uevent_buf_len = uevent_buf_len;
+   
+   return 0;
+}
+
+
+// record a uevent to the --record log, if we're recording.
+// the log is written in the background; if it can't keep up, the uevent is dropped.
+static void vdev_linux_record_uevent( struct vdev_linux_context* ctx, int source, struct timespec const* ts, char const* uevent_buf, size_t uevent_buf_len ) {
+   
+   if( ctx->record != NULL ) {
+      
+      vdev_uevlog_append( ctx->record, source, ts, uevent_buf, uevent_buf_len );
+   }
+}
+
+
+// flush and close the --record log, if we're recording 
+static void vdev_linux_record_close( struct vdev_linux_context* ctx ) {
+   
+   if( ctx->record != NULL ) {
+      
+      vdev_uevlog_close( ctx->record );
+      
+      free( ctx->record );
+      ctx->record = NULL;
+   }
+}
+
+
+// sglib methods 
+SGLIB_DEFINE_RBTREE_FUNCTIONS(vdev_linux_known_devices, left, right, color, VDEV_LINUX_KNOWN_DEVICE_CMP);
+
+// free a known device
+// always succeeds
+static void vdev_linux_known_device_free( struct vdev_linux_known_device* kd ) {
+   
+   if( kd->devpath != NULL ) {
+      
+      free( kd->devpath );
+      kd->devpath = NULL;
+   }
+   
+   if( kd->uevent != NULL ) {
+      
+      free( kd->uevent );
+      kd->uevent = NULL;
+   }
+   
+   free( kd );
+}
+
+
+// free all known devices
+// always succeeds
+static void vdev_linux_known_devices_free( vdev_linux_known_devices* known_devices ) {
+   
+   struct sglib_vdev_linux_known_devices_iterator itr;
+   struct vdev_linux_known_device* kd = NULL;
+   struct vdev_linux_known_device* to_free = NULL;
+   
+   // NOTE: free each one only after the iterator has moved past it
+   for( kd = sglib_vdev_linux_known_devices_it_init( &itr, known_devices ); kd != NULL; kd = sglib_vdev_linux_known_devices_it_next( &itr ) ) {
+      
+      if( to_free != NULL ) {
+         vdev_linux_known_device_free( to_free );
+      }
+      
+      to_free = kd;
+   }
+   
+   if( to_free != NULL ) {
+      vdev_linux_known_device_free( to_free );
+   }
+}
+
+
+// remember (or forget) a device whose request was just parsed, so a later resync can tell which
+// devices appeared or disappeared while vdevd wasn't listening.
+// the uevent kept for it is rebuilt from the request's parameters, plus MAJOR and MINOR if given.
+// return 0 on success
+// return -ENOMEM on OOM
+static int vdev_linux_known_devices_update( struct vdev_linux_context* ctx, struct vdev_device_request* vreq, vdev_device_request_t reqtype, char const* devpath, bool have_dev ) {
+   
+   int rc = 0;
+   char* uevent = NULL;
+   size_t uevent_len = 0;
+   char numbuf[50];
+   struct vdev_linux_known_device lookup;
+   struct vdev_linux_known_device* kd = NULL;
+   struct sglib_vdev_params_iterator itr;
+   struct vdev_param_t* dp = NULL;
+   
+   memset( &lookup, 0, sizeof(lookup) );
+   lookup.devpath = (char*)devpath;
+   
+   if( reqtype == VDEV_DEVICE_REMOVE ) {
+      
+      // forget it 
+      pthread_mutex_lock( &ctx->known_devices_lock );
+      
+      kd = sglib_vdev_linux_known_devices_find_member( ctx->known_devices, &lookup );
+      if( kd != NULL ) {
+         
+         sglib_vdev_linux_known_devices_delete( &ctx->known_devices, kd );
+      }
+      
+      pthread_mutex_unlock( &ctx->known_devices_lock );
+      
+      if( kd != NULL ) {
+         vdev_linux_known_device_free( kd );
+      }
+      
+      return 0;
+   }
+   
+   // rebuild its uevent (which parsing has clobbered)
+   for( dp = sglib_vdev_params_it_init_inorder( &itr, vreq->params ); dp != NULL && rc == 0; dp = sglib_vdev_params_it_next( &itr ) ) {
+      
+      if( strcmp( dp->key, "SEQNUM" ) == 0 || strcmp( dp->key, "SYSFS_MOUNTPOINT" ) == 0 ) {
+         continue;
+      }
+      
+      rc = vdev_linux_uevent_append( &uevent, &uevent_len, dp->key, dp->value );
+   }
+   
+   if( rc == 0 && have_dev ) {
+      
+      sprintf( numbuf, "%u", major( vreq->dev ) );
+      rc = vdev_linux_uevent_append( &uevent, &uevent_len, "MAJOR", numbuf );
+      
+      if( rc == 0 ) {
+         
+         sprintf( numbuf, "%u", minor( vreq->dev ) );
+         rc = vdev_linux_uevent_append( &uevent, &uevent_len, "MINOR", numbuf );
+      }
+   }
+   
+   if( rc != 0 ) {
+      
+      free( uevent );
+      return rc;
+   }
+   
+   pthread_mutex_lock( &ctx->known_devices_lock );
+   
+   kd = sglib_vdev_linux_known_devices_find_member( ctx->known_devices, &lookup );
+   if( kd == NULL ) {
+      
+      kd = VDEV_CALLOC( struct vdev_linux_known_device, 1 );
+      if( kd == NULL ) {
+         
+         pthread_mutex_unlock( &ctx->known_devices_lock );
+         free( uevent );
+         return -ENOMEM;
+      }
+      
+      kd->devpath = vdev_strdup_or_null( devpath );
+      if( kd->devpath == NULL ) {
+         
+         pthread_mutex_unlock( &ctx->known_devices_lock );
+         free( kd );
+         free( uevent );
+         return -ENOMEM;
+      }
+      
+      sglib_vdev_linux_known_devices_add( &ctx->known_devices, kd );
+   }
+   
+   if( kd->uevent != NULL ) {
+      free( kd->uevent );
+   }
+   
+   kd->uevent = uevent;
+   kd->uevent_len = uevent_len;
+   kd->resync_gen = ctx->resync_gen;
+   
+   pthread_mutex_unlock( &ctx->known_devices_lock );
+   
+   return 0;
+}
+
+
+// ask vdev_os_next_device to resync with sysfs before handling any more kernel events
+// always succeeds
+static void vdev_linux_request_resync( struct vdev_linux_context* ctx ) {
+   
+   pthread_mutex_lock( &ctx->netlink_lock );
+   
+   ctx->resync_needed = true;
+   
+   pthread_cond_broadcast( &ctx->netlink_cond );
+   pthread_mutex_unlock( &ctx->netlink_lock );
+}
+
+
+// check a kernel event's SEQNUM against the last one we saw.
+// the kernel numbers its uevents consecutively, so a jump means we missed some--unless
+// our socket filter is dropping the ones we don't want, in which case only ENOBUFS tells us.
+// only called from the thread that runs vdev_os_next_device.
+// always succeeds
+static void vdev_linux_check_seqnum( struct vdev_linux_context* ctx, uint64_t seqnum ) {
+   
+   if( ctx->last_seqnum != 0 && seqnum > ctx->last_seqnum + 1 && !ctx->netlink_filtered ) {
+      
+      vdev_warn("Missed %lu kernel event(s) between SEQNUM %lu and %lu\n", (unsigned long)(seqnum - ctx->last_seqnum - 1), (unsigned long)ctx->last_seqnum, (unsigned long)seqnum );
+      
+      if( ctx->netlink_thread_running ) {
+         vdev_linux_request_resync( ctx );
+      }
+   }
+   
+   if( seqnum > ctx->last_seqnum ) {
+      ctx->last_seqnum = seqnum;
+   }
+}
+
+
 // parse a uevent, and use the information to fill in a device request.
 // nlbuf must be a contiguous concatenation of null-terminated KEY=VALUE strings.
 // return 0 on success
@@ -221,6 +475,7 @@ static int vdev_linux_parse_request( struct vdev_linux_context* ctx, struct vdev
    char* devpath = NULL;        // sysfs devpath 
    char* subsystem = NULL;      // sysfs subsystem 
    char* devname = (char*)VDEV_DEVICE_PATH_UNKNOWN;        // DEVNAME from uevent
+   uint64_t seqnum = 0;         // kernel SEQNUM, if this came from the kernel
    
    vdev_device_request_t reqtype = VDEV_DEVICE_INVALID;
    
@@ -284,6 +539,12 @@ static int vdev_linux_parse_request( struct vdev_linux_context* ctx, struct vdev
          devname = value;
       }
       
+      // kernel event sequence number?
+      else if( strcmp(key, "SEQNUM") == 0 ) {
+         
+         seqnum = strtoull( value, NULL, 10 );
+      }
+      
       // subsystem given?
       else if( strcmp(key, "SUBSYSTEM") == 0 ) {
          
@@ -459,122 +720,53 @@ static int vdev_linux_parse_request( struct vdev_linux_context* ctx, struct vdev
       return rc;
    }
    
-   return rc;
-}
-
-
-// yield the next device event
-// return 0 on success 
-// return 1 if there are no more devices
-// return -EAGAIN if vdev should try to get this device again 
-// return -errno on failure to poll for devices or read the next device packet.
-int vdev_os_next_device( struct vdev_device_request* vreq, void* cls ) {
-   
-   int rc = 0;
-   struct vdev_linux_context* ctx = (struct vdev_linux_context*)cls;
-   char buf[VDEV_LINUX_NETLINK_BUF_MAX];
-   ssize_t len = 0;
-   
-   char cbuf[CMSG_SPACE(sizeof(struct ucred))];
-   struct cmsghdr *chdr = NULL;
-   struct ucred *cred = NULL;
-   struct msghdr hdr;
-   struct iovec iov;
-   struct sockaddr_nl cnls;
-
-   pthread_mutex_lock( &ctx->initial_requests_lock );
-   
-   // do we have initial requests?
-   if( ctx->initial_requests != NULL ) {
-      
-      // next request
-      struct vdev_device_request* req = ctx->initial_requests;
-      
-      // consume 
-      ctx->initial_requests = ctx->initial_requests->next;
-      
-      memcpy( vreq, req, sizeof(struct vdev_device_request) );
-      free( req );
-      
-      pthread_mutex_unlock( &ctx->initial_requests_lock );
-      
-      // was that the last of them?
-      if( ctx->initial_requests == NULL ) {
-         
-         // tell vdevd that we've finished coldplug processing
-         vdev_os_context_signal_coldplug_finished( ctx->os_ctx );
-      }
-      
-      return 0;
-   }
-   else if( ctx->os_ctx->coldplug_only ) {
+   if( seqnum != 0 ) {
       
-      // out of coldplug requests; die 
-      pthread_mutex_unlock( &ctx->initial_requests_lock );
-      return 1;
-   }
-   else {
+      // did we miss anything?
+      vdev_linux_check_seqnum( ctx, seqnum );
       
-      pthread_mutex_unlock( &ctx->initial_requests_lock );
+      // trace it as this event 
+      vdev_device_request_set_trace_id( vreq, seqnum );
    }
    
-   memset(&hdr, 0, sizeof(struct msghdr));
-   
-   // next event (wait forever)
-   // NOTE: this is a cancellation point!
-   rc = poll( &ctx->pfd, 1, -1 );
-   
-   if( rc < 0 ) {
-      
-      rc = -errno;
+   if( devpath != NULL && !ctx->os_ctx->coldplug_only ) {
       
-      if( rc == -EINTR ) {
-         // try again 
-         return -EAGAIN;
+      // remember this device for resyncing 
+      rc = vdev_linux_known_devices_update( ctx, vreq, reqtype, devpath, have_major && have_minor );
+      if( rc != 0 ) {
+         
+         // not fatal 
+         vdev_warn("vdev_linux_known_devices_update('%s') rc = %d\n", devpath, rc );
+         rc = 0;
       }
-      
-      vdev_error("FATAL: poll(%d) rc = %d\n", ctx->pfd.fd, rc );
-      
-      return rc;
    }
    
-   // get the event 
-   iov.iov_base = buf;
-   iov.iov_len = VDEV_LINUX_NETLINK_BUF_MAX;
-                
-   hdr.msg_iov = &iov;
-   hdr.msg_iovlen = 1;
-   
-   // get control-plane messages
-   hdr.msg_control = cbuf;
-   hdr.msg_controllen = sizeof(cbuf);
-   
-   hdr.msg_name = &cnls;
-   hdr.msg_namelen = sizeof(cnls);
+   return rc;
+}
 
-   // get the event 
-   len = recvmsg( ctx->pfd.fd, &hdr, 0 );
-   if( len < 0 ) {
-      
-      rc = -errno;
-      vdev_error("FATAL: recvmsg(%d) rc = %d\n", ctx->pfd.fd, rc );
-      
-      return rc;
-   }
+
+// is a received netlink message a device event from the kernel?
+// return true if so
+// return false if it should be ignored
+static bool vdev_linux_netlink_msg_ok( struct msghdr* hdr, char const* buf, ssize_t len ) {
+   
+   struct cmsghdr *chdr = NULL;
+   struct ucred *cred = NULL;
+   struct sockaddr_nl* cnls = (struct sockaddr_nl*)hdr->msg_name;
    
    // big enough?
-   if( len < 32 || len >= VDEV_LINUX_NETLINK_BUF_MAX ) {
+   if( len < 32 || len >= VDEV_LINUX_NETLINK_BUF_MAX || (hdr->msg_flags & MSG_TRUNC) ) {
       
       vdev_error("Netlink message is %zd bytes; ignoring...\n", len );
-      return -EAGAIN;
+      return false;
    }
    
    // control message, for credentials
-   chdr = CMSG_FIRSTHDR( &hdr );
+   chdr = CMSG_FIRSTHDR( hdr );
    if( chdr == NULL || chdr->cmsg_type != SCM_CREDENTIALS ) {
       
       vdev_error("%s", "Netlink message has no credentials\n");
-      return -EAGAIN;
+      return false;
    }
    
    // get the credentials
@@ -584,7 +776,7 @@ int vdev_os_next_device( struct vdev_device_request* vreq, void* cls ) {
    if( cred->uid != 0 ) {
       
       vdev_error("Ignoring message from non-root ID %d\n", cred->uid );
-      return -EAGAIN;
+      return false;
    }
    
    // if udev, ignore 
@@ -592,64 +784,542 @@ int vdev_os_next_device( struct vdev_device_request* vreq, void* cls ) {
       
       // message from udev; ignore 
       vdev_warn("%s", "Ignoring libudev message\n");
-      return -EAGAIN;
+      return false;
    }
    
    // kernel messages don't come from userspace 
-   if( cnls.nl_pid > 0 ) {
+   if( cnls->nl_pid > 0 ) {
       
       // from userspace???
-      vdev_warn("Ignoring message from PID %d\n", (int)cnls.nl_pid );
-      return -EAGAIN;
-   }
-   
-   // parse the event buffer
-   vdev_debug("%p from netlink\n", vreq );
-   rc = vdev_linux_parse_request( ctx, vreq, buf, len );
-   
-   if( rc != 0 ) {
-      
-      vdev_error("vdev_linux_parse_request rc = %d\n", rc );
-      
-      return -EAGAIN;
+      vdev_warn("Ignoring message from PID %d\n", (int)cnls->nl_pid );
+      return false;
    }
    
-   return 0;
+   return true;
 }
 
 
-// find sysfs mountpoint in /proc/mounts
-// this is apparently superfluous (it *should* be mounted at /sys), but you never know.
-// mountpoint must be big enough (PATH_MAX will do)
-// return 0 on success
-// return -ENOSYS if sysfs is not mounted
-// return -ENOMEM if the buffer isn't big enough 
-// return -EINVAL if somehow we failed to parse a mount entry
-// return negative for some other errors (like access permission failures, or /proc not mounted)
-static int vdev_linux_find_sysfs_mountpoint( char* mountpoint, size_t mountpoint_len ) {
-   
-   FILE* f = NULL;
+// netlink reader thread: drain the netlink socket into the ring in batches with recvmmsg(2), so 
+// the kernel's socket buffer stays empty while vdevd parses and processes device events.
+// only blocks on the socket while there is room in the ring.
+static void* vdev_linux_netlink_main( void* arg ) {
+   
+   struct vdev_linux_context* ctx = (struct vdev_linux_context*)arg;
+   
+   struct mmsghdr msgs[ VDEV_LINUX_NETLINK_BATCH ];
+   struct iovec iovs[ VDEV_LINUX_NETLINK_BATCH ];
+   struct sockaddr_nl addrs[ VDEV_LINUX_NETLINK_BATCH ];
+   char cbufs[ VDEV_LINUX_NETLINK_BATCH ][ CMSG_SPACE(sizeof(struct ucred)) ];
+   
+   struct pollfd pfds[2];
+   struct timespec received;
+   size_t tail = 0;
+   size_t batch = 0;
+   int num_msgs = 0;
    int rc = 0;
    
-   char mntbuf[4096];
-   struct mntent ment_buf;
-   struct mntent* ment_ptr = NULL;
-   int ent_count = 1;
-   bool found = false;
-   
-   f = fopen( "/proc/mounts", "r" );
-   if( f == NULL ) {
-      
-      rc = -errno;
-      fprintf(stderr, "Failed to open /proc/mounts, rc = %d\n", rc );
-      return rc;
-   }
+   pfds[0].fd = ctx->pfd.fd;
+   pfds[0].events = POLLIN;
+   pfds[1].fd = ctx->netlink_wakeup_pipe[0];
+   pfds[1].events = POLLIN;
    
-   // scan for sysfs mount type
    while( 1 ) {
       
-      ment_ptr = getmntent_r( f, &ment_buf, mntbuf, 4096 );
-      if( ment_ptr == NULL ) {
+      pthread_mutex_lock( &ctx->netlink_lock );
+      
+      // wait for room
+      while( ctx->netlink_ring_count == VDEV_LINUX_NETLINK_RING_LEN && !ctx->netlink_stop ) {
+         
+         pthread_cond_wait( &ctx->netlink_cond, &ctx->netlink_lock );
+      }
+      
+      if( ctx->netlink_stop ) {
+         
+         pthread_mutex_unlock( &ctx->netlink_lock );
+         break;
+      }
+      
+      // receive into the free slots after the ones vdevd has yet to parse
+      tail = (ctx->netlink_ring_head + ctx->netlink_ring_count) % VDEV_LINUX_NETLINK_RING_LEN;
+      batch = VDEV_LINUX_NETLINK_RING_LEN - ctx->netlink_ring_count;
+      
+      pthread_mutex_unlock( &ctx->netlink_lock );
+      
+      if( batch > VDEV_LINUX_NETLINK_BATCH ) {
+         batch = VDEV_LINUX_NETLINK_BATCH;
+      }
+      
+      // next events (wait forever)
+      rc = poll( pfds, 2, -1 );
+      if( rc < 0 ) {
+         
+         rc = -errno;
+         if( rc == -EINTR ) {
+            continue;
+         }
+         
+         vdev_error("FATAL: poll(%d) rc = %d\n", ctx->pfd.fd, rc );
+         break;
+      }
+      
+      if( pfds[1].revents != 0 ) {
+         
+         // told to stop 
+         continue;
+      }
+      
+      memset( msgs, 0, sizeof(msgs) );
+      
+      for( size_t i = 0; i < batch; i++ ) {
+         
+         struct vdev_linux_netlink_msg* msg = &ctx->netlink_ring[ (tail + i) % VDEV_LINUX_NETLINK_RING_LEN ];
+         
+         iovs[i].iov_base = msg->buf;
+         iovs[i].iov_len = VDEV_LINUX_NETLINK_BUF_MAX;
+         
+         msgs[i].msg_hdr.msg_iov = &iovs[i];
+         msgs[i].msg_hdr.msg_iovlen = 1;
+         
+         // get control-plane messages
+         msgs[i].msg_hdr.msg_control = cbufs[i];
+         msgs[i].msg_hdr.msg_controllen = sizeof(cbufs[i]);
+         
+         msgs[i].msg_hdr.msg_name = &addrs[i];
+         msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+      }
+      
+      // get the events 
+      num_msgs = recvmmsg( ctx->pfd.fd, msgs, batch, MSG_DONTWAIT, NULL );
+      if( num_msgs < 0 ) {
+         
+         rc = -errno;
+         
+         if( rc == -EAGAIN || rc == -EWOULDBLOCK || rc == -EINTR ) {
+            continue;
+         }
+         
+         if( rc == -ENOBUFS ) {
+            
+            // the kernel dropped events.  The socket is still usable.
+            pthread_mutex_lock( &ctx->netlink_lock );
+            
+            ctx->netlink_overflows++;
+            ctx->resync_needed = true;
+            
+            pthread_cond_broadcast( &ctx->netlink_cond );
+            pthread_mutex_unlock( &ctx->netlink_lock );
+            
+            vdev_warn("Netlink socket %d overflowed; some device events were lost.  Will resync with sysfs.\n", ctx->pfd.fd );
+            continue;
+         }
+         
+         vdev_error("FATAL: recvmmsg(%d) rc = %d\n", ctx->pfd.fd, rc );
+         break;
+      }
+      
+      clock_gettime( CLOCK_MONOTONIC, &received );
+      
+      for( int i = 0; i < num_msgs; i++ ) {
+         
+         struct vdev_linux_netlink_msg* msg = &ctx->netlink_ring[ (tail + i) % VDEV_LINUX_NETLINK_RING_LEN ];
+         
+         msg->received = received;
+         
+         if( vdev_linux_netlink_msg_ok( &msgs[i].msg_hdr, msg->buf, msgs[i].msg_len ) ) {
+            
+            msg->len = msgs[i].msg_len;
+            vdev_linux_record_uevent( ctx, VDEV_UEVLOG_SOURCE_NETLINK, &received, msg->buf, msg->len );
+         }
+         else {
+            msg->len = 0;
+         }
+      }
+      
+      // hand them off 
+      pthread_mutex_lock( &ctx->netlink_lock );
+      
+      ctx->netlink_ring_count += num_msgs;
+      
+      pthread_cond_broadcast( &ctx->netlink_cond );
+      pthread_mutex_unlock( &ctx->netlink_lock );
+      
+      rc = 0;
+   }
+   
+   if( rc != 0 ) {
+      
+      // tell vdevd 
+      pthread_mutex_lock( &ctx->netlink_lock );
+      
+      ctx->netlink_error = rc;
+      
+      pthread_cond_broadcast( &ctx->netlink_cond );
+      pthread_mutex_unlock( &ctx->netlink_lock );
+   }
+   
+   return NULL;
+}
+
+
+// start the netlink reader thread
+// return 0 on success
+// return -ENOMEM on OOM 
+// return -errno on failure to create the wakeup pipe or thread
+static int vdev_linux_netlink_start( struct vdev_linux_context* ctx ) {
+   
+   int rc = 0;
+   
+   ctx->netlink_ring = VDEV_CALLOC( struct vdev_linux_netlink_msg, VDEV_LINUX_NETLINK_RING_LEN );
+   if( ctx->netlink_ring == NULL ) {
+      
+      return -ENOMEM;
+   }
+   
+   rc = pipe2( ctx->netlink_wakeup_pipe, O_CLOEXEC );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+      vdev_error("pipe2 rc = %d\n", rc );
+      
+      free( ctx->netlink_ring );
+      ctx->netlink_ring = NULL;
+      return rc;
+   }
+   
+   pthread_mutex_init( &ctx->netlink_lock, NULL );
+   pthread_cond_init( &ctx->netlink_cond, NULL );
+   
+   rc = pthread_create( &ctx->netlink_thread, NULL, vdev_linux_netlink_main, ctx );
+   if( rc != 0 ) {
+      
+      rc = -rc;
+      vdev_error("pthread_create(netlink) rc = %d\n", rc );
+      
+      pthread_cond_destroy( &ctx->netlink_cond );
+      pthread_mutex_destroy( &ctx->netlink_lock );
+      
+      close( ctx->netlink_wakeup_pipe[0] );
+      close( ctx->netlink_wakeup_pipe[1] );
+      
+      free( ctx->netlink_ring );
+      ctx->netlink_ring = NULL;
+      return rc;
+   }
+   
+   ctx->netlink_thread_running = true;
+   return 0;
+}
+
+
+// stop the netlink reader thread, and free the ring
+// always succeeds
+static int vdev_linux_netlink_stop( struct vdev_linux_context* ctx ) {
+   
+   if( !ctx->netlink_thread_running ) {
+      return 0;
+   }
+   
+   pthread_mutex_lock( &ctx->netlink_lock );
+   
+   ctx->netlink_stop = true;
+   
+   pthread_cond_broadcast( &ctx->netlink_cond );
+   pthread_mutex_unlock( &ctx->netlink_lock );
+   
+   vdev_write_uninterrupted( ctx->netlink_wakeup_pipe[1], "x", 1 );
+   
+   pthread_join( ctx->netlink_thread, NULL );
+   ctx->netlink_thread_running = false;
+   
+   pthread_cond_destroy( &ctx->netlink_cond );
+   pthread_mutex_destroy( &ctx->netlink_lock );
+   
+   close( ctx->netlink_wakeup_pipe[0] );
+   close( ctx->netlink_wakeup_pipe[1] );
+   
+   free( ctx->netlink_ring );
+   ctx->netlink_ring = NULL;
+   
+   return 0;
+}
+
+
+// the first four bytes of a kernel uevent, as a BPF_ABS word load sees them (network byte order)
+#define VDEV_LINUX_BPF_WORD( a, b, c, d ) ((((unsigned int)(a)) << 24) | (((unsigned int)(b)) << 16) | (((unsigned int)(c)) << 8) | ((unsigned int)(d)))
+
+// attach a socket filter to the netlink socket that only lets through uevents vdevd can act on.
+// kernel uevents start with "$ACTION@$DEVPATH", and vdevd only understands add, remove, and change:
+// * add and remove always get through, since vdevd manages device files and metadata for them;
+// * change only gets through if want_change is set (i.e. some action runs on it);
+// * everything else (bind, unbind, move, online, offline, and libudev's own messages) is dropped by the kernel.
+// NOTE: a classic BPF program can't look past DEVPATH for SUBSYSTEM, since it can't loop to find its end.
+// return 0 on success
+// return -errno on failure to attach it
+static int vdev_linux_netlink_filter_attach( struct vdev_linux_context* ctx, bool want_change ) {
+   
+   int rc = 0;
+   struct sock_fprog prog;
+   struct sock_filter ins[] = {
+      
+      /* 0 */  BPF_STMT( BPF_LD | BPF_W | BPF_ABS, 0 ),
+      /* 1 */  BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, VDEV_LINUX_BPF_WORD('a','d','d','@'), 9, 0 ),
+      
+      // "remove@"
+      /* 2 */  BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, VDEV_LINUX_BPF_WORD('r','e','m','o'), 0, 3 ),
+      /* 3 */  BPF_STMT( BPF_LD | BPF_H | BPF_ABS, 4 ),
+      /* 4 */  BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, ('v' << 8) | 'e', 0, 7 ),
+      /* 5 */  BPF_STMT( BPF_JMP | BPF_JA, 3 ),
+      
+      // "change@" (jump-if-true is patched below to drop it instead, if need be)
+      /* 6 */  BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, VDEV_LINUX_BPF_WORD('c','h','a','n'), 0, 5 ),
+      /* 7 */  BPF_STMT( BPF_LD | BPF_H | BPF_ABS, 4 ),
+      /* 8 */  BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, ('g' << 8) | 'e', 0, 3 ),
+      
+      // '@' 
+      /* 9 */  BPF_STMT( BPF_LD | BPF_B | BPF_ABS, 6 ),
+      /* 10 */ BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, '@', 0, 1 ),
+      
+      // accept the whole message
+      /* 11 */ BPF_STMT( BPF_RET | BPF_K, 0xffffffff ),
+      
+      // drop it 
+      /* 12 */ BPF_STMT( BPF_RET | BPF_K, 0 ),
+   };
+   
+   if( !want_change ) {
+      
+      // "chan" goes to 12 
+      ins[6].jt = 5;
+   }
+   
+   memset( &prog, 0, sizeof(prog) );
+   prog.len = sizeof(ins) / sizeof(ins[0]);
+   prog.filter = ins;
+   
+   rc = setsockopt( ctx->pfd.fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog) );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+      vdev_error("setsockopt(SO_ATTACH_FILTER) rc = %d\n", rc );
+      return rc;
+   }
+   
+   ctx->netlink_filtered = true;
+   
+   vdev_debug("Netlink filter: add, remove%s\n", (want_change ? ", change" : "") );
+   return 0;
+}
+
+
+// filter out kernel events that vdevd can't do anything with, given the loaded actions.
+// return 0 on success, including if we're not listening for kernel events
+// return -errno on failure to attach the filter
+int vdev_os_update_filter( struct vdev_action** acts, size_t num_acts, void* cls ) {
+   
+   struct vdev_linux_context* ctx = (struct vdev_linux_context*)cls;
+   bool want_change = false;
+   
+   if( ctx == NULL || ctx->pfd.fd < 0 ) {
+      return 0;
+   }
+   
+   for( size_t i = 0; i < num_acts; i++ ) {
+      
+      if( acts[i]->trigger == VDEV_DEVICE_CHANGE || acts[i]->trigger == VDEV_DEVICE_ANY ) {
+         
+         want_change = true;
+         break;
+      }
+   }
+   
+   return vdev_linux_netlink_filter_attach( ctx, want_change );
+}
+
+
+// defined below, with the sysfs crawler
+static int vdev_linux_resync_start( struct vdev_linux_context* ctx );
+
+// yield the next device event
+// return 0 on success 
+// return 1 if there are no more devices
+// return -EAGAIN if vdev should try to get this device again 
+// return -errno if the netlink reader thread failed to poll for devices or read the next device packets.
+int vdev_os_next_device( struct vdev_device_request* vreq, void* cls ) {
+   
+   int rc = 0;
+   struct vdev_linux_context* ctx = (struct vdev_linux_context*)cls;
+   struct vdev_linux_netlink_msg* msg = NULL;
+   bool coldplug_finished = false;
+
+   pthread_mutex_lock( &ctx->initial_requests_lock );
+   
+   // wait for the coldplug thread to find the next device, or to finish crawling sysfs
+   while( ctx->initial_requests == NULL && !ctx->coldplug_scan_done ) {
+      
+      pthread_cond_wait( &ctx->initial_requests_cond, &ctx->initial_requests_lock );
+   }
+   
+   // do we have initial requests?
+   if( ctx->initial_requests != NULL ) {
+      
+      // next request
+      struct vdev_device_request* req = ctx->initial_requests;
+      
+      // consume 
+      ctx->initial_requests = ctx->initial_requests->next;
+      if( ctx->initial_requests == NULL ) {
+         ctx->initial_requests_tail = NULL;
+      }
+      
+      ctx->num_initial_requests--;
+      
+      // the coldplug thread may be waiting for room
+      pthread_cond_broadcast( &ctx->initial_requests_cond );
+      
+      pthread_mutex_unlock( &ctx->initial_requests_lock );
+      
+      memcpy( vreq, req, sizeof(struct vdev_device_request) );
+      free( req );
+      
+      return 0;
+   }
+   
+   // sysfs has been crawled, and every device it had has been handed off to vdevd.
+   // only tell vdevd once.
+   if( !ctx->coldplug_finished ) {
+      
+      ctx->coldplug_finished = true;
+      coldplug_finished = true;
+   }
+   
+   pthread_mutex_unlock( &ctx->initial_requests_lock );
+   
+   if( coldplug_finished ) {
+      
+      // tell vdevd that we've finished coldplug processing
+      vdev_os_context_signal_coldplug_finished( ctx->os_ctx );
+   }
+   
+   if( ctx->os_ctx->coldplug_only ) {
+      
+      // out of coldplug requests; die 
+      return 1;
+   }
+   
+   pthread_mutex_lock( &ctx->netlink_lock );
+   
+   // next event from the netlink reader thread (wait forever)
+   while( ctx->netlink_ring_count == 0 && ctx->netlink_error == 0 && !ctx->resync_needed ) {
+      
+      pthread_cond_wait( &ctx->netlink_cond, &ctx->netlink_lock );
+   }
+   
+   if( ctx->resync_needed ) {
+      
+      // we lost events.  Find out what changed before handling any more.
+      ctx->resync_needed = false;
+      
+      pthread_mutex_unlock( &ctx->netlink_lock );
+      
+      rc = vdev_linux_resync_start( ctx );
+      if( rc != 0 ) {
+         
+         vdev_error("vdev_linux_resync_start rc = %d\n", rc );
+      }
+      
+      return vdev_os_next_device( vreq, cls );
+   }
+   
+   if( ctx->netlink_ring_count == 0 ) {
+      
+      // reader thread died 
+      rc = ctx->netlink_error;
+      pthread_mutex_unlock( &ctx->netlink_lock );
+      
+      vdev_error("FATAL: netlink reader rc = %d\n", rc );
+      return rc;
+   }
+   
+   // the reader thread won't touch this message until we release it
+   msg = &ctx->netlink_ring[ ctx->netlink_ring_head ];
+   
+   pthread_mutex_unlock( &ctx->netlink_lock );
+   
+   if( msg->len > 0 ) {
+      
+      struct timespec parse_start, parse_end;
+      
+      // parse the event buffer
+      vdev_debug("%p from netlink\n", vreq );
+      
+      clock_gettime( CLOCK_MONOTONIC, &parse_start );
+      
+      rc = vdev_linux_parse_request( ctx, vreq, msg->buf, msg->len );
+      
+      if( rc != 0 ) {
+         
+         vdev_error("vdev_linux_parse_request rc = %d\n", rc );
+         rc = -EAGAIN;
+      }
+      else {
+         
+         clock_gettime( CLOCK_MONOTONIC, &parse_end );
+         
+         vdev_device_request_trace( vreq, VDEV_TRACE_NETLINK, NULL, &msg->received, &parse_start );
+         vdev_device_request_trace( vreq, VDEV_TRACE_PARSE, NULL, &parse_start, &parse_end );
+      }
+   }
+   else {
+      
+      // not from the kernel
+      rc = -EAGAIN;
+   }
+   
+   // release it 
+   pthread_mutex_lock( &ctx->netlink_lock );
+   
+   ctx->netlink_ring_head = (ctx->netlink_ring_head + 1) % VDEV_LINUX_NETLINK_RING_LEN;
+   ctx->netlink_ring_count--;
+   
+   pthread_cond_broadcast( &ctx->netlink_cond );
+   pthread_mutex_unlock( &ctx->netlink_lock );
+   
+   return rc;
+}
+
+
+// find sysfs mountpoint in /proc/mounts
+// this is apparently superfluous (it *should* be mounted at /sys), but you never know.
+// mountpoint must be big enough (PATH_MAX will do)
+// return 0 on success
+// return -ENOSYS if sysfs is not mounted
+// return -ENOMEM if the buffer isn't big enough 
+// return -EINVAL if somehow we failed to parse a mount entry
+// return negative for some other errors (like access permission failures, or /proc not mounted)
+static int vdev_linux_find_sysfs_mountpoint( char* mountpoint, size_t mountpoint_len ) {
+   
+   FILE* f = NULL;
+   int rc = 0;
+   
+   char mntbuf[4096];
+   struct mntent ment_buf;
+   struct mntent* ment_ptr = NULL;
+   int ent_count = 1;
+   bool found = false;
+   
+   f = fopen( "/proc/mounts", "r" );
+   if( f == NULL ) {
+      
+      rc = -errno;
+      fprintf(stderr, "Failed to open /proc/mounts, rc = %d\n", rc );
+      return rc;
+   }
+   
+   // scan for sysfs mount type
+   while( 1 ) {
+      
+      ment_ptr = getmntent_r( f, &ment_buf, mntbuf, 4096 );
+      if( ment_ptr == NULL ) {
          
          vdev_error("Failed on processing entry #%d of /proc/mounts\n", ent_count );
          rc = -EINVAL;
@@ -678,6 +1348,41 @@ static int vdev_linux_find_sysfs_mountpoint( char* mountpoint, size_t mountpoint
    return rc;
 }
 
+// use a directory other than the mounted sysfs as sysfs, such as a generated tree.
+// mountpoint must be at least PATH_MAX+1 bytes, and gets the directory's absolute path.
+// return 0 on success
+// return -ENOTDIR if it has no devices/ directory to crawl
+// return -ENOMEM on OOM
+// return -errno if we can't resolve or stat it
+static int vdev_linux_sysfs_use_mountpoint( char const* path, char* mountpoint ) {
+   
+   int rc = 0;
+   struct stat sb;
+   char* devices_path = NULL;
+   
+   if( realpath( path, mountpoint ) == NULL ) {
+      return -errno;
+   }
+   
+   devices_path = vdev_fullpath( mountpoint, "/devices", NULL );
+   if( devices_path == NULL ) {
+      return -ENOMEM;
+   }
+   
+   rc = stat( devices_path, &sb );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+   }
+   else if( !S_ISDIR( sb.st_mode ) ) {
+      
+      rc = -ENOTDIR;
+   }
+   
+   free( devices_path );
+   return rc;
+}
+
 // get a uevent from a uevent file 
 // replace newlines with '\0', making the uevent look like it came from the netlink socket
 // (i.e. so it can be parsed by vdev_linux_parse_request)
@@ -752,42 +1457,50 @@ static int vdev_linux_sysfs_read_uevent( char const* fp_uevent, char** ret_ueven
 }
 
 
-// append a key/value pair to a uevent buffer
+// hand a device request found in sysfs off to vdev_os_next_device, by appending it to the initial_requests list.
+// blocks while the list is full.  vreq is consumed either way.
 // return 0 on success
-// return -ENOMEM on OOM
-static int vdev_linux_uevent_append( char** ret_uevent_buf, size_t* ret_uevent_buf_len, char const* key, char const* value ) {
+// return -ECANCELED if the coldplug thread is being stopped
+static int vdev_linux_initial_requests_append( struct vdev_linux_context* ctx, struct vdev_device_request* vreq ) {
    
-   char* tmp = NULL;
-   char* uevent_buf = *ret_uevent_buf;
-   size_t uevent_buf_len = *ret_uevent_buf_len;
+   pthread_mutex_lock( &ctx->initial_requests_lock );
    
-   // add it to the uevent buffer, so we can parse it like a normal uevent
-   tmp = (char*)realloc( uevent_buf, uevent_buf_len + 1 + strlen(key) + 1 + strlen(value) + 1 );
-   if( tmp == NULL ) {
+   // don't get too far ahead of vdevd
+   while( ctx->num_initial_requests >= VDEV_LINUX_COLDPLUG_MAX_PENDING && !ctx->coldplug_cancel ) {
       
-      return -ENOMEM;
+      pthread_cond_wait( &ctx->initial_requests_cond, &ctx->initial_requests_lock );
    }
    
-   uevent_buf = tmp;
-   
-   // add key
-   memcpy( uevent_buf + uevent_buf_len, key, strlen(key) );
-   uevent_buf_len += strlen(key);
+   if( ctx->coldplug_cancel ) {
+      
+      // shutting down
+      pthread_mutex_unlock( &ctx->initial_requests_lock );
+      
+      vdev_device_request_free( vreq );
+      free( vreq );
+      
+      return -ECANCELED;
+   }
    
-   // add '='
-   *(uevent_buf + uevent_buf_len) = '=';
-   uevent_buf_len ++;
+   // append 
+   if( ctx->initial_requests == NULL ) {
+      
+      ctx->initial_requests = vreq;
+      ctx->initial_requests_tail = vreq;
+   }
+   else {
+      
+      ctx->initial_requests_tail->next = vreq;
+      ctx->initial_requests_tail = vreq;
+   }
    
-   // add value
-   memcpy( uevent_buf + uevent_buf_len, value, strlen(value) );
-   uevent_buf_len += strlen(value);
+   vreq->next = NULL;
+   ctx->num_initial_requests++;
    
-   // NULL-terminate 
-   *(uevent_buf + uevent_buf_len) = '\0';
-   uevent_buf_len ++;
+   vdev_device_request_set_coldplug( vreq, true );
    
-   *ret_uevent_buf = uevent_buf;
-   *ret_uevent_buf_len = uevent_buf_len;
+   pthread_cond_broadcast( &ctx->initial_requests_cond );
+   pthread_mutex_unlock( &ctx->initial_requests_lock );
    
    return 0;
 }
@@ -795,9 +1508,11 @@ static int vdev_linux_uevent_append( char** ret_uevent_buf, size_t* ret_uevent_b
 
 // register a device from sysfs, given the path to its uevent file.
 // that is, read the uevent file, generate a device request, and add it to the initial_requests list in the ctx.
+// blocks while the list is full.
 // NOTE: it is assumed that fp_uevent--the full path to the uevent file--lives in /sys/devices
 // return 0 on success
 // return -ENOMEM on OOM
+// return -ECANCELED if the coldplug thread is being stopped
 // return negative on error.
 static int vdev_linux_sysfs_register_device( struct vdev_linux_context* ctx, char const* fp_uevent ) {
    
@@ -903,6 +1618,9 @@ static int vdev_linux_sysfs_register_device( struct vdev_linux_context* ctx, cha
    // build up the request
    vdev_device_request_init( vreq, ctx->os_ctx->state, VDEV_DEVICE_INVALID, devname );
    
+   // record it as we synthesized it, since parsing modifies it 
+   vdev_linux_record_uevent( ctx, VDEV_UEVLOG_SOURCE_COLDPLUG, NULL, uevent_buf, uevent_buf_len );
+   
    // parse from our uevent
    rc = vdev_linux_parse_request( ctx, vreq, uevent_buf, uevent_buf_len );
    
@@ -916,286 +1634,670 @@ static int vdev_linux_sysfs_register_device( struct vdev_linux_context* ctx, cha
       free( full_devpath );
       free( devname );
    
-      return rc;
+      return rc;
+   }
+   
+   free( full_devpath );
+   free( devname );
+   
+   return vdev_linux_initial_requests_append( ctx, vreq );
+}
+
+
+// free a list of cstr vectors
+// always succeeds
+static int vdev_cstr_vector_free_all( struct sglib_cstr_vector* vec ) {
+   
+   // free all strings
+   for( unsigned long i = 0; i < sglib_cstr_vector_size( vec ); i++ ) {
+      
+      if( sglib_cstr_vector_at( vec, i ) != NULL ) {
+         
+         free( sglib_cstr_vector_at( vec, i ) );
+         sglib_cstr_vector_set( vec, NULL, i );
+      }
+   }
+   
+   return 0;
+}
+
+
+// most threads to crawl sysfs with 
+#define VDEV_LINUX_SYSFS_CRAWL_MAX_THREADS      8
+
+// size of the buffer each crawler thread reads directory entries into 
+#define VDEV_LINUX_SYSFS_DIRENT_BUF_LEN         32768
+
+// directory entry, as getdents64(2) returns it
+struct vdev_linux_dirent64 {
+   
+   uint64_t d_ino;
+   int64_t d_off;
+   unsigned short d_reclen;
+   unsigned char d_type;
+   char d_name[];
+};
+
+// parallel sysfs crawl state, shared by all crawler threads
+struct vdev_linux_sysfs_crawl {
+   
+   // $sysfs/devices, and an open dirfd to it.  All directories are opened relative to it.
+   char* devices_path;
+   int devices_fd;
+   
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   
+   // directories still to be read, relative to devices_fd
+   struct sglib_cstr_vector frontier;
+   
+   // number of threads reading a directory (which may add more to the frontier)
+   int num_busy;
+   
+   // first error encountered, which stops the crawl
+   int rc;
+   
+   // context to register devices with, and how many have been registered
+   struct vdev_linux_context* ctx;
+   unsigned long num_devices;
+   
+   // if true, only register devices vdevd doesn't already know about
+   bool resync;
+};
+
+
+// during a resync, note that a device found in sysfs is still there.
+// return true if vdevd already knows about it
+// return false if not
+static bool vdev_linux_known_devices_mark( struct vdev_linux_context* ctx, char const* uevent_path ) {
+   
+   char devpath[ PATH_MAX+1 ];
+   size_t devpath_len = strlen(uevent_path) - strlen(ctx->sysfs_mountpoint) - strlen("/uevent");
+   struct vdev_linux_known_device lookup;
+   struct vdev_linux_known_device* kd = NULL;
+   
+   if( devpath_len > PATH_MAX ) {
+      return false;
+   }
+   
+   memcpy( devpath, uevent_path + strlen(ctx->sysfs_mountpoint), devpath_len );
+   devpath[ devpath_len ] = '\0';
+   
+   memset( &lookup, 0, sizeof(lookup) );
+   lookup.devpath = devpath;
+   
+   pthread_mutex_lock( &ctx->known_devices_lock );
+   
+   kd = sglib_vdev_linux_known_devices_find_member( ctx->known_devices, &lookup );
+   if( kd != NULL ) {
+      
+      kd->resync_gen = ctx->resync_gen;
+   }
+   
+   pthread_mutex_unlock( &ctx->known_devices_lock );
+   
+   return (kd != NULL);
+}
+
+
+// read one sysfs directory: register its device if it has a uevent file, and then queue up its subdirectories.
+// registering the device before any of its children are queued ensures that parent devices are always
+// handed off to vdevd before their children, no matter how many threads are crawling.
+// dir_path is relative to crawl->devices_fd ("" for the top).
+// buf is the thread's getdents64(2) buffer.
+// return 0 on success, including if the directory has disappeared since it was queued
+// return -ENOMEM on OOM 
+// return -ECANCELED if the crawl is being stopped
+// return -errno on failure to open or read the directory
+static int vdev_linux_sysfs_crawl_directory( struct vdev_linux_sysfs_crawl* crawl, char const* dir_path, char* buf ) {
+   
+   int rc = 0;
+   int dirfd = -1;
+   long nr = 0;
+   bool has_uevent = false;
+   bool registered = false;
+   struct stat sb;
+   struct sglib_cstr_vector children;
+   char* uevent_path = NULL;
+   
+   sglib_cstr_vector_init( &children );
+   
+   dirfd = openat( crawl->devices_fd, (*dir_path != '\0' ? dir_path : "."), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+   if( dirfd < 0 ) {
+      
+      rc = -errno;
+      if( rc == -ENOENT ) {
+         
+         // device went away 
+         vdev_debug("Device directory '%s/%s' disappeared\n", crawl->devices_path, dir_path );
+         return 0;
+      }
+      
+      vdev_error("openat('%s/%s') rc = %d\n", crawl->devices_path, dir_path, rc );
+      return rc;
+   }
+   
+   while( rc == 0 ) {
+      
+      nr = syscall( SYS_getdents64, dirfd, buf, VDEV_LINUX_SYSFS_DIRENT_BUF_LEN );
+      if( nr < 0 ) {
+         
+         rc = -errno;
+         vdev_error("getdents64('%s/%s') rc = %d\n", crawl->devices_path, dir_path, rc );
+         break;
+      }
+      
+      if( nr == 0 ) {
+         break;
+      }
+      
+      for( long off = 0; off < nr; ) {
+         
+         struct vdev_linux_dirent64* dent = (struct vdev_linux_dirent64*)(buf + off);
+         unsigned char d_type = dent->d_type;
+         
+         off += dent->d_reclen;
+         
+         // skip . and .. 
+         if( strcmp( dent->d_name, "." ) == 0 || strcmp( dent->d_name, ".." ) == 0 ) {
+            continue;
+         }
+         
+         if( d_type == DT_UNKNOWN ) {
+            
+            // sysfs always fills in d_type, but just in case
+            if( fstatat( dirfd, dent->d_name, &sb, AT_SYMLINK_NOFOLLOW ) != 0 ) {
+               continue;
+            }
+            
+            d_type = (S_ISDIR( sb.st_mode ) ? DT_DIR : DT_REG);
+         }
+         
+         if( d_type == DT_DIR ) {
+            
+            // search this one later 
+            char* child_path = VDEV_CALLOC( char, strlen(dir_path) + 1 + strlen(dent->d_name) + 1 );
+            if( child_path == NULL ) {
+               
+               rc = -ENOMEM;
+               break;
+            }
+            
+            if( *dir_path != '\0' ) {
+               sprintf( child_path, "%s/%s", dir_path, dent->d_name );
+            }
+            else {
+               strcpy( child_path, dent->d_name );
+            }
+            
+            rc = sglib_cstr_vector_push_back( &children, child_path );
+            if( rc != 0 ) {
+               
+               free( child_path );
+               break;
+            }
+         }
+         else if( strcmp( dent->d_name, "uevent" ) == 0 ) {
+            
+            // this directory is a device 
+            has_uevent = true;
+         }
+      }
+   }
+   
+   close( dirfd );
+   
+   if( rc == 0 && has_uevent ) {
+      
+      uevent_path = VDEV_CALLOC( char, strlen(crawl->devices_path) + 1 + strlen(dir_path) + strlen("/uevent") + 1 );
+      if( uevent_path == NULL ) {
+         
+         rc = -ENOMEM;
+      }
+      else if( *dir_path != '\0' ) {
+         sprintf( uevent_path, "%s/%s/uevent", crawl->devices_path, dir_path );
+      }
+      else {
+         sprintf( uevent_path, "%s/uevent", crawl->devices_path );
+      }
+   }
+   
+   if( rc == 0 && uevent_path != NULL && crawl->resync && vdev_linux_known_devices_mark( crawl->ctx, uevent_path ) ) {
+      
+      // already have it 
+      free( uevent_path );
+      uevent_path = NULL;
+   }
+   
+   if( rc == 0 && uevent_path != NULL ) {
+      
+      vdev_debug("Register device '%s'\n", uevent_path );
+      
+      rc = vdev_linux_sysfs_register_device( crawl->ctx, uevent_path );
+      if( rc == 0 ) {
+         
+         registered = true;
+      }
+      else if( rc != -ECANCELED ) {
+         
+         // skip this device, but keep crawling
+         vdev_error("vdev_linux_sysfs_register_device('%s') rc = %d\n", uevent_path, rc );
+         rc = 0;
+      }
+   }
+   
+   if( rc == 0 ) {
+      
+      pthread_mutex_lock( &crawl->lock );
+      
+      if( registered ) {
+         crawl->num_devices++;
+      }
+      
+      for( unsigned long i = 0; rc == 0 && i < sglib_cstr_vector_size( &children ); i++ ) {
+         
+         rc = sglib_cstr_vector_push_back( &crawl->frontier, sglib_cstr_vector_at( &children, i ) );
+         if( rc == 0 ) {
+            sglib_cstr_vector_set( &children, NULL, i );
+         }
+      }
+      
+      pthread_cond_broadcast( &crawl->cond );
+      pthread_mutex_unlock( &crawl->lock );
+   }
+   
+   vdev_cstr_vector_free_all( &children );
+   sglib_cstr_vector_free( &children );
+   
+   if( uevent_path != NULL ) {
+      free( uevent_path );
    }
    
-   free( full_devpath );
-   free( devname );
+   return rc;
+}
+
+
+// sysfs crawler thread: read directories off of the frontier until there are none left and no 
+// other thread can add more, or until some thread fails.
+static void* vdev_linux_sysfs_crawl_main( void* arg ) {
    
-   pthread_mutex_lock( &ctx->initial_requests_lock );
+   struct vdev_linux_sysfs_crawl* crawl = (struct vdev_linux_sysfs_crawl*)arg;
+   char* dir_path = NULL;
+   int rc = 0;
    
-   // append 
-   if( ctx->initial_requests == NULL ) {
+   char* buf = VDEV_CALLOC( char, VDEV_LINUX_SYSFS_DIRENT_BUF_LEN );
+   if( buf == NULL ) {
       
-      ctx->initial_requests = vreq;
-      ctx->initial_requests_tail = vreq;
-   }
-   else {
+      pthread_mutex_lock( &crawl->lock );
       
-      ctx->initial_requests_tail->next = vreq;
-      ctx->initial_requests_tail = vreq;
+      if( crawl->rc == 0 ) {
+         crawl->rc = -ENOMEM;
+      }
+      
+      pthread_cond_broadcast( &crawl->cond );
+      pthread_mutex_unlock( &crawl->lock );
+      return NULL;
    }
    
-   vreq->next = NULL;
-   
-   pthread_mutex_unlock( &ctx->initial_requests_lock );
+   while( 1 ) {
+      
+      pthread_mutex_lock( &crawl->lock );
+      
+      while( sglib_cstr_vector_size( &crawl->frontier ) == 0 && crawl->num_busy > 0 && crawl->rc == 0 ) {
+         pthread_cond_wait( &crawl->cond, &crawl->lock );
+      }
+      
+      if( sglib_cstr_vector_size( &crawl->frontier ) == 0 || crawl->rc != 0 ) {
+         
+         // done 
+         pthread_mutex_unlock( &crawl->lock );
+         break;
+      }
+      
+      dir_path = sglib_cstr_vector_pop_back( &crawl->frontier );
+      crawl->num_busy++;
+      
+      pthread_mutex_unlock( &crawl->lock );
+      
+      rc = vdev_linux_sysfs_crawl_directory( crawl, dir_path, buf );
+      
+      free( dir_path );
+      dir_path = NULL;
+      
+      pthread_mutex_lock( &crawl->lock );
+      
+      crawl->num_busy--;
+      
+      if( rc != 0 && crawl->rc == 0 ) {
+         crawl->rc = rc;
+      }
+      
+      // wake up waiters if we were the last one who could have added work
+      if( crawl->num_busy == 0 || crawl->rc != 0 ) {
+         pthread_cond_broadcast( &crawl->cond );
+      }
+      
+      pthread_mutex_unlock( &crawl->lock );
+   }
    
-   return rc;
+   free( buf );
+   return NULL;
 }
 
 
-// scan structure for finding new device directories, and signalling whether or not 
-// the given directory has a uevent.
-struct vdev_linux_sysfs_scan_context {
-   
-   char* uevent_path;
-   struct sglib_cstr_vector* device_frontier;
-};
-
-// scan a directory in /sys/devices directory, to find its child directories
+// register all devices in sysfs, handing each one off to vdevd as soon as it is found.
+// if resync is true, only register the ones vdevd doesn't already know about, and mark the rest as seen.
+// /sys/devices is crawled by several threads at once, reading directories with openat(2) and getdents64(2).
 // return 0 on success
-// return -ENOMEM on OOM
-// return -errno on failure to stat
-static int vdev_linux_sysfs_scan_device_directory( char const* fp, void* cls ) {
-   
-   struct vdev_linux_sysfs_scan_context* scan_ctx = (struct vdev_linux_sysfs_scan_context*)cls;
-   
-   struct sglib_cstr_vector* device_frontier = scan_ctx->device_frontier;
+// return -ECANCELED if the crawl was stopped
+// return negative on error
+static int vdev_linux_sysfs_register_devices( struct vdev_linux_context* ctx, bool resync ) {
    
-   struct stat sb;
    int rc = 0;
-   char* fp_base = NULL;
-   char* fp_dup = NULL;
+   int num_threads = 0;
+   int num_started = 0;
+   pthread_t threads[ VDEV_LINUX_SYSFS_CRAWL_MAX_THREADS ];
+   char* top = NULL;
+   struct vdev_linux_sysfs_crawl crawl;
    
-   fp_base = rindex( fp, '/' );
+   memset( &crawl, 0, sizeof(struct vdev_linux_sysfs_crawl) );
    
-   if( fp_base == NULL ) {
-      return 0;
-   }
+   crawl.ctx = ctx;
+   crawl.resync = resync;
+   sglib_cstr_vector_init( &crawl.frontier );
    
-   // skip . and .. 
-   if( strcmp( fp_base, "/." ) == 0 || strcmp( fp_base, "/.." ) == 0 ) {
-      return 0;
+   crawl.devices_path = vdev_fullpath( ctx->sysfs_mountpoint, "/devices", NULL );
+   if( crawl.devices_path == NULL ) {
+      
+      return -ENOMEM;
    }
    
-   // add directories
-   rc = lstat( fp, &sb );
-   if( rc != 0 ) {
+   crawl.devices_fd = open( crawl.devices_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+   if( crawl.devices_fd < 0 ) {
       
       rc = -errno;
-      vdev_error("lstat('%s') rc = %d\n", fp, rc );
+      vdev_error("open('%s') rc = %d\n", crawl.devices_path, rc );
+      
+      free( crawl.devices_path );
       return rc;
    }
    
-   if( !S_ISDIR( sb.st_mode ) && strcmp( fp_base, "/uevent" ) != 0 ) {
+   // start from the top 
+   top = vdev_strdup_or_null( "" );
+   if( top == NULL ) {
       
-      // not a directory, and not a uevent
-      return 0;
+      close( crawl.devices_fd );
+      free( crawl.devices_path );
+      return -ENOMEM;
    }
    
-   fp_dup = vdev_strdup_or_null( fp );
-   if( fp_dup == NULL ) {
+   rc = sglib_cstr_vector_push_back( &crawl.frontier, top );
+   if( rc != 0 ) {
       
-      return -ENOMEM;
+      free( top );
+      close( crawl.devices_fd );
+      free( crawl.devices_path );
+      return rc;
    }
    
-   if( S_ISDIR( sb.st_mode ) ) {
+   pthread_mutex_init( &crawl.lock, NULL );
+   pthread_cond_init( &crawl.cond, NULL );
+   
+   num_threads = (int)sysconf( _SC_NPROCESSORS_ONLN );
+   if( num_threads > VDEV_LINUX_SYSFS_CRAWL_MAX_THREADS ) {
+      num_threads = VDEV_LINUX_SYSFS_CRAWL_MAX_THREADS;
+   }
    
-      vdev_debug("Search '%s'\n", fp_dup );
+   // this thread crawls too 
+   for( num_started = 0; num_started < num_threads - 1; num_started++ ) {
       
-      rc = sglib_cstr_vector_push_back( device_frontier, fp_dup );
+      rc = pthread_create( &threads[num_started], NULL, vdev_linux_sysfs_crawl_main, &crawl );
       if( rc != 0 ) {
-      
-         free( fp_dup );
-         return rc;
+         
+         // crawl with the threads we have 
+         vdev_warn("pthread_create rc = %d\n", rc );
+         rc = 0;
+         break;
       }
    }
-   else {
-      
-      // this is a uevent; this directory is a device 
-      vdev_debug("Uevent '%s'\n", fp_dup );
-      scan_ctx->uevent_path = fp_dup;
+   
+   vdev_linux_sysfs_crawl_main( &crawl );
+   
+   for( int i = 0; i < num_started; i++ ) {
+      pthread_join( threads[i], NULL );
    }
    
-   return 0;
+   rc = crawl.rc;
+   
+   vdev_debug("Registered %lu devices in '%s' with %d thread(s)\n", crawl.num_devices, crawl.devices_path, num_started + 1 );
+   
+   vdev_cstr_vector_free_all( &crawl.frontier );
+   sglib_cstr_vector_free( &crawl.frontier );
+   
+   pthread_cond_destroy( &crawl.cond );
+   pthread_mutex_destroy( &crawl.lock );
+   
+   close( crawl.devices_fd );
+   free( crawl.devices_path );
+   
+   return rc;
 }
 
 
-// read all devices from sysfs, and put their uevent paths into the given uevent_paths.
-// scan in breadth-first order, so we find and process parent devices before their child devices.
-// return 0 on success
-// return negative on error
-static int vdev_linux_sysfs_find_devices( struct vdev_linux_context* ctx, struct sglib_cstr_vector* uevent_paths ) {
+// coldplug thread: crawl sysfs and register each device as it is found, and then
+// tell vdev_os_next_device that there will be no more.
+static void* vdev_linux_coldplug_main( void* arg ) {
    
+   struct vdev_linux_context* ctx = (struct vdev_linux_context*)arg;
    int rc = 0;
    
-   // find all directories that have a 'uevent' file in them 
-   struct sglib_cstr_vector device_frontier;
-   sglib_cstr_vector_init( &device_frontier );
+   rc = vdev_linux_sysfs_register_devices( ctx, false );
+   if( rc != 0 && rc != -ECANCELED ) {
+      
+      // process whatever we found
+      vdev_error("vdev_linux_sysfs_register_devices rc = %d\n", rc );
+   }
+   
+   pthread_mutex_lock( &ctx->initial_requests_lock );
+   
+   ctx->coldplug_scan_done = true;
+   
+   pthread_cond_broadcast( &ctx->initial_requests_cond );
+   pthread_mutex_unlock( &ctx->initial_requests_lock );
    
-   struct vdev_linux_sysfs_scan_context scan_context;
-   memset( &scan_context, 0, sizeof(struct vdev_linux_sysfs_scan_context) );
+   return NULL;
+}
+
+
+// synthesize remove requests for known devices that the current resync pass did not find in sysfs,
+// and forget them.
+// return 0 on success
+// return -ENOMEM on OOM
+// return -ECANCELED if the resync is being stopped
+static int vdev_linux_sysfs_register_removed_devices( struct vdev_linux_context* ctx ) {
    
-   scan_context.device_frontier = &device_frontier;
+   int rc = 0;
+   struct sglib_vdev_linux_known_devices_iterator itr;
+   struct vdev_linux_known_device* kd = NULL;
+   struct vdev_linux_known_device** gone = NULL;
+   struct vdev_device_request* vreq = NULL;
+   size_t num_gone = 0;
+   size_t i = 0;
    
-   char* device_root = NULL;
+   pthread_mutex_lock( &ctx->known_devices_lock );
    
-   // scan /sys/devices 
-   device_root = vdev_fullpath( ctx->sysfs_mountpoint, "/devices", NULL );
-   if( device_root == NULL ) {
+   // find the ones that are gone...
+   for( kd = sglib_vdev_linux_known_devices_it_init( &itr, ctx->known_devices ); kd != NULL; kd = sglib_vdev_linux_known_devices_it_next( &itr ) ) {
       
-      return -ENOMEM;
+      if( kd->resync_gen != ctx->resync_gen ) {
+         num_gone++;
+      }
    }
    
-   rc = vdev_load_all( device_root, vdev_linux_sysfs_scan_device_directory, &scan_context );
-   if( rc != 0 ) {
-      
-      vdev_error("vdev_load_all('%s') rc = %d\n", device_root, rc );
-      
-      free( device_root );
+   if( num_gone == 0 ) {
       
-      sglib_cstr_vector_free( &device_frontier );
-      
-      return rc;
+      pthread_mutex_unlock( &ctx->known_devices_lock );
+      return 0;
    }
    
-   free( device_root );
-   
-   while( 1 ) {
+   gone = VDEV_CALLOC( struct vdev_linux_known_device*, num_gone );
+   if( gone == NULL ) {
       
-      unsigned long len = sglib_cstr_vector_size( &device_frontier );
+      pthread_mutex_unlock( &ctx->known_devices_lock );
+      return -ENOMEM;
+   }
+   
+   for( kd = sglib_vdev_linux_known_devices_it_init( &itr, ctx->known_devices ); kd != NULL; kd = sglib_vdev_linux_known_devices_it_next( &itr ) ) {
       
-      if( len == 0 ) {
-         break;
+      if( kd->resync_gen != ctx->resync_gen ) {
+         gone[i++] = kd;
       }
+   }
+   
+   // ...and forget them
+   for( i = 0; i < num_gone; i++ ) {
       
-      device_root = sglib_cstr_vector_at( &device_frontier, len - 1 );
-      sglib_cstr_vector_set( &device_frontier, NULL, len - 1 );
-      
-      sglib_cstr_vector_pop_back( &device_frontier );
+      sglib_vdev_linux_known_devices_delete( &ctx->known_devices, gone[i] );
+   }
+   
+   pthread_mutex_unlock( &ctx->known_devices_lock );
+   
+   vdev_debug("%zu device(s) disappeared from sysfs\n", num_gone );
+   
+   for( i = 0; i < num_gone; i++ ) {
       
-      // scan for more devices 
-      rc = vdev_load_all( device_root, vdev_linux_sysfs_scan_device_directory, &scan_context );
       if( rc != 0 ) {
          
-         vdev_error("vdev_load_all('%s') rc = %d\n", device_root, rc );
-         free( device_root );
-         break;
+         vdev_linux_known_device_free( gone[i] );
+         continue;
       }
       
-      // is one of them a uevent?
-      if( scan_context.uevent_path != NULL ) {
+      // their last uevent, but removed 
+      rc = vdev_linux_uevent_append( &gone[i]->uevent, &gone[i]->uevent_len, "ACTION", "remove" );
+      if( rc == 0 ) {
          
-         // yup--remember it
-         char* uevent_path = vdev_strdup_or_null( scan_context.uevent_path );
-         
-         if( uevent_path == NULL ) {
-            
-            free( device_root );
-            free( scan_context.uevent_path );
-            scan_context.uevent_path = NULL;
+         vreq = VDEV_CALLOC( struct vdev_device_request, 1 );
+         if( vreq == NULL ) {
             
             rc = -ENOMEM;
-            break;
          }
+      }
+      
+      if( rc == 0 ) {
          
-         rc = sglib_cstr_vector_push_back( uevent_paths, uevent_path );
-         if( rc < 0 ) {
+         vdev_device_request_init( vreq, ctx->os_ctx->state, VDEV_DEVICE_INVALID, NULL );
+         
+         rc = vdev_linux_parse_request( ctx, vreq, gone[i]->uevent, gone[i]->uevent_len );
+         if( rc == 0 ) {
+            
+            rc = vdev_linux_initial_requests_append( ctx, vreq );
+         }
+         else {
             
-            free( uevent_path );
-            free( device_root );
-            free( scan_context.uevent_path );
-            scan_context.uevent_path = NULL;
+            // skip it 
+            vdev_error("vdev_linux_parse_request('%s') rc = %d\n", gone[i]->devpath, rc );
             
-            break;
+            vdev_device_request_free( vreq );
+            free( vreq );
+            rc = 0;
          }
-         
-         free( scan_context.uevent_path );
-         scan_context.uevent_path = NULL;
       }
       
-      free( device_root );
+      vdev_linux_known_device_free( gone[i] );
    }
    
-   sglib_cstr_vector_free( &device_frontier );
-   
+   free( gone );
    return rc;
 }
 
 
-// free a list of cstr vectors
-// always succeeds
-static int vdev_cstr_vector_free_all( struct sglib_cstr_vector* vec ) {
+// resync thread: find the devices that were added or removed while vdevd wasn't listening,
+// and register an add or remove request for each one.
+static void* vdev_linux_resync_main( void* arg ) {
    
-   // free all strings
-   for( unsigned long i = 0; i < sglib_cstr_vector_size( vec ); i++ ) {
+   struct vdev_linux_context* ctx = (struct vdev_linux_context*)arg;
+   int rc = 0;
+   
+   rc = vdev_linux_sysfs_register_devices( ctx, true );
+   if( rc == 0 ) {
       
-      if( sglib_cstr_vector_at( vec, i ) != NULL ) {
-         
-         free( sglib_cstr_vector_at( vec, i ) );
-         sglib_cstr_vector_set( vec, NULL, i );
-      }
+      rc = vdev_linux_sysfs_register_removed_devices( ctx );
    }
    
-   return 0;
+   if( rc != 0 && rc != -ECANCELED ) {
+      
+      vdev_error("resync rc = %d\n", rc );
+   }
+   
+   pthread_mutex_lock( &ctx->initial_requests_lock );
+   
+   ctx->coldplug_scan_done = true;
+   
+   pthread_cond_broadcast( &ctx->initial_requests_cond );
+   pthread_mutex_unlock( &ctx->initial_requests_lock );
+   
+   return NULL;
 }
- 
-// register all devices, given a vector to their uevent files
+
+
+// start resyncing with sysfs, reusing the coldplug thread.
+// vdev_os_next_device will yield the resync's requests before any more kernel events.
+// only call once the last crawl has finished.
 // return 0 on success
-// return negative on error
-static int vdev_linux_sysfs_register_devices( struct vdev_linux_context* ctx ) {
+// return -errno on failure to start the thread
+static int vdev_linux_resync_start( struct vdev_linux_context* ctx ) {
    
    int rc = 0;
-   struct sglib_cstr_vector uevent_paths;
-   
-   sglib_cstr_vector_init( &uevent_paths );
    
-   // scan devices 
-   rc = vdev_linux_sysfs_find_devices( ctx, &uevent_paths );
-   if( rc != 0 ) {
-      
-      vdev_error("vdev_linux_sysfs_find_devices() rc = %d\n", rc );
+   if( ctx->coldplug_thread_running ) {
       
-      vdev_cstr_vector_free_all( &uevent_paths );
-      sglib_cstr_vector_free( &uevent_paths );
-      return rc;
+      // finished 
+      pthread_join( ctx->coldplug_thread, NULL );
+      ctx->coldplug_thread_running = false;
    }
    
-   // process all devices
-   for( unsigned long i = 0; i < sglib_cstr_vector_size( &uevent_paths ); i++ ) {
+   pthread_mutex_lock( &ctx->known_devices_lock );
+   
+   ctx->resync_gen++;
+   
+   pthread_mutex_unlock( &ctx->known_devices_lock );
+   
+   pthread_mutex_lock( &ctx->initial_requests_lock );
+   
+   ctx->coldplug_scan_done = false;
+   
+   pthread_mutex_unlock( &ctx->initial_requests_lock );
+   
+   vdev_info("Resyncing with sysfs (pass %lu)\n", (unsigned long)ctx->resync_gen );
+   
+   rc = pthread_create( &ctx->coldplug_thread, NULL, vdev_linux_resync_main, ctx );
+   if( rc != 0 ) {
       
-      char* uevent_path = sglib_cstr_vector_at( &uevent_paths, i );
+      rc = -rc;
+      vdev_error("pthread_create(resync) rc = %d\n", rc );
       
-      // skip filtered entries
-      if( uevent_path == NULL ) {
-         continue;
-      }
+      pthread_mutex_lock( &ctx->initial_requests_lock );
       
-      vdev_debug("Register device '%s'\n", uevent_path );
-      rc = vdev_linux_sysfs_register_device( ctx, uevent_path );
-      if( rc != 0 ) {
-         
-         vdev_error("vdev_linux_sysfs_register_device('%s') rc = %d\n", uevent_path, rc );
-         continue;
-      }
+      ctx->coldplug_scan_done = true;
+      
+      pthread_mutex_unlock( &ctx->initial_requests_lock );
+      return rc;
    }
    
-   // free all paths
-   vdev_cstr_vector_free_all( &uevent_paths );
-   sglib_cstr_vector_free( &uevent_paths );
-   
-   return rc;
+   ctx->coldplug_thread_running = true;
+   return 0;
 }
 
 // start listening for kernel events via netlink
 // only do so if we're *NOT* going to run once (check the config)
 // return 0 on success
-// return -errno on error (failure to socket(2), setsockopt(2), bind(2), or walk sysfs)
+// return -errno on error (failure to socket(2), setsockopt(2), bind(2), or start crawling sysfs)
 static int vdev_linux_context_init( struct vdev_os_context* os_ctx, struct vdev_linux_context* ctx ) {
    
    int rc = 0;
    size_t slen = VDEV_LINUX_NETLINK_RECV_BUF_MAX;
    int so_passcred_enable = 1;
+   char const* sysfs_mountpoint = NULL;
    
    memset( ctx, 0, sizeof(struct vdev_linux_context) );
    
@@ -1259,26 +2361,106 @@ static int vdev_linux_context_init( struct vdev_os_context* os_ctx, struct vdev_
       ctx->pfd.fd = -1;
    }
    
-   // lookup sysfs mountpoint
-   rc = vdev_linux_find_sysfs_mountpoint( ctx->sysfs_mountpoint, PATH_MAX );
-   if( rc != 0 ) {
+   // lookup sysfs mountpoint, unless we were given one
+   sysfs_mountpoint = vdev_config_OS_option( os_ctx->state->snapshot->config, VDEV_LINUX_SYSFS_MOUNTPOINT );
+   if( sysfs_mountpoint != NULL ) {
+      
+      rc = vdev_linux_sysfs_use_mountpoint( sysfs_mountpoint, ctx->sysfs_mountpoint );
+      if( rc != 0 ) {
+         
+         vdev_error("vdev_linux_sysfs_use_mountpoint('%s') rc = %d\n", sysfs_mountpoint, rc );
+         
+         close( ctx->pfd.fd );
+         return rc;
+      }
       
-      vdev_error("vdev_linux_find_sysfs_mountpoint rc = %d\n", rc );
+      vdev_info("Using '%s' as sysfs\n", ctx->sysfs_mountpoint );
+   }
+   else {
       
-      close( ctx->pfd.fd );
-      return rc;
+      rc = vdev_linux_find_sysfs_mountpoint( ctx->sysfs_mountpoint, PATH_MAX );
+      if( rc != 0 ) {
+         
+         vdev_error("vdev_linux_find_sysfs_mountpoint rc = %d\n", rc );
+         
+         close( ctx->pfd.fd );
+         return rc;
+      }
+   }
+   
+   // record what we receive?
+   if( os_ctx->state->snapshot->config->record_path != NULL ) {
+      
+      ctx->record = VDEV_CALLOC( struct vdev_uevlog, 1 );
+      if( ctx->record == NULL ) {
+         
+         close( ctx->pfd.fd );
+         return -ENOMEM;
+      }
+      
+      rc = vdev_uevlog_open( ctx->record, os_ctx->state->snapshot->config->record_path );
+      if( rc != 0 ) {
+         
+         vdev_error("vdev_uevlog_open('%s') rc = %d\n", os_ctx->state->snapshot->config->record_path, rc );
+         
+         free( ctx->record );
+         ctx->record = NULL;
+         
+         close( ctx->pfd.fd );
+         return rc;
+      }
+      
+      vdev_info("Recording uevents to '%s'\n", os_ctx->state->snapshot->config->record_path );
+   }
+   
+   if( ctx->pfd.fd >= 0 ) {
+      
+      // only wake up for events our actions can handle
+      rc = vdev_os_update_filter( os_ctx->state->snapshot->acts, os_ctx->state->snapshot->num_acts, ctx );
+      if( rc != 0 ) {
+         
+         // not fatal; we'll just see everything
+         vdev_warn("vdev_os_update_filter rc = %d\n", rc );
+      }
+      
+      // start draining the netlink socket now, so it doesn't overflow during coldplug
+      rc = vdev_linux_netlink_start( ctx );
+      if( rc != 0 ) {
+         
+         vdev_error("vdev_linux_netlink_start rc = %d\n", rc );
+         
+         vdev_linux_record_close( ctx );
+         close( ctx->pfd.fd );
+         return rc;
+      }
    }
    
    pthread_mutex_init( &ctx->initial_requests_lock, NULL );
+   pthread_cond_init( &ctx->initial_requests_cond, NULL );
+   pthread_mutex_init( &ctx->known_devices_lock, NULL );
    
-   // seed devices from sysfs 
-   rc = vdev_linux_sysfs_register_devices( ctx );
+   // seed devices from sysfs, while vdevd processes the ones found so far
+   rc = pthread_create( &ctx->coldplug_thread, NULL, vdev_linux_coldplug_main, ctx );
    if( rc != 0 ) {
       
-      vdev_error("vdev_linux_sysfs_walk_devs rc = %d\n", rc );
+      rc = -rc;
+      vdev_error("pthread_create(coldplug) rc = %d\n", rc );
+      
+      pthread_cond_destroy( &ctx->initial_requests_cond );
+      pthread_mutex_destroy( &ctx->initial_requests_lock );
+      pthread_mutex_destroy( &ctx->known_devices_lock );
+      
+      vdev_linux_netlink_stop( ctx );
+      vdev_linux_record_close( ctx );
+      
+      if( ctx->pfd.fd >= 0 ) {
+         close( ctx->pfd.fd );
+      }
       return rc;
    }
    
+   ctx->coldplug_thread_running = true;
+   
    return 0;
 }
 
@@ -1289,6 +2471,25 @@ static int vdev_linux_context_shutdown( struct vdev_linux_context* ctx ) {
    // shut down 
    if( ctx != NULL ) {
       
+      if( ctx->coldplug_thread_running ) {
+         
+         // stop crawling sysfs 
+         pthread_mutex_lock( &ctx->initial_requests_lock );
+         
+         ctx->coldplug_cancel = true;
+         
+         pthread_cond_broadcast( &ctx->initial_requests_cond );
+         pthread_mutex_unlock( &ctx->initial_requests_lock );
+         
+         pthread_join( ctx->coldplug_thread, NULL );
+         ctx->coldplug_thread_running = false;
+      }
+      
+      vdev_linux_netlink_stop( ctx );
+      
+      // nothing else will be recorded 
+      vdev_linux_record_close( ctx );
+      
       if( ctx->pfd.fd >= 0 ) {
          close( ctx->pfd.fd );
          ctx->pfd.fd = -1;
@@ -1311,7 +2512,15 @@ static int vdev_linux_context_shutdown( struct vdev_linux_context* ctx ) {
          
          ctx->initial_requests = NULL;
          ctx->initial_requests_tail = NULL;
+         ctx->num_initial_requests = 0;
       }
+      
+      vdev_linux_known_devices_free( ctx->known_devices );
+      ctx->known_devices = NULL;
+      
+      pthread_cond_destroy( &ctx->initial_requests_cond );
+      pthread_mutex_destroy( &ctx->initial_requests_lock );
+      pthread_mutex_destroy( &ctx->known_devices_lock );
    }
    
    return 0;
@@ -1441,13 +2650,19 @@ int vdev_os_init( struct vdev_os_context* os_ctx, void** cls ) {
       // using devtmpfs 
       vdev_info("'%s' is on devtmpfs\n", os_ctx->state->mountpoint );
       
-      vdev_config_set_OS_quirk( os_ctx->state->config->OS_quirks, VDEV_OS_QUIRK_DEVICE_EXISTS );
+      vdev_config_set_OS_quirk( os_ctx->state->snapshot->config->OS_quirks, VDEV_OS_QUIRK_DEVICE_EXISTS );
    }
    else {
       
       vdev_info("'%s' is not on devtmpfs\n", os_ctx->state->mountpoint );
    }
    
+   // a stand-in sysfs describes devices that aren't really there, so don't create their device files
+   if( vdev_config_OS_option( os_ctx->state->snapshot->config, VDEV_LINUX_SYSFS_MOUNTPOINT ) != NULL ) {
+      
+      vdev_config_set_OS_quirk( os_ctx->state->snapshot->config->OS_quirks, VDEV_OS_QUIRK_DEVICE_EXISTS );
+   }
+   
    ctx = VDEV_CALLOC( struct vdev_linux_context, 1 );
    if( ctx == NULL ) {
       return -ENOMEM;
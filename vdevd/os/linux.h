@@ -23,22 +23,27 @@
 #define _VDEV_OS_LINUX_H_
 
 // build Linux-specific method implementations
-#ifdef _VDEV_OS_LINUX
+#if defined(_VDEV_OS_LINUX) && !defined(_VDEV_OS_REPLAY)
 
 #define _GNU_SOURCE 
 
 #include "vdev.h"
+#include "libvdev/sglib.h"
+#include "libvdev/uevlog.h"
 
 #include <poll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/sysmacros.h>
 #include <unistd.h>
 #include <glob.h>
 #include <mntent.h>
+#include <sys/syscall.h>
 
 #include <linux/types.h>
 #include <linux/netlink.h>
 #include <linux/socket.h>
+#include <linux/filter.h>
 
 #define VDEV_LINUX_NETLINK_BUF_MAX 4097
 #define VDEV_LINUX_NETLINK_RECV_BUF_MAX 128 * 1024 * 1024
@@ -46,6 +51,50 @@
 #define VDEV_LINUX_NETLINK_UDEV_HEADER "libudev"
 #define VDEV_LINUX_NETLINK_UDEV_HEADER_LEN 8
 
+// most netlink messages to receive with one recvmmsg(2)
+#define VDEV_LINUX_NETLINK_BATCH 32
+
+// most netlink messages the reader thread can buffer before vdevd parses them
+#define VDEV_LINUX_NETLINK_RING_LEN 256
+
+// most coldplug requests the sysfs crawl can get ahead of the device workqueue by
+#define VDEV_LINUX_COLDPLUG_MAX_PENDING 1024
+
+// [vdev-OS] option: directory to use as sysfs instead of the mounted one (e.g. a generated tree to benchmark coldplug with)
+#define VDEV_LINUX_SYSFS_MOUNTPOINT "sysfs_mountpoint"
+
+// netlink message, as received by the netlink reader thread
+struct vdev_linux_netlink_msg {
+   
+   // length of the message, or 0 if it was not from the kernel and should be ignored
+   ssize_t len;
+   char buf[ VDEV_LINUX_NETLINK_BUF_MAX ];
+   
+   // when it was received (CLOCK_MONOTONIC), to trace how long it waited to be parsed
+   struct timespec received;
+};
+
+// device vdevd has processed, by sysfs DEVPATH, so a resync can tell which ones it missed
+struct vdev_linux_known_device {
+   
+   char* devpath;
+   
+   // its last uevent, without ACTION and SEQNUM, for synthesizing its removal
+   char* uevent;
+   size_t uevent_len;
+   
+   // resync pass that last saw it
+   uint64_t resync_gen;
+   
+   struct vdev_linux_known_device* left;
+   struct vdev_linux_known_device* right;
+   char color;
+};
+
+typedef struct vdev_linux_known_device vdev_linux_known_devices;
+
+#define VDEV_LINUX_KNOWN_DEVICE_CMP( kd1, kd2 ) (strcmp( (kd1)->devpath, (kd2)->devpath ))
+
 // connection to the linux kernel for hotplug
 struct vdev_linux_context {
    
@@ -55,24 +104,80 @@ struct vdev_linux_context {
    // poll on the netlink socket
    struct pollfd pfd;
    
+   // netlink reader thread, which drains the netlink socket into the ring
+   pthread_t netlink_thread;
+   bool netlink_thread_running;
+   
+   // pipe to wake up the netlink reader thread to stop
+   int netlink_wakeup_pipe[2];
+   bool netlink_stop;
+   
+   // ring of received netlink messages, which vdev_os_next_device parses 
+   pthread_mutex_t netlink_lock;
+   pthread_cond_t netlink_cond;
+   struct vdev_linux_netlink_msg* netlink_ring;
+   size_t netlink_ring_head;
+   size_t netlink_ring_count;
+   
+   // fatal error encountered by the netlink reader thread
+   int netlink_error;
+   
+   // number of times the netlink socket overflowed (ENOBUFS), losing events
+   uint64_t netlink_overflows;
+   
+   // set once a socket filter is attached, since the kernel then skips SEQNUMs on purpose
+   bool netlink_filtered;
+   
+   // set when kernel events were lost, and sysfs must be rescanned (guarded by netlink_lock)
+   bool resync_needed;
+   
+   // last kernel SEQNUM seen
+   uint64_t last_seqnum;
+   
+   // devices vdevd has processed, and the current resync pass
+   pthread_mutex_t known_devices_lock;
+   vdev_linux_known_devices* known_devices;
+   uint64_t resync_gen;
+   
    // path to mounted sysfs 
    char sysfs_mountpoint[ PATH_MAX+1 ];
    
    // ref to OS context 
    struct vdev_os_context* os_ctx;
    
-   // initial device requests 
+   // initial device requests, added by the coldplug thread as it finds them in sysfs
    pthread_mutex_t initial_requests_lock;
+   pthread_cond_t initial_requests_cond;
    struct vdev_device_request* initial_requests;
    struct vdev_device_request* initial_requests_tail;
+   size_t num_initial_requests;
+   
+   // coldplug thread, which crawls sysfs
+   pthread_t coldplug_thread;
+   bool coldplug_thread_running;
+   
+   // set once the coldplug thread has finished crawling sysfs
+   bool coldplug_scan_done;
+   
+   // set to make the coldplug thread stop early
+   bool coldplug_cancel;
+   
+   // set once we've told vdevd that all coldplug requests have been handed off
+   bool coldplug_finished;
+   
+   // log of the uevents we receive and synthesize, from --record (NULL if not recording)
+   struct vdev_uevlog* record;
 };
 
 C_LINKAGE_BEGIN
 
+SGLIB_DEFINE_RBTREE_PROTOTYPES(vdev_linux_known_devices, left, right, color, VDEV_LINUX_KNOWN_DEVICE_CMP);
+
 int vdev_os_init( struct vdev_os_context* ctx, void** cls );
 int vdev_os_shutdown( void* cls );
 
 int vdev_os_next_device( struct vdev_device_request* request, void* cls );
+int vdev_os_update_filter( struct vdev_action** acts, size_t num_acts, void* cls );
 
 C_LINKAGE_END
 
@@ -26,12 +26,13 @@
 #include "common.h"
 
 // add OS-specific headers here
-#ifdef _VDEV_OS_LINUX
+// the replay back-end stands in for the Linux one, but keeps the rest of vdevd's Linux support
+#if defined(_VDEV_OS_LINUX) && !defined(_VDEV_OS_REPLAY)
 #include "linux.h"
 #endif
 
-#ifdef _VDEV_OS_TEST
-#include "test.h"
+#ifdef _VDEV_OS_REPLAY
+#include "replay.h"
 #endif
 
 C_LINKAGE_BEGIN
@@ -46,6 +47,11 @@ int vdev_os_shutdown( void* cls );
 // return negative on fatal error (causes vdevd to exit).
 int vdev_os_next_device( struct vdev_device_request* request, void* cls );
 
+// filter out device events that none of the given actions could handle
+// return 0 on success
+// return negative on error
+int vdev_os_update_filter( struct vdev_action** acts, size_t num_acts, void* cls );
+
 C_LINKAGE_END
 
 #endif 
@@ -0,0 +1,683 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifdef _VDEV_OS_REPLAY
+
+#include "replay.h"
+#include "workqueue.h"
+#include "action.h"
+#include "stats.h"
+
+// parse a uevent action.  vdevd only distinguishes add and remove from everything else.
+static vdev_device_request_t vdev_replay_parse_device_request_type( char const* type ) {
+   
+   if( strcmp(type, "add") == 0 ) {
+      return VDEV_DEVICE_ADD;
+   }
+   else if( strcmp(type, "remove") == 0 ) {
+      return VDEV_DEVICE_REMOVE;
+   }
+   
+   // change, move, bind, unbind, online, offline...
+   return VDEV_DEVICE_CHANGE;
+}
+
+
+// free a recorded event 
+static void vdev_replay_event_free( struct vdev_replay_event* ev ) {
+   
+   if( ev->devname != NULL ) {
+      
+      free( ev->devname );
+      ev->devname = NULL;
+   }
+   
+   if( ev->params != NULL ) {
+      
+      free( ev->params );
+      ev->params = NULL;
+   }
+   
+   memset( ev, 0, sizeof(struct vdev_replay_event) );
+}
+
+
+// append a KEY=VALUE line to an event's parameters, as a null-terminated key and value.
+// *params_len is the number of bytes of ev->params used so far
+// return 0 on success
+// return -ENOMEM on OOM
+static int vdev_replay_event_add_param( struct vdev_replay_event* ev, size_t* params_len, char const* line, size_t line_len ) {
+   
+   char* new_params = (char*)realloc( ev->params, *params_len + line_len + 1 );
+   char* eq = NULL;
+   
+   if( new_params == NULL ) {
+      return -ENOMEM;
+   }
+   
+   ev->params = new_params;
+   
+   memcpy( ev->params + *params_len, line, line_len + 1 );
+   
+   // split at the first '=' 
+   eq = strchr( ev->params + *params_len, '=' );
+   *eq = '\0';
+   
+   *params_len += line_len + 1;
+   ev->num_params++;
+   
+   return 0;
+}
+
+
+// interpret a recorded event's parameters, the same way the Linux back-end interprets a uevent
+// return 0 on success
+// return -EINVAL if the event has no ACTION, or has a bad MAJOR/MINOR
+// return -ENOMEM on OOM
+static int vdev_replay_event_parse( struct vdev_replay_event* ev ) {
+   
+   char* key = ev->params;
+   char* value = NULL;
+   char* tmp = NULL;
+   bool have_action = false;
+   bool have_major = false;
+   bool have_minor = false;
+   bool is_block = false;
+   unsigned int major = 0;
+   unsigned int minor = 0;
+   
+   for( size_t i = 0; i < ev->num_params; i++ ) {
+      
+      value = key + strlen(key) + 1;
+      
+      if( strcmp(key, "ACTION") == 0 ) {
+         
+         ev->type = vdev_replay_parse_device_request_type( value );
+         have_action = true;
+      }
+      
+      else if( strcmp(key, "DEVNAME") == 0 && ev->devname == NULL ) {
+         
+         // udevd reports absolute paths; the kernel does not 
+         if( strncmp(value, "/dev/", 5) == 0 ) {
+            value += 5;
+         }
+         
+         ev->devname = vdev_strdup_or_null( value );
+         if( ev->devname == NULL ) {
+            return -ENOMEM;
+         }
+      }
+      
+      else if( strcmp(key, "SEQNUM") == 0 ) {
+         
+         ev->seqnum = strtoull( value, NULL, 10 );
+      }
+      
+      else if( strcmp(key, "SUBSYSTEM") == 0 ) {
+         
+         is_block = (strcasecmp(value, "block") == 0);
+      }
+      
+      else if( strcmp(key, "MAJOR") == 0 ) {
+         
+         major = (unsigned int)strtoul( value, &tmp, 10 );
+         if( *tmp != '\0' ) {
+            
+            vdev_error("Invalid 'MAJOR' value '%s'\n", value );
+            return -EINVAL;
+         }
+         
+         have_major = true;
+      }
+      
+      else if( strcmp(key, "MINOR") == 0 ) {
+         
+         minor = (unsigned int)strtoul( value, &tmp, 10 );
+         if( *tmp != '\0' ) {
+            
+            vdev_error("Invalid 'MINOR' value '%s'\n", value );
+            return -EINVAL;
+         }
+         
+         have_minor = true;
+      }
+      
+      key = value + strlen(value) + 1;
+   }
+   
+   if( !have_action ) {
+      
+      vdev_error("%s", "No ACTION given\n");
+      return -EINVAL;
+   }
+   
+   if( have_major != have_minor ) {
+      
+      vdev_error("Missing device information: major=%d, minor=%d\n", have_major, have_minor );
+      return -EINVAL;
+   }
+   
+   if( have_major ) {
+      
+      ev->have_dev = true;
+      ev->dev = makedev( major, minor );
+      ev->mode = (is_block ? S_IFBLK : S_IFCHR);
+   }
+   
+   return 0;
+}
+
+
+// add the event we just finished reading to the recording.
+// ts_nanos is when it was recorded, or 0 if not known 
+// return 0 on success (dropping it if it's not a valid uevent)
+// return -ENOMEM on OOM
+static int vdev_replay_add_event( struct vdev_replay_context* ctx, size_t* max_events, struct vdev_replay_event* ev, uint64_t ts_nanos, uint64_t* first_ts_nanos ) {
+   
+   int rc = 0;
+   
+   if( ev->num_params == 0 ) {
+      
+      // nothing read 
+      vdev_replay_event_free( ev );
+      return 0;
+   }
+   
+   rc = vdev_replay_event_parse( ev );
+   if( rc != 0 ) {
+      
+      vdev_replay_event_free( ev );
+      
+      if( rc == -ENOMEM ) {
+         return rc;
+      }
+      
+      // skip it 
+      vdev_warn("Skipping invalid event %zu\n", ctx->num_events );
+      return 0;
+   }
+   
+   // time since the first event; events without a timestamp happen along with the one before 
+   if( ts_nanos != 0 && *first_ts_nanos == 0 ) {
+      *first_ts_nanos = ts_nanos;
+   }
+   
+   if( ts_nanos != 0 && ts_nanos >= *first_ts_nanos ) {
+      ev->offset_nanos = ts_nanos - *first_ts_nanos;
+   }
+   else if( ctx->num_events > 0 ) {
+      ev->offset_nanos = ctx->events[ ctx->num_events - 1 ].offset_nanos;
+   }
+   
+   if( ctx->num_events == *max_events ) {
+      
+      size_t new_max = (*max_events == 0 ? 1024 : *max_events * 2);
+      struct vdev_replay_event* new_events = (struct vdev_replay_event*)realloc( ctx->events, new_max * sizeof(struct vdev_replay_event) );
+      
+      if( new_events == NULL ) {
+         
+         vdev_replay_event_free( ev );
+         return -ENOMEM;
+      }
+      
+      ctx->events = new_events;
+      *max_events = new_max;
+   }
+   
+   ctx->events[ ctx->num_events ] = *ev;
+   ctx->num_events++;
+   
+   memset( ev, 0, sizeof(struct vdev_replay_event) );
+   return 0;
+}
+
+
+// is a line a udevadm monitor header with the given source (i.e. "KERNEL[...]" or "UDEV  [...]")?
+// if so, return the text after the '['.  Otherwise, return NULL
+static char const* vdev_replay_header( char const* line, char const* source ) {
+   
+   size_t len = strlen( source );
+   
+   if( strncmp( line, source, len ) != 0 ) {
+      return NULL;
+   }
+   
+   line += len;
+   line += strspn( line, " " );
+   
+   if( *line != '[' ) {
+      return NULL;
+   }
+   
+   return line + 1;
+}
+
+
+// read a recorded uevent stream, in the format of `udevadm monitor --kernel --property`:
+// KEY=VALUE lines, one event per paragraph, optionally preceded by a "KERNEL[timestamp] ..." line.
+// "UDEV [...]" events are skipped, as are comments and any other lines without a '='.
+// return 0 on success
+// return -ENOMEM on OOM
+// return -errno on failure to read 
+static int vdev_replay_load( struct vdev_replay_context* ctx, char const* path ) {
+   
+   int rc = 0;
+   FILE* f = NULL;
+   char* line = NULL;
+   size_t line_cap = 0;
+   ssize_t line_len = 0;
+   size_t max_events = 0;
+   size_t params_len = 0;
+   struct vdev_replay_event ev;
+   bool skip = false;
+   uint64_t ts_nanos = 0;
+   uint64_t first_ts_nanos = 0;
+   char const* kernel_ts = NULL;
+   char const* udev_ts = NULL;
+   
+   memset( &ev, 0, sizeof(struct vdev_replay_event) );
+   
+   f = fopen( path, "r" );
+   if( f == NULL ) {
+      
+      rc = -errno;
+      vdev_error("fopen('%s') rc = %d\n", path, rc );
+      return rc;
+   }
+   
+   while( rc == 0 ) {
+      
+      errno = 0;
+      line_len = getline( &line, &line_cap, f );
+      
+      if( line_len < 0 ) {
+         
+         if( errno != 0 ) {
+            
+            rc = -errno;
+            vdev_error("getline('%s') rc = %d\n", path, rc );
+         }
+         
+         break;
+      }
+      
+      // chomp 
+      while( line_len > 0 && (line[ line_len - 1 ] == '\n' || line[ line_len - 1 ] == '\r') ) {
+         
+         line_len--;
+         line[ line_len ] = '\0';
+      }
+      
+      kernel_ts = vdev_replay_header( line, VDEV_REPLAY_KERNEL_HEADER );
+      udev_ts = vdev_replay_header( line, VDEV_REPLAY_UDEV_HEADER );
+      
+      // end of an event, or the start of a new one?
+      if( line_len == 0 || kernel_ts != NULL || udev_ts != NULL ) {
+         
+         if( !skip ) {
+            rc = vdev_replay_add_event( ctx, &max_events, &ev, ts_nanos, &first_ts_nanos );
+         }
+         else {
+            vdev_replay_event_free( &ev );
+         }
+         
+         params_len = 0;
+         ts_nanos = 0;
+         
+         // skip events udevd already processed 
+         skip = (udev_ts != NULL);
+         
+         if( kernel_ts != NULL ) {
+            
+            // KERNEL[seconds.micros]
+            char* tmp = NULL;
+            double ts = strtod( kernel_ts, &tmp );
+            
+            if( *tmp == ']' && ts > 0 ) {
+               ts_nanos = (uint64_t)(ts * 1e9);
+            }
+         }
+         
+         continue;
+      }
+      
+      if( skip || line[0] == '#' || strchr( line, '=' ) == NULL ) {
+         continue;
+      }
+      
+      rc = vdev_replay_event_add_param( &ev, &params_len, line, line_len );
+   }
+   
+   if( rc == 0 && !skip ) {
+      
+      // last event 
+      rc = vdev_replay_add_event( ctx, &max_events, &ev, ts_nanos, &first_ts_nanos );
+   }
+   
+   vdev_replay_event_free( &ev );
+   
+   if( line != NULL ) {
+      free( line );
+   }
+   
+   fclose( f );
+   return rc;
+}
+
+
+// wait until it's time to yield event i 
+static void vdev_replay_pace( struct vdev_replay_context* ctx, size_t i ) {
+   
+   uint64_t offset_nanos = 0;
+   struct timespec deadline;
+   int rc = 0;
+   
+   if( ctx->rate == VDEV_REPLAY_RATE_RECORDED ) {
+      
+      offset_nanos = ctx->events[i].offset_nanos;
+   }
+   else if( ctx->rate == VDEV_REPLAY_RATE_FIXED ) {
+      
+      offset_nanos = (uint64_t)i * 1000000000ULL / ctx->events_per_sec;
+   }
+   else {
+      
+      // as fast as possible
+      return;
+   }
+   
+   // absolute deadline, so time spent yielding events doesn't add up 
+   deadline.tv_sec = ctx->start.tv_sec + offset_nanos / 1000000000ULL;
+   deadline.tv_nsec = ctx->start.tv_nsec + offset_nanos % 1000000000ULL;
+   
+   if( deadline.tv_nsec >= 1000000000L ) {
+      
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+   }
+   
+   do {
+      
+      rc = clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL );
+      
+   } while( rc == EINTR );
+}
+
+
+// print the results of the replay to stdout: throughput, queue delay, and how long each action took
+static void vdev_replay_report( struct vdev_replay_context* ctx, struct timespec const* end ) {
+   
+   struct vdev_state* state = ctx->os_ctx->state;
+   struct vdev_snapshot* snapshot = NULL;
+   struct vdev_histogram queue_delay;
+   struct vdev_histogram total;
+   struct vdev_wq* wq = &state->device_wq;
+   uint64_t num_merged = 0;
+   uint64_t num_cancelled = 0;
+   uint64_t elapsed_nanos = vdev_stats_nanos( &ctx->start, end );
+   double elapsed = (double)elapsed_nanos / 1e9;
+   
+   vdev_stats_get_queue_delay( &state->stats, &queue_delay );
+   
+   // requests that vdevd coalesced instead of processing 
+   pthread_mutex_lock( &wq->work_lock );
+   
+   num_merged = wq->num_merged;
+   num_cancelled = wq->num_cancelled;
+   
+   pthread_mutex_unlock( &wq->work_lock );
+   
+   printf("events: %zu (%" PRIu64 " merged, %" PRIu64 " cancelled)\n", ctx->num_events, num_merged, num_cancelled );
+   printf("elapsed: %.6f s\n", elapsed );
+   printf("throughput: %.1f events/s\n", elapsed > 0 ? (double)ctx->num_events / elapsed : 0.0 );
+   printf("queue delay: p50=%" PRIu64 "us p90=%" PRIu64 "us p99=%" PRIu64 "us max=%" PRIu64 "us\n",
+          vdev_histogram_quantile( &queue_delay, 0.5 ) / 1000,
+          vdev_histogram_quantile( &queue_delay, 0.9 ) / 1000,
+          vdev_histogram_quantile( &queue_delay, 0.99 ) / 1000,
+          queue_delay.max_nanos / 1000 );
+   
+   printf("%-32s %10s %12s %10s %10s\n", "action", "calls", "total_ms", "mean_us", "p99_us" );
+   
+   snapshot = vdev_snapshot_pin( state );
+   
+   for( size_t i = 0; i < snapshot->num_acts; i++ ) {
+      
+      struct vdev_action* act = snapshot->acts[i];
+      
+      memset( &total, 0, sizeof(struct vdev_histogram) );
+      
+      // every kind of call, successful or not 
+      pthread_mutex_lock( &act->lock );
+      
+      for( int k = 0; k < VDEV_STATS_NUM_KINDS; k++ ) {
+         for( int o = 0; o < VDEV_STATS_NUM_OUTCOMES; o++ ) {
+            
+            vdev_histogram_merge( &total, &act->latency[k][o] );
+         }
+      }
+      
+      pthread_mutex_unlock( &act->lock );
+      
+      if( total.count == 0 ) {
+         continue;
+      }
+      
+      printf("%-32s %10" PRIu64 " %12.3f %10" PRIu64 " %10" PRIu64 "\n", act->name, total.count,
+             (double)total.sum_nanos / 1e6, total.sum_nanos / total.count / 1000, vdev_histogram_quantile( &total, 0.99 ) / 1000 );
+   }
+   
+   vdev_snapshot_release( state, snapshot );
+   
+   fflush( stdout );
+}
+
+
+// yield the next recorded event.
+// once they have all been yielded, wait for vdevd to finish them, report, and exit.
+// return 0 on success
+// return 1 once there are no more events
+// return -ENOMEM on OOM
+int vdev_os_next_device( struct vdev_device_request* vreq, void* cls ) {
+   
+   int rc = 0;
+   struct vdev_replay_context* ctx = (struct vdev_replay_context*)cls;
+   struct vdev_replay_event* ev = NULL;
+   char* key = NULL;
+   char* value = NULL;
+   struct timespec end;
+   
+   if( ctx->next == 0 ) {
+      
+      clock_gettime( CLOCK_MONOTONIC, &ctx->start );
+   }
+   
+   if( ctx->next >= ctx->num_events ) {
+      
+      // there's no coldplug to speak of 
+      vdev_os_context_signal_coldplug_finished( ctx->os_ctx );
+      
+      // wait for vdevd to catch up 
+      vdev_wq_wait_for_empty( &ctx->os_ctx->state->device_wq );
+      
+      clock_gettime( CLOCK_MONOTONIC, &end );
+      
+      vdev_replay_report( ctx, &end );
+      return 1;
+   }
+   
+   vdev_replay_pace( ctx, ctx->next );
+   
+   ev = &ctx->events[ ctx->next ];
+   ctx->next++;
+   
+   vdev_device_request_set_type( vreq, ev->type );
+   vdev_device_request_set_trace_id( vreq, ev->seqnum );
+   
+   rc = vdev_device_request_set_path( vreq, ev->devname != NULL ? ev->devname : VDEV_DEVICE_PATH_UNKNOWN );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   if( ev->have_dev ) {
+      
+      vdev_device_request_set_dev( vreq, ev->dev );
+      vdev_device_request_set_mode( vreq, ev->mode );
+   }
+   
+   key = ev->params;
+   for( size_t i = 0; i < ev->num_params; i++ ) {
+      
+      value = key + strlen(key) + 1;
+      
+      // same as the Linux back-end: these are part of the request itself 
+      if( strcmp(key, "ACTION") != 0 && strcmp(key, "MAJOR") != 0 && strcmp(key, "MINOR") != 0 ) {
+         
+         rc = vdev_device_request_add_param( vreq, key, value );
+         if( rc != 0 ) {
+            return rc;
+         }
+      }
+      
+      key = value + strlen(value) + 1;
+   }
+   
+   // tell helpers where /sys is mounted 
+   rc = vdev_device_request_add_param( vreq, "SYSFS_MOUNTPOINT", ctx->sysfs_mountpoint );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   return 0;
+}
+
+
+// there's no event source to filter 
+int vdev_os_update_filter( struct vdev_action** acts, size_t num_acts, void* cls ) {
+   
+   return 0;
+}
+
+
+// set up the replay: load the recording, and configure the rate 
+// NOTE: this should only be called from reload-safe code--i.e. a reload can't occur while this method runs
+int vdev_os_init( struct vdev_os_context* os_ctx, void** cls ) {
+   
+   int rc = 0;
+   struct vdev_replay_context* ctx = NULL;
+   struct vdev_config* config = os_ctx->state->snapshot->config;
+   char const* events_path = vdev_config_OS_option( config, VDEV_REPLAY_EVENTS );
+   char const* rate = vdev_config_OS_option( config, VDEV_REPLAY_RATE );
+   char const* mknod = vdev_config_OS_option( config, VDEV_REPLAY_MKNOD );
+   char const* sysfs = vdev_config_OS_option( config, VDEV_REPLAY_SYSFS );
+   
+   if( events_path == NULL ) {
+      
+      vdev_error("No '%s' given in [%s]\n", VDEV_REPLAY_EVENTS, VDEV_OS_CONFIG_NAME );
+      return -EINVAL;
+   }
+   
+   ctx = VDEV_CALLOC( struct vdev_replay_context, 1 );
+   if( ctx == NULL ) {
+      return -ENOMEM;
+   }
+   
+   ctx->os_ctx = os_ctx;
+   
+   if( rate == NULL || strcmp( rate, VDEV_REPLAY_RATE_MAX_STR ) == 0 ) {
+      
+      ctx->rate = VDEV_REPLAY_RATE_MAX;
+   }
+   else if( strcmp( rate, VDEV_REPLAY_RATE_RECORDED_STR ) == 0 ) {
+      
+      ctx->rate = VDEV_REPLAY_RATE_RECORDED;
+   }
+   else {
+      
+      bool success = false;
+      
+      ctx->rate = VDEV_REPLAY_RATE_FIXED;
+      ctx->events_per_sec = vdev_parse_uint64( rate, &success );
+      
+      if( !success || ctx->events_per_sec == 0 ) {
+         
+         vdev_error("Invalid value '%s' for '%s'\n", rate, VDEV_REPLAY_RATE );
+         free( ctx );
+         return -EINVAL;
+      }
+   }
+   
+   ctx->sysfs_mountpoint = strdup( sysfs != NULL ? sysfs : VDEV_REPLAY_SYSFS_DEFAULT );
+   if( ctx->sysfs_mountpoint == NULL ) {
+      
+      free( ctx );
+      return -ENOMEM;
+   }
+   
+   // unless asked, the device files "already exist", so the replay needn't run as root 
+   if( mknod == NULL || strcasecmp( mknod, "true" ) != 0 ) {
+      
+      vdev_config_set_OS_quirk( config->OS_quirks, VDEV_OS_QUIRK_DEVICE_EXISTS );
+   }
+   
+   rc = vdev_replay_load( ctx, events_path );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_replay_load('%s') rc = %d\n", events_path, rc );
+      
+      vdev_os_shutdown( ctx );
+      return rc;
+   }
+   
+   vdev_info("Replaying %zu events from '%s'\n", ctx->num_events, events_path );
+   
+   *cls = ctx;
+   return 0;
+}
+
+
+// free the recording 
+int vdev_os_shutdown( void* cls ) {
+   
+   struct vdev_replay_context* ctx = (struct vdev_replay_context*)cls;
+   
+   if( ctx == NULL ) {
+      return 0;
+   }
+   
+   for( size_t i = 0; i < ctx->num_events; i++ ) {
+      
+      vdev_replay_event_free( &ctx->events[i] );
+   }
+   
+   if( ctx->events != NULL ) {
+      free( ctx->events );
+   }
+   
+   if( ctx->sysfs_mountpoint != NULL ) {
+      free( ctx->sysfs_mountpoint );
+   }
+   
+   free( ctx );
+   return 0;
+}
+
+#endif
@@ -0,0 +1,112 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _VDEV_OS_REPLAY_H_
+#define _VDEV_OS_REPLAY_H_
+
+// replay a recorded uevent stream instead of listening to the kernel, to benchmark vdevd.
+// build with -D_VDEV_OS_REPLAY (see bench/Makefile); it takes the place of the Linux back-end.
+#ifdef _VDEV_OS_REPLAY
+
+#include "vdev.h"
+
+#include <sys/sysmacros.h>
+
+// [vdev-OS] options 
+#define VDEV_REPLAY_EVENTS              "replay_events"         // path to the recorded uevents
+#define VDEV_REPLAY_RATE                "replay_rate"           // "max", "recorded", or events per second
+#define VDEV_REPLAY_MKNOD               "replay_mknod"          // "true" to have vdevd create device files
+#define VDEV_REPLAY_SYSFS               "replay_sysfs"          // what to pass to helpers as SYSFS_MOUNTPOINT
+
+#define VDEV_REPLAY_RATE_MAX_STR        "max"
+#define VDEV_REPLAY_RATE_RECORDED_STR   "recorded"
+
+#define VDEV_REPLAY_SYSFS_DEFAULT       "/sys"
+
+// udevadm monitor headers, i.e. "KERNEL[1234.567890] add /devices/... (block)" (udevd's are padded to line up)
+#define VDEV_REPLAY_KERNEL_HEADER       "KERNEL"
+#define VDEV_REPLAY_UDEV_HEADER         "UDEV"
+
+// how fast to replay 
+typedef enum {
+   VDEV_REPLAY_RATE_MAX = 0,            // as fast as vdevd will take them 
+   VDEV_REPLAY_RATE_RECORDED,           // with the recorded gaps between them 
+   VDEV_REPLAY_RATE_FIXED               // at a fixed rate
+} vdev_replay_rate_t;
+
+// a recorded uevent 
+struct vdev_replay_event {
+   
+   vdev_device_request_t type;
+   
+   // DEVNAME, without the leading /dev/, or NULL if not given
+   char* devname;
+   
+   // MAJOR/MINOR, as a device number and file type 
+   bool have_dev;
+   dev_t dev;
+   mode_t mode;
+   
+   // SEQNUM, or 0 if not given 
+   uint64_t seqnum;
+   
+   // when it was recorded, relative to the first event (0 if not known)
+   uint64_t offset_nanos;
+   
+   // every KEY=VALUE pair, as consecutive null-terminated keys and values 
+   char* params;
+   size_t num_params;
+};
+
+// replay back-end state 
+struct vdev_replay_context {
+   
+   // the recording, parsed up front 
+   struct vdev_replay_event* events;
+   size_t num_events;
+   
+   // next event to yield 
+   size_t next;
+   
+   vdev_replay_rate_t rate;
+   uint64_t events_per_sec;
+   
+   char* sysfs_mountpoint;
+   
+   // when the first event was yielded (CLOCK_MONOTONIC)
+   struct timespec start;
+   
+   // ref to OS context 
+   struct vdev_os_context* os_ctx;
+};
+
+C_LINKAGE_BEGIN
+
+int vdev_os_init( struct vdev_os_context* ctx, void** cls );
+int vdev_os_shutdown( void* cls );
+
+int vdev_os_next_device( struct vdev_device_request* request, void* cls );
+int vdev_os_update_filter( struct vdev_action** acts, size_t num_acts, void* cls );
+
+C_LINKAGE_END
+
+#endif
+#endif
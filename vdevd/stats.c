@@ -0,0 +1,654 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "stats.h"
+#include "vdev.h"
+#include "action.h"
+
+#include <poll.h>
+
+// names of the kinds and outcomes, as they appear in the statistics files 
+static char const* vdev_stats_kind_names[ VDEV_STATS_NUM_KINDS ] = { "sync", "async", "daemonlet" };
+static char const* vdev_stats_outcome_names[ VDEV_STATS_NUM_OUTCOMES ] = { "success", "failure" };
+
+
+// nanoseconds between two CLOCK_MONOTONIC samples 
+uint64_t vdev_stats_nanos( struct timespec const* start, struct timespec const* end ) {
+   
+   int64_t nanos = (int64_t)(end->tv_sec - start->tv_sec) * 1000000000LL + (int64_t)(end->tv_nsec - start->tv_nsec);
+   
+   if( nanos < 0 ) {
+      return 0;
+   }
+   
+   return (uint64_t)nanos;
+}
+
+
+// which bucket a latency goes into 
+static int vdev_histogram_bucket( uint64_t nanos ) {
+   
+   int b = 0;
+   
+   if( nanos < (1ULL << VDEV_HISTOGRAM_MIN_SHIFT) ) {
+      return 0;
+   }
+   
+   b = (63 - __builtin_clzll( nanos )) - VDEV_HISTOGRAM_MIN_SHIFT + 1;
+   if( b >= VDEV_HISTOGRAM_NUM_BUCKETS ) {
+      b = VDEV_HISTOGRAM_NUM_BUCKETS - 1;
+   }
+   
+   return b;
+}
+
+
+// record a latency.  The caller must hold whatever lock guards hist.
+// always succeeds
+int vdev_histogram_add( struct vdev_histogram* hist, uint64_t nanos ) {
+   
+   hist->buckets[ vdev_histogram_bucket( nanos ) ]++;
+   
+   hist->count++;
+   hist->sum_nanos += nanos;
+   
+   if( nanos > hist->max_nanos ) {
+      hist->max_nanos = nanos;
+   }
+   
+   return 0;
+}
+
+
+// add src's latencies to dest 
+// always succeeds
+int vdev_histogram_merge( struct vdev_histogram* dest, struct vdev_histogram const* src ) {
+   
+   for( int i = 0; i < VDEV_HISTOGRAM_NUM_BUCKETS; i++ ) {
+      dest->buckets[i] += src->buckets[i];
+   }
+   
+   dest->count += src->count;
+   dest->sum_nanos += src->sum_nanos;
+   
+   if( src->max_nanos > dest->max_nanos ) {
+      dest->max_nanos = src->max_nanos;
+   }
+   
+   return 0;
+}
+
+
+// estimate the q-th quantile (0 <= q <= 1) of the recorded latencies, in nanoseconds.
+// this is the upper bound of the bucket that holds it, so it over-estimates by less than 2x;
+// it is never more than the largest latency seen.
+// return 0 if nothing was recorded
+uint64_t vdev_histogram_quantile( struct vdev_histogram const* hist, double q ) {
+   
+   uint64_t rank = 0;
+   uint64_t seen = 0;
+   
+   if( hist->count == 0 ) {
+      return 0;
+   }
+   
+   // ceil( q * count ), without libm 
+   rank = (uint64_t)( q * (double)hist->count );
+   if( (double)rank < q * (double)hist->count ) {
+      rank++;
+   }
+   
+   if( rank < 1 ) {
+      rank = 1;
+   }
+   
+   for( int i = 0; i < VDEV_HISTOGRAM_NUM_BUCKETS - 1; i++ ) {
+      
+      seen += hist->buckets[i];
+      if( seen >= rank ) {
+         
+         uint64_t upper = 1ULL << (VDEV_HISTOGRAM_MIN_SHIFT + i);
+         return upper < hist->max_nanos ? upper : hist->max_nanos;
+      }
+   }
+   
+   return hist->max_nanos;
+}
+
+
+// write a histogram's summary in the text format, after its (already written) name
+static void vdev_stats_text_histogram( FILE* f, struct vdev_histogram const* hist ) {
+   
+   fprintf( f, " count=%" PRIu64 " sum_ns=%" PRIu64 " max_ns=%" PRIu64 " p50_ns=%" PRIu64 " p90_ns=%" PRIu64 " p99_ns=%" PRIu64 "\n",
+            hist->count, hist->sum_nanos, hist->max_nanos,
+            vdev_histogram_quantile( hist, 0.5 ), vdev_histogram_quantile( hist, 0.9 ), vdev_histogram_quantile( hist, 0.99 ) );
+}
+
+
+// write one action's latencies in the text format:
+// one line per kind and outcome that has been seen
+static void vdev_stats_write_text( FILE* f, char const* name, struct vdev_histogram latency[ VDEV_STATS_NUM_KINDS ][ VDEV_STATS_NUM_OUTCOMES ] ) {
+   
+   for( int k = 0; k < VDEV_STATS_NUM_KINDS; k++ ) {
+      for( int o = 0; o < VDEV_STATS_NUM_OUTCOMES; o++ ) {
+         
+         if( latency[k][o].count == 0 ) {
+            continue;
+         }
+         
+         fprintf( f, "%s %s %s", name, vdev_stats_kind_names[k], vdev_stats_outcome_names[o] );
+         vdev_stats_text_histogram( f, &latency[k][o] );
+      }
+   }
+}
+
+
+// write a Prometheus label value, escaped 
+static void vdev_stats_prom_label( FILE* f, char const* value ) {
+   
+   for( char const* p = value; *p != '\0'; p++ ) {
+      
+      if( *p == '\\' ) {
+         fputs( "\\\\", f );
+      }
+      else if( *p == '"' ) {
+         fputs( "\\\"", f );
+      }
+      else if( *p == '\n' ) {
+         fputs( "\\n", f );
+      }
+      else {
+         fputc( *p, f );
+      }
+   }
+}
+
+
+// write one sample's labels: the action's (if name is not NULL), and then "le" (if not NULL)
+static void vdev_stats_prom_labels( FILE* f, char const* name, int kind, int outcome, char const* le ) {
+   
+   if( name == NULL && le == NULL ) {
+      return;
+   }
+   
+   fputs( "{", f );
+   
+   if( name != NULL ) {
+      
+      fputs( "action=\"", f );
+      vdev_stats_prom_label( f, name );
+      fprintf( f, "\",kind=\"%s\",outcome=\"%s\"%s", vdev_stats_kind_names[kind], vdev_stats_outcome_names[outcome], le != NULL ? "," : "" );
+   }
+   
+   if( le != NULL ) {
+      fprintf( f, "le=\"%s\"", le );
+   }
+   
+   fputs( "}", f );
+}
+
+
+// write a histogram in the Prometheus text exposition format.
+// the action's labels are added if name is not NULL.
+static void vdev_stats_prom_histogram( FILE* f, char const* metric, char const* name, int kind, int outcome, struct vdev_histogram const* hist ) {
+   
+   char le[ 64 ];
+   uint64_t cumulative = 0;
+   
+   // buckets are cumulative; the last one is +Inf 
+   for( int i = 0; i < VDEV_HISTOGRAM_NUM_BUCKETS - 1; i++ ) {
+      
+      cumulative += hist->buckets[i];
+      
+      snprintf( le, sizeof(le), "%.13g", (double)(1ULL << (VDEV_HISTOGRAM_MIN_SHIFT + i)) / 1e9 );
+      
+      fprintf( f, "%s_bucket", metric );
+      vdev_stats_prom_labels( f, name, kind, outcome, le );
+      fprintf( f, " %" PRIu64 "\n", cumulative );
+   }
+   
+   fprintf( f, "%s_bucket", metric );
+   vdev_stats_prom_labels( f, name, kind, outcome, "+Inf" );
+   fprintf( f, " %" PRIu64 "\n", hist->count );
+   
+   fprintf( f, "%s_sum", metric );
+   vdev_stats_prom_labels( f, name, kind, outcome, NULL );
+   fprintf( f, " %.9f\n", (double)hist->sum_nanos / 1e9 );
+   
+   fprintf( f, "%s_count", metric );
+   vdev_stats_prom_labels( f, name, kind, outcome, NULL );
+   fprintf( f, " %" PRIu64 "\n", hist->count );
+}
+
+
+// write one action's latencies in the Prometheus text exposition format 
+static void vdev_stats_write_prom( FILE* f, char const* name, struct vdev_histogram latency[ VDEV_STATS_NUM_KINDS ][ VDEV_STATS_NUM_OUTCOMES ] ) {
+   
+   for( int k = 0; k < VDEV_STATS_NUM_KINDS; k++ ) {
+      for( int o = 0; o < VDEV_STATS_NUM_OUTCOMES; o++ ) {
+         
+         if( latency[k][o].count == 0 ) {
+            continue;
+         }
+         
+         vdev_stats_prom_histogram( f, "vdevd_action_latency_seconds", name, k, o, &latency[k][o] );
+      }
+   }
+}
+
+
+// open $mountpoint/metadata/$name.tmp for writing, and put its path in tmp_path (PATH_MAX bytes)
+// return NULL on failure
+static FILE* vdev_stats_open( struct vdev_state* state, char const* name, char* tmp_path ) {
+   
+   FILE* f = NULL;
+   
+   snprintf( tmp_path, PATH_MAX, "%s/" VDEV_METADATA_PREFIX "%s.tmp", state->mountpoint, name );
+   
+   f = fopen( tmp_path, "w" );
+   if( f == NULL ) {
+      
+      vdev_error("fopen('%s') errno = %d\n", tmp_path, -errno );
+   }
+   
+   return f;
+}
+
+
+// finish writing a statistics file, and move it into place 
+// return 0 on success
+// return -errno on failure
+static int vdev_stats_close( struct vdev_state* state, char const* name, char const* tmp_path, FILE* f ) {
+   
+   int rc = 0;
+   char path[ PATH_MAX + 1 ];
+   
+   if( ferror( f ) ) {
+      rc = -EIO;
+   }
+   
+   if( fclose( f ) != 0 && rc == 0 ) {
+      rc = -errno;
+   }
+   
+   if( rc != 0 ) {
+      
+      vdev_error("write('%s') rc = %d\n", tmp_path, rc );
+      unlink( tmp_path );
+      return rc;
+   }
+   
+   snprintf( path, PATH_MAX, "%s/" VDEV_METADATA_PREFIX "%s", state->mountpoint, name );
+   
+   rc = rename( tmp_path, path );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+      vdev_error("rename('%s', '%s') rc = %d\n", tmp_path, path, rc );
+      
+      unlink( tmp_path );
+   }
+   
+   return rc;
+}
+
+
+// write the current actions' latencies to $mountpoint/metadata/stats and $mountpoint/metadata/stats.prom.
+// readers always see a complete file.
+// return 0 on success
+// return -ENOMEM on OOM 
+// return -errno on failure to write either file
+int vdev_stats_write( struct vdev_state* state ) {
+   
+   int rc = 0;
+   int close_rc = 0;
+   struct vdev_snapshot* snapshot = NULL;
+   struct vdev_histogram latency[ VDEV_STATS_NUM_KINDS ][ VDEV_STATS_NUM_OUTCOMES ];
+   struct vdev_histogram queue_delay;
+   char text_tmp_path[ PATH_MAX + 1 ];
+   char prom_tmp_path[ PATH_MAX + 1 ];
+   FILE* text = NULL;
+   FILE* prom = NULL;
+   
+   text = vdev_stats_open( state, VDEV_STATS_FILE, text_tmp_path );
+   if( text == NULL ) {
+      return -errno;
+   }
+   
+   prom = vdev_stats_open( state, VDEV_STATS_PROMETHEUS_FILE, prom_tmp_path );
+   if( prom == NULL ) {
+      
+      rc = -errno;
+      
+      fclose( text );
+      unlink( text_tmp_path );
+      return rc;
+   }
+   
+   // how long device requests waited to be processed 
+   vdev_stats_get_queue_delay( &state->stats, &queue_delay );
+   
+   fputs( "# queue_delay count=N sum_ns=N max_ns=N p50_ns=N p90_ns=N p99_ns=N\n", text );
+   fputs( "queue_delay", text );
+   vdev_stats_text_histogram( text, &queue_delay );
+   
+   fputs( "# HELP vdevd_queue_delay_seconds Time device requests waited in the workqueue.\n", prom );
+   fputs( "# TYPE vdevd_queue_delay_seconds histogram\n", prom );
+   vdev_stats_prom_histogram( prom, "vdevd_queue_delay_seconds", NULL, 0, 0, &queue_delay );
+   
+   // how long each action took
+   fputs( "# action kind outcome count=N sum_ns=N max_ns=N p50_ns=N p90_ns=N p99_ns=N\n", text );
+   
+   fputs( "# HELP vdevd_action_latency_seconds Time taken to run an action's command.\n", prom );
+   fputs( "# TYPE vdevd_action_latency_seconds histogram\n", prom );
+   
+   snapshot = vdev_snapshot_pin( state );
+   
+   for( size_t i = 0; i < snapshot->num_acts; i++ ) {
+      
+      struct vdev_action* act = snapshot->acts[i];
+      
+      // copy, so we don't hold up device workers while formatting 
+      pthread_mutex_lock( &act->lock );
+      
+      memcpy( latency, act->latency, sizeof(latency) );
+      
+      pthread_mutex_unlock( &act->lock );
+      
+      vdev_stats_write_text( text, act->name, latency );
+      vdev_stats_write_prom( prom, act->name, latency );
+   }
+   
+   vdev_snapshot_release( state, snapshot );
+   
+   rc = vdev_stats_close( state, VDEV_STATS_FILE, text_tmp_path, text );
+   
+   close_rc = vdev_stats_close( state, VDEV_STATS_PROMETHEUS_FILE, prom_tmp_path, prom );
+   if( rc == 0 ) {
+      rc = close_rc;
+   }
+   
+   return rc;
+}
+
+
+// statistics thread main loop: rewrite the statistics files every interval seconds, and whenever asked 
+static void* vdev_stats_main( void* arg ) {
+   
+   struct vdev_stats* stats = (struct vdev_stats*)arg;
+   struct pollfd pfd;
+   char buf[ 64 ];
+   ssize_t nr = 0;
+   bool refresh = false;
+   bool dump_trace = false;
+   int rc = 0;
+   sigset_t sigs;
+   
+   // signals are for the main thread 
+   sigemptyset( &sigs );
+   sigaddset( &sigs, SIGHUP );
+   sigaddset( &sigs, SIGUSR1 );
+   sigaddset( &sigs, SIGUSR2 );
+   pthread_sigmask( SIG_BLOCK, &sigs, NULL );
+   
+   memset( &pfd, 0, sizeof(pfd) );
+   pfd.fd = stats->wakeup_pipe[0];
+   pfd.events = POLLIN;
+   
+   while( stats->running ) {
+      
+      rc = poll( &pfd, 1, stats->interval > 0 ? stats->interval * 1000 : -1 );
+      if( rc < 0 ) {
+         
+         rc = -errno;
+         if( rc == -EINTR ) {
+            continue;
+         }
+         
+         vdev_error("poll rc = %d\n", rc );
+         break;
+      }
+      
+      // refresh on timeout, and on request 
+      refresh = (rc == 0);
+      dump_trace = false;
+      
+      if( rc > 0 ) {
+         
+         // drain requests; several of the same kind coalesce into one 
+         while( (nr = read( stats->wakeup_pipe[0], buf, sizeof(buf) )) > 0 ) {
+            
+            for( ssize_t i = 0; i < nr; i++ ) {
+               
+               if( buf[i] == VDEV_STATS_REQUEST_TRACE ) {
+                  dump_trace = true;
+               }
+               else {
+                  refresh = true;
+               }
+            }
+         }
+      }
+      
+      if( !stats->running ) {
+         break;
+      }
+      
+      if( refresh ) {
+         
+         rc = vdev_stats_write( stats->state );
+         if( rc != 0 ) {
+            
+            vdev_error("vdev_stats_write rc = %d\n", rc );
+         }
+      }
+      
+      if( dump_trace ) {
+         
+         char path[ PATH_MAX + 1 ];
+         
+         snprintf( path, PATH_MAX, "%s/" VDEV_METADATA_PREFIX VDEV_TRACE_FILE, stats->state->mountpoint );
+         
+         rc = vdev_trace_dump( &stats->state->trace, path );
+         if( rc == -EINVAL ) {
+            
+            vdev_warn("%s", "Event tracing is off; set trace_buffer in the config file to turn it on\n");
+         }
+         else if( rc != 0 ) {
+            
+            vdev_error("vdev_trace_dump('%s') rc = %d\n", path, rc );
+         }
+      }
+   }
+   
+   return NULL;
+}
+
+
+// set up the statistics thread 
+// return 0 on success
+// return -errno on failure to create the wakeup pipe
+int vdev_stats_init( struct vdev_stats* stats, struct vdev_state* state, int interval ) {
+   
+   int rc = 0;
+   
+   memset( stats, 0, sizeof(struct vdev_stats) );
+   
+   rc = pipe( stats->wakeup_pipe );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+      vdev_error("pipe rc = %d\n", rc );
+      
+      stats->wakeup_pipe[0] = -1;
+      stats->wakeup_pipe[1] = -1;
+      return rc;
+   }
+   
+   // don't leak these into helpers, and never block the signal handler or the reader 
+   for( int i = 0; i < 2; i++ ) {
+      
+      fcntl( stats->wakeup_pipe[i], F_SETFD, FD_CLOEXEC );
+      fcntl( stats->wakeup_pipe[i], F_SETFL, fcntl( stats->wakeup_pipe[i], F_GETFL ) | O_NONBLOCK );
+   }
+   
+   pthread_mutex_init( &stats->lock, NULL );
+   
+   stats->state = state;
+   stats->interval = interval;
+   
+   return 0;
+}
+
+
+// start the statistics thread 
+// return 0 on success
+// return -errno on failure to create the thread
+int vdev_stats_start( struct vdev_stats* stats ) {
+   
+   int rc = 0;
+   
+   stats->running = true;
+   
+   rc = pthread_create( &stats->thread, NULL, vdev_stats_main, stats );
+   if( rc != 0 ) {
+      
+      stats->running = false;
+      vdev_error("pthread_create rc = %d\n", rc );
+      return -rc;
+   }
+   
+   return 0;
+}
+
+
+// send a request to the statistics thread.
+// async-signal-safe, so it can be called from a signal handler.
+// return 0 on success 
+// return -EINVAL if the thread is not set up
+static int vdev_stats_request( struct vdev_stats* stats, char request ) {
+   
+   int errsv = errno;
+   
+   if( stats->wakeup_pipe[1] <= 0 ) {
+      return -EINVAL;
+   }
+   
+   // if the pipe is full, there's already plenty for the thread to do
+   write( stats->wakeup_pipe[1], &request, 1 );
+   
+   errno = errsv;
+   return 0;
+}
+
+
+// ask the statistics thread to rewrite the statistics files.
+// async-signal-safe.
+// return 0 on success 
+// return -EINVAL if the thread is not set up
+int vdev_stats_refresh( struct vdev_stats* stats ) {
+   
+   return vdev_stats_request( stats, VDEV_STATS_REQUEST_REFRESH );
+}
+
+
+// ask the statistics thread to dump the event trace to $mountpoint/metadata/trace.json.
+// async-signal-safe.
+// return 0 on success 
+// return -EINVAL if the thread is not set up
+int vdev_stats_dump_trace( struct vdev_stats* stats ) {
+   
+   return vdev_stats_request( stats, VDEV_STATS_REQUEST_TRACE );
+}
+
+
+// stop the statistics thread, and join with it 
+// return 0 on success 
+// return -EINVAL if not running
+int vdev_stats_stop( struct vdev_stats* stats ) {
+   
+   if( !stats->running ) {
+      return -EINVAL;
+   }
+   
+   stats->running = false;
+   vdev_stats_refresh( stats );
+   
+   pthread_join( stats->thread, NULL );
+   return 0;
+}
+
+
+// free a stopped statistics thread's state 
+// always succeeds
+int vdev_stats_free( struct vdev_stats* stats ) {
+   
+   if( stats->wakeup_pipe[0] > 0 ) {
+      
+      close( stats->wakeup_pipe[0] );
+      close( stats->wakeup_pipe[1] );
+      
+      pthread_mutex_destroy( &stats->lock );
+   }
+   
+   stats->wakeup_pipe[0] = -1;
+   stats->wakeup_pipe[1] = -1;
+   
+   return 0;
+}
+
+
+// record how long a device request waited in the workqueue 
+// always succeeds
+int vdev_stats_add_queue_delay( struct vdev_stats* stats, uint64_t nanos ) {
+   
+   if( stats->wakeup_pipe[0] <= 0 ) {
+      
+      // not set up 
+      return 0;
+   }
+   
+   pthread_mutex_lock( &stats->lock );
+   
+   vdev_histogram_add( &stats->queue_delay, nanos );
+   
+   pthread_mutex_unlock( &stats->lock );
+   return 0;
+}
+
+
+// get a copy of the queue delay histogram 
+// always succeeds
+int vdev_stats_get_queue_delay( struct vdev_stats* stats, struct vdev_histogram* queue_delay ) {
+   
+   memset( queue_delay, 0, sizeof(struct vdev_histogram) );
+   
+   if( stats->wakeup_pipe[0] <= 0 ) {
+      return 0;
+   }
+   
+   pthread_mutex_lock( &stats->lock );
+   
+   memcpy( queue_delay, &stats->queue_delay, sizeof(struct vdev_histogram) );
+   
+   pthread_mutex_unlock( &stats->lock );
+   return 0;
+}
@@ -0,0 +1,108 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _VDEV_STATS_H_
+#define _VDEV_STATS_H_
+
+#include "libvdev/util.h"
+
+#include <inttypes.h>
+
+// latency histogram buckets are powers of two, in nanoseconds.
+// bucket i counts latencies under 2^(VDEV_HISTOGRAM_MIN_SHIFT + i) ns that no lower bucket counts;
+// the last bucket counts everything else.
+#define VDEV_HISTOGRAM_MIN_SHIFT        10              // about 1 microsecond
+#define VDEV_HISTOGRAM_NUM_BUCKETS      32              // the last bucket starts at about 18 minutes
+
+// how an action's command ran 
+#define VDEV_STATS_SYNC                 0               // subprocess that vdevd waited for
+#define VDEV_STATS_ASYNC                1               // subprocess that vdevd did not wait for (time to start it)
+#define VDEV_STATS_DAEMONLET            2               // daemonlet request, until its reply
+#define VDEV_STATS_NUM_KINDS            3
+
+// how it went 
+#define VDEV_STATS_SUCCESS              0
+#define VDEV_STATS_FAILURE              1
+#define VDEV_STATS_NUM_OUTCOMES         2
+
+// statistics files, under $mountpoint/metadata/
+#define VDEV_STATS_FILE                 "stats"
+#define VDEV_STATS_PROMETHEUS_FILE      "stats.prom"
+
+// requests to the statistics thread, written to its wakeup pipe 
+#define VDEV_STATS_REQUEST_REFRESH      'r'             // rewrite the statistics files
+#define VDEV_STATS_REQUEST_TRACE        't'             // dump the event trace
+
+// log-bucketed latency histogram 
+struct vdev_histogram {
+   
+   uint64_t buckets[ VDEV_HISTOGRAM_NUM_BUCKETS ];
+   
+   uint64_t count;
+   uint64_t sum_nanos;
+   uint64_t max_nanos;
+};
+
+struct vdev_state;
+
+// statistics writer thread: refreshes the statistics files periodically, and on request.
+// it also dumps the event trace on request, so that happens outside of signal context too.
+struct vdev_stats {
+   
+   struct vdev_state* state;
+   
+   // seconds between refreshes (0 to refresh only on request)
+   int interval;
+   
+   // written to in order to request a refresh, or to wake up the thread when stopping
+   int wakeup_pipe[2];
+   
+   pthread_t thread;
+   volatile bool running;
+   
+   // how long device requests waited in the workqueue (covered by lock)
+   struct vdev_histogram queue_delay;
+   pthread_mutex_t lock;
+};
+
+C_LINKAGE_BEGIN
+
+uint64_t vdev_stats_nanos( struct timespec const* start, struct timespec const* end );
+
+int vdev_histogram_add( struct vdev_histogram* hist, uint64_t nanos );
+int vdev_histogram_merge( struct vdev_histogram* dest, struct vdev_histogram const* src );
+uint64_t vdev_histogram_quantile( struct vdev_histogram const* hist, double q );
+
+int vdev_stats_init( struct vdev_stats* stats, struct vdev_state* state, int interval );
+int vdev_stats_start( struct vdev_stats* stats );
+int vdev_stats_stop( struct vdev_stats* stats );
+int vdev_stats_free( struct vdev_stats* stats );
+
+int vdev_stats_refresh( struct vdev_stats* stats );
+int vdev_stats_dump_trace( struct vdev_stats* stats );
+int vdev_stats_write( struct vdev_state* state );
+
+int vdev_stats_add_queue_delay( struct vdev_stats* stats, uint64_t nanos );
+int vdev_stats_get_queue_delay( struct vdev_stats* stats, struct vdev_histogram* queue_delay );
+
+C_LINKAGE_END
+
+#endif
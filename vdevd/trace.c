@@ -0,0 +1,372 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifdef _VDEV_OS_LINUX
+// for syscall(2)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "trace.h"
+
+#ifdef _VDEV_OS_LINUX
+#include <sys/syscall.h>
+#endif
+
+// names of the stages, as they appear in the trace file 
+static char const* vdev_trace_stage_names[ VDEV_TRACE_NUM_STAGES ] = {
+   "netlink",
+   "parse",
+   "enqueue",
+   "queued",
+   "request",
+   "create_path",
+   "mknod",
+   "metadata",
+   "action",
+   "reply"
+};
+
+
+// set up a trace buffer that holds the last capacity spans (rounded up to a power of two).
+// a capacity of 0 turns tracing off.
+// return 0 on success
+// return -ENOMEM on OOM
+int vdev_trace_init( struct vdev_trace* trace, uint64_t capacity ) {
+   
+   uint64_t rounded = 1;
+   
+   memset( trace, 0, sizeof(struct vdev_trace) );
+   
+   trace->next_id = VDEV_TRACE_SYNTHETIC_ID_BASE;
+   
+   if( capacity == 0 ) {
+      return 0;
+   }
+   
+   while( rounded < capacity ) {
+      rounded <<= 1;
+   }
+   
+   trace->spans = VDEV_CALLOC( struct vdev_trace_span, rounded );
+   if( trace->spans == NULL ) {
+      return -ENOMEM;
+   }
+   
+   trace->capacity = rounded;
+   
+   return 0;
+}
+
+
+// free a trace buffer 
+// always succeeds
+int vdev_trace_free( struct vdev_trace* trace ) {
+   
+   if( trace->spans != NULL ) {
+      
+      free( trace->spans );
+      trace->spans = NULL;
+   }
+   
+   trace->capacity = 0;
+   return 0;
+}
+
+
+// is tracing on?
+bool vdev_trace_enabled( struct vdev_trace* trace ) {
+   
+   return trace->spans != NULL;
+}
+
+
+// get an ID for an event that did not come with one 
+uint64_t vdev_trace_synthetic_id( struct vdev_trace* trace ) {
+   
+   return __sync_fetch_and_add( &trace->next_id, 1 );
+}
+
+
+// nanoseconds since CLOCK_MONOTONIC's epoch 
+static uint64_t vdev_trace_nanos( struct timespec const* ts ) {
+   
+   return (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
+}
+
+
+// calling thread's ID 
+static pid_t vdev_trace_gettid(void) {
+   
+#ifdef _VDEV_OS_LINUX
+   return (pid_t)syscall( SYS_gettid );
+#else
+   return getpid();
+#endif
+}
+
+
+// record that an event spent [start, end] in a stage.  name is the action name, if the stage has one.
+// overwrites the oldest span once the buffer is full.  Never blocks.
+// return 0 on success (including if tracing is off)
+int vdev_trace_record( struct vdev_trace* trace, uint64_t id, int stage, char const* name, struct timespec const* start, struct timespec const* end ) {
+   
+   uint64_t idx = 0;
+   struct vdev_trace_span* span = NULL;
+   
+   if( trace == NULL || trace->spans == NULL ) {
+      return 0;
+   }
+   
+   idx = __sync_fetch_and_add( &trace->next, 1 );
+   span = &trace->spans[ idx & (trace->capacity - 1) ];
+   
+   // readers must not trust this slot until we're done with it
+   span->stamp = 0;
+   __sync_synchronize();
+   
+   span->id = id;
+   span->start_nanos = vdev_trace_nanos( start );
+   span->end_nanos = vdev_trace_nanos( end );
+   span->stage = stage;
+   span->tid = vdev_trace_gettid();
+   
+   if( name != NULL ) {
+      
+      strncpy( span->name, name, VDEV_TRACE_NAME_MAX - 1 );
+      span->name[ VDEV_TRACE_NAME_MAX - 1 ] = '\0';
+   }
+   else {
+      
+      span->name[0] = '\0';
+   }
+   
+   __sync_synchronize();
+   span->stamp = idx + 1;
+   
+   return 0;
+}
+
+
+// order spans by event, and then by start time 
+static int vdev_trace_span_cmp( void const* a, void const* b ) {
+   
+   struct vdev_trace_span const* s1 = (struct vdev_trace_span const*)a;
+   struct vdev_trace_span const* s2 = (struct vdev_trace_span const*)b;
+   
+   if( s1->id != s2->id ) {
+      return s1->id < s2->id ? -1 : 1;
+   }
+   
+   if( s1->start_nanos != s2->start_nanos ) {
+      return s1->start_nanos < s2->start_nanos ? -1 : 1;
+   }
+   
+   return s1->stage - s2->stage;
+}
+
+
+// copy out the spans currently in the buffer, skipping any that get overwritten while we copy.
+// return 0 on success, and set *ret_spans (malloc'ed) and *ret_num_spans 
+// return -ENOMEM on OOM
+static int vdev_trace_snapshot( struct vdev_trace* trace, struct vdev_trace_span** ret_spans, size_t* ret_num_spans ) {
+   
+   uint64_t last = trace->next;
+   uint64_t first = last > trace->capacity ? last - trace->capacity : 0;
+   struct vdev_trace_span* spans = NULL;
+   size_t num_spans = 0;
+   
+   spans = VDEV_CALLOC( struct vdev_trace_span, (last - first) + 1 );
+   if( spans == NULL ) {
+      return -ENOMEM;
+   }
+   
+   for( uint64_t i = first; i < last; i++ ) {
+      
+      struct vdev_trace_span* span = &trace->spans[ i & (trace->capacity - 1) ];
+      uint64_t stamp = span->stamp;
+      
+      if( stamp != i + 1 ) {
+         
+         // still being written, or already overwritten
+         continue;
+      }
+      
+      __sync_synchronize();
+      memcpy( &spans[ num_spans ], span, sizeof(struct vdev_trace_span) );
+      __sync_synchronize();
+      
+      if( span->stamp != stamp ) {
+         
+         // overwritten while we copied it 
+         continue;
+      }
+      
+      num_spans++;
+   }
+   
+   *ret_spans = spans;
+   *ret_num_spans = num_spans;
+   
+   return 0;
+}
+
+
+// write a string as a JSON string literal 
+static void vdev_trace_json_string( FILE* f, char const* str ) {
+   
+   fputc( '"', f );
+   
+   for( char const* p = str; *p != '\0'; p++ ) {
+      
+      if( *p == '"' || *p == '\\' ) {
+         fprintf( f, "\\%c", *p );
+      }
+      else if( (unsigned char)*p < 0x20 ) {
+         fprintf( f, "\\u%04x", (unsigned char)*p );
+      }
+      else {
+         fputc( *p, f );
+      }
+   }
+   
+   fputc( '"', f );
+}
+
+
+// write the spans as Chrome trace-event JSON (load it in chrome://tracing or Perfetto).
+// each event gets its own row, named by its SEQNUM, with a slice per stage.
+static void vdev_trace_write_json( FILE* f, struct vdev_trace_span* spans, size_t num_spans ) {
+   
+   pid_t pid = getpid();
+   bool first = true;
+   
+   fputs( "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f );
+   
+   for( size_t i = 0; i < num_spans; i++ ) {
+      
+      struct vdev_trace_span* span = &spans[i];
+      
+      if( i == 0 || spans[i-1].id != span->id ) {
+         
+         // name this event's row 
+         if( span->id >= VDEV_TRACE_SYNTHETIC_ID_BASE ) {
+            fprintf( f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%" PRIu64 ",\"args\":{\"name\":\"event %" PRIu64 "\"}}", first ? "" : ",\n", (int)pid, span->id, (uint64_t)(span->id - VDEV_TRACE_SYNTHETIC_ID_BASE) );
+         }
+         else {
+            fprintf( f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%" PRIu64 ",\"args\":{\"name\":\"SEQNUM %" PRIu64 "\"}}", first ? "" : ",\n", (int)pid, span->id, span->id );
+         }
+         
+         first = false;
+      }
+      
+      fputs( ",\n{\"name\":", f );
+      vdev_trace_json_string( f, span->name[0] != '\0' ? span->name : vdev_trace_stage_names[ span->stage ] );
+      
+      fprintf( f, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%" PRIu64 ".%03u,\"dur\":%" PRIu64 ".%03u,\"pid\":%d,\"tid\":%" PRIu64 ",\"args\":{\"thread\":%d}}",
+               vdev_trace_stage_names[ span->stage ],
+               span->start_nanos / 1000, (unsigned int)(span->start_nanos % 1000),
+               (span->end_nanos - span->start_nanos) / 1000, (unsigned int)((span->end_nanos - span->start_nanos) % 1000),
+               (int)pid, span->id, (int)span->tid );
+   }
+   
+   fputs( "\n]}\n", f );
+}
+
+
+// dump the buffered spans to path as Chrome trace-event JSON.
+// the file is replaced atomically, so it can be read at any time.
+// return 0 on success
+// return -EINVAL if tracing is off
+// return -ENOMEM on OOM 
+// return -errno on failure to write the file
+int vdev_trace_dump( struct vdev_trace* trace, char const* path ) {
+   
+   int rc = 0;
+   struct vdev_trace_span* spans = NULL;
+   size_t num_spans = 0;
+   char* tmp_path = NULL;
+   FILE* f = NULL;
+   
+   if( trace->spans == NULL ) {
+      return -EINVAL;
+   }
+   
+   rc = vdev_trace_snapshot( trace, &spans, &num_spans );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   qsort( spans, num_spans, sizeof(struct vdev_trace_span), vdev_trace_span_cmp );
+   
+   tmp_path = VDEV_CALLOC( char, strlen(path) + 5 );
+   if( tmp_path == NULL ) {
+      
+      free( spans );
+      return -ENOMEM;
+   }
+   
+   sprintf( tmp_path, "%s.tmp", path );
+   
+   f = fopen( tmp_path, "w" );
+   if( f == NULL ) {
+      
+      rc = -errno;
+      vdev_error("fopen('%s') rc = %d\n", tmp_path, rc );
+      
+      free( spans );
+      free( tmp_path );
+      return rc;
+   }
+   
+   vdev_trace_write_json( f, spans, num_spans );
+   free( spans );
+   
+   if( ferror( f ) ) {
+      rc = -EIO;
+   }
+   
+   if( fclose( f ) != 0 && rc == 0 ) {
+      rc = -errno;
+   }
+   
+   if( rc == 0 ) {
+      
+      rc = rename( tmp_path, path );
+      if( rc != 0 ) {
+         
+         rc = -errno;
+         vdev_error("rename('%s', '%s') rc = %d\n", tmp_path, path, rc );
+      }
+   }
+   else {
+      
+      vdev_error("write('%s') rc = %d\n", tmp_path, rc );
+   }
+   
+   if( rc != 0 ) {
+      unlink( tmp_path );
+   }
+   
+   free( tmp_path );
+   return rc;
+}
@@ -0,0 +1,105 @@
+/*
+   vdev: a virtual device manager for *nix
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.GPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _VDEV_TRACE_H_
+#define _VDEV_TRACE_H_
+
+#include "libvdev/util.h"
+
+#include <inttypes.h>
+
+// stages of processing a device event.
+// a span records when one stage started and ended for one event.
+#define VDEV_TRACE_NETLINK              0               // received from the kernel, waiting to be parsed
+#define VDEV_TRACE_PARSE                1               // parsing the uevent into a device request
+#define VDEV_TRACE_ENQUEUE              2               // deciding how to schedule it, and queueing it 
+#define VDEV_TRACE_QUEUED               3               // waiting in the workqueue (including any debounce)
+#define VDEV_TRACE_REQUEST              4               // processing it, from dequeue to completion
+#define VDEV_TRACE_CREATE_PATH          5               // running rename commands to find the device path
+#define VDEV_TRACE_MKNOD                6               // creating (or removing) the device file and its directories 
+#define VDEV_TRACE_METADATA             7               // writing (or removing) the device's metadata
+#define VDEV_TRACE_ACTION               8               // running one action's command 
+#define VDEV_TRACE_REPLY                9               // waiting for an asynchronous daemonlet's reply
+#define VDEV_TRACE_NUM_STAGES           10
+
+// longest action name kept in a span (longer ones are truncated)
+#define VDEV_TRACE_NAME_MAX             32
+
+// events that did not come with a kernel SEQNUM get IDs from here up, so the two never collide
+#define VDEV_TRACE_SYNTHETIC_ID_BASE    (1ULL << 48)
+
+// trace file, under $mountpoint/metadata/
+#define VDEV_TRACE_FILE                 "trace.json"
+
+// one recorded span 
+struct vdev_trace_span {
+   
+   // 0 while the span is being written; otherwise, 1 + the number of spans recorded before it.
+   // a reader uses this to skip spans that are overwritten while it copies them.
+   volatile uint64_t stamp;
+   
+   // event ID (the kernel SEQNUM, or a synthetic one)
+   uint64_t id;
+   
+   // CLOCK_MONOTONIC, in nanoseconds 
+   uint64_t start_nanos;
+   uint64_t end_nanos;
+   
+   // which stage, and which thread did it
+   int stage;
+   pid_t tid;
+   
+   // action name, for VDEV_TRACE_ACTION and VDEV_TRACE_REPLY spans 
+   char name[ VDEV_TRACE_NAME_MAX ];
+};
+
+// ring buffer of the most recent spans.
+// any number of threads can record spans at once without taking a lock.
+struct vdev_trace {
+   
+   // NULL if tracing is off
+   struct vdev_trace_span* spans;
+   
+   // always a power of two
+   uint64_t capacity;
+   
+   // number of spans ever recorded (updated atomically)
+   volatile uint64_t next;
+   
+   // next synthetic event ID (updated atomically)
+   volatile uint64_t next_id;
+};
+
+C_LINKAGE_BEGIN
+
+int vdev_trace_init( struct vdev_trace* trace, uint64_t capacity );
+int vdev_trace_free( struct vdev_trace* trace );
+
+bool vdev_trace_enabled( struct vdev_trace* trace );
+uint64_t vdev_trace_synthetic_id( struct vdev_trace* trace );
+
+int vdev_trace_record( struct vdev_trace* trace, uint64_t id, int stage, char const* name, struct timespec const* start, struct timespec const* end );
+
+int vdev_trace_dump( struct vdev_trace* trace, char const* path );
+
+C_LINKAGE_END
+
+#endif
@@ -21,10 +21,19 @@
 
 #include "vdev.h"
 #include "action.h"
+#include "actcache.h"
 #include "libvdev/config.h"
 
+#include <poll.h>
+
+#ifdef _VDEV_OS_LINUX
+#include <sys/inotify.h>
+#endif
+
 SGLIB_DEFINE_VECTOR_FUNCTIONS( cstr );
 
+static int vdev_snapshot_free_retired( struct vdev_state* vdev );
+
 
 // context for removing unplugged device 
 struct vdev_device_unplug_context {
@@ -37,11 +46,20 @@ struct vdev_device_unplug_context {
 // instance_str must be at least VDEV_CONFIG_INSTANCE_NONCE_STRLEN bytes
 // return 0 on success
 // return -errno on failure to stat, open, or read
-static int vdev_device_read_vdevd_instance( char const* mountpoint, char const* dev_fullpath, char* instance_str ) {
+static int vdev_device_read_vdevd_instance( struct vdev_state* state, char const* dev_fullpath, char* instance_str ) {
    
    int rc = 0;
+   char const* mountpoint = state->mountpoint;
    char const* devpath = dev_fullpath + strlen(mountpoint);
    
+   // look in its record first 
+   rc = vdev_device_record_get( state->records_fd, devpath, VDEV_METADATA_PARAM_INSTANCE, instance_str, VDEV_CONFIG_INSTANCE_NONCE_STRLEN );
+   if( rc != -ENOENT ) {
+      
+      return rc;
+   }
+   
+   // no record, so an older vdevd (or a helper) made it.  Look in its metadata directory.
    char* instance_attr_relpath = vdev_fullpath( VDEV_METADATA_PREFIX "/dev", devpath, NULL );
    if( instance_attr_relpath == NULL ) {
       
@@ -93,6 +111,7 @@ static int vdev_remove_unplugged_device( char const* path, void* cls ) {
    struct stat sb;
    char instance_str[ VDEV_CONFIG_INSTANCE_NONCE_STRLEN + 1 ];
    char basename[ NAME_MAX+1 ];
+   char const* relpath = NULL;
    
    memset( instance_str, 0, VDEV_CONFIG_INSTANCE_NONCE_STRLEN + 1 );
    
@@ -115,10 +134,14 @@ static int vdev_remove_unplugged_device( char const* path, void* cls ) {
       return 0;
    }
    
-   // what is this?
-   rc = lstat( path, &sb );
+   // what is this?  (stat it relative to the mountpoint, which we already have open)
+   relpath = path + strlen( state->mountpoint );
+   relpath += strspn( relpath, "/" );
+   
+   rc = fstatat( state->mountpoint_fd, relpath, &sb, AT_SYMLINK_NOFOLLOW );
    if( rc != 0 ) {
       
+      rc = -errno;
       vdev_error("stat('%s') rc = %d\n", path, rc );
       
       // mask
@@ -150,7 +173,7 @@ static int vdev_remove_unplugged_device( char const* path, void* cls ) {
    if( S_ISBLK( sb.st_mode ) || S_ISCHR( sb.st_mode ) ) {
       
       // what's the instance value?
-      rc = vdev_device_read_vdevd_instance( state->config->mountpoint, path, instance_str );
+      rc = vdev_device_read_vdevd_instance( state, path, instance_str );
       if( rc != 0 ) {
          
          vdev_error("vdev_device_read_vdevd_instance('%s') rc = %d\n", path, rc );
@@ -160,14 +183,14 @@ static int vdev_remove_unplugged_device( char const* path, void* cls ) {
       }
       
       // does it match ours?
-      if( strcmp( state->config->instance_str, instance_str ) != 0 ) {
+      if( strcmp( state->snapshot->config->instance_str, instance_str ) != 0 ) {
 
          struct vdev_device_request* to_delete = NULL;
          char const* device_path = NULL;
          
          vdev_debug("Remove unplugged device '%s'\n", path );
          
-         device_path = path + strlen( state->config->mountpoint );
+         device_path = path + strlen( state->snapshot->config->mountpoint );
          
          to_delete = VDEV_CALLOC( struct vdev_device_request, 1 );
          if( to_delete == NULL ) {
@@ -208,7 +231,7 @@ int vdev_remove_unplugged_devices( struct vdev_state* state ) {
    
    int rc = 0;
    struct sglib_cstr_vector device_paths;
-   char* devroot = vdev_strdup_or_null( state->config->mountpoint );
+   char* devroot = vdev_strdup_or_null( state->snapshot->config->mountpoint );
    char* next_dir = NULL;
    size_t next_dir_index = 0;
    struct stat sb;
@@ -407,7 +430,7 @@ int vdev_error_thread_start( struct vdev_state* vdev ) {
    int rc = 0;
    pthread_attr_t attrs;
 
-   rc = vdev_error_fifo_get_or_create( vdev->config->mountpoint, &vdev->error_fd );
+   rc = vdev_error_fifo_get_or_create( vdev->snapshot->config->mountpoint, &vdev->error_fd );
    if( rc < 0 ) {
 
       vdev_error("vdev_error_fifo_get_or_create: %s\n", strerror(-rc) );
@@ -471,6 +494,303 @@ int vdev_error_thread_stop( struct vdev_state* vdev ) {
 }
 
 
+// how long acts_dir must stay quiet before we reload it, so that 
+// a burst of changes (i.e. a package upgrade) causes only one reload
+#define VDEV_WATCH_SETTLE_MILLIS 100
+
+// reload thread: do the reloads SIGHUP asks for, and (on Linux) wait for acts_dir to change, 
+// wait for it to settle, and reload the changed actions.
+// this is the only thread that publishes snapshots while vdevd is running, and it frees the ones that get released.
+static void* vdev_watch_thread_main( void* arg ) {
+   
+   struct vdev_state* vdev = (struct vdev_state*)arg;
+   struct pollfd pfds[2];
+   char requests[ 64 ];
+   bool changed = false;
+   bool reload = false;
+   bool stop = false;
+   ssize_t nr = 0;
+   int nready = 0;
+   int rc = 0;
+   sigset_t sigs;
+   
+#ifdef _VDEV_OS_LINUX
+   char buf[ 4096 ] __attribute__((aligned(__alignof__(struct inotify_event))));
+#endif
+   
+   // signals are for the main thread 
+   sigemptyset( &sigs );
+   sigaddset( &sigs, SIGHUP );
+   sigaddset( &sigs, SIGUSR1 );
+   sigaddset( &sigs, SIGUSR2 );
+   pthread_sigmask( SIG_BLOCK, &sigs, NULL );
+   
+   memset( pfds, 0, sizeof(pfds) );
+   
+   // poll() ignores the watch fd if we couldn't get one 
+   pfds[0].fd = vdev->watch_fd;
+   pfds[0].events = POLLIN;
+   
+   pfds[1].fd = vdev->watch_wakeup_pipe[0];
+   pfds[1].events = POLLIN;
+   
+   while( !stop ) {
+      
+      nready = poll( pfds, 2, changed ? VDEV_WATCH_SETTLE_MILLIS : -1 );
+      if( nready < 0 ) {
+         
+         rc = -errno;
+         if( rc == -EINTR ) {
+            continue;
+         }
+         
+         vdev_error("poll: %s\n", strerror(-rc) );
+         break;
+      }
+      
+      if( pfds[1].revents != 0 ) {
+         
+         // drain requests; several reloads coalesce into one 
+         while( (nr = read( vdev->watch_wakeup_pipe[0], requests, sizeof(requests) )) > 0 ) {
+            
+            for( ssize_t i = 0; i < nr; i++ ) {
+               
+               if( requests[i] == VDEV_WATCH_REQUEST_STOP ) {
+                  stop = true;
+               }
+               else if( requests[i] == VDEV_WATCH_REQUEST_RELOAD ) {
+                  reload = true;
+               }
+            }
+         }
+         
+         if( stop ) {
+            break;
+         }
+         
+         // free snapshots that device workers released 
+         vdev_snapshot_free_retired( vdev );
+         
+         if( reload ) {
+            
+            reload = false;
+            
+            rc = vdev_reload( vdev );
+            if( rc != 0 ) {
+               
+               vdev_error("vdev_reload rc = %d\n", rc );
+            }
+         }
+      }
+      
+      if( nready == 0 && changed ) {
+         
+         // quiet for long enough.
+         // which files changed does not matter; the unchanged ones will get reused
+         changed = false;
+         
+         rc = vdev_reload_actions( vdev );
+         if( rc != 0 ) {
+            
+            // keep the actions we have, and try again on the next change 
+            vdev_error("vdev_reload_actions rc = %d\n", rc );
+         }
+         
+         continue;
+      }
+      
+#ifdef _VDEV_OS_LINUX
+      if( pfds[0].revents != 0 ) {
+         
+         // drain the events 
+         nr = read( vdev->watch_fd, buf, sizeof(buf) );
+         if( nr < 0 ) {
+            
+            rc = -errno;
+            if( rc == -EINTR || rc == -EAGAIN ) {
+               continue;
+            }
+            
+            vdev_error("read(%d): %s\n", vdev->watch_fd, strerror(-rc) );
+            break;
+         }
+         
+         if( nr > 0 ) {
+            changed = true;
+         }
+      }
+#endif
+   }
+   
+   return NULL;
+}
+
+
+// start watching acts_dir for changes (on Linux), and start the reload thread.
+// the thread still handles SIGHUP if we can't watch acts_dir.
+// return 0 on success, and set state->watch_thread 
+// return -errno on failure 
+static int vdev_watch_thread_start( struct vdev_state* vdev ) {
+   
+   int rc = 0;
+   
+#ifdef _VDEV_OS_LINUX
+   vdev->watch_fd = inotify_init1( IN_CLOEXEC | IN_NONBLOCK );
+   if( vdev->watch_fd < 0 ) {
+      
+      // not fatal; SIGHUP still reloads
+      rc = -errno;
+      vdev_warn("inotify_init1: %s\n", strerror(-rc) );
+   }
+   else {
+      
+      rc = inotify_add_watch( vdev->watch_fd, vdev->snapshot->config->acts_dir, IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB );
+      if( rc < 0 ) {
+         
+         // not fatal; SIGHUP still reloads
+         rc = -errno;
+         vdev_warn("inotify_add_watch('%s'): %s\n", vdev->snapshot->config->acts_dir, strerror(-rc) );
+         
+         close( vdev->watch_fd );
+         vdev->watch_fd = -1;
+      }
+   }
+#endif
+   
+   rc = pipe( vdev->watch_wakeup_pipe );
+   if( rc != 0 ) {
+      
+      rc = -errno;
+      vdev_error("pipe: %s\n", strerror(-rc) );
+      
+      if( vdev->watch_fd >= 0 ) {
+         
+         close( vdev->watch_fd );
+         vdev->watch_fd = -1;
+      }
+      
+      return rc;
+   }
+   
+   // don't leak these into helpers, and never block the signal handler or the thread's drain loop
+   for( int i = 0; i < 2; i++ ) {
+      
+      fcntl( vdev->watch_wakeup_pipe[i], F_SETFD, FD_CLOEXEC );
+      fcntl( vdev->watch_wakeup_pipe[i], F_SETFL, O_NONBLOCK );
+   }
+   
+   pthread_mutex_lock( &vdev->retired_lock );
+   vdev->watch_thread_running = true;
+   pthread_mutex_unlock( &vdev->retired_lock );
+   
+   rc = pthread_create( &vdev->watch_thread, NULL, vdev_watch_thread_main, vdev );
+   if( rc != 0 ) {
+      
+      pthread_mutex_lock( &vdev->retired_lock );
+      vdev->watch_thread_running = false;
+      pthread_mutex_unlock( &vdev->retired_lock );
+      
+      vdev_snapshot_free_retired( vdev );
+      
+      vdev_error("pthread_create: %s\n", strerror(rc) );
+      
+      close( vdev->watch_wakeup_pipe[0] );
+      close( vdev->watch_wakeup_pipe[1] );
+      
+      if( vdev->watch_fd >= 0 ) {
+         close( vdev->watch_fd );
+      }
+      
+      vdev->watch_wakeup_pipe[0] = -1;
+      vdev->watch_wakeup_pipe[1] = -1;
+      vdev->watch_fd = -1;
+      return -rc;
+   }
+   
+   return 0;
+}
+
+
+// stop the reload thread.  Waits for a reload in progress to finish.
+// return 0 on success 
+static int vdev_watch_thread_stop( struct vdev_state* vdev ) {
+   
+   int rc = 0;
+   char c = VDEV_WATCH_REQUEST_STOP;
+   
+   if( !vdev->watch_thread_running ) {
+      // already stopped 
+      return 0;
+   }
+   
+   // wake it up 
+   while( true ) {
+      
+      rc = write( vdev->watch_wakeup_pipe[1], &c, 1 );
+      if( rc < 0 && errno == EINTR ) {
+         continue;
+      }
+      
+      if( rc < 0 && errno == EAGAIN ) {
+         
+         // full of reload requests; let it drain them 
+         sched_yield();
+         continue;
+      }
+      
+      break;
+   }
+   
+   rc = pthread_join( vdev->watch_thread, NULL );
+   if( rc != 0 ) {
+      
+      vdev_error("pthread_join: %s\n", strerror(rc) );
+   }
+   
+   // from now on, whoever releases a snapshot last frees it
+   pthread_mutex_lock( &vdev->retired_lock );
+   vdev->watch_thread_running = false;
+   pthread_mutex_unlock( &vdev->retired_lock );
+   
+   // free the ones it didn't get to 
+   vdev_snapshot_free_retired( vdev );
+   
+   close( vdev->watch_wakeup_pipe[0] );
+   close( vdev->watch_wakeup_pipe[1] );
+   
+   if( vdev->watch_fd >= 0 ) {
+      close( vdev->watch_fd );
+   }
+   
+   vdev->watch_wakeup_pipe[0] = -1;
+   vdev->watch_wakeup_pipe[1] = -1;
+   vdev->watch_fd = -1;
+   
+   return 0;
+}
+
+
+// ask the reload thread to do a full vdev_reload().
+// async-signal-safe, so the SIGHUP handler calls this instead of reloading in whatever thread got the signal.
+// return 0 on success
+// return -EINVAL if the reload thread is not running
+int vdev_reload_request( struct vdev_state* vdev ) {
+   
+   int errsv = errno;
+   char c = VDEV_WATCH_REQUEST_RELOAD;
+   
+   if( vdev->watch_wakeup_pipe[1] < 0 ) {
+      return -EINVAL;
+   }
+   
+   // if the pipe is full, a reload is already pending 
+   write( vdev->watch_wakeup_pipe[1], &c, 1 );
+   
+   errno = errsv;
+   return 0;
+}
+
+
 // start up the back-end
 // return 0 on success 
 // return -ENOMEM on OOM 
@@ -500,12 +820,31 @@ int vdev_start( struct vdev_state* vdev ) {
       return rc;
    }
 
+   // start collecting asynchronous daemonlet replies 
+   rc = vdev_completion_start( &vdev->daemonlet_completion );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_completion_start: %s\n", strerror(-rc) );
+      
+      int erc = vdev_error_thread_stop( vdev );
+      if( erc != 0 ) {
+
+         vdev_error("vdev_error_thread_stop: %s\n", strerror(-erc) );
+      }
+
+      free( vdev->os );
+      vdev->os = NULL;
+      return rc;
+   }
+   
    // start processing requests 
    rc = vdev_wq_start( &vdev->device_wq );
    if( rc != 0 ) {
       
       vdev_error("vdev_wq_start: %s\n", strerror(-rc) );
       
+      vdev_completion_stop( &vdev->daemonlet_completion );
+      
       int erc = vdev_error_thread_stop( vdev );
       if( erc != 0 ) {
 
@@ -529,12 +868,34 @@ int vdev_start( struct vdev_state* vdev ) {
          vdev_error("vdev_wq_stop rc = %d\n", wqrc);
       }
       
+      vdev_completion_stop( &vdev->daemonlet_completion );
       vdev_error_thread_stop( vdev );
       free( vdev->os );
       vdev->os = NULL;
       return rc;
    }
    
+   // reload on SIGHUP, and pick up changes to the actions as they happen
+   if( !vdev->coldplug_only ) {
+      
+      rc = vdev_watch_thread_start( vdev );
+      if( rc != 0 ) {
+         
+         // not fatal, but we won't reload
+         vdev_warn("vdev_watch_thread_start: %s\n", strerror(-rc) );
+         rc = 0;
+      }
+   }
+   
+   // publish action statistics as we go
+   rc = vdev_stats_start( &vdev->stats );
+   if( rc != 0 ) {
+      
+      // not fatal; we just won't have the statistics files
+      vdev_warn("vdev_stats_start: %s\n", strerror(-rc) );
+      rc = 0;
+   }
+   
    return 0;
 }
 
@@ -700,7 +1061,7 @@ int vdev_parse_device_request( struct vdev_state* state, struct vdev_device_requ
    }
    
    // finally, does this device exist already?
-   snprintf( fullpath, PATH_MAX, "%s/%s", state->config->mountpoint, name );
+   snprintf( fullpath, PATH_MAX, "%s/%s", state->snapshot->config->mountpoint, name );
    stat_rc = lstat( fullpath, &sb );
    
    if( stat_rc == 0 ) {
@@ -841,7 +1202,7 @@ int vdev_preseed_run( struct vdev_state* vdev ) {
    size_t output_len = 1024 * 1024;         // 1MB buffer for initial devices, just in case
    char* output = NULL;
    
-   if( vdev->config->preseed_path == NULL ) {
+   if( vdev->snapshot->config->preseed_path == NULL ) {
       // nothing to do 
       return 0;
    }
@@ -853,7 +1214,7 @@ int vdev_preseed_run( struct vdev_state* vdev ) {
       return -ENOMEM;
    }
    
-   command = VDEV_CALLOC( char, strlen( vdev->config->preseed_path ) + 2 + strlen( vdev->config->mountpoint ) + 2 + strlen( vdev->config->config_path ) + 1 );
+   command = VDEV_CALLOC( char, strlen( vdev->snapshot->config->preseed_path ) + 2 + strlen( vdev->snapshot->config->mountpoint ) + 2 + strlen( vdev->snapshot->config->config_path ) + 1 );
    if( command == NULL ) {
       
       // OOM
@@ -861,7 +1222,7 @@ int vdev_preseed_run( struct vdev_state* vdev ) {
       return -ENOMEM;
    }
    
-   sprintf(command, "%s %s %s", vdev->config->preseed_path, vdev->config->mountpoint, vdev->config->config_path );
+   sprintf(command, "%s %s %s", vdev->snapshot->config->preseed_path, vdev->snapshot->config->mountpoint, vdev->snapshot->config->config_path );
    
    rc = vdev_subprocess( command, NULL, &output, output_len, -1, &exit_status, true );
    if( rc != 0 ) {
@@ -897,27 +1258,235 @@ int vdev_preseed_run( struct vdev_state* vdev ) {
 }
 
 
+// make a snapshot that takes ownership of a config and a set of actions.
+// the caller holds the one reference to it.
+// return the snapshot on success
+// return NULL on OOM
+static struct vdev_snapshot* vdev_snapshot_new( struct vdev_config* config, struct vdev_action** acts, size_t num_acts, struct vdev_action_index* acts_index ) {
+   
+   struct vdev_snapshot* snapshot = VDEV_CALLOC( struct vdev_snapshot, 1 );
+   if( snapshot == NULL ) {
+      return NULL;
+   }
+   
+   snapshot->config = config;
+   snapshot->acts = acts;
+   snapshot->num_acts = num_acts;
+   snapshot->acts_index = acts_index;
+   snapshot->refcount = 1;
+   
+   return snapshot;
+}
+
+
+// free a snapshot, once nothing references it 
+// always succeeds
+static int vdev_snapshot_free( struct vdev_snapshot* snapshot ) {
+   
+   // actions that no newer snapshot shares get their daemonlets stopped
+   vdev_action_free_all( snapshot->acts, snapshot->num_acts );
+   vdev_action_index_free( snapshot->acts_index );
+   
+   if( snapshot->config != NULL ) {
+      
+      vdev_config_free( snapshot->config );
+      free( snapshot->config );
+   }
+   
+   memset( snapshot, 0, sizeof(struct vdev_snapshot) );
+   free( snapshot );
+   
+   return 0;
+}
+
+
+// pin the current snapshot of the config and actions, so it stays valid until released.
+// this never blocks, even while a reload is in progress.
+// return the snapshot
+struct vdev_snapshot* vdev_snapshot_pin( struct vdev_state* vdev ) {
+   
+   struct vdev_snapshot* snapshot = NULL;
+   
+   // announce that we're about to take a reference, so a reload won't
+   // drop its reference to the snapshot we load before we've taken ours
+   __sync_fetch_and_add( &vdev->num_pinning, 1 );
+   
+   snapshot = vdev->snapshot;
+   __sync_fetch_and_add( &snapshot->refcount, 1 );
+   
+   __sync_fetch_and_sub( &vdev->num_pinning, 1 );
+   
+   return snapshot;
+}
+
+
+// free the snapshots released since the last call.
+// called by the reload thread, and by whoever stops it.
+// always succeeds
+static int vdev_snapshot_free_retired( struct vdev_state* vdev ) {
+   
+   struct vdev_snapshot* retired = NULL;
+   struct vdev_snapshot* next = NULL;
+   
+   pthread_mutex_lock( &vdev->retired_lock );
+   
+   retired = vdev->retired;
+   vdev->retired = NULL;
+   
+   pthread_mutex_unlock( &vdev->retired_lock );
+   
+   while( retired != NULL ) {
+      
+      next = retired->next;
+      vdev_snapshot_free( retired );
+      retired = next;
+   }
+   
+   return 0;
+}
+
+
+// release a pinned snapshot.  If it is no longer current and this was the last pin, it gets freed:
+// by the reload thread if it is running, since stopping daemonlets can take seconds,
+// and by the caller otherwise (i.e. during startup and shutdown).
+// always succeeds
+int vdev_snapshot_release( struct vdev_state* vdev, struct vdev_snapshot* snapshot ) {
+   
+   char c = VDEV_WATCH_REQUEST_FREE;
+   bool retired = false;
+   
+   if( snapshot == NULL ) {
+      return 0;
+   }
+   
+   if( __sync_sub_and_fetch( &snapshot->refcount, 1 ) > 0 ) {
+      
+      // still in use 
+      return 0;
+   }
+   
+   pthread_mutex_lock( &vdev->retired_lock );
+   
+   if( vdev->watch_thread_running ) {
+      
+      snapshot->next = vdev->retired;
+      vdev->retired = snapshot;
+      retired = true;
+      
+      // wake it up (while the lock keeps the pipe open).  If the pipe is full, it's already awake, and will find this one.
+      write( vdev->watch_wakeup_pipe[1], &c, 1 );
+   }
+   
+   pthread_mutex_unlock( &vdev->retired_lock );
+   
+   if( !retired ) {
+      
+      vdev_snapshot_free( snapshot );
+   }
+   
+   return 0;
+}
+
+
+// make a snapshot current, and release the old one.
+// NOTE: the caller must hold vdev->reload_lock, and must not be in the middle of vdev_snapshot_pin()
+// (i.e. never call this from a signal handler; the reload thread is the only publisher while vdevd runs)
+// always succeeds
+static int vdev_snapshot_publish( struct vdev_state* vdev, struct vdev_snapshot* snapshot ) {
+   
+   struct vdev_snapshot* old_snapshot = vdev->snapshot;
+   
+   vdev->snapshot = snapshot;
+   __sync_synchronize();
+   
+   // wait out any thread that loaded the old snapshot but has not yet referenced it.
+   // this is only ever a few instructions' worth of waiting.
+   while( vdev->num_pinning > 0 ) {
+      
+      sched_yield();
+      __sync_synchronize();
+   }
+   
+   return vdev_snapshot_release( vdev, old_snapshot );
+}
+
+
+// load the actions: from the action cache if it is up to date, and by parsing the action files otherwise.
+// with --compile-actions, parse them and (re)write the cache.
+// return 0 on success, and set *ret_acts and *ret_num_acts 
+// return -ENOMEM on OOM 
+// return -EINVAL if at least one action file failed to load due to a sanity test failure 
+// return -errno if at least one action file failed to load due to an I/O error
+static int vdev_load_actions( struct vdev_config* config, struct vdev_action*** ret_acts, size_t* ret_num_acts ) {
+   
+   int rc = 0;
+   
+   if( config->compile_acts ) {
+      
+      return vdev_actcache_compile( config, ret_acts, ret_num_acts );
+   }
+   
+   if( config->acts_cache_path != NULL ) {
+      
+      rc = vdev_actcache_load( config, ret_acts, ret_num_acts );
+      if( rc == 0 ) {
+         
+         vdev_info("Loaded %zu actions from '%s'\n", *ret_num_acts, config->acts_cache_path );
+         return 0;
+      }
+      
+      // not fatal; parse them instead
+      if( rc == -ESTALE ) {
+         vdev_info("Action cache '%s' is out of date\n", config->acts_cache_path );
+      }
+      else {
+         vdev_warn("vdev_actcache_load('%s') rc = %d\n", config->acts_cache_path, rc );
+      }
+   }
+   
+   return vdev_action_load_all( config, ret_acts, ret_num_acts );
+}
+
+
 // global vdev initialization 
 int vdev_init( struct vdev_state* vdev, int argc, char** argv ) {
    
    int rc = 0;
+   int num_workers = 0;
+   struct vdev_config* config = NULL;
 
    // global setup 
    vdev_setup_global();
    
-   pthread_mutex_init( &vdev->reload_lock, NULL );
    vdev->error_fd = -1;
    vdev->coldplug_finished_fd = -1;
+   vdev->watch_fd = -1;
+   vdev->mountpoint_fd = -1;
+   vdev->metadata_fd = -1;
+   vdev->records_fd = -1;
+   vdev->watch_wakeup_pipe[0] = -1;
+   vdev->watch_wakeup_pipe[1] = -1;
+   
+   pthread_mutex_init( &vdev->reload_lock, NULL );
+   pthread_mutex_init( &vdev->retired_lock, NULL );
    
    // config...
-   vdev->config = VDEV_CALLOC( struct vdev_config, 1 );
-   if( vdev->config == NULL ) {
+   config = VDEV_CALLOC( struct vdev_config, 1 );
+   if( config == NULL ) {
       
       return -ENOMEM;
    }
    
+   // ...which the first snapshot owns from here on; actions are filled in below
+   vdev->snapshot = vdev_snapshot_new( config, NULL, 0, NULL );
+   if( vdev->snapshot == NULL ) {
+      
+      free( config );
+      return -ENOMEM;
+   }
+   
    // config init
-   rc = vdev_config_init( vdev->config );
+   rc = vdev_config_init( config );
    if( rc != 0 ) {
       
       vdev_error("vdev_config_init rc = %d\n", rc );
@@ -925,7 +1494,7 @@ int vdev_init( struct vdev_state* vdev, int argc, char** argv ) {
    }
    
    // parse config options from command-line 
-   rc = vdev_config_load_from_args( vdev->config, argc, argv, NULL, NULL );
+   rc = vdev_config_load_from_args( config, argc, argv, NULL, NULL );
    
    if( rc != 0 ) {
       
@@ -937,56 +1506,56 @@ int vdev_init( struct vdev_state* vdev, int argc, char** argv ) {
    }
    
    // if we didn't get a config file, use the default one
-   if( vdev->config->config_path == NULL ) {
+   if( config->config_path == NULL ) {
       
-      vdev->config->config_path = vdev_strdup_or_null( VDEV_CONFIG_FILE );
-      if( vdev->config->config_path == NULL ) {
+      config->config_path = vdev_strdup_or_null( VDEV_CONFIG_FILE );
+      if( config->config_path == NULL ) {
 
          // OOM 
          return -ENOMEM;
       }
    }
    
-   vdev_set_debug_level( vdev->config->debug_level );
-   vdev_set_error_level( vdev->config->error_level );
+   vdev_set_debug_level( config->debug_level );
+   vdev_set_error_level( config->error_level );
    
-   vdev_info("Config file:      '%s'\n", vdev->config->config_path );
-   vdev_info("Log debug level:  '%s'\n", (vdev->config->debug_level == VDEV_LOGLEVEL_DEBUG ? "debug" : (vdev->config->debug_level == VDEV_LOGLEVEL_INFO ? "info" : "none")) );
-   vdev_info("Log error level:  '%s'\n", (vdev->config->error_level == VDEV_LOGLEVEL_WARN ? "warning" : (vdev->config->error_level == VDEV_LOGLEVEL_ERROR ? "error" : "none")) );
+   vdev_info("Config file:      '%s'\n", config->config_path );
+   vdev_info("Log debug level:  '%s'\n", (config->debug_level == VDEV_LOGLEVEL_DEBUG ? "debug" : (config->debug_level == VDEV_LOGLEVEL_INFO ? "info" : "none")) );
+   vdev_info("Log error level:  '%s'\n", (config->error_level == VDEV_LOGLEVEL_WARN ? "warning" : (config->error_level == VDEV_LOGLEVEL_ERROR ? "error" : "none")) );
    
    // load from file...
-   rc = vdev_config_load( vdev->config->config_path, vdev->config );
+   rc = vdev_config_load( config->config_path, config );
    if( rc != 0 ) {
       
-      vdev_error("vdev_config_load('%s') rc = %d\n", vdev->config->config_path, rc );
+      vdev_error("vdev_config_load('%s') rc = %d\n", config->config_path, rc );
       
       return rc;
    }
    
    // if no command-line loglevel is given, then take it from the config file (if given)
-   if( vdev->config->debug_level != VDEV_LOGLEVEL_NONE ) {
+   if( config->debug_level != VDEV_LOGLEVEL_NONE ) {
       
-      vdev_set_debug_level( vdev->config->debug_level );
+      vdev_set_debug_level( config->debug_level );
    }
    
-   if( vdev->config->error_level != VDEV_LOGLEVEL_NONE ) {
+   if( config->error_level != VDEV_LOGLEVEL_NONE ) {
       
-      vdev_set_error_level( vdev->config->error_level );
+      vdev_set_error_level( config->error_level );
    }
    
-   vdev_info("vdev actions dir: '%s'\n", vdev->config->acts_dir );
-   vdev_info("helpers dir:      '%s'\n", vdev->config->helpers_dir );
-   vdev_info("logfile path:     '%s'\n", vdev->config->logfile_path );
-   vdev_info("pidfile path:     '%s'\n", vdev->config->pidfile_path );
-   vdev_info("default mode:      0%o\n", vdev->config->default_mode );
-   vdev_info("preseed script:   '%s'\n", vdev->config->preseed_path );
+   vdev_info("vdev actions dir: '%s'\n", config->acts_dir );
+   vdev_info("helpers dir:      '%s'\n", config->helpers_dir );
+   vdev_info("logfile path:     '%s'\n", config->logfile_path );
+   vdev_info("pidfile path:     '%s'\n", config->pidfile_path );
+   vdev_info("default mode:      0%o\n", config->default_mode );
+   vdev_info("preseed script:   '%s'\n", config->preseed_path );
    
-   vdev->mountpoint = vdev_strdup_or_null( vdev->config->mountpoint );
-   vdev->coldplug_only = vdev->config->coldplug_only;
+   vdev->mountpoint = vdev_strdup_or_null( config->mountpoint );
+   vdev->coldplug_only = config->coldplug_only;
 
    if( vdev->mountpoint == NULL ) {
       
-      vdev_error("Failed to set mountpoint, config->mountpount = '%s'\n", vdev->config->mountpoint );
+      vdev_error("Failed to set mountpoint, config->mountpount = '%s'\n", config->mountpoint );
       
       return -EINVAL;
    }
@@ -999,55 +1568,176 @@ int vdev_init( struct vdev_state* vdev, int argc, char** argv ) {
    vdev->argv = argv;
    
    // load actions 
-   rc = vdev_action_load_all( vdev->config, &vdev->acts, &vdev->num_acts );
+   rc = vdev_load_actions( config, &vdev->snapshot->acts, &vdev->snapshot->num_acts );
    if( rc != 0) {
       
-      vdev_error("vdev_action_load_all('%s') rc = %d\n", vdev->config->acts_dir, rc );
+      vdev_error("vdev_load_actions('%s') rc = %d\n", config->acts_dir, rc );
       
       return rc;
    }
    
+   // index them 
+   rc = vdev_action_index_build( vdev->snapshot->acts, vdev->snapshot->num_acts, &vdev->snapshot->acts_index );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_action_index_build rc = %d\n", rc );
+      
+      return rc;
+   }
+   
+   // how many device workers?  default to one per CPU
+   num_workers = config->num_workers;
+   if( num_workers <= 0 ) {
+      
+      num_workers = (int)sysconf( _SC_NPROCESSORS_ONLN );
+      if( num_workers <= 0 ) {
+         num_workers = 1;
+      }
+   }
+   
+   vdev_info("device workers:    %d\n", num_workers );
+   
    // initialize request work queue 
-   rc = vdev_wq_init( &vdev->device_wq, vdev );
+   rc = vdev_wq_init( &vdev->device_wq, vdev, num_workers );
    if( rc != 0 ) {
       
       vdev_error("vdev_wq_init rc = %d\n", rc );
       
       return rc;
    }
+   
+   // initialize asynchronous daemonlet reply collection 
+   rc = vdev_completion_init( &vdev->daemonlet_completion );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_completion_init rc = %d\n", rc );
+      
+      return rc;
+   }
+   
+   // set up event tracing, if asked 
+   rc = vdev_trace_init( &vdev->trace, config->trace_buffer );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_trace_init rc = %d\n", rc );
+      
+      return rc;
+   }
+   
+   // set up statistics collection (workers record into it as soon as they start)
+   rc = vdev_stats_init( &vdev->stats, vdev, config->stats_interval );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_stats_init rc = %d\n", rc );
+      
+      return rc;
+   }
 
    return 0;
 }
 
 
-// main loop for the back-end 
-// takes a file descriptor to be written to once coldplug processing has finished.
+// close the directories opened by vdev_metadata_open 
+// always succeeds
+static int vdev_metadata_close( struct vdev_state* vdev ) {
+   
+   if( vdev->records_fd >= 0 ) {
+      
+      close( vdev->records_fd );
+      vdev->records_fd = -1;
+   }
+   
+   if( vdev->metadata_fd >= 0 ) {
+      
+      close( vdev->metadata_fd );
+      vdev->metadata_fd = -1;
+   }
+   
+   if( vdev->mountpoint_fd >= 0 ) {
+      
+      close( vdev->mountpoint_fd );
+      vdev->mountpoint_fd = -1;
+   }
+   
+   return 0;
+}
+
+
+// make the metadata directories, and open the mountpoint, the metadata directory, and the record directory
 // return 0 on success
-// return -errno on failure to daemonize, or abnormal OS-specific back-end failure
-int vdev_main( struct vdev_state* vdev, int coldplug_finished_fd ) {
+// return -ENOMEM on OOM
+// return -errno on failure to make or open them
+static int vdev_metadata_open( struct vdev_state* vdev ) {
    
    int rc = 0;
+   char* records_dir = NULL;
    
-   vdev->coldplug_finished_fd = coldplug_finished_fd;
-   
-   char* metadata_dir = vdev_device_metadata_fullpath( vdev->mountpoint, "" );
-   if( metadata_dir == NULL ) {
+   // create the metadata and record directories 
+   records_dir = vdev_fullpath( vdev->mountpoint, VDEV_METADATA_PREFIX VDEV_METADATA_RECORDS, NULL );
+   if( records_dir == NULL ) {
       
       return -ENOMEM;
    }
    
-   // create metadata directory 
-   rc = vdev_mkdirs( metadata_dir, 0, 0755 );
-   
+   rc = vdev_mkdirs( records_dir, 0, 0755 );
    if( rc != 0 ) {
       
-      vdev_error("vdev_mkdirs('%s') rc = %d\n", metadata_dir, rc );
+      vdev_error("vdev_mkdirs('%s') rc = %d\n", records_dir, rc );
       
-      free( metadata_dir );
+      free( records_dir );
       return rc;
    }
    
-   free( metadata_dir );
+   free( records_dir );
+   
+   vdev->mountpoint_fd = open( vdev->mountpoint, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+   if( vdev->mountpoint_fd < 0 ) {
+      
+      rc = -errno;
+      vdev_error("open('%s') rc = %d\n", vdev->mountpoint, rc );
+      return rc;
+   }
+   
+   vdev->metadata_fd = openat( vdev->mountpoint_fd, VDEV_METADATA_PREFIX, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+   if( vdev->metadata_fd < 0 ) {
+      
+      rc = -errno;
+      vdev_error("openat('%s/%s') rc = %d\n", vdev->mountpoint, VDEV_METADATA_PREFIX, rc );
+      
+      vdev_metadata_close( vdev );
+      return rc;
+   }
+   
+   vdev->records_fd = openat( vdev->metadata_fd, VDEV_METADATA_RECORDS, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+   if( vdev->records_fd < 0 ) {
+      
+      rc = -errno;
+      vdev_error("openat('%s/%s%s') rc = %d\n", vdev->mountpoint, VDEV_METADATA_PREFIX, VDEV_METADATA_RECORDS, rc );
+      
+      vdev_metadata_close( vdev );
+      return rc;
+   }
+   
+   return 0;
+}
+
+
+// main loop for the back-end 
+// takes a file descriptor to be written to once coldplug processing has finished.
+// return 0 on success
+// return -errno on failure to daemonize, or abnormal OS-specific back-end failure
+int vdev_main( struct vdev_state* vdev, int coldplug_finished_fd ) {
+   
+   int rc = 0;
+   
+   vdev->coldplug_finished_fd = coldplug_finished_fd;
+   
+   rc = vdev_metadata_open( vdev );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_metadata_open rc = %d\n", rc );
+      return rc;
+   }
    
    rc = vdev_os_main( vdev->os );
    
@@ -1068,31 +1758,17 @@ int vdev_signal_coldplug_finished( struct vdev_state* vdev, int status ) {
 }
 
 
-// prevent reload
-int vdev_reload_lock( struct vdev_state* vdev ) {
-   return pthread_mutex_lock( &vdev->reload_lock );
-}
-
-
-// allow reload 
-int vdev_reload_unlock( struct vdev_state* vdev ) {
-   return pthread_mutex_unlock( &vdev->reload_lock );
-}
-
-
-// do a reload 
+// do a reload, without waiting for device requests in progress
 // return 0 on success, and replace the config and actions, atomically
 // return -errno on failure, and do nothing to vdev
 int vdev_reload( struct vdev_state* vdev ) {
 
    int rc = 0;
    struct vdev_config* config = NULL;
-   struct vdev_action* acts = NULL;
+   struct vdev_action** acts = NULL;
    size_t num_acts = 0;
-
-   struct vdev_config* old_config = NULL;
-   struct vdev_action* old_acts = NULL;
-   size_t old_num_acts = 0;
+   struct vdev_action_index* acts_index = NULL;
+   struct vdev_snapshot* snapshot = NULL;
 
    config = VDEV_CALLOC( struct vdev_config, 1 );
    if( config == NULL ) {
@@ -1138,35 +1814,152 @@ int vdev_reload( struct vdev_state* vdev ) {
    }
    
    // load actions
-   rc = vdev_action_load_all( config, &acts, &num_acts );
+   rc = vdev_load_actions( config, &acts, &num_acts );
    if( rc != 0) {
       
-      vdev_error("vdev_action_load_all('%s') rc = %d\n", config->acts_dir, rc );
+      vdev_error("vdev_load_actions('%s') rc = %d\n", config->acts_dir, rc );
       
       vdev_config_free( config );
       free( config );
       return rc;
    }
+   
+   // index them
+   rc = vdev_action_index_build( acts, num_acts, &acts_index );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_action_index_build rc = %d\n", rc );
+      
+      vdev_action_free_all( acts, num_acts );
+      vdev_config_free( config );
+      free( config );
+      return rc;
+   }
 
-   // install them
-   vdev_reload_lock( vdev );
-
-   old_config = vdev->config;
-   vdev->config = config;
-
-   old_acts = vdev->acts;
-   old_num_acts = vdev->num_acts;
-   vdev->acts = acts;
-   vdev->num_acts = num_acts;
-    
-   vdev_reload_unlock( vdev );
+   pthread_mutex_lock( &vdev->reload_lock );
+   
+   // OS quirks are discovered at startup, not loaded 
+   config->OS_quirks = vdev->snapshot->config->OS_quirks;
+   
+   // publish them.  Requests in progress keep using the old ones, which get freed once the last of them finishes.
+   snapshot = vdev_snapshot_new( config, acts, num_acts, acts_index );
+   if( snapshot == NULL ) {
+      
+      pthread_mutex_unlock( &vdev->reload_lock );
+      
+      vdev_action_free_all( acts, num_acts );
+      vdev_action_index_free( acts_index );
+      vdev_config_free( config );
+      free( config );
+      return -ENOMEM;
+   }
+   
+   vdev_snapshot_publish( vdev, snapshot );
 
-   // free old state
-   vdev_config_free( old_config );
-   free( old_config );
+   // only receive events the new actions can handle
+   if( vdev->os != NULL ) {
+      
+      rc = vdev_os_context_update_filter( vdev->os, acts, num_acts );
+      if( rc != 0 ) {
+         
+         vdev_warn("vdev_os_context_update_filter rc = %d\n", rc );
+         rc = 0;
+      }
+   }
+   
+   pthread_mutex_unlock( &vdev->reload_lock );
 
-   vdev_action_free_all( old_acts, old_num_acts );
+   return rc;
+}
 
+// reload only the action files that changed since the current snapshot was made,
+// and publish a new snapshot with them.  Unchanged actions carry over to it, along with 
+// their compiled matchers, running daemonlets, and statistics.
+// the config is not re-read; that still takes a full vdev_reload().
+// return 0 on success
+// return -ENOMEM on OOM 
+// return -errno if the actions could not be loaded, in which case the current snapshot stays in place
+int vdev_reload_actions( struct vdev_state* vdev ) {
+   
+   int rc = 0;
+   struct vdev_config* config = NULL;
+   struct vdev_action** acts = NULL;
+   size_t num_acts = 0;
+   size_t num_reused = 0;
+   struct vdev_action_index* acts_index = NULL;
+   struct vdev_snapshot* snapshot = NULL;
+   struct vdev_snapshot* cur_snapshot = NULL;
+   
+   config = VDEV_CALLOC( struct vdev_config, 1 );
+   if( config == NULL ) {
+      return -ENOMEM;
+   }
+   
+   pthread_mutex_lock( &vdev->reload_lock );
+   
+   // no one else can replace it while we hold the lock 
+   cur_snapshot = vdev->snapshot;
+   
+   rc = vdev_config_dup( config, cur_snapshot->config );
+   if( rc != 0 ) {
+      
+      pthread_mutex_unlock( &vdev->reload_lock );
+      free( config );
+      return rc;
+   }
+   
+   // load the changed actions, and share the rest 
+   rc = vdev_action_reload_all( config, cur_snapshot->acts, cur_snapshot->num_acts, &acts, &num_acts, &num_reused );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_action_reload_all('%s') rc = %d\n", config->acts_dir, rc );
+      
+      pthread_mutex_unlock( &vdev->reload_lock );
+      vdev_config_free( config );
+      free( config );
+      return rc;
+   }
+   
+   rc = vdev_action_index_build( acts, num_acts, &acts_index );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_action_index_build rc = %d\n", rc );
+      
+      pthread_mutex_unlock( &vdev->reload_lock );
+      vdev_action_free_all( acts, num_acts );
+      vdev_config_free( config );
+      free( config );
+      return rc;
+   }
+   
+   snapshot = vdev_snapshot_new( config, acts, num_acts, acts_index );
+   if( snapshot == NULL ) {
+      
+      pthread_mutex_unlock( &vdev->reload_lock );
+      vdev_action_free_all( acts, num_acts );
+      vdev_action_index_free( acts_index );
+      vdev_config_free( config );
+      free( config );
+      return -ENOMEM;
+   }
+   
+   vdev_snapshot_publish( vdev, snapshot );
+   
+   vdev_info("Reloaded actions in '%s': %zu unchanged, %zu loaded\n", config->acts_dir, num_reused, num_acts - num_reused );
+   
+   // only receive events the new actions can handle
+   if( vdev->os != NULL ) {
+      
+      rc = vdev_os_context_update_filter( vdev->os, acts, num_acts );
+      if( rc != 0 ) {
+         
+         vdev_warn("vdev_os_context_update_filter rc = %d\n", rc );
+         rc = 0;
+      }
+   }
+   
+   pthread_mutex_unlock( &vdev->reload_lock );
+   
    return rc;
 }
 
@@ -1186,6 +1979,9 @@ int vdev_stop( struct vdev_state* vdev ) {
    vdev->running = false;
    wait_for_empty = vdev->coldplug_only;         // wait for the queue to drain if running coldplug only
    
+   // no more reloads 
+   vdev_watch_thread_stop( vdev );
+   
    // stop processing requests 
    rc = vdev_wq_stop( &vdev->device_wq, wait_for_empty );
    if( rc != 0 ) {
@@ -1195,7 +1991,25 @@ int vdev_stop( struct vdev_state* vdev ) {
    }
    
    // stop all actions' daemonlets
-   vdev_action_daemonlet_stop_all( vdev->acts, vdev->num_acts );
+   vdev_action_daemonlet_stop_all( vdev->snapshot->acts, vdev->snapshot->num_acts );
+   
+   // no more replies to collect 
+   rc = vdev_completion_stop( &vdev->daemonlet_completion );
+   if( rc != 0 ) {
+      
+      vdev_error("vdev_completion_stop: %s\n", strerror(-rc) );
+   }
+   
+   // write out the final statistics, now that no more actions can run
+   if( vdev_stats_stop( &vdev->stats ) == 0 ) {
+      
+      int src = vdev_stats_write( vdev );
+      if( src != 0 ) {
+         
+         vdev_error("vdev_stats_write: %s\n", strerror(-src) );
+      }
+   }
+   
    return rc;
 }
 
@@ -1219,35 +2033,34 @@ int vdev_shutdown( struct vdev_state* vdev, bool unlink_pidfile ) {
    }
 
    // remove the PID file, if we have one 
-   if( vdev->config->pidfile_path != NULL && unlink_pidfile ) {
-      unlink( vdev->config->pidfile_path );
+   if( vdev->snapshot != NULL && vdev->snapshot->config->pidfile_path != NULL && unlink_pidfile ) {
+      unlink( vdev->snapshot->config->pidfile_path );
    }
    
-   vdev_action_free_all( vdev->acts, vdev->num_acts );
-   
-   vdev->acts = NULL;
-   vdev->num_acts = 0;
-   
    if( vdev->os != NULL ) {
       vdev_os_context_free( vdev->os );
       free( vdev->os );
       vdev->os = NULL;
    }
    
-   if( vdev->config != NULL ) {
-      vdev_config_free( vdev->config );
-      free( vdev->config );
-      vdev->config = NULL;
-   }
+   // no device request can hold a pin anymore
+   vdev_snapshot_release( vdev, vdev->snapshot );
+   vdev->snapshot = NULL;
    
    vdev_wq_free( &vdev->device_wq );
+   vdev_completion_free( &vdev->daemonlet_completion );
+   vdev_stats_free( &vdev->stats );
+   vdev_trace_free( &vdev->trace );
+   
+   pthread_mutex_destroy( &vdev->reload_lock );
+   pthread_mutex_destroy( &vdev->retired_lock );
+   
+   vdev_metadata_close( vdev );
    
    if( vdev->mountpoint != NULL ) {
       free( vdev->mountpoint );
       vdev->mountpoint = NULL;
    }
 
-   pthread_mutex_destroy( &vdev->reload_lock );
-   
    return 0;
 }
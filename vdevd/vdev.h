@@ -27,16 +27,61 @@
 #include "os/common.h"
 #include "device.h"
 #include "workqueue.h"
+#include "completion.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <sys/sysmacros.h>
+
+// requests to the reload thread 
+#define VDEV_WATCH_REQUEST_RELOAD       'r'             // do a full reload 
+#define VDEV_WATCH_REQUEST_STOP         's'             // exit 
+#define VDEV_WATCH_REQUEST_FREE         'f'             // free released snapshots 
 
 #ifndef VDEV_CONFIG_FILE
 #define VDEV_CONFIG_FILE "/etc/vdev/vdevd.conf"
 #endif
 
+// one version of the configuration and actions.
+// a device request pins the snapshot that is current when it starts, and uses it until it finishes.
+// a reload publishes a new snapshot without waiting for requests; the last one to release the old snapshot 
+// hands it to the reload thread, which frees it (and stops the daemonlets of actions no newer snapshot shares).
+struct vdev_snapshot {
+   
+   // configuration 
+   struct vdev_config* config;
+   
+   // actions 
+   struct vdev_action** acts;
+   size_t num_acts;
+   
+   // dispatch index over acts 
+   struct vdev_action_index* acts_index;
+   
+   // number of references: one while the snapshot is current, plus one per pin (updated atomically)
+   volatile int refcount;
+   
+   // next released snapshot waiting for the reload thread to free it 
+   struct vdev_snapshot* next;
+};
+
 // global vdev state 
 struct vdev_state {
    
-   // configuration (covered by reload_lock)
-   struct vdev_config* config;
+   // current configuration and actions.  The main thread may use it directly while the reload
+   // thread is not running; otherwise, threads must pin it with vdev_snapshot_pin().
+   struct vdev_snapshot* volatile snapshot;
+   
+   // serializes replacing the snapshot (the reload thread's full and action-only reloads)
+   pthread_mutex_t reload_lock;
+   
+   // number of threads in the middle of pinning the current snapshot (updated atomically)
+   volatile int num_pinning;
+   
+   // released snapshots for the reload thread to free, so device workers never wait for daemonlets to stop.
+   // the lock also guards watch_thread_running.
+   pthread_mutex_t retired_lock;
+   struct vdev_snapshot* retired;
    
    // arguments 
    int argc;
@@ -45,19 +90,25 @@ struct vdev_state {
    // mountpoint; where /dev is
    char* mountpoint;
    
+   // open directories, so device files and metadata can be made and removed with the *at() syscalls 
+   // instead of resolving full paths:  the mountpoint, its metadata directory, and the record directory.
+   // opened by vdev_main().
+   int mountpoint_fd;
+   int metadata_fd;
+   int records_fd;
+   
    // OS context
    struct vdev_os_context* os;
    
-   // actions (covered by reload_lock)
-   struct vdev_action* acts;
-   size_t num_acts;
-   
    // pending requests
    struct vdev_pending_context* pending;
    
    // device processing workqueue (back-end)
    struct vdev_wq device_wq;
    
+   // collects replies from asynchronous daemonlets (back-end)
+   struct vdev_completion daemonlet_completion;
+   
    // are we taking events from the OS? (back-end)
    bool running;
    
@@ -76,9 +127,21 @@ struct vdev_state {
    // fd to the error pipe, to be passed to subprocesses
    // in place of stderr
    int error_fd;
-
-   // reload lock--held when reloading the config 
-   pthread_mutex_t reload_lock;
+   
+   // reload thread:  does the reloads SIGHUP asks for, and reloads changed actions 
+   // as acts_dir changes (Linux only)
+   bool watch_thread_running;
+   pthread_t watch_thread;
+   
+   // inotify fd on acts_dir (-1 if not watching), and a pipe to send the reload thread requests
+   int watch_fd;
+   int watch_wakeup_pipe[2];
+   
+   // statistics thread that writes out the actions' latencies
+   struct vdev_stats stats;
+   
+   // recent event-processing spans, dumped on SIGUSR2 (empty unless trace_buffer is set)
+   struct vdev_trace trace;
 };
 
 typedef char* cstr;
@@ -89,11 +152,13 @@ int vdev_init( struct vdev_state* vdev, int argc, char** argv );
 int vdev_start( struct vdev_state* vdev );
 int vdev_main( struct vdev_state* vdev, int flush_fd );
 int vdev_reload( struct vdev_state* vdev );
+int vdev_reload_request( struct vdev_state* vdev );
+int vdev_reload_actions( struct vdev_state* vdev );
 int vdev_stop( struct vdev_state* vdev );
 int vdev_shutdown( struct vdev_state* vdev, bool unlink_pidfile );
 
-int vdev_reload_lock( struct vdev_state* vdev );
-int vdev_reload_unlock( struct vdev_state* vdev );
+struct vdev_snapshot* vdev_snapshot_pin( struct vdev_state* vdev );
+int vdev_snapshot_release( struct vdev_state* vdev, struct vdev_snapshot* snapshot );
 
 int vdev_error_fifo_path( char const* mountpoint, char* path, size_t path_len );
 int vdev_signal_coldplug_finished( struct vdev_state* state, int status );
@@ -24,16 +24,43 @@
 #include "os/common.h"
 #include "vdev.h"
 
+// is there no pending work in any lane?
+// NOTE: wq->work_lock must be held
+static bool vdev_wq_is_empty( struct vdev_wq* wq ) {
+   
+   for( int i = 0; i < VDEV_WQ_NUM_LANES; i++ ) {
+      
+      if( wq->lanes[i].work != NULL ) {
+         return false;
+      }
+   }
+   
+   return true;
+}
+
+
 // wait for the queue to be drained of coldplug events
-static void vdev_wq_wait_for_empty( struct vdev_wq* wq ) {
+// always succeeds
+int vdev_wq_wait_for_empty( struct vdev_wq* wq ) {
+   
+   pthread_mutex_lock( &wq->work_lock );
+   
+   if( vdev_wq_is_empty( wq ) && wq->num_active == 0 ) {
+      
+      // already drained
+      pthread_mutex_unlock( &wq->work_lock );
+      return 0;
+   }
    
    pthread_mutex_lock( &wq->waiter_lock );
    
    wq->num_waiters++;
    
    pthread_mutex_unlock( &wq->waiter_lock );
+   pthread_mutex_unlock( &wq->work_lock );
    
    sem_wait( &wq->end_sem );
+   return 0;
 }
 
 
@@ -56,20 +83,287 @@ static void vdev_wq_signal_empty( struct vdev_wq* wq ) {
 }
 
 
-// work queue main method
-// always succeeds
-static void* vdev_wq_main( void* cls ) {
+// do two ordering keys refer to the same device, or to a device and one of its ancestors?
+// a NULL key conflicts with everything.
+static bool vdev_wq_keys_conflict( char const* key1, char const* key2 ) {
+   
+   size_t len1 = 0;
+   size_t len2 = 0;
+   
+   if( key1 == NULL || key2 == NULL ) {
+      return true;
+   }
+   
+   len1 = strlen( key1 );
+   len2 = strlen( key2 );
+   
+   if( strncmp( key1, key2, MIN( len1, len2 ) ) != 0 ) {
+      return false;
+   }
+   
+   if( len1 == len2 ) {
+      return true;
+   }
+   
+   // one is a prefix of the other, but is it a path prefix?
+   if( len1 < len2 ) {
+      return key2[len1] == '/';
+   }
+   else {
+      return key1[len2] == '/';
+   }
+}
+
 
-   struct vdev_wq* wq = (struct vdev_wq*)cls;
+// get the current time on the monotonic clock, in milliseconds 
+static uint64_t vdev_wq_now_millis(void) {
    
-   struct vdev_wreq* work_itr = NULL;
-   struct vdev_wreq* next = NULL;
+   struct timespec now;
+   
+   clock_gettime( CLOCK_MONOTONIC, &now );
+   return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+
+// find the earliest time at which a held-back pending request becomes runnable.
+// requests that are already due are not considered.
+// return the time (CLOCK_MONOTONIC, in millis), or 0 if no pending request is held back
+// NOTE: wq->work_lock must be held
+static uint64_t vdev_wq_next_deadline( struct vdev_wq* wq ) {
+   
+   uint64_t now = vdev_wq_now_millis();
+   uint64_t deadline = 0;
+   
+   for( int i = 0; i < VDEV_WQ_NUM_LANES; i++ ) {
+      
+      for( struct vdev_wreq* itr = wq->lanes[i].work; itr != NULL; itr = itr->next ) {
+         
+         if( itr->not_before_millis > now && (deadline == 0 || itr->not_before_millis < deadline) ) {
+            deadline = itr->not_before_millis;
+         }
+      }
+   }
+   
+   return deadline;
+}
+
+
+// wait for work to be posted, or for the given time (CLOCK_MONOTONIC, in millis) to arrive
+// return 0 if work was posted
+// return -ETIMEDOUT if the deadline arrived first
+// return -EINTR if interrupted
+static int vdev_wq_timedwait( struct vdev_wq* wq, uint64_t deadline ) {
+   
+   struct timespec ts;
+   uint64_t now = vdev_wq_now_millis();
+   uint64_t delay = 0;
+   int rc = 0;
+   
+   if( deadline <= now ) {
+      return -ETIMEDOUT;
+   }
+   
+   // sem_timedwait() wants an absolute time on the realtime clock
+   delay = deadline - now;
+   
+   clock_gettime( CLOCK_REALTIME, &ts );
+   
+   ts.tv_sec += delay / 1000;
+   ts.tv_nsec += (delay % 1000) * 1000000;
+   
+   if( ts.tv_nsec >= 1000000000 ) {
+      
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+   }
+   
+   rc = sem_timedwait( &wq->work_sem, &ts );
+   if( rc != 0 ) {
+      return -errno;
+   }
+   
+   return 0;
+}
+
+
+// is a pending request ordered behind a request that was enqueued before it, in any lane?
+// NOTE: wq->work_lock must be held
+static bool vdev_wq_ordered_behind_pending( struct vdev_wq* wq, struct vdev_wreq* wreq ) {
+   
+   for( int i = 0; i < VDEV_WQ_NUM_LANES; i++ ) {
+      
+      for( struct vdev_wreq* earlier = wq->lanes[i].work; earlier != NULL && earlier->seq < wreq->seq; earlier = earlier->next ) {
+         
+         if( vdev_wq_keys_conflict( earlier->key, wreq->key ) ) {
+            return true;
+         }
+      }
+   }
+   
+   return false;
+}
+
+
+// find and unlink the oldest pending request in a lane that is not ordered behind an
+// active request or an older pending request, and is not being held back.
+// return the request on success
+// return NULL if the lane has no pending work, or if all of it must wait.
+// NOTE: wq->work_lock must be held
+static struct vdev_wreq* vdev_wq_lane_next_runnable( struct vdev_wq* wq, struct vdev_wq_lane* lane, uint64_t now ) {
+   
+   struct vdev_wreq* prev = NULL;
+   bool blocked = false;
+   
+   for( struct vdev_wreq* itr = lane->work; itr != NULL; prev = itr, itr = itr->next ) {
+      
+      // held back?  later requests with conflicting keys stay ordered behind it.
+      blocked = (itr->not_before_millis > now);
+      
+      // ordered behind an active request?
+      for( int i = 0; i < wq->num_threads && !blocked; i++ ) {
+         
+         if( wq->active[i] != NULL && vdev_wq_keys_conflict( wq->active[i]->key, itr->key ) ) {
+            blocked = true;
+         }
+      }
+      
+      // ordered behind an older pending request, in this lane or another?
+      if( !blocked ) {
+         blocked = vdev_wq_ordered_behind_pending( wq, itr );
+      }
+      
+      if( !blocked ) {
+         
+         // runnable; unlink 
+         if( prev == NULL ) {
+            lane->work = itr->next;
+         }
+         else {
+            prev->next = itr->next;
+         }
+         
+         if( lane->tail == itr ) {
+            lane->tail = prev;
+         }
+         
+         lane->num_pending--;
+         
+         itr->next = NULL;
+         return itr;
+      }
+      
+      if( itr->key == NULL ) {
+         
+         // everything after this request is ordered behind it
+         break;
+      }
+   }
+   
+   return NULL;
+}
+
+
+// find and unlink the next request to run.  Lanes are tried in priority order, but
+// each lane may only dequeue its weight's worth of requests per round while other lanes
+// have runnable work.
+// return the request on success
+// return NULL if there is no pending work, or if all of it must wait.
+// NOTE: wq->work_lock must be held
+static struct vdev_wreq* vdev_wq_next_runnable( struct vdev_wq* wq ) {
+   
+   struct vdev_wreq* wreq = NULL;
+   uint64_t now = vdev_wq_now_millis();
+   
+   for( int pass = 0; pass < 2; pass++ ) {
+      
+      for( int i = 0; i < VDEV_WQ_NUM_LANES; i++ ) {
+         
+         struct vdev_wq_lane* lane = &wq->lanes[i];
+         
+         if( lane->work == NULL || (pass == 0 && lane->credits <= 0) ) {
+            continue;
+         }
+         
+         wreq = vdev_wq_lane_next_runnable( wq, lane, now );
+         if( wreq != NULL ) {
+            
+            if( lane->credits > 0 ) {
+               lane->credits--;
+            }
+            
+            lane->num_dequeued++;
+            return wreq;
+         }
+      }
+      
+      // lanes with credit left have nothing runnable.  start a new round.
+      for( int i = 0; i < VDEV_WQ_NUM_LANES; i++ ) {
+         
+         wq->lanes[i].credits = wq->lanes[i].weight;
+      }
+   }
+   
+   return NULL;
+}
+
+
+// handle the queue becoming idle: wake up anyone waiting for it to drain,
+// and tell the parent if coldplug processing has finished.
+// NOTE: wq->work_lock must be held, so only one worker reports it
+static void vdev_wq_idle( struct vdev_wq* wq ) {
    
    struct vdev_state* state = wq->state;
    
-   bool coldplug_finished = false;
+   vdev_wq_signal_empty( wq );
+   
+   if( state->os != NULL && vdev_os_context_is_coldplug_finished( state->os ) ) {
+      
+      // coldplug has finished!  signal the parent to exit.
+      vdev_signal_coldplug_finished( state, 0 );
+   }
+}
+
+
+// handle the queue becoming idle if it already is.
+// use this when the conditions vdev_wq_idle checks change while no work is pending.
+// always succeeds
+int vdev_wq_check_idle( struct vdev_wq* wq ) {
+   
+   pthread_mutex_lock( &wq->work_lock );
+   
+   if( wq->running && vdev_wq_is_empty( wq ) && wq->num_active == 0 ) {
+      
+      vdev_wq_idle( wq );
+   }
+   
+   pthread_mutex_unlock( &wq->work_lock );
+   return 0;
+}
+
+
+// arguments to a worker thread 
+struct vdev_wq_worker_args {
+   
+   struct vdev_wq* wq;
+   int id;
+};
+
+
+// work queue worker main method
+// always succeeds
+static void* vdev_wq_main( void* cls ) {
+
+   struct vdev_wq_worker_args* args = (struct vdev_wq_worker_args*)cls;
+   struct vdev_wq* wq = args->wq;
+   int id = args->id;
+   
+   struct vdev_wreq* wreq = NULL;
+   int num_blocked = 0;
+   uint64_t deadline = 0;
    
    int rc = 0;
+   
+   free( args );
 
    while( wq->running ) {
 
@@ -80,8 +374,23 @@ static void* vdev_wq_main( void* cls ) {
          rc = -errno;
          if( rc == -EAGAIN ) {
             
-            // wait for work
-            sem_wait( &wq->work_sem );
+            // is any pending work being held back?
+            pthread_mutex_lock( &wq->work_lock );
+            
+            deadline = vdev_wq_next_deadline( wq );
+            
+            pthread_mutex_unlock( &wq->work_lock );
+            
+            if( deadline == 0 ) {
+               
+               // wait for work
+               sem_wait( &wq->work_sem );
+            }
+            else {
+               
+               // wait for work, or for held-back work to become runnable
+               vdev_wq_timedwait( wq, deadline );
+            }
          }
          else {
             
@@ -99,65 +408,115 @@ static void* vdev_wq_main( void* cls ) {
       // we have work to do
       pthread_mutex_lock( &wq->work_lock );
 
-      work_itr = wq->work;
-      wq->work = NULL;
-      wq->tail = NULL;
-      
-      pthread_mutex_unlock( &wq->work_lock );
-      
-      if( !coldplug_finished ) {
-         coldplug_finished = vdev_os_context_is_coldplug_finished( state->os );
-      }
+      wreq = vdev_wq_next_runnable( wq );
       
-      if( work_itr == NULL ) {
+      if( wreq == NULL ) {
          
-         vdev_wq_signal_empty( wq );
-         
-         if( coldplug_finished ) {
-         
-            // coldplug has finished!  signal the parent to exit.
-            vdev_signal_coldplug_finished( state, 0 );
+         if( vdev_wq_is_empty( wq ) && wq->num_active == 0 ) {
+            
+            // drained
+            vdev_wq_idle( wq );
+         }
+         else if( !vdev_wq_is_empty( wq ) ) {
+            
+            // all pending work is ordered behind active requests, or held back.
+            // the worker that finishes an active request will wake us back up,
+            // and the next idle worker will wait for the held-back work.
+            wq->num_blocked++;
          }
          
+         pthread_mutex_unlock( &wq->work_lock );
          continue;
       }
-
-      // safe to use work buffer (we'll clear it out in the process)
-      while( work_itr != NULL ) {
-
-         // carry out work
-         rc = (*work_itr->work)( work_itr, work_itr->work_data );
-         
-         if( rc != 0 ) {
-            
-            vdev_warn("work %p rc = %d\n", work_itr->work, rc );
-         }
+      
+      wq->active[id] = wreq;
+      wq->num_active++;
+      
+      pthread_mutex_unlock( &wq->work_lock );
+      
+      // carry out work
+      rc = (*wreq->work)( wreq, wreq->work_data );
+      
+      if( rc != 0 ) {
          
-         next = work_itr->next;
+         vdev_warn("work %p rc = %d\n", wreq->work, rc );
+      }
+      
+      pthread_mutex_lock( &wq->work_lock );
+      
+      wq->active[id] = NULL;
+      wq->num_active--;
+      
+      // requests held back by this one may now be runnable 
+      num_blocked = wq->num_blocked;
+      wq->num_blocked = 0;
+      
+      if( vdev_wq_is_empty( wq ) && wq->num_active == 0 ) {
          
-         vdev_wreq_free( work_itr );
-         free( work_itr );
+         // drained
+         vdev_wq_idle( wq );
+      }
+      
+      pthread_mutex_unlock( &wq->work_lock );
+      
+      for( int i = 0; i < num_blocked; i++ ) {
          
-         work_itr = next;
+         sem_post( &wq->work_sem );
       }
+      
+      vdev_wreq_free( wreq );
+      free( wreq );
    }
 
    return NULL;
 }
 
-// set up a work queue, but don't start it.
+// set up a work queue with num_threads workers, but don't start it.
 // return 0 on success
 // return negative on failure:
+// * -EINVAL if num_threads is not positive
 // * -ENOMEM if OOM
-int vdev_wq_init( struct vdev_wq* wq, struct vdev_state* state ) {
+int vdev_wq_init( struct vdev_wq* wq, struct vdev_state* state, int num_threads ) {
 
    int rc = 0;
+   
+   if( num_threads <= 0 ) {
+      return -EINVAL;
+   }
 
    memset( wq, 0, sizeof(struct vdev_wq) );
    
+   wq->threads = VDEV_CALLOC( pthread_t, num_threads );
+   if( wq->threads == NULL ) {
+      
+      return -ENOMEM;
+   }
+   
+   wq->active = VDEV_CALLOC( struct vdev_wreq*, num_threads );
+   if( wq->active == NULL ) {
+      
+      free( wq->threads );
+      wq->threads = NULL;
+      return -ENOMEM;
+   }
+   
+   wq->num_threads = num_threads;
+   
+   wq->lanes[ VDEV_WQ_LANE_HIGH ].weight = VDEV_WQ_LANE_HIGH_WEIGHT;
+   wq->lanes[ VDEV_WQ_LANE_NORMAL ].weight = VDEV_WQ_LANE_NORMAL_WEIGHT;
+   wq->lanes[ VDEV_WQ_LANE_LOW ].weight = VDEV_WQ_LANE_LOW_WEIGHT;
+   
+   for( int i = 0; i < VDEV_WQ_NUM_LANES; i++ ) {
+      
+      wq->lanes[i].credits = wq->lanes[i].weight;
+   }
+   
    rc = pthread_mutex_init( &wq->work_lock, NULL );
    if( rc != 0 ) {
       
+      free( wq->threads );
+      free( wq->active );
+      memset( wq, 0, sizeof(struct vdev_wq) );
       return -abs(rc);
    }
    
@@ -165,6 +524,9 @@ int vdev_wq_init( struct vdev_wq* wq, struct vdev_state* state ) {
    if( rc != 0 ) {
       
       pthread_mutex_destroy( &wq->work_lock );
+      free( wq->threads );
+      free( wq->active );
+      memset( wq, 0, sizeof(struct vdev_wq) );
       return -abs(rc);
    }
    
@@ -177,10 +539,11 @@ int vdev_wq_init( struct vdev_wq* wq, struct vdev_state* state ) {
 }
 
 
-// start a work queue
+// start a work queue's workers
 // return 0 on success
 // return negative on error:
 // * -EINVAL if already started
+// * -ENOMEM if OOM
 // * whatever pthread_create errors on
 int vdev_wq_start( struct vdev_wq* wq ) {
 
@@ -190,20 +553,48 @@ int vdev_wq_start( struct vdev_wq* wq ) {
 
    int rc = 0;
    pthread_attr_t attrs;
+   struct vdev_wq_worker_args* args = NULL;
 
    memset( &attrs, 0, sizeof(pthread_attr_t) );
 
    wq->running = true;
 
-   rc = pthread_create( &wq->thread, &attrs, vdev_wq_main, wq );
-   if( rc != 0 ) {
-
-      wq->running = false;
-
-      rc = -errno;
-      vdev_error("pthread_create errno = %d\n", rc );
-
-      return rc;
+   for( int i = 0; i < wq->num_threads; i++ ) {
+      
+      args = VDEV_CALLOC( struct vdev_wq_worker_args, 1 );
+      if( args == NULL ) {
+         
+         rc = -ENOMEM;
+      }
+      else {
+         
+         args->wq = wq;
+         args->id = i;
+         
+         rc = pthread_create( &wq->threads[i], &attrs, vdev_wq_main, args );
+         if( rc != 0 ) {
+            
+            free( args );
+            rc = -abs(rc);
+            vdev_error("pthread_create rc = %d\n", rc );
+         }
+      }
+      
+      if( rc != 0 ) {
+         
+         // stop the ones we started
+         wq->running = false;
+         
+         for( int j = 0; j < i; j++ ) {
+            sem_post( &wq->work_sem );
+         }
+         
+         for( int j = 0; j < i; j++ ) {
+            pthread_join( wq->threads[j], NULL );
+         }
+         
+         return rc;
+      }
    }
 
    return 0;
@@ -227,11 +618,18 @@ int vdev_wq_stop( struct vdev_wq* wq, bool wait ) {
 
    wq->running = false;
 
-   // wake up the work queue so it cancels
-   sem_post( &wq->work_sem );
-   pthread_cancel( wq->thread );
+   // wake up the workers so they exit.
+   // don't cancel them:  a worker may be in the middle of a request, holding an action's lock or talking to a daemonlet.
+   // it finishes that request, and sees that we're no longer running.
+   for( int i = 0; i < wq->num_threads; i++ ) {
+      
+      sem_post( &wq->work_sem );
+   }
 
-   pthread_join( wq->thread, NULL );
+   for( int i = 0; i < wq->num_threads; i++ ) {
+      
+      pthread_join( wq->threads[i], NULL );
+   }
 
    return 0;
 }
@@ -267,7 +665,22 @@ int vdev_wq_free( struct vdev_wq* wq ) {
    }
 
    // free all
-   vdev_wq_queue_free( wq->work );
+   for( int i = 0; i < VDEV_WQ_NUM_LANES; i++ ) {
+      
+      vdev_wq_queue_free( wq->lanes[i].work );
+   }
+   
+   for( int i = 0; i < wq->num_threads; i++ ) {
+      
+      if( wq->active[i] != NULL ) {
+         
+         vdev_wreq_free( wq->active[i] );
+         free( wq->active[i] );
+      }
+   }
+   
+   free( wq->active );
+   free( wq->threads );
    
    pthread_mutex_destroy( &wq->work_lock );
    pthread_mutex_destroy( &wq->waiter_lock );
@@ -288,7 +701,60 @@ int vdev_wreq_init( struct vdev_wreq* wreq, vdev_wq_func_t work, void* work_data
 
    wreq->work = work;
    wreq->work_data = work_data;
+   wreq->lane = VDEV_WQ_LANE_NORMAL;
+
+   return 0;
+}
+
+// set a work request's ordering key
+// return 0 on success
+// return -ENOMEM if OOM
+int vdev_wreq_set_key( struct vdev_wreq* wreq, char const* key ) {
+   
+   char* key_dup = NULL;
+   
+   if( key != NULL ) {
+      
+      key_dup = vdev_strdup_or_null( key );
+      if( key_dup == NULL ) {
+         return -ENOMEM;
+      }
+   }
+   
+   if( wreq->key != NULL ) {
+      free( wreq->key );
+   }
+   
+   wreq->key = key_dup;
+   return 0;
+}
 
+// set a work request's merge callback
+// always succeeds
+int vdev_wreq_set_merge( struct vdev_wreq* wreq, vdev_wq_merge_func_t merge ) {
+   
+   wreq->merge = merge;
+   return 0;
+}
+
+// hold a work request back for delay_millis once it has been enqueued
+// always succeeds
+int vdev_wreq_set_delay( struct vdev_wreq* wreq, uint64_t delay_millis ) {
+   
+   wreq->delay_millis = delay_millis;
+   return 0;
+}
+
+// set the priority lane a work request runs in
+// return 0 on success
+// return -EINVAL if there is no such lane
+int vdev_wreq_set_lane( struct vdev_wreq* wreq, int lane ) {
+   
+   if( lane < 0 || lane >= VDEV_WQ_NUM_LANES ) {
+      return -EINVAL;
+   }
+   
+   wreq->lane = lane;
    return 0;
 }
 
@@ -296,17 +762,105 @@ int vdev_wreq_init( struct vdev_wreq* wreq, vdev_wq_func_t work, void* work_data
 // always succeeds
 int vdev_wreq_free( struct vdev_wreq* wreq ) {
 
+   if( wreq->key != NULL ) {
+      
+      free( wreq->key );
+      wreq->key = NULL;
+   }
+   
    memset( wreq, 0, sizeof(struct vdev_wreq) );
    return 0;
 }
 
-// enqueue work
+// try to merge a new request into the last pending request it is ordered behind, in any lane.
+// only requests with exactly the same key are merged.
+// return what the merge callback decided, and unlink and free the requests it dropped
+// NOTE: wq->work_lock must be held
+static vdev_wq_merge_t vdev_wq_merge( struct vdev_wq* wq, struct vdev_wreq* wreq ) {
+   
+   struct vdev_wreq* prev = NULL;
+   struct vdev_wreq* pending = NULL;
+   struct vdev_wreq* pending_prev = NULL;
+   struct vdev_wq_lane* pending_lane = NULL;
+   vdev_wq_merge_t merged = VDEV_WQ_MERGE_NONE;
+   
+   if( wreq->merge == NULL || wreq->key == NULL ) {
+      return VDEV_WQ_MERGE_NONE;
+   }
+   
+   for( int i = 0; i < VDEV_WQ_NUM_LANES; i++ ) {
+      
+      prev = NULL;
+      
+      for( struct vdev_wreq* itr = wq->lanes[i].work; itr != NULL; prev = itr, itr = itr->next ) {
+         
+         if( vdev_wq_keys_conflict( itr->key, wreq->key ) && (pending == NULL || itr->seq > pending->seq) ) {
+            
+            pending = itr;
+            pending_prev = prev;
+            pending_lane = &wq->lanes[i];
+         }
+      }
+   }
+   
+   if( pending == NULL || pending->key == NULL || strcmp( pending->key, wreq->key ) != 0 ) {
+      
+      // nothing to merge with, or a request for a parent or child device sits in between 
+      return VDEV_WQ_MERGE_NONE;
+   }
+   
+   merged = (*wreq->merge)( pending, wreq );
+   
+   if( merged == VDEV_WQ_MERGE_ABSORBED ) {
+      
+      wq->num_merged++;
+   }
+   else if( merged == VDEV_WQ_MERGE_CANCELLED ) {
+      
+      // unlink the pending request 
+      if( pending_prev == NULL ) {
+         pending_lane->work = pending->next;
+      }
+      else {
+         pending_prev->next = pending->next;
+      }
+      
+      if( pending_lane->tail == pending ) {
+         pending_lane->tail = pending_prev;
+      }
+      
+      pending_lane->num_pending--;
+      wq->num_cancelled += 2;
+      
+      vdev_wreq_free( pending );
+      free( pending );
+      
+      if( wq->running && vdev_wq_is_empty( wq ) && wq->num_active == 0 ) {
+         
+         // that was the last of the work
+         vdev_wq_idle( wq );
+      }
+   }
+   
+   return merged;
+}
+
+
+// enqueue work in its lane.  The queue takes ownership of wreq's key.
+// if wreq has a merge callback, it may be merged into a pending request with the same key instead.
 // return 0 on success
+// return -EINVAL if wreq's lane is invalid
 // return -ENOMEM if OOM
 int vdev_wq_add( struct vdev_wq* wq, struct vdev_wreq* wreq ) {
 
    int rc = 0;
    struct vdev_wreq* next = NULL;
+   struct vdev_wq_lane* lane = NULL;
+   vdev_wq_merge_t merged = VDEV_WQ_MERGE_NONE;
+   
+   if( wreq->lane < 0 || wreq->lane >= VDEV_WQ_NUM_LANES ) {
+      return -EINVAL;
+   }
 
    // duplicate this work item 
    next = VDEV_CALLOC( struct vdev_wreq, 1 );
@@ -316,19 +870,53 @@ int vdev_wq_add( struct vdev_wq* wq, struct vdev_wreq* wreq ) {
    
    next->work = wreq->work;
    next->work_data = wreq->work_data;
+   next->key = wreq->key;
+   next->merge = wreq->merge;
+   next->lane = wreq->lane;
    next->next = NULL;
    
+   if( wreq->delay_millis > 0 ) {
+      next->not_before_millis = vdev_wq_now_millis() + wreq->delay_millis;
+   }
+   
+   wreq->key = NULL;
+   
    pthread_mutex_lock( &wq->work_lock );
    
-   if( wq->work == NULL ) {
+   merged = vdev_wq_merge( wq, next );
+   if( merged != VDEV_WQ_MERGE_NONE ) {
+      
+      // nothing new to do
+      pthread_mutex_unlock( &wq->work_lock );
+      
+      vdev_wreq_free( next );
+      free( next );
+      return 0;
+   }
+   
+   if( next->not_before_millis > 0 ) {
+      wq->num_delayed++;
+   }
+   
+   next->seq = wq->next_seq;
+   wq->next_seq++;
+   
+   lane = &wq->lanes[ next->lane ];
+   
+   if( lane->work == NULL ) {
       // head
-      wq->work = next;
-      wq->tail = next;
+      lane->work = next;
+      lane->tail = next;
    }
    else {
       // append 
-      wq->tail->next = next;
-      wq->tail = next;
+      lane->tail->next = next;
+      lane->tail = next;
+   }
+   
+   lane->num_pending++;
+   if( lane->num_pending > lane->max_pending ) {
+      lane->max_pending = lane->num_pending;
    }
    
    pthread_mutex_unlock( &wq->work_lock );
@@ -340,3 +928,25 @@ int vdev_wq_add( struct vdev_wq* wq, struct vdev_wreq* wreq ) {
 
    return rc;
 }
+
+
+// log how many requests were merged, cancelled, and held back, and how deep each lane is
+// always succeeds
+int vdev_wq_log_stats( struct vdev_wq* wq ) {
+   
+   static char const* lane_names[ VDEV_WQ_NUM_LANES ] = { "high", "normal", "low" };
+   
+   pthread_mutex_lock( &wq->work_lock );
+   
+   vdev_debug("Workqueue: %lu requests merged; %lu requests cancelled; %lu requests debounced\n",
+              (unsigned long)wq->num_merged, (unsigned long)wq->num_cancelled, (unsigned long)wq->num_delayed );
+   
+   for( int i = 0; i < VDEV_WQ_NUM_LANES; i++ ) {
+      
+      vdev_debug("Workqueue lane '%s' (weight=%d): %lu pending; %lu max pending; %lu dequeued\n",
+                 lane_names[i], wq->lanes[i].weight, (unsigned long)wq->lanes[i].num_pending, (unsigned long)wq->lanes[i].max_pending, (unsigned long)wq->lanes[i].num_dequeued );
+   }
+   
+   pthread_mutex_unlock( &wq->work_lock );
+   return 0;
+}
@@ -27,9 +27,32 @@
 struct vdev_wreq;
 struct vdev_state;
 
+// priority lanes.  Lower numbers are dequeued first.
+#define VDEV_WQ_LANE_HIGH       0
+#define VDEV_WQ_LANE_NORMAL     1
+#define VDEV_WQ_LANE_LOW        2
+#define VDEV_WQ_NUM_LANES       3
+
+// how many requests each lane may dequeue per round, while lower-priority lanes
+// have runnable work.  This keeps a flood in a higher lane from starving the lower ones.
+#define VDEV_WQ_LANE_HIGH_WEIGHT        8
+#define VDEV_WQ_LANE_NORMAL_WEIGHT      4
+#define VDEV_WQ_LANE_LOW_WEIGHT         1
+
 // vdev workqueue callback type
 typedef int (*vdev_wq_func_t)( struct vdev_wreq* wreq, void* cls );
 
+// what became of a request offered to a pending request with the same key 
+typedef enum {
+   VDEV_WQ_MERGE_NONE = 0,              // no merge; enqueue the new request as usual
+   VDEV_WQ_MERGE_ABSORBED,              // the pending request now does the new request's work; drop the new request
+   VDEV_WQ_MERGE_CANCELLED              // the two requests cancel out; drop both
+} vdev_wq_merge_t;
+
+// vdev workqueue merge callback type.  It is called with the queue locked, and must
+// free whatever work data it drops.
+typedef vdev_wq_merge_t (*vdev_wq_merge_func_t)( struct vdev_wreq* pending, struct vdev_wreq* wreq );
+
 // vdev workqueue request
 struct vdev_wreq {
 
@@ -38,23 +61,80 @@ struct vdev_wreq {
 
    // user-supplied arguments
    void* work_data;
+   
+   // ordering key (i.e. the device path).  Requests whose keys are equal, or
+   // where one key is a path prefix of the other, run in the order they were
+   // enqueued.  A NULL key orders the request against all other requests.
+   char* key;
+   
+   // if set, try to merge this request into the last pending request with the same key
+   vdev_wq_merge_func_t merge;
+   
+   // how long to hold the request back before running it, in milliseconds.
+   // once enqueued, the time at which it becomes runnable (CLOCK_MONOTONIC), or 0 to run it as soon as possible.
+   uint64_t delay_millis;
+   uint64_t not_before_millis;
+   
+   // which priority lane to run in (VDEV_WQ_LANE_NORMAL by default)
+   int lane;
+   
+   // position in the order in which requests were enqueued (set by the queue)
+   uint64_t seq;
 
    // next item 
    struct vdev_wreq* next;
 };
 
+// vdev workqueue priority lane
+struct vdev_wq_lane {
+   
+   // pending requests, in the order they were enqueued 
+   struct vdev_wreq* work;
+   struct vdev_wreq* tail;
+   
+   // dequeues allowed per round, and dequeues left in this round 
+   int weight;
+   int credits;
+   
+   // queue depth, and the deepest it has been 
+   uint64_t num_pending;
+   uint64_t max_pending;
+   
+   // number of requests dequeued from this lane
+   uint64_t num_dequeued;
+};
+
 // vdev workqueue
 struct vdev_wq {
 
-   // worker thread
-   pthread_t thread;
+   // worker threads
+   pthread_t* threads;
+   int num_threads;
 
-   // is the thread running?
+   // are the threads running?
    volatile bool running;
 
-   // things to do
-   struct vdev_wreq* work;
-   struct vdev_wreq* tail;
+   // things to do, by priority (covered by work_lock)
+   struct vdev_wq_lane lanes[ VDEV_WQ_NUM_LANES ];
+   
+   // sequence number for the next request enqueued (covered by work_lock)
+   uint64_t next_seq;
+   
+   // requests being processed, indexed by worker (covered by work_lock)
+   struct vdev_wreq** active;
+   int num_active;
+   
+   // number of times workers woke up, but found that all pending work 
+   // was ordered behind active requests (covered by work_lock)
+   int num_blocked;
+   
+   // number of requests absorbed into pending requests, and number of
+   // requests dropped because they cancelled out (covered by work_lock)
+   uint64_t num_merged;
+   uint64_t num_cancelled;
+   
+   // number of requests that were held back for a while before running (covered by work_lock)
+   uint64_t num_delayed;
 
    // lock governing access to work
    pthread_mutex_t work_lock;
@@ -75,15 +155,22 @@ struct vdev_wq {
 
 C_LINKAGE_BEGIN
 
-int vdev_wq_init( struct vdev_wq* wq, struct vdev_state* state );
+int vdev_wq_init( struct vdev_wq* wq, struct vdev_state* state, int num_threads );
 int vdev_wq_start( struct vdev_wq* wq );
 int vdev_wq_stop( struct vdev_wq* wq, bool wait );
 int vdev_wq_free( struct vdev_wq* wq );
 
 int vdev_wreq_init( struct vdev_wreq* wreq, vdev_wq_func_t work, void* work_data );
+int vdev_wreq_set_key( struct vdev_wreq* wreq, char const* key );
+int vdev_wreq_set_merge( struct vdev_wreq* wreq, vdev_wq_merge_func_t merge );
+int vdev_wreq_set_delay( struct vdev_wreq* wreq, uint64_t delay_millis );
+int vdev_wreq_set_lane( struct vdev_wreq* wreq, int lane );
 int vdev_wreq_free( struct vdev_wreq* wreq );
 
 int vdev_wq_add( struct vdev_wq* wq, struct vdev_wreq* wreq );
+int vdev_wq_check_idle( struct vdev_wq* wq );
+int vdev_wq_wait_for_empty( struct vdev_wq* wq );
+int vdev_wq_log_stats( struct vdev_wq* wq );
 
 C_LINKAGE_END
 